@@ -128,6 +128,42 @@
 #define FUSE_DEFAULT_IOV_PERMANENT_BUFSIZE (1 << 19)
 #define FUSE_DEFAULT_IOV_CREDIT            16
 
+/*
+ * At most fuse_iov_pool_maxbytes (a tunable) of pooled ticket buffers are
+ * kept per mount; see FUSE_IOV_POOL_CLASSSIZE() below.
+ */
+#define FUSE_DEFAULT_IOV_POOL_MAXBYTES     (16 * 1024 * 1024)
+
+/*
+ * If the daemon negotiates FUSE_BATCH_FORGETS at INIT time, forgets are
+ * accumulated per mount and sent as one FUSE_BATCH_FORGET message. A batch
+ * goes out once it holds FUSE_FORGET_BATCH_MAX nodes, once its oldest entry
+ * is FUSE_FORGET_BATCH_DELAY seconds old, or whenever the daemon comes back
+ * for more work and finds the message queue empty. A daemon waiting for
+ * messages is woken when a batch is started.
+ */
+#define FUSE_FORGET_BATCH_MAX              64
+#define FUSE_FORGET_BATCH_DELAY            1      /* s */
+
+/*
+ * The chunks of a strategy buf are sent to the daemon as separate tickets
+ * that may be in flight at the same time. A mount keeps at most
+ * fuse_strategy_inflight (a tunable) of them outstanding, and a single buf
+ * at most FUSE_MAX_STRATEGY_INFLIGHT (below).
+ */
+#define FUSE_DEFAULT_STRATEGY_INFLIGHT     8
+
+/*
+ * On nosyncwrites mounts, written ranges are left dirty in the UBC and
+ * remembered per vnode. They are pushed to the daemon on fsync, on close,
+ * when the VM pages them out, or once a vnode has more than
+ * fuse_writeback_maxdirty (a tunable; 0 turns this off) bytes outstanding.
+ * Such pushes go out as FUSE_WRITEs of up to FUSE_MAX_WRITEBACK_WRITE bytes,
+ * as far as the daemon's max_write allows.
+ */
+#define FUSE_DEFAULT_WRITEBACK_MAXDIRTY    (8 * 1024 * 1024)
+#define FUSE_MAX_WRITEBACK_WRITE           (1024 * 1024)
+
 /* User-Kernel IPC Buffer */
 
 #define FUSE_MIN_USERKERNEL_BUFSIZE        (128  * 1024)
@@ -137,6 +173,48 @@
 
 #endif /* KERNEL */
 
+/*
+ * This is the number of hash chains a mount uses to match daemon replies
+ * with the tickets awaiting them; it must be a power of two. Ticket unique
+ * IDs are handed out sequentially, so (unique & mask) spreads them evenly
+ * over the chains. It is sized so that chains stay a few tickets long with
+ * 10,000 or more requests in flight; the heads cost 32 KiB per mount on a
+ * 64-bit kernel. It is outside the KERNEL block because fuse_awhash.c is
+ * also built in user space.
+ */
+#define FUSE_AW_HASH_SIZE                  4096
+
+/*
+ * Each mount keeps FUSE_TICKET_NCACHES small caches of refreshed tickets in
+ * front of its free ticket list. A thread uses the cache its thread pointer
+ * hashes to, which keeps most ticket fetches and drops off ticket_mtx.
+ * FUSE_TICKET_NCACHES must be a power of two. These are outside the KERNEL
+ * block for fuse_ticketcache.c.
+ */
+#define FUSE_TICKET_NCACHES                8
+#define FUSE_TICKET_CACHE_SIZE             8
+
+/*
+ * Ticket buffers bigger than a page are borrowed from a per-mount pool of
+ * size-classed buffers instead of being reallocated. Class c holds buffers
+ * of (1 << (FUSE_IOV_POOL_MINSHIFT + c)) bytes plus FUSE_IOV_POOL_SLACK,
+ * which leaves room for the message headers in front of a power-of-two
+ * payload. The pool itself, in fuse_pool.c, is built in user space too.
+ */
+#define FUSE_IOV_POOL_MINSHIFT             12
+#define FUSE_IOV_POOL_MAXSHIFT             22
+#define FUSE_IOV_POOL_NCLASSES             \
+    (FUSE_IOV_POOL_MAXSHIFT - FUSE_IOV_POOL_MINSHIFT + 1)
+#define FUSE_IOV_POOL_SLACK                4096
+#define FUSE_IOV_POOL_CLASSSIZE(c)         \
+    (((size_t)1 << (FUSE_IOV_POOL_MINSHIFT + (c))) + FUSE_IOV_POOL_SLACK)
+
+/*
+ * The most chunks of one strategy buf that may be in flight at once. This
+ * sizes the window in fuse_strategy.c, which user-space harnesses build too.
+ */
+#define FUSE_MAX_STRATEGY_INFLIGHT         16
+
 #define FUSE_DEFAULT_USERKERNEL_BUFSIZE    (4096 * 1024)
 
 #define FUSE_LINK_MAX                      LINK_MAX
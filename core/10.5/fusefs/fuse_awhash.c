@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#include "fuse_awhash.h"
+
+static __inline__
+struct fuse_awlink **
+fuse_awhash_chain(struct fuse_awhash *ah, uint64_t unique)
+{
+    return &ah->ah_chains[unique & (FUSE_AW_HASH_SIZE - 1)];
+}
+
+void
+fuse_awhash_init(struct fuse_awhash *ah)
+{
+    uint32_t i;
+
+    ah->ah_count = 0;
+    for (i = 0; i < FUSE_AW_HASH_SIZE; i++) {
+        ah->ah_chains[i] = NULL;
+    }
+}
+
+void
+fuse_awhash_insert(struct fuse_awhash *ah, struct fuse_awlink *al,
+                   uint64_t unique)
+{
+    struct fuse_awlink **headp = fuse_awhash_chain(ah, unique);
+
+    al->al_unique = unique;
+    al->al_prevp = headp;
+    al->al_next = *headp;
+    if (al->al_next) {
+        al->al_next->al_prevp = &al->al_next;
+    }
+    *headp = al;
+    ah->ah_count++;
+}
+
+void
+fuse_awhash_remove(struct fuse_awhash *ah, struct fuse_awlink *al)
+{
+    if (al->al_next) {
+        al->al_next->al_prevp = al->al_prevp;
+    }
+    *al->al_prevp = al->al_next;
+    al->al_next = NULL;
+    al->al_prevp = NULL;
+    ah->ah_count--;
+}
+
+struct fuse_awlink *
+fuse_awhash_find(struct fuse_awhash *ah, uint64_t unique)
+{
+    struct fuse_awlink *al;
+
+    for (al = *fuse_awhash_chain(ah, unique); al; al = al->al_next) {
+        if (al->al_unique == unique) {
+            break;
+        }
+    }
+
+    return al;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#ifndef _FUSE_AWHASH_H_
+#define _FUSE_AWHASH_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fuse_param.h>
+
+/*
+ * A fixed-size hash of the tickets awaiting an answer, keyed by unique ID.
+ * Links are embedded in the objects being hashed, and the chain heads live
+ * inside the table itself, so nothing here allocates. Unique IDs are handed
+ * out sequentially, so (unique & mask) spreads them evenly over the chains.
+ *
+ * Nothing here depends on the kernel, so the same code can be exercised and
+ * measured in user space. Locking is up to the caller.
+ */
+
+#if (FUSE_AW_HASH_SIZE & (FUSE_AW_HASH_SIZE - 1)) != 0
+#error FUSE_AW_HASH_SIZE must be a power of two
+#endif
+
+struct fuse_awlink {
+    struct fuse_awlink  *al_next;
+    struct fuse_awlink **al_prevp;  /* the pointer that points at us */
+    uint64_t             al_unique;
+};
+
+struct fuse_awhash {
+    uint32_t            ah_count;
+    struct fuse_awlink *ah_chains[FUSE_AW_HASH_SIZE];
+};
+
+/* The object that embeds a given link, as with the kernel's queue macros. */
+#define FUSE_AWLINK_OBJECT(al, type, field) \
+    ((type *)((char *)(al) - offsetof(type, field)))
+
+void fuse_awhash_init(struct fuse_awhash *ah);
+void fuse_awhash_insert(struct fuse_awhash *ah, struct fuse_awlink *al,
+                        uint64_t unique);
+void fuse_awhash_remove(struct fuse_awhash *ah, struct fuse_awlink *al);
+struct fuse_awlink *fuse_awhash_find(struct fuse_awhash *ah, uint64_t unique);
+
+#endif /* _FUSE_AWHASH_H_ */
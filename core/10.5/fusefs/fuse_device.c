@@ -297,13 +297,62 @@ fuse_device_close(dev_t dev, __unused int flags, __unused int devtype,
     return KERN_SUCCESS;
 }
 
-int
-fuse_device_read(dev_t dev, uio_t uio, int ioflag)
+static __inline__
+size_t
+fuse_device_msglen(struct fuse_ticket *ftick)
+{
+    return ftick->tk_ms_fiov.len +
+           ((ftick->tk_ms_type == FT_M_BUF) ? ftick->tk_ms_bufsize : 0);
+}
+
+static int
+fuse_device_copyout(struct fuse_data *data, struct fuse_ticket *ftick,
+                    uio_t uio)
 {
     int i, err = 0;
     size_t buflen[3];
     void *buf[] = { NULL, NULL, NULL };
 
+    switch (ftick->tk_ms_type) {
+
+    case FT_M_FIOV:
+        buf[0]    = ftick->tk_ms_fiov.base;
+        buflen[0] = ftick->tk_ms_fiov.len;
+        break;
+
+    case FT_M_BUF:
+        buf[0]    = ftick->tk_ms_fiov.base;
+        buflen[0] = ftick->tk_ms_fiov.len;
+        buf[1]    = ftick->tk_ms_bufdata;
+        buflen[1] = ftick->tk_ms_bufsize;
+        break;
+
+    default:
+        panic("MacFUSE: unknown message type for ticket %p", ftick);
+    }
+
+    for (i = 0; buf[i]; i++) {
+        if (uio_resid(uio) < (user_ssize_t)buflen[i]) {
+            data->dataflags |= FSESS_DEAD;
+            err = ENODEV;
+            break;
+        }
+
+        err = uiomove(buf[i], (int)buflen[i], uio);
+
+        if (err) {
+            break;
+        }
+    }
+
+    return err;
+}
+
+int
+fuse_device_read(dev_t dev, uio_t uio, int ioflag)
+{
+    int err = 0;
+
     struct fuse_device *fdev;
     struct fuse_data   *data;
     struct fuse_ticket *ftick;
@@ -328,6 +377,13 @@ again:
     }
 
     if (!(ftick = fuse_ms_pop(data))) {
+        if (data->forget_count) {
+            /* The daemon is idle; a good time to hand it pending forgets. */
+            fuse_lck_mtx_unlock(data->ms_mtx);
+            fuse_internal_forget_flush(data, (vfs_context_t)0);
+            fuse_lck_mtx_lock(data->ms_mtx);
+            goto again;
+        }
         if (ioflag & FNONBLOCK) {
             fuse_lck_mtx_unlock(data->ms_mtx);
             return EAGAIN;
@@ -353,37 +409,7 @@ again:
          return ENODEV;
     }
 
-    switch (ftick->tk_ms_type) {
-
-    case FT_M_FIOV:
-        buf[0]    = ftick->tk_ms_fiov.base;
-        buflen[0] = ftick->tk_ms_fiov.len;
-        break;
-
-    case FT_M_BUF:
-        buf[0]    = ftick->tk_ms_fiov.base;
-        buflen[0] = ftick->tk_ms_fiov.len;
-        buf[1]    = ftick->tk_ms_bufdata;
-        buflen[1] = ftick->tk_ms_bufsize;
-        break;
-
-    default:
-        panic("MacFUSE: unknown message type for ticket %p", ftick);
-    }
-
-    for (i = 0; buf[i]; i++) {
-        if (uio_resid(uio) < (user_ssize_t)buflen[i]) {
-            data->dataflags |= FSESS_DEAD;
-            err = ENODEV;
-            break;
-        }
-
-        err = uiomove(buf[i], (int)buflen[i], uio);
-
-        if (err) {
-            break;
-        }
-    }
+    err = fuse_device_copyout(data, ftick, uio);
 
     /*
      * XXX: Stop gap! I really need to finish interruption plumbing.
@@ -400,26 +426,74 @@ again:
    
     fuse_ticket_drop_invalid(ftick);
 
+    /*
+     * If the daemon negotiated FUSE_MULTI_MESSAGE, hand it whatever else is
+     * queued, back to back, for as long as the next message fits in what is
+     * left of its buffer. We never wait for more messages here.
+     *
+     * Once a message has been copied out, this read must succeed, or the
+     * daemon would throw away messages whose senders then wait forever.
+     */
+    while (!err && (data->dataflags & FSESS_MULTI_MESSAGE)) {
+
+        user_ssize_t resid;
+        off_t        offset;
+
+        fuse_lck_mtx_lock(data->ms_mtx);
+
+        ftick = STAILQ_FIRST(&data->ms_head);
+        if (!ftick || fdata_dead_get(data) ||
+            (user_ssize_t)fuse_device_msglen(ftick) > uio_resid(uio)) {
+            fuse_lck_mtx_unlock(data->ms_mtx);
+            break;
+        }
+
+        (void)fuse_ms_pop(data);
+
+        fuse_lck_mtx_unlock(data->ms_mtx);
+
+        /* Already answered (interrupted, say); the daemon needn't see it. */
+        if (fticket_answered(ftick)) {
+            fuse_ticket_drop_invalid(ftick);
+            continue;
+        }
+
+        resid  = uio_resid(uio);
+        offset = uio_offset(uio);
+
+        if (fuse_device_copyout(data, ftick, uio)) {
+            /*
+             * Take back whatever part of this message was copied and leave
+             * it at the head of the queue for the next read.
+             */
+            uio_setoffset(uio, offset);
+            uio_setresid(uio, resid);
+            fuse_lck_mtx_lock(data->ms_mtx);
+            fuse_ms_push_head(ftick);
+            fuse_lck_mtx_unlock(data->ms_mtx);
+            break;
+        }
+
+        fuse_ticket_drop_invalid(ftick);
+    }
+
     return err;
 }
 
-int
-fuse_device_write(dev_t dev, uio_t uio, __unused int ioflag)
+/*
+ * Delivers one reply, which starts at the current offset of uio. With
+ * FUSE_MULTI_MESSAGE negotiated, the reply need not run to the end of the
+ * write: the residual count is clipped to this reply's body for the handler,
+ * and whatever the handler leaves unread is skipped.
+ */
+static int
+fuse_device_write_one(struct fuse_data *data, uio_t uio, int multi)
 {
     int err = 0, found = 0;
 
-    struct fuse_device    *fdev;
-    struct fuse_data      *data;
     struct fuse_ticket    *ftick;
-    struct fuse_ticket    *x_ftick;
     struct fuse_out_header ohead;
-
-    fuse_trace_printf_func();
-
-    fdev = FUSE_DEVICE_FROM_UNIT_FAST(minor(dev));
-    if (!fdev) {
-        return ENXIO;
-    }
+    user_ssize_t           bodylen, rest;
 
     if (uio_resid(uio) < (user_ssize_t)sizeof(struct fuse_out_header)) {
         return EINVAL;
@@ -433,12 +507,20 @@ fuse_device_write(dev_t dev, uio_t uio, __unused int ioflag)
 
     /* begin audit */
 
-    if (uio_resid(uio) + sizeof(struct fuse_out_header) != ohead.len) {
+    if (ohead.len < sizeof(struct fuse_out_header)) {
+        IOLog("MacFUSE: message size is smaller than its header\n");
+        return EINVAL;
+    }
+
+    bodylen = (user_ssize_t)(ohead.len - sizeof(struct fuse_out_header));
+    rest = uio_resid(uio) - bodylen;
+
+    if ((rest < 0) || (rest > 0 && !multi)) {
         IOLog("MacFUSE: message body size does not match that in the header\n");
         return EINVAL; 
     }   
 
-    if (uio_resid(uio) && ohead.error) {
+    if (bodylen && ohead.error) {
         IOLog("MacFUSE: non-zero error for a message with a body\n");
         return EINVAL;
     }
@@ -447,32 +529,65 @@ fuse_device_write(dev_t dev, uio_t uio, __unused int ioflag)
 
     /* end audit */
 
-    data = fdev->data;
-
     fuse_lck_mtx_lock(data->aw_mtx);
 
-    TAILQ_FOREACH_SAFE(ftick, &data->aw_head, tk_aw_link, x_ftick) {
-        if (ftick->tk_unique == ohead.unique) {
-            found = 1;
-            fuse_aw_remove(ftick);
-            break;
-        }
+    if ((ftick = fuse_aw_find(data, ohead.unique))) {
+        found = 1;
+        fuse_aw_remove(ftick);
     }
 
     fuse_lck_mtx_unlock(data->aw_mtx);
 
+    if (rest) {
+        uio_setresid(uio, bodylen);
+    }
+
     if (found) {
         if (ftick->tk_aw_handler) {
             memcpy(&ftick->tk_aw_ohead, &ohead, sizeof(ohead));
             err = ftick->tk_aw_handler(ftick, uio);
         } else {
             fuse_ticket_drop(ftick);
-            return err;
         }
     } else {
         /* ticket has no response handler */
     }
 
+    if (rest) {
+        if (uio_resid(uio)) {
+            uio_update(uio, uio_resid(uio));
+        }
+        uio_setresid(uio, rest);
+    }
+
+    return err;
+}
+
+int
+fuse_device_write(dev_t dev, uio_t uio, __unused int ioflag)
+{
+    int err = 0;
+
+    struct fuse_device *fdev;
+    struct fuse_data   *data;
+
+    fuse_trace_printf_func();
+
+    fdev = FUSE_DEVICE_FROM_UNIT_FAST(minor(dev));
+    if (!fdev) {
+        return ENXIO;
+    }
+
+    data = fdev->data;
+
+    if (!(data->dataflags & FSESS_MULTI_MESSAGE)) {
+        return fuse_device_write_one(data, uio, 0 /* multi */);
+    }
+
+    do {
+        err = fuse_device_write_one(data, uio, 1 /* multi */);
+    } while (!err && uio_resid(uio) > 0);
+
     return err;
 }
 
@@ -720,7 +835,9 @@ fuse_device_select(dev_t dev, int events, void *wql, struct proc *p)
 
     if (events & (POLLIN | POLLRDNORM)) {
         fuse_lck_mtx_lock(data->ms_mtx);
-        if (fdata_dead_get(data) || STAILQ_FIRST(&data->ms_head)) {
+        /* A read with nothing queued sends the pending forgets. */
+        if (fdata_dead_get(data) || STAILQ_FIRST(&data->ms_head) ||
+            data->forget_count) {
             revents |= (events & (POLLIN | POLLRDNORM));
         } else {
             selrecord((proc_t)p, (struct selinfo*)&data->d_rsel, wql);
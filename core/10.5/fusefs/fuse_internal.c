@@ -34,6 +34,8 @@
 #include "fuse_node.h"
 #include "fuse_file.h"
 #include "fuse_nodehash.h"
+#include "fuse_readdir.h"
+#include "fuse_strategy.h"
 #include "fuse_sysctl.h"
 #include "fuse_kludges.h"
 
@@ -659,6 +661,7 @@ fuse_internal_readdir(vnode_t                 vp,
                       int                    *numdirent)
 {
     int err = 0;
+    int plus;
     struct fuse_dispatcher fdi;
     struct fuse_read_in   *fri;
     struct fuse_data      *data;
@@ -667,6 +670,9 @@ fuse_internal_readdir(vnode_t                 vp,
         return 0;
     }
 
+    data = fuse_get_mpdata(vnode_mount(vp));
+    plus = fuse_implemented(data, FSESS_NOIMPLBIT(READDIRPLUS));
+
     fdisp_init(&fdi, 0);
 
     /* Note that we DO NOT have a UIO_SYSSPACE here (so no need for p2p I/O). */
@@ -674,15 +680,21 @@ fuse_internal_readdir(vnode_t                 vp,
     while (uio_resid(uio) > 0) {
 
         fdi.iosize = sizeof(*fri);
-        fdisp_make_vp(&fdi, FUSE_READDIR, vp, context);
+        fdisp_make_vp(&fdi, (plus) ? FUSE_READDIRPLUS : FUSE_READDIR, vp,
+                      context);
 
         fri = fdi.indata;
         fri->fh = fufh->fh_id;
         fri->offset = uio_offset(uio);
-        data = fuse_get_mpdata(vnode_mount(vp));
         fri->size = (typeof(fri->size))min((size_t)uio_resid(uio), data->iosize);
 
         if ((err = fdisp_wait_answ(&fdi))) {
+            if (plus && err == ENOSYS) {
+                fuse_clear_implemented(data, FSESS_NOIMPLBIT(READDIRPLUS));
+                plus = 0;
+                fdisp_init(&fdi, 0);
+                continue;
+            }
             goto out;
         }
 
@@ -692,7 +704,9 @@ fuse_internal_readdir(vnode_t                 vp,
                                                      fdi.answ,
                                                      fdi.iosize,
                                                      cookediov,
-                                                     numdirent))) {
+                                                     numdirent,
+                                                     plus,
+                                                     context))) {
             break;
         }
     }
@@ -705,118 +719,148 @@ out:
     return ((err == -1) ? 0 : err);
 }
 
-__private_extern__
-int
-fuse_internal_readdir_processdata(vnode_t          vp,
-                                  uio_t            uio,
-                         __unused size_t           reqsize,
-                                  void            *buf,
-                                  size_t           bufsize,
-                                  struct fuse_iov *cookediov,
-                                  int             *numdirent)
+/*
+ * The caller's side of fuse_readdir_take(): entries are turned into struct
+ * dirent and copied out to the uio, and with FUSE_READDIRPLUS the nodes that
+ * went out get a vnode, a name cache entry and fresh attributes right away,
+ * so that listing the directory and then stat()ing its entries doesn't cost
+ * a lookup and a getattr per entry.
+ */
+
+struct fuse_internal_readdir_arg {
+    vnode_t          vp;
+    uio_t            uio;
+    struct fuse_iov *cookediov;
+    vfs_context_t    context;
+};
+
+static int
+fuse_internal_readdir_emit(void *arg, const struct fuse_dirent *fudge)
 {
-    int err = 0;
-    int cou = 0;
-    int n   = 0;
+    int err;
     size_t bytesavail;
-    size_t freclen;
+    struct dirent *de;
+    struct fuse_internal_readdir_arg *ra = arg;
+    struct fuse_iov *cookediov = ra->cookediov;
+
+#define GENERIC_DIRSIZ(dp) \
+  ((sizeof(struct dirent) - (FUSE_MAXNAMLEN + 1)) + \
+   (((dp)->d_namlen + 1 + 3) & ~3))
 
-    struct dirent      *de;
-    struct fuse_dirent *fudge;
+    bytesavail = GENERIC_DIRSIZ((const struct pseudo_dirent *)&fudge->namelen);
 
-    if (bufsize < FUSE_NAME_OFFSET) {
+    if (bytesavail > (size_t)uio_resid(ra->uio)) {
         return -1;
     }
 
-    for (;;) {
+    fiov_refresh(cookediov);
+    fiov_adjust(cookediov, bytesavail);
 
-        if (bufsize < FUSE_NAME_OFFSET) {
-            err = -1;
-            break;
-        }
+    de = (struct dirent *)cookediov->base;
+#if __DARWIN_64_BIT_INO_T
+    de->d_fileno = fudge->ino;
+#else
+    de->d_fileno = (ino_t)fudge->ino; /* XXX: truncation */
+#endif /* __DARWIN_64_BIT_INO_T */
+    de->d_reclen = bytesavail;
+    de->d_type   = fudge->type;
+    de->d_namlen = fudge->namelen;
 
-        fudge = (struct fuse_dirent *)buf;
-        freclen = FUSE_DIRENT_SIZE(fudge);
+    /* Filter out any ._* files if the mount is configured as such. */
+    if (fuse_skip_apple_double_mp(vnode_mount(ra->vp),
+                                  (char *)fudge->name, fudge->namelen)) {
+        de->d_fileno = 0;
+        de->d_type = DT_WHT;
+    }
 
-        cou++;
+    memcpy((char *)cookediov->base + sizeof(struct dirent) - FUSE_MAXNAMLEN - 1,
+           fudge->name, fudge->namelen);
+    ((char *)cookediov->base)[bytesavail] = '\0';
 
-        if (bufsize < freclen) {
-            err = ((cou == 1) ? -1 : 0);
-            break;
-        }
+    err = uiomove(cookediov->base, (int)cookediov->len, ra->uio);
+    if (err) {
+        return err;
+    }
 
-        /*
-         * if (isbzero(buf, FUSE_NAME_OFFSET)) {
-         *     // zero-pad incomplete buffer
-         *     ...
-         *     err = -1;
-         *     break;
-         * }
-         */
+    uio_setoffset(ra->uio, fudge->off);
 
-        if (!fudge->namelen) { 
-            err = EINVAL;
-            break;
-        }
+    return 0;
+}
 
-        if (fudge->namelen > FUSE_MAXNAMLEN) {
-            err = EIO;
-            break;
-        }
+static int
+fuse_internal_readdir_cache(void                        *arg,
+                            const struct fuse_entry_out *feo,
+                            const char                  *name,
+                            size_t                       namelen)
+{
+    int err;
+    vnode_t vp = NULLVP;
+    struct fuse_internal_readdir_arg *ra = arg;
+    mount_t mp = vnode_mount(ra->vp);
+    struct componentname cn;
 
-#define GENERIC_DIRSIZ(dp) \
-  ((sizeof(struct dirent) - (FUSE_MAXNAMLEN + 1)) + \
-   (((dp)->d_namlen + 1 + 3) & ~3))
+    if (fuse_skip_apple_double_mp(mp, (char *)name, namelen)) {
+        return EINVAL;
+    }
 
-        bytesavail = GENERIC_DIRSIZ((struct pseudo_dirent *)&fudge->namelen); 
+    bzero(&cn, sizeof(cn));
+    cn.cn_nameiop = LOOKUP;
+    cn.cn_flags = MAKEENTRY | ISLASTCN;
+    cn.cn_context = ra->context;
+    cn.cn_nameptr = (char *)name;
+    cn.cn_namelen = (int)namelen;
 
-        if (bytesavail > (size_t)uio_resid(uio)) {
-            err = -1;
-            break;
-        }
+    err = fuse_vget_i(&vp, 0 /* flags */, (struct fuse_entry_out *)feo, &cn,
+                      ra->vp, mp, ra->context);
+    if (err) {
+        return err;
+    }
 
-        fiov_refresh(cookediov);
-        fiov_adjust(cookediov, bytesavail);
+    /* ATTR_FUDGE_CASE */
+    if (vnode_isreg(vp) && fuse_isnoubc(vp)) {
+        VTOFUD(vp)->filesize = feo->attr.size;
+    }
 
-        de = (struct dirent *)cookediov->base;
-#if __DARWIN_64_BIT_INO_T
-        de->d_fileno = fudge->ino;
-#else
-        de->d_fileno = (ino_t)fudge->ino; /* XXX: truncation */
-#endif /* __DARWIN_64_BIT_INO_T */
-        de->d_reclen = bytesavail;
-        de->d_type   = fudge->type; 
-        de->d_namlen = fudge->namelen;
-
-        /* Filter out any ._* files if the mount is configured as such. */
-        if (fuse_skip_apple_double_mp(vnode_mount(vp),
-                                      fudge->name, fudge->namelen)) {
-            de->d_fileno = 0;
-            de->d_type = DT_WHT;
-        }
+    cache_attrs(vp, (struct fuse_entry_out *)feo);
 
-        memcpy((char *)cookediov->base +
-               sizeof(struct dirent) - FUSE_MAXNAMLEN - 1,
-               (char *)buf + FUSE_NAME_OFFSET, fudge->namelen);
-        ((char *)cookediov->base)[bytesavail] = '\0';
+    vnode_put(vp);
 
-        err = uiomove(cookediov->base, (int)cookediov->len, uio);
-        if (err) {
-            break;
-        }
+    return 0;
+}
 
-        n++;
+static void
+fuse_internal_readdir_forget(void *arg, uint64_t nodeid)
+{
+    struct fuse_internal_readdir_arg *ra = arg;
+    struct fuse_dispatcher fdi;
 
-        buf = (char *)buf + freclen;
-        bufsize -= freclen;
-        uio_setoffset(uio, fudge->off);
-    }
+    fdisp_init(&fdi, 0);
+    fuse_internal_forget_send(vnode_mount(ra->vp), ra->context, nodeid, 1,
+                              &fdi);
+}
 
-    if (!err && numdirent) {
-        *numdirent = n;
-    }
+static const struct fuse_readdir_ops fuse_internal_readdir_ops = {
+    fuse_internal_readdir_emit,
+    fuse_internal_readdir_cache,
+    fuse_internal_readdir_forget,
+};
 
-    return err;
+__private_extern__
+int
+fuse_internal_readdir_processdata(vnode_t          vp,
+                                  uio_t            uio,
+                         __unused size_t           reqsize,
+                                  void            *buf,
+                                  size_t           bufsize,
+                                  struct fuse_iov *cookediov,
+                                  int             *numdirent,
+                                  int              plus,
+                                  vfs_context_t    context)
+{
+    struct fuse_internal_readdir_arg ra = { vp, uio, cookediov, context };
+
+    return fuse_readdir_take(&fuse_internal_readdir_ops, &ra, buf, bufsize,
+                             plus, numdirent);
 }
 
 /* remove */
@@ -958,15 +1002,280 @@ fuse_internal_revoke(vnode_t vp, int flags, vfs_context_t context, int how)
     return ret;
 }
 
+/* writeback */
+
+/*
+ * On nosyncwrites mounts, fuse_vnop_write() leaves written data dirty in the
+ * UBC and records the page-rounded range here. The ranges are pushed to the
+ * daemon by fuse_internal_writeback_flush(), which fsync and close call, and
+ * which a write calls once the vnode has more than fuse_writeback_maxdirty
+ * bytes outstanding. Pages that reach the daemon by other means (the VM
+ * paging them out, or the cluster layer's own write-behind) are taken out of
+ * the set in fuse_internal_strategy().
+ */
+
+static __inline__
+size_t
+fuse_writeback_iosize(struct fuse_data *data)
+{
+    size_t iosize = min(data->max_write, FUSE_MAX_WRITEBACK_WRITE);
+
+    iosize &= ~((size_t)PAGE_MASK);
+
+    return (iosize > data->iosize) ? iosize : data->iosize;
+}
+
+__private_extern__
+int
+fuse_internal_iswriteback(vnode_t vp)
+{
+    return (fuse_writeback_maxdirty != 0 && !fuse_isnoubc(vp) &&
+            fuse_isnosyncwrites_mp(vnode_mount(vp)));
+}
+
+/* Returns TRUE if the vnode now has too much outstanding. */
+__private_extern__
+int
+fuse_internal_writeback_add(vnode_t vp, off_t start, off_t end)
+{
+    off_t dirty;
+    struct fuse_vnode_data *fvdat = VTOFUD(vp);
+
+    fuse_lck_mtx_lock(fvdat->dirtylock);
+    fuse_rangeset_add(&fvdat->dirty, trunc_page_64(start), round_page_64(end));
+    dirty = fvdat->dirty.bytes;
+    fuse_lck_mtx_unlock(fvdat->dirtylock);
+
+    return (dirty > (off_t)fuse_writeback_maxdirty);
+}
+
+__private_extern__
+void
+fuse_internal_writeback_remove(vnode_t vp, off_t start, off_t end)
+{
+    struct fuse_vnode_data *fvdat = VTOFUD(vp);
+
+    fuse_lck_mtx_lock(fvdat->dirtylock);
+    fuse_rangeset_remove(&fvdat->dirty, start, end);
+    fuse_lck_mtx_unlock(fvdat->dirtylock);
+}
+
+/*
+ * The ranges go out lowest offset first, in chunks of the write-back I/O
+ * size. ubc_msync() hands each chunk's dirty pages to fuse_vnop_pageout(),
+ * so every contiguous run of them reaches fuse_internal_strategy() as one
+ * buf and the daemon as one FUSE_WRITE. Clean pages in a chunk cost nothing.
+ */
+__private_extern__
+int
+fuse_internal_writeback_flush(vnode_t vp)
+{
+    int   err = 0;
+    int   tmp_err;
+    int   found;
+    off_t start;
+    off_t end;
+    off_t chunksize;
+
+    struct fuse_vnode_data *fvdat = VTOFUD(vp);
+
+    chunksize = fuse_writeback_iosize(fuse_get_mpdata(vnode_mount(vp)));
+
+    for (;;) {
+
+        fuse_lck_mtx_lock(fvdat->dirtylock);
+        found = fuse_rangeset_pop(&fvdat->dirty, chunksize, &start, &end);
+        fuse_lck_mtx_unlock(fvdat->dirtylock);
+
+        if (!found) {
+            break;
+        }
+
+        if (start >= fvdat->filesize) {
+            /* Truncated away. */
+            continue;
+        }
+
+        tmp_err = ubc_msync(vp, start, end, (off_t *)0,
+                            UBC_PUSHDIRTY | UBC_SYNC);
+        if (tmp_err && !err) {
+            err = tmp_err;
+        }
+    }
+
+    return err;
+}
+
 /* strategy */
 
+/*
+ * A strategy buf is transferred in chunks of at most data->iosize bytes
+ * (for writes on write-back mounts, see fuse_writeback_iosize()).
+ * Rather than waiting for each chunk before sending the next, several
+ * chunks are sent as independent tickets so that a multithreaded daemon can
+ * serve them in parallel; fuse_strategy_transfer() keeps the window, and
+ * the ops below turn its chunks into tickets.
+ *
+ * The number of chunks a mount has in flight is bounded by the
+ * fuse_strategy_inflight tunable.
+ */
+
+struct fuse_strategy_io {
+    vnode_t           vp;
+    struct fuse_data *data;
+    uint64_t          fh;
+    int               op;
+    caddr_t           bufdat;
+    off_t             offset;
+};
+
+static void *
+fuse_strategy_io_send(void *arg, size_t start, size_t size)
+{
+    struct fuse_strategy_io *sio = arg;
+    struct fuse_dispatcher   fdi;
+
+    if (sio->op == FUSE_WRITE) {
+        struct fuse_write_in *fwi;
+
+        fdisp_init(&fdi, sizeof(*fwi));
+        fdisp_make_vp(&fdi, sio->op, sio->vp, (vfs_context_t)0);
+
+        fwi = fdi.indata;
+        fwi->fh = sio->fh;
+        fwi->offset = sio->offset + start;
+        fwi->size = (typeof(fwi->size))size;
+
+        fdi.tick->tk_ms_type = FT_M_BUF;
+        fdi.tick->tk_ms_bufdata = sio->bufdat + start;
+        fdi.tick->tk_ms_bufsize = size;
+    } else {
+        struct fuse_read_in *fri;
+
+        fdisp_init(&fdi, sizeof(*fri));
+        fdisp_make_vp(&fdi, sio->op, sio->vp, (vfs_context_t)0);
+
+        fri = fdi.indata;
+        fri->fh = sio->fh;
+        fri->offset = sio->offset + start;
+        fri->size = (typeof(fri->size))size;
+
+        fdi.tick->tk_aw_type = FT_A_BUF;
+        fdi.tick->tk_aw_bufdata = sio->bufdat + start;
+    }
+
+    fdisp_send(&fdi);
+
+    return fdi.tick;
+}
+
+static int
+fuse_strategy_io_wait(void *arg, void *req, size_t *gotp)
+{
+    struct fuse_strategy_io *sio = arg;
+    struct fuse_dispatcher   fdi;
+    int err;
+
+    fdi.tick = req;
+
+    if ((err = fdisp_wait_sent(&fdi))) {
+        /* fdisp_wait_sent() has disposed of the ticket. */
+        return err;
+    }
+
+    if (sio->op == FUSE_WRITE) {
+        *gotp = ((struct fuse_write_out *)fdi.answ)->size;
+    } else {
+        *gotp = fdi.tick->tk_aw_bufsize;
+    }
+
+    fuse_ticket_drop(fdi.tick);
+
+    return 0;
+}
+
+static void
+fuse_strategy_io_discard(void *arg, void *req)
+{
+    struct fuse_dispatcher fdi;
+
+    fdi.tick = req;
+
+    if (!fdisp_wait_sent(&fdi)) {
+        fuse_ticket_drop(fdi.tick);
+    }
+}
+
+static int32_t
+fuse_strategy_io_inflight_add(void *arg, int32_t delta)
+{
+    struct fuse_strategy_io *sio = arg;
+
+    return OSAddAtomic(delta, (SInt32 *)&sio->data->strategy_inflight);
+}
+
+static const struct fuse_strategy_ops fuse_strategy_io_ops = {
+    fuse_strategy_io_send,
+    fuse_strategy_io_wait,
+    fuse_strategy_io_discard,
+    fuse_strategy_io_inflight_add,
+};
+
+/*
+ * Transfers count bytes between bufdat and the file at offset with FUSE_READ,
+ * FUSE_READDIR or FUSE_WRITE (op), and sets *donep to the length of the
+ * prefix that was transferred. A read that hits end of file (or a hole)
+ * zero-fills the rest of the buf and counts it as transferred.
+ */
+__private_extern__
+int
+fuse_internal_strategy_io(vnode_t vp, struct fuse_data *data, uint64_t fh,
+                          int op, caddr_t bufdat, off_t offset, size_t count,
+                          size_t *donep)
+{
+    struct fuse_strategy_io sio;
+
+    size_t iosize = data->iosize;
+    size_t done;
+    int    eof;
+    int    err;
+
+    if (op == FUSE_WRITE && fuse_internal_iswriteback(vp)) {
+        iosize = fuse_writeback_iosize(data);
+    }
+
+    sio.vp = vp;
+    sio.data = data;
+    sio.fh = fh;
+    sio.op = op;
+    sio.bufdat = bufdat;
+    sio.offset = offset;
+
+    err = fuse_strategy_transfer(&fuse_strategy_io_ops, &sio,
+                                 (op == FUSE_WRITE), count, iosize,
+                                 fuse_strategy_inflight, &done, &eof);
+
+    if (eof) {
+        /*
+         * Historical note:
+         * If we don't get enough data, just fill the rest with zeros.
+         * In NFS context, this would mean a hole in the file.
+         */
+        bzero(bufdat + done, count - done);
+        done = count;
+    }
+
+    *donep = done;
+
+    return err;
+}
+
 __private_extern__
 int
 fuse_internal_strategy(vnode_t vp, buf_t bp)
 {
     size_t biosize;
-    size_t chunksize;
-    size_t respsize;
+    size_t done;
 
     int mapped = FALSE;
     int mode;
@@ -976,12 +1285,10 @@ fuse_internal_strategy(vnode_t vp, buf_t bp)
     int err = 0;
 
     caddr_t bufdat;
-    off_t   left;
     off_t   offset;
     int32_t bflags = buf_flags(bp);
 
     fufh_type_t             fufh_type;
-    struct fuse_dispatcher  fdi;
     struct fuse_data       *data;
     struct fuse_vnode_data *fvdat = VTOFUD(vp);
     struct fuse_filehandle *fufh = NULL;
@@ -1094,12 +1401,8 @@ fuse_internal_strategy(vnode_t vp, buf_t bp)
         return 0;
     }
 
-    fdisp_init(&fdi, 0);
-
     if (mode == FREAD) {
 
-        struct fuse_read_in *fri;
-
         buf_setresid(bp, buf_count(bp));
         offset = (off_t)((off_t)buf_blkno(bp) * biosize);
 
@@ -1126,70 +1429,13 @@ fuse_internal_strategy(vnode_t vp, buf_t bp)
             mapped = TRUE;
         }
 
-        while (buf_resid(bp) > 0) {
-
-            chunksize = min((size_t)buf_resid(bp), data->iosize);
-
-            fdi.iosize = sizeof(*fri);
-
-            op = FUSE_READ;
-            if (vtype == VDIR) {
-                op = FUSE_READDIR;
-            }
-            fdisp_make_vp(&fdi, op, vp, (vfs_context_t)0);
-        
-            fri = fdi.indata;
-            fri->fh = fufh->fh_id;
-
-            /*
-             * Historical note:
-             *
-             * fri->offset = ((off_t)(buf_blkno(bp))) * biosize;
-             *
-             * This wasn't being incremented!?
-             */
-
-            fri->offset = offset;
-            fri->size = (typeof(fri->size))chunksize;
-            fdi.tick->tk_aw_type = FT_A_BUF;
-            fdi.tick->tk_aw_bufdata = bufdat;
-        
-            if ((err = fdisp_wait_answ(&fdi))) {
-                /* There was a problem with reading. */
-                goto out;
-            }
-
-            respsize = fdi.tick->tk_aw_bufsize;
-
-            if (respsize < 0) { /* Cannot really happen... */
-                err = EIO;
-                goto out;
-            }
+        op = FUSE_READ;
+        if (vtype == VDIR) {
+            op = FUSE_READDIR;
+        }
 
-            buf_setresid(bp, (uint32_t)(buf_resid(bp) - respsize));
-            bufdat += respsize;
-            offset += respsize;
-
-            /* Did we hit EOF before being done? */
-            if ((respsize == 0) && (buf_resid(bp) > 0)) {
-                 /*
-                  * Historical note:
-                  * If we don't get enough data, just fill the rest with zeros.
-                  * In NFS context, this would mean a hole in the file.
-                  */
-
-                 /* Zero-pad the incomplete buffer. */
-                 bzero(bufdat, buf_resid(bp));
-                 buf_setresid(bp, 0);
-                 break;
-            }
-        } /* while (buf_resid(bp) > 0) */
     } else {
         /* write */
-        struct fuse_write_in  *fwi;
-        struct fuse_write_out *fwo;
-        int merr = 0;
-        off_t diff;
 
         if (buf_map(bp, &bufdat)) {
             IOLog("MacFUSE: failed to map buffer in strategy\n");
@@ -1198,65 +1444,23 @@ fuse_internal_strategy(vnode_t vp, buf_t bp)
             mapped = TRUE;
         }
 
-        /* Write begin */
-
         buf_setresid(bp, buf_count(bp));
         offset = (off_t)((off_t)buf_blkno(bp) * biosize);
 
         /* XXX: TBD -- Check here for extension (writing past end) */
 
-        left = buf_count(bp);
-
-        while (left) {
-
-            fdi.iosize = sizeof(*fwi);
-            op = FUSE_WRITE;
-
-            fdisp_make_vp(&fdi, op, vp, (vfs_context_t)0);
-            chunksize = min((size_t)left, data->iosize);
-
-            fwi = fdi.indata;
-            fwi->fh = fufh->fh_id;
-            fwi->offset = offset;
-            fwi->size = (typeof(fwi->size))chunksize;
-
-            fdi.tick->tk_ms_type = FT_M_BUF;
-            fdi.tick->tk_ms_bufdata = bufdat;
-            fdi.tick->tk_ms_bufsize = chunksize;
+        op = FUSE_WRITE;
+    }
 
-            /* About to write <chunksize> at <offset> */
+    err = fuse_internal_strategy_io(vp, data, fufh->fh_id, op, bufdat, offset,
+                                    buf_count(bp), &done);
 
-            if ((err = fdisp_wait_answ(&fdi))) {
-                merr = 1;
-                break;
-            }
-    
-            fwo = fdi.answ;
-            diff = chunksize - fwo->size;
-            if (diff < 0) {
-                err = EINVAL;
-                break;
-            }
-    
-            left -= fwo->size;
-            bufdat += fwo->size;
-            offset += fwo->size;
-            buf_setresid(bp, buf_resid(bp) - fwo->size);
-        }
+    buf_setresid(bp, (uint32_t)(buf_count(bp) - done));
 
-        if (merr) {
-            goto out;
-        }
-    }
-
-    if (fdi.tick) {
-        fuse_ticket_drop(fdi.tick);
-    } else {
-        /* No ticket upon leaving */
+    if (op == FUSE_WRITE && done > 0) {
+        fuse_internal_writeback_remove(vp, offset, offset + done);
     }
 
-out:
-
     if (err) {
         buf_seterror(bp, err);
     }
@@ -1450,6 +1654,126 @@ fuse_internal_forget_callback(struct fuse_ticket *ftick, __unused uio_t uio)
     return 0;
 }
 
+/*
+ * Sends whatever forgets are pending on the mount as one FUSE_BATCH_FORGET
+ * message. Forgets only ever lower the daemon's lookup counts, so holding
+ * them back for a while is harmless: a lookup that races with a pending
+ * forget just bumps the count before the forget takes it down again.
+ */
+__private_extern__
+void
+fuse_internal_forget_flush(struct fuse_data *data, vfs_context_t context)
+{
+    uint32_t count;
+    size_t   pendingsize;
+    struct fuse_dispatcher fdi;
+    struct fuse_batch_forget_in *fbfi;
+
+    if (!data->forget_count) {
+        return;
+    }
+
+    if (fdata_dead_get(data)) {
+        fuse_lck_mtx_lock(data->forget_mtx);
+        data->forget_count = 0;
+        fuse_lck_mtx_unlock(data->forget_mtx);
+        return;
+    }
+
+    pendingsize = sizeof(data->forget_pending);
+
+    fdisp_init(&fdi, sizeof(*fbfi) + pendingsize);
+    fdisp_make(&fdi, FUSE_BATCH_FORGET, data->mp, (uint64_t)0, context);
+
+    fbfi = fdi.indata;
+
+    fuse_lck_mtx_lock(data->forget_mtx);
+    count = data->forget_count;
+    memcpy(fbfi + 1, data->forget_pending,
+           count * sizeof(struct fuse_forget_one));
+    data->forget_count = 0;
+    fuse_lck_mtx_unlock(data->forget_mtx);
+
+    if (count == 0) { /* someone else got to them first */
+        fuse_ticket_drop(fdi.tick);
+        return;
+    }
+
+    fbfi->count = count;
+
+    /* Trim the message to the entries actually used. */
+    fdi.iosize = sizeof(*fbfi) + count * sizeof(struct fuse_forget_one);
+    bzero((char *)fdi.indata + fdi.iosize,
+          sizeof(*fbfi) + pendingsize - fdi.iosize);
+    fdi.finh->len = (uint32_t)(sizeof(struct fuse_in_header) + fdi.iosize);
+    fdi.tick->tk_ms_fiov.len = fdi.finh->len;
+
+    fticket_invalidate(fdi.tick);
+    fuse_insert_message(fdi.tick);
+}
+
+static void
+fuse_internal_forget_batch(struct fuse_data *data,
+                           vfs_context_t     context,
+                           uint64_t          nodeid,
+                           uint64_t          nlookup)
+{
+    uint32_t i;
+    int flush = 0, first = 0;
+    struct timeval now;
+
+    microuptime(&now);
+
+again:
+    fuse_lck_mtx_lock(data->forget_mtx);
+
+    if (data->forget_count == FUSE_FORGET_BATCH_MAX) {
+        fuse_lck_mtx_unlock(data->forget_mtx);
+        fuse_internal_forget_flush(data, context);
+        goto again;
+    }
+
+    for (i = 0; i < data->forget_count; i++) {
+        if (data->forget_pending[i].nodeid == nodeid) {
+            data->forget_pending[i].nlookup += nlookup;
+            break;
+        }
+    }
+
+    if (i == data->forget_count) {
+        if (i == 0) {
+            data->forget_oldest = now;
+            first = 1;
+        }
+        data->forget_pending[i].nodeid  = nodeid;
+        data->forget_pending[i].nlookup = nlookup;
+        data->forget_count++;
+    }
+
+    if ((data->forget_count == FUSE_FORGET_BATCH_MAX) ||
+        (now.tv_sec - data->forget_oldest.tv_sec >= FUSE_FORGET_BATCH_DELAY)) {
+        flush = 1;
+    }
+
+    fuse_lck_mtx_unlock(data->forget_mtx);
+
+    if (flush) {
+        fuse_internal_forget_flush(data, context);
+    } else if (first) {
+        /*
+         * The delay above is only checked when the next forget comes in.
+         * Wake a daemon that is waiting for messages: finding none, it
+         * takes the batch, so forgets never sit behind an idle daemon.
+         */
+        fuse_lck_mtx_lock(data->ms_mtx);
+        fuse_wakeup_one((caddr_t)data);
+#if M_MACFUSE_ENABLE_DSELECT
+        selwakeup((struct selinfo*)&data->d_rsel);
+#endif /* M_MACFUSE_ENABLE_DSELECT */
+        fuse_lck_mtx_unlock(data->ms_mtx);
+    }
+}
+
 __private_extern__
 void
 fuse_internal_forget_send(mount_t                 mp,
@@ -1459,12 +1783,26 @@ fuse_internal_forget_send(mount_t                 mp,
                           struct fuse_dispatcher *fdip)
 {
     struct fuse_forget_in *ffi;
+    struct fuse_data *data = fuse_get_mpdata(mp);
 
     /*
      * KASSERT(nlookup > 0, ("zero-times forget for vp #%llu",
      *         (long long unsigned) nodeid));
      */
 
+    if (data->dataflags & FSESS_BATCH_FORGET) {
+
+        /* The caller's ticket, if any, isn't needed for a batched forget. */
+        if (fdip->tick) {
+            fuse_ticket_drop(fdip->tick);
+            fdip->tick = NULL;
+        }
+
+        fuse_internal_forget_batch(data, context, nodeid, nlookup);
+
+        return;
+    }
+
     fdisp_init(fdip, sizeof(*ffi));
     fdisp_make(fdip, FUSE_FORGET, mp, nodeid, context);
 
@@ -1563,6 +1901,18 @@ fuse_internal_init_synchronous(struct fuse_ticket *ftick)
         data->dataflags |= FSESS_XTIMES;
     }
 
+    if (fiio->flags & FUSE_BATCH_FORGETS) {
+        data->dataflags |= FSESS_BATCH_FORGET;
+    }
+
+    if (fiio->flags & FUSE_MULTI_MESSAGE) {
+        data->dataflags |= FSESS_MULTI_MESSAGE;
+    }
+
+    if (!(fiio->flags & FUSE_DO_READDIRPLUS)) {
+        fuse_clear_implemented(data, FSESS_NOIMPLBIT(READDIRPLUS));
+    }
+
 out:
     fuse_ticket_drop(ftick);
 
@@ -1592,7 +1942,8 @@ fuse_internal_send_init(struct fuse_data *data, vfs_context_t context)
     fiii->major = FUSE_KERNEL_VERSION;
     fiii->minor = FUSE_KERNEL_MINOR_VERSION;
     fiii->max_readahead = data->iosize * 16;
-    fiii->flags = 0;
+    fiii->flags = FUSE_BATCH_FORGETS | FUSE_MULTI_MESSAGE |
+                  FUSE_DO_READDIRPLUS;
 
     /* blocking FUSE_INIT up to user space */
 
@@ -716,7 +716,9 @@ fuse_internal_readdir_processdata(vnode_t          vp,
                                   void            *buf,
                                   size_t           bufsize,
                                   struct fuse_iov *cookediov,
-                                  int             *numdirent);
+                                  int             *numdirent,
+                                  int              plus,
+                                  vfs_context_t    context);
 
 /* remove */
 
@@ -746,8 +748,27 @@ fuse_internal_revoke(vnode_t vp, int flags, vfs_context_t context, int how);
 void
 fuse_internal_vnode_disappear(vnode_t vp, vfs_context_t context, int how);
 
+/* writeback */
+
+int
+fuse_internal_iswriteback(vnode_t vp);
+
+int
+fuse_internal_writeback_add(vnode_t vp, off_t start, off_t end);
+
+void
+fuse_internal_writeback_remove(vnode_t vp, off_t start, off_t end);
+
+int
+fuse_internal_writeback_flush(vnode_t vp);
+
 /* strategy */
 
+int
+fuse_internal_strategy_io(vnode_t vp, struct fuse_data *data, uint64_t fh,
+                          int op, caddr_t bufdat, off_t offset, size_t count,
+                          size_t *donep);
+
 int
 fuse_internal_strategy(vnode_t vp, buf_t bp);
 
@@ -835,6 +856,9 @@ fuse_internal_forget_send(mount_t                 mp,
                           uint64_t                nlookup,
                           struct fuse_dispatcher *fdip);
 
+void
+fuse_internal_forget_flush(struct fuse_data *data, vfs_context_t context);
+
 void
 fuse_internal_interrupt_send(struct fuse_ticket *ftick);
 
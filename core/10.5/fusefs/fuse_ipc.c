@@ -24,6 +24,9 @@ static __inline__ void     fuse_push_freeticks(struct fuse_ticket *ftick);
 static __inline__ struct fuse_ticket *
 fuse_pop_freeticks(struct fuse_data *data);
 
+static struct fuse_ticket *fuse_ticket_cache_fetch(struct fuse_data *data);
+static int                 fuse_ticket_cache_put(struct fuse_ticket *ftick);
+
 static __inline__ void     fuse_push_allticks(struct fuse_ticket *ftick);
 static __inline__ void     fuse_remove_allticks(struct fuse_ticket *ftick);
 static struct fuse_ticket *fuse_pop_allticks(struct fuse_data *data);
@@ -38,12 +41,73 @@ static __inline__ void fuse_setup_ihead(struct fuse_in_header *ihead,
 
 static fuse_handler_t  fuse_standard_handler;
 
+/* The ticket buffer pool (fuse_pool.c) on lck_mtx_t and OSMalloc. */
+
+static void
+fuse_iov_pool_lock(void *mtx)
+{
+    fuse_lck_mtx_lock((lck_mtx_t *)mtx);
+}
+
+static void
+fuse_iov_pool_unlock(void *mtx)
+{
+    fuse_lck_mtx_unlock((lck_mtx_t *)mtx);
+}
+
+static void *
+fuse_iov_pool_alloc(size_t size)
+{
+    void *buf = FUSE_OSMalloc(size, fuse_malloc_tag);
+
+    if (buf) {
+        FUSE_OSAddAtomic(1, (SInt32 *)&fuse_realloc_count);
+    }
+
+    return buf;
+}
+
+static void
+fuse_iov_pool_free(void *buf, size_t size)
+{
+    FUSE_OSFree(buf, size, fuse_malloc_tag);
+}
+
+static void
+fuse_iov_pool_count(int c, int event)
+{
+    switch (event) {
+    case FUSE_IOV_POOL_HIT:
+        FUSE_OSAddAtomic(-1, (SInt32 *)&fuse_iov_pool_cached[c]);
+        FUSE_OSAddAtomic(1, (SInt32 *)&fuse_iov_pool_hits[c]);
+        break;
+    case FUSE_IOV_POOL_MISS:
+        FUSE_OSAddAtomic(1, (SInt32 *)&fuse_iov_pool_allocs[c]);
+        break;
+    case FUSE_IOV_POOL_CACHE:
+        FUSE_OSAddAtomic(1, (SInt32 *)&fuse_iov_pool_cached[c]);
+        break;
+    case FUSE_IOV_POOL_UNCACHE:
+        FUSE_OSAddAtomic(-1, (SInt32 *)&fuse_iov_pool_cached[c]);
+        break;
+    }
+}
+
+static const struct fuse_iov_pool_ops fuse_iov_pool_ops = {
+    fuse_iov_pool_lock,
+    fuse_iov_pool_unlock,
+    fuse_iov_pool_alloc,
+    fuse_iov_pool_free,
+    fuse_iov_pool_count,
+};
+
 void
 fiov_init(struct fuse_iov *fiov, size_t size)
 {
     size_t msize = FU_AT_LEAST(size);
 
     fiov->len = 0;
+    fiov->pool = NULL;
 
     fiov->base = FUSE_OSMalloc(msize, fuse_malloc_tag);
     if (!fiov->base) {
@@ -61,7 +125,8 @@ fiov_init(struct fuse_iov *fiov, size_t size)
 void
 fiov_teardown(struct fuse_iov *fiov)
 {
-    FUSE_OSFree(fiov->base, fiov->allocated_size, fuse_malloc_tag);
+    fuse_iov_pool_put(&fuse_iov_pool_ops, fiov->pool, fiov->base,
+                      fiov->allocated_size, fuse_iov_pool_maxbytes);
     fiov->allocated_size = 0;
 
     FUSE_OSAddAtomic(-1, (SInt32 *)&fuse_iov_current);
@@ -70,22 +135,9 @@ fiov_teardown(struct fuse_iov *fiov)
 void
 fiov_adjust(struct fuse_iov *fiov, size_t size)
 {
-    if (fiov->allocated_size < size ||
-        (fuse_iov_permanent_bufsize >= 0 &&
-         fiov->allocated_size - size > fuse_iov_permanent_bufsize &&
-             --fiov->credit < 0)) {
-
-        fiov->base = FUSE_OSRealloc_nocopy(fiov->base, fiov->allocated_size,
-                                           FU_AT_LEAST(size));
-        if (!fiov->base) {
-            panic("MacFUSE: realloc failed");
-        }
-
-        fiov->allocated_size = FU_AT_LEAST(size);
-        fiov->credit = fuse_iov_credit;
+    if (fiov_adjust_canfail(fiov, size)) {
+        panic("MacFUSE: realloc failed");
     }
-
-    fiov->len = size;
 }
 
 int
@@ -96,17 +148,24 @@ fiov_adjust_canfail(struct fuse_iov *fiov, size_t size)
          fiov->allocated_size - size > fuse_iov_permanent_bufsize &&
              --fiov->credit < 0)) {
 
-        void *tmpbase = NULL;
+        void  *tmpbase = NULL;
+        size_t tmpsize = fuse_iov_pool_roundup(fiov->pool, FU_AT_LEAST(size));
+
+        /* Shrinking within the same size class would just churn. */
+        if (tmpsize != fiov->allocated_size) {
+            tmpbase = fuse_iov_pool_get(&fuse_iov_pool_ops, fiov->pool,
+                                        FU_AT_LEAST(size), &tmpsize);
+            if (!tmpbase) {
+                return ENOMEM;
+            }
+
+            fuse_iov_pool_put(&fuse_iov_pool_ops, fiov->pool, fiov->base,
+                              fiov->allocated_size, fuse_iov_pool_maxbytes);
 
-        tmpbase = FUSE_OSRealloc_nocopy_canfail(fiov->base,
-                                                fiov->allocated_size,
-                                                FU_AT_LEAST(size));
-        if (!tmpbase) {
-            return ENOMEM;
+            fiov->base = tmpbase;
+            fiov->allocated_size = tmpsize;
         }
 
-        fiov->base = tmpbase;
-        fiov->allocated_size = FU_AT_LEAST(size);
         fiov->credit = fuse_iov_credit;
     }
 
@@ -141,10 +200,12 @@ fticket_alloc(struct fuse_data *data)
     ftick->tk_data = data;
 
     fiov_init(&ftick->tk_ms_fiov, sizeof(struct fuse_in_header));
+    ftick->tk_ms_fiov.pool = &data->iov_pool;
     ftick->tk_ms_type = FT_M_FIOV;
 
     ftick->tk_aw_mtx = lck_mtx_alloc_init(fuse_lock_group, fuse_lock_attr);
     fiov_init(&ftick->tk_aw_fiov, 0);
+    ftick->tk_aw_fiov.pool = &data->iov_pool;
     ftick->tk_aw_type = FT_A_FIOV;
 
     return ftick;
@@ -387,9 +448,41 @@ fticket_pull(struct fuse_ticket *ftick, uio_t uio)
     return err;
 }
 
+static void
+fuse_ticket_cache_lock(void *mtx)
+{
+    fuse_lck_mtx_lock((lck_mtx_t *)mtx);
+}
+
+static void
+fuse_ticket_cache_unlock(void *mtx)
+{
+    fuse_lck_mtx_unlock((lck_mtx_t *)mtx);
+}
+
+static void
+fuse_ticket_cache_refresh(struct fuse_tclink *tl)
+{
+    fticket_refresh(FUSE_TCLINK_OBJECT(tl, struct fuse_ticket, tk_tclink));
+}
+
+static int32_t
+fuse_ticket_cache_add(int32_t *counter, int32_t delta)
+{
+    return OSAddAtomic(delta, (SInt32 *)counter);
+}
+
+static const struct fuse_ticketcache_ops fuse_ticket_cache_ops = {
+    fuse_ticket_cache_lock,
+    fuse_ticket_cache_unlock,
+    fuse_ticket_cache_refresh,
+    fuse_ticket_cache_add,
+};
+
 struct fuse_data *
 fdata_alloc(struct proc *p)
 {
+    int i;
     struct fuse_data *data;
 
     data = (struct fuse_data *)FUSE_OSMalloc(sizeof(struct fuse_data),
@@ -412,10 +505,13 @@ fdata_alloc(struct proc *p)
     data->rwlock        = lck_rw_alloc_init(fuse_lock_group, fuse_lock_attr);
     data->ms_mtx        = lck_mtx_alloc_init(fuse_lock_group, fuse_lock_attr);
     data->aw_mtx        = lck_mtx_alloc_init(fuse_lock_group, fuse_lock_attr);
+    fuse_iov_pool_init(&data->iov_pool,
+                       lck_mtx_alloc_init(fuse_lock_group, fuse_lock_attr));
     data->ticket_mtx    = lck_mtx_alloc_init(fuse_lock_group, fuse_lock_attr);
 
     STAILQ_INIT(&data->ms_head);
     TAILQ_INIT(&data->aw_head);
+    fuse_awhash_init(&data->aw_hash);
     STAILQ_INIT(&data->freetickets_head);
     TAILQ_INIT(&data->alltickets_head);
 
@@ -423,6 +519,17 @@ fdata_alloc(struct proc *p)
     data->deadticket_counter = 0;
     data->ticketer           = 0;
 
+    fuse_ticketcache_init(&data->ticket_caches, &fuse_ticket_cache_ops);
+    for (i = 0; i < FUSE_TICKET_NCACHES; i++) {
+        data->ticket_caches.tcs_caches[i].tc_mtx =
+            lck_mtx_alloc_init(fuse_lock_group, fuse_lock_attr);
+    }
+
+    data->forget_mtx   = lck_mtx_alloc_init(fuse_lock_group, fuse_lock_attr);
+    data->forget_count = 0;
+
+    data->strategy_inflight = 0;
+
 #if M_MACFUSE_EXCPLICIT_RENAME_LOCK
     data->rename_lock = lck_rw_alloc_init(fuse_lock_group, fuse_lock_attr);
 #endif
@@ -436,6 +543,7 @@ fdata_alloc(struct proc *p)
 void
 fdata_destroy(struct fuse_data *data)
 {
+    int i;
     struct fuse_ticket *ftick;
 
     lck_mtx_free(data->ms_mtx, fuse_lock_group);
@@ -447,6 +555,17 @@ fdata_destroy(struct fuse_data *data)
     lck_mtx_free(data->ticket_mtx, fuse_lock_group);
     data->ticket_mtx = NULL;
 
+    /* Cached tickets are still on alltickets_head; they go away below. */
+    for (i = 0; i < FUSE_TICKET_NCACHES; i++) {
+        lck_mtx_free((lck_mtx_t *)data->ticket_caches.tcs_caches[i].tc_mtx,
+                     fuse_lock_group);
+        data->ticket_caches.tcs_caches[i].tc_mtx = NULL;
+    }
+
+    /* Forgets still pending here are moot; the daemon is gone. */
+    lck_mtx_free(data->forget_mtx, fuse_lock_group);
+    data->forget_mtx = NULL;
+
 #if M_MACFUSE_EXPLICIT_RENAME_LOCK
     lck_rw_free(data->rename_lock, fuse_lock_group);
     data->rename_lock = NULL;
@@ -459,6 +578,10 @@ fdata_destroy(struct fuse_data *data)
         fticket_destroy(ftick);
     }
 
+    fuse_iov_pool_shrink(&fuse_iov_pool_ops, &data->iov_pool, 0);
+    lck_mtx_free((lck_mtx_t *)data->iov_pool.mtx, fuse_lock_group);
+    data->iov_pool.mtx = NULL;
+
     kauth_cred_unref(&(data->daemoncred));
 
     lck_rw_free(data->rwlock, fuse_lock_group);
@@ -551,12 +674,55 @@ fuse_pop_allticks(struct fuse_data *data)
     return ftick;
 }
 
+/*
+ * The ticket caches sit in front of the free ticket list. A ticket in a
+ * cache has already been refreshed and is still on alltickets_head; it is
+ * counted in ticket_caches.tcs_count rather than freeticket_counter.
+ */
+
+static struct fuse_ticket *
+fuse_ticket_cache_fetch(struct fuse_data *data)
+{
+    struct fuse_tclink *tl;
+
+    tl = fuse_ticketcache_fetch(&data->ticket_caches,
+                                (uintptr_t)current_thread());
+
+    return tl ? FUSE_TCLINK_OBJECT(tl, struct fuse_ticket, tk_tclink) : NULL;
+}
+
+static int
+fuse_ticket_cache_put(struct fuse_ticket *ftick)
+{
+    struct fuse_data *data = ftick->tk_data;
+
+    /*
+     * Cached tickets count against the free ticket limit too. We read
+     * freeticket_counter without ticket_mtx, which keeping drops off that
+     * lock is all about, so the limit is only approximate here.
+     */
+    return fuse_ticketcache_put(&data->ticket_caches,
+                                (uintptr_t)current_thread(),
+                                &ftick->tk_tclink, fuse_max_freetickets,
+                                data->freeticket_counter);
+}
+
 struct fuse_ticket *
 fuse_ticket_fetch(struct fuse_data *data)
 {
     int err = 0;
     struct fuse_ticket *ftick;
 
+    /*
+     * Until the daemon has answered FUSE_INIT, every fetch must go through
+     * ticket_mtx so that it can wait for initialization below.
+     */
+    if (data->dataflags & FSESS_INITED) {
+        if ((ftick = fuse_ticket_cache_fetch(data))) {
+            return ftick;
+        }
+    }
+
     fuse_lck_mtx_lock(data->ticket_mtx);
 
     if (data->freeticket_counter == 0) {
@@ -598,10 +764,15 @@ fuse_ticket_drop(struct fuse_ticket *ftick)
 {
     int die = 0;
 
+    if (!(ftick->tk_flag & FT_KILLL) && fuse_ticket_cache_put(ftick)) {
+        return;
+    }
+
     fuse_lck_mtx_lock(ftick->tk_data->ticket_mtx);
 
     if ((fuse_max_freetickets >= 0 &&
-        fuse_max_freetickets <= ftick->tk_data->freeticket_counter) ||
+        fuse_max_freetickets <= ftick->tk_data->freeticket_counter +
+                   (uint32_t)ftick->tk_data->ticket_caches.tcs_count) ||
         (ftick->tk_flag & FT_KILLL)) {
         die = 1;
     } else {
@@ -826,6 +997,7 @@ fuse_body_audit(struct fuse_ticket *ftick, size_t blen)
         break;
 
     case FUSE_READDIR:
+    case FUSE_READDIRPLUS:
         err = (((struct fuse_read_in *)(
                 (char *)ftick->tk_ms_fiov.base +
                         sizeof(struct fuse_in_header)
@@ -1027,17 +1199,35 @@ fdisp_make_vp_canfail(struct fuse_dispatcher *fdip,
 int
 fdisp_wait_answ(struct fuse_dispatcher *fdip)
 {
-    int err = 0;
+    fdisp_send(fdip);
 
+    return fdisp_wait_sent(fdip);
+}
+
+/*
+ * fdisp_send() queues the dispatcher's ticket without waiting for the
+ * answer; fdisp_wait_sent() later waits for it, with the same results and
+ * the same ticket ownership rules as fdisp_wait_answ().
+ */
+void
+fdisp_send(struct fuse_dispatcher *fdip)
+{
     fdip->answ_stat = 0;
     fuse_insert_callback(fdip->tick, fuse_standard_handler);
     fuse_insert_message(fdip->tick);
+}
+
+int
+fdisp_wait_sent(struct fuse_dispatcher *fdip)
+{
+    int err = 0;
+
+    fdip->answ_stat = 0;
 
     if ((err = fticket_wait_answer(fdip->tick))) { /* interrupted */
 
 #ifndef DONT_TRY_HARD_PREVENT_IO_IN_VAIN
-        struct fuse_ticket *ftick;
-        unsigned            age;
+        unsigned age;
 #endif
 
         fuse_lck_mtx_lock(fdip->tick->tk_aw_mtx);
@@ -1053,14 +1243,11 @@ fdisp_wait_answ(struct fuse_dispatcher *fdip)
             fuse_lck_mtx_unlock(fdip->tick->tk_aw_mtx);
 #ifndef DONT_TRY_HARD_PREVENT_IO_IN_VAIN
             fuse_lck_mtx_lock(fdip->tick->tk_data->aw_mtx);
-            TAILQ_FOREACH(ftick, &fdip->tick->tk_data->aw_head, tk_aw_link) {
-                if (ftick == fdip->tick) {
-                    if (fdip->tick->tk_age == age) {
-                        /* Succeeded preventing I/O in vain */
-                        fdip->tick->tk_aw_handler = NULL;
-                    }
-                    break;
-                }
+            if (fuse_aw_find(fdip->tick->tk_data,
+                             fdip->tick->tk_unique) == fdip->tick &&
+                fdip->tick->tk_age == age) {
+                /* Succeeded preventing I/O in vain */
+                fdip->tick->tk_aw_handler = NULL;
             }
 
             fuse_lck_mtx_unlock(fdip->tick->tk_data->aw_mtx);
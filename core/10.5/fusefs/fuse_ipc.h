@@ -25,15 +25,19 @@
 #include <libkern/locks.h>
 
 #include "fuse.h"
+#include "fuse_awhash.h"
 #include "fuse_device.h"
 #include "fuse_kludges.h"
 #include "fuse_locking.h"
+#include "fuse_pool.h"
+#include "fuse_ticketcache.h"
 
 struct fuse_iov {
-    void   *base;
-    size_t  len;
-    size_t  allocated_size;
-    ssize_t credit;
+    void                 *base;
+    size_t                len;
+    size_t                allocated_size;
+    ssize_t               credit;
+    struct fuse_iov_pool *pool;
 };
 
 #define FUSE_DATA_LOCK_SHARED(d)      fuse_lck_rw_lock_shared((d)->rwlock)
@@ -68,6 +72,7 @@ struct fuse_ticket {
     uint32_t                     tk_age;
 
     STAILQ_ENTRY(fuse_ticket)    tk_freetickets_link;
+    struct fuse_tclink           tk_tclink;
     TAILQ_ENTRY(fuse_ticket)     tk_alltickets_link;
 
     struct fuse_iov              tk_ms_fiov;
@@ -86,6 +91,7 @@ struct fuse_ticket {
     lck_mtx_t                   *tk_aw_mtx;
     fuse_handler_t              *tk_aw_handler;
     TAILQ_ENTRY(fuse_ticket)     tk_aw_link;
+    struct fuse_awlink           tk_aw_hashlink;
 };
 
 #define FT_ANSW  0x01  // request of ticket has already been answered
@@ -159,8 +165,11 @@ struct fuse_data {
     lck_mtx_t                 *ms_mtx;
     STAILQ_HEAD(, fuse_ticket) ms_head;
 
+    struct fuse_iov_pool       iov_pool;
+
     lck_mtx_t                 *aw_mtx;
     TAILQ_HEAD(, fuse_ticket)  aw_head;
+    struct fuse_awhash         aw_hash;
 
     lck_mtx_t                 *ticket_mtx;
     STAILQ_HEAD(, fuse_ticket) freetickets_head;
@@ -168,6 +177,14 @@ struct fuse_data {
     uint32_t                   freeticket_counter;
     uint32_t                   deadticket_counter;
     uint64_t                   ticketer;
+    struct fuse_ticketcache    ticket_caches;
+
+    lck_mtx_t                 *forget_mtx;
+    struct fuse_forget_one     forget_pending[FUSE_FORGET_BATCH_MAX];
+    uint32_t                   forget_count;
+    struct timeval             forget_oldest;
+
+    uint32_t                   strategy_inflight;
 
 #if M_MACFUSE_EXPLICIT_RENAME_LOCK
     lck_rw_t                  *rename_lock;
@@ -231,6 +248,8 @@ enum {
 #define FSESS_AUTO_CACHE          0x08000000
 #define FSESS_NATIVE_XATTR        0x10000000
 #define FSESS_SPARSE              0x20000000
+#define FSESS_BATCH_FORGET        0x40000000
+#define FSESS_MULTI_MESSAGE       0x80000000
 
 static __inline__
 struct fuse_data *
@@ -269,11 +288,19 @@ fuse_ms_pop(struct fuse_data *data)
     return ftick;
 }
 
+/*
+ * Tickets awaiting an answer are kept on aw_head, in the order they were
+ * sent, for the teardown paths. They are also hashed by unique ID so that
+ * a reply from the daemon can be matched without walking the whole list.
+ */
+
 static __inline__
 void
 fuse_aw_push(struct fuse_ticket *ftick)
 {
     TAILQ_INSERT_TAIL(&ftick->tk_data->aw_head, ftick, tk_aw_link);
+    fuse_awhash_insert(&ftick->tk_data->aw_hash, &ftick->tk_aw_hashlink,
+                       ftick->tk_unique);
 }
 
 static __inline__
@@ -281,6 +308,17 @@ void
 fuse_aw_remove(struct fuse_ticket *ftick)
 {
     TAILQ_REMOVE(&ftick->tk_data->aw_head, ftick, tk_aw_link);
+    fuse_awhash_remove(&ftick->tk_data->aw_hash, &ftick->tk_aw_hashlink);
+}
+
+static __inline__
+struct fuse_ticket *
+fuse_aw_find(struct fuse_data *data, uint64_t unique)
+{
+    struct fuse_awlink *al = fuse_awhash_find(&data->aw_hash, unique);
+
+    return al ? FUSE_AWLINK_OBJECT(al, struct fuse_ticket, tk_aw_hashlink)
+              : NULL;
 }
 
 static __inline__
@@ -352,6 +390,9 @@ int  fdisp_make_vp_canfail(struct fuse_dispatcher *fdip, enum fuse_opcode op,
 
 int  fdisp_wait_answ(struct fuse_dispatcher *fdip);
 
+void fdisp_send(struct fuse_dispatcher *fdip);
+int  fdisp_wait_sent(struct fuse_dispatcher *fdip);
+
 static __inline__
 int
 fdisp_simple_putget_vp(struct fuse_dispatcher *fdip, enum fuse_opcode op,
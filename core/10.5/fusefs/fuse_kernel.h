@@ -142,6 +142,9 @@ struct fuse_file_lock {
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
 #if (__FreeBSD__ >= 10)
+#define FUSE_DO_READDIRPLUS	(1 << 13)
+#define FUSE_MULTI_MESSAGE	(1 << 27)
+#define FUSE_BATCH_FORGETS	(1 << 28)
 #define FUSE_CASE_INSENSITIVE	(1 << 29)
 #define FUSE_VOL_RENAME		(1 << 30)
 #define FUSE_XTIMES		(1 << 31)
@@ -189,6 +192,10 @@ enum fuse_opcode {
 	FUSE_INTERRUPT     = 36,
 	FUSE_BMAP          = 37,
 	FUSE_DESTROY       = 38,
+#if (__FreeBSD__ >= 10)
+	FUSE_BATCH_FORGET  = 42, /* no reply */
+	FUSE_READDIRPLUS   = 44,
+#endif /* __FreeBSD__ >= 10 */
 #if (__FreeBSD__ >= 10)
         FUSE_SETVOLNAME    = 61,
 	FUSE_GETXTIMES     = 62,
@@ -214,6 +221,19 @@ struct fuse_forget_in {
 	__u64	nlookup;
 };
 
+#if (__FreeBSD__ >= 10)
+struct fuse_forget_one {
+	__u64	nodeid;
+	__u64	nlookup;
+};
+
+/* Followed by count fuse_forget_one entries; the header nodeid is 0. */
+struct fuse_batch_forget_in {
+	__u32	count;
+	__u32	dummy;
+};
+#endif /* __FreeBSD__ >= 10 */
+
 struct fuse_attr_out {
 	__u64	attr_valid;	/* Cache timeout for the attributes */
 	__u32	attr_valid_nsec;
@@ -437,3 +457,15 @@ struct fuse_dirent {
 #define FUSE_DIRENT_ALIGN(x) (((x) + sizeof(__u64) - 1) & ~(sizeof(__u64) - 1))
 #define FUSE_DIRENT_SIZE(d) \
 	FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + (d)->namelen)
+
+#if (__FreeBSD__ >= 10)
+struct fuse_direntplus {
+	struct fuse_entry_out entry_out;
+	struct fuse_dirent dirent;
+};
+
+#define FUSE_NAME_OFFSET_DIRENTPLUS \
+	offsetof(struct fuse_direntplus, dirent.name)
+#define FUSE_DIRENTPLUS_SIZE(d) \
+	FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET_DIRENTPLUS + (d)->dirent.namelen)
+#endif /* __FreeBSD__ >= 10 */
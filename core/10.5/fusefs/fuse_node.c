@@ -14,6 +14,7 @@ void
 FSNodeScrub(struct fuse_vnode_data *fvdat)
 {
     lck_mtx_free(fvdat->createlock, fuse_lock_group);
+    lck_mtx_free(fvdat->dirtylock, fuse_lock_group);
 #if M_MACFUSE_ENABLE_TSLOCKING
     lck_rw_free(fvdat->nodelock, fuse_lock_group);
     lck_rw_free(fvdat->truncatelock, fuse_lock_group);
@@ -119,6 +120,9 @@ FSNodeGetOrCreateFileVNodeByID(vnode_t               *vnPtr,
             fvdat->createlock = lck_mtx_alloc_init(fuse_lock_group,
                                                    fuse_lock_attr);
             fvdat->creator = current_thread();
+            fvdat->dirtylock = lck_mtx_alloc_init(fuse_lock_group,
+                                                  fuse_lock_attr);
+            fuse_rangeset_init(&fvdat->dirty);
 #if M_MACFUSE_ENABLE_TSLOCKING
             fvdat->nodelock = lck_rw_alloc_init(fuse_lock_group,
                                                 fuse_lock_attr);
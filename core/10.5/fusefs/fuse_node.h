@@ -9,6 +9,7 @@
 #include "fuse_file.h"
 #include "fuse_knote.h"
 #include "fuse_nodehash.h"
+#include "fuse_range.h"
 #include <fuse_param.h>
 
 extern errno_t (**fuse_vnode_operations)(void *);
@@ -105,6 +106,15 @@ struct fuse_vnode_data {
     lck_rw_t  *truncatelock;
 #endif
 
+    /** write-back **/
+
+    /*
+     * Ranges written into the UBC but not yet pushed to the daemon (see
+     * fuse_internal_writeback_flush()). The dirtylock protects them.
+     */
+    lck_mtx_t           *dirtylock;
+    struct fuse_rangeset dirty;
+
     /** miscellaneous **/
 
 #if M_MACFUSE_ENABLE_KQUEUE
@@ -31,7 +31,7 @@
 #if M_MACFUSE_ENABLE_UNSUPPORTED
 #define LCK_MTX_ASSERT lck_mtx_assert
 #else
-#define LCK_MTX_ASSERT(gHashMutex, LCK_MTX_ASSERT_OWNED) do { } while (0)
+#define LCK_MTX_ASSERT(lock, LCK_MTX_ASSERT_OWNED) do { } while (0)
 #endif
 
 /*
@@ -57,10 +57,10 @@ struct HNode {
     /* [2] next pointer for hash chain */
     LIST_ENTRY(HNode) hashLink;
 
-    /* [1] device number on which file system object (fsobj) resides */
+    /* [4] device number on which file system object (fsobj) resides */
     fuse_device_t dev;
 
-    /* [1] inode number of fsobj resides */
+    /* [4] inode number of fsobj resides */
     uint64_t ino;
 
     /* [2] [3] */
@@ -99,13 +99,19 @@ typedef struct HNode HNode;
  *     creating an HNode, and is not modified after that. Thus, it doesn't need 
  *     to be protected from concurrent access.
  *
- * [2] The gHashMutex lock protects this field in /all/ HNodes.
+ * [2] The lock of the hash chain that the HNode is on (see HNodeGetLock)
+ *     protects this field.
  *
  * [3] This is true if HNodeLookupCreatingIfNecessary has return success but
  *     with a NULL vnode.  In this case, we're expecting the client to call
  *     either HNodeAttachVNodeSucceeded or HNodeAttachVNodeFailed at some time
  *     in the future. While this is true, forkVNodesCount is incremented to
  *     prevent the HNode from going away.
+ *
+ * [4] This field only changes in HNodeExchangeFromFSNode, which holds the
+ *     locks of both the old and the new hash chain while it does so. It can
+ *     be read without a lock, but a lock chosen from it must be checked
+ *     against it again once held (see HNodeLockNode).
  */
 
 /*
@@ -119,20 +125,26 @@ static size_t       gFSNodeSize;
 static OSMallocTag  gOSMallocTag;
 
 /*
- *gHashMutex is a single mutex that protects all fields (except the immutable
- * ones) of all HNodes, the hash table itself (all elements of the gHashTable
- * array), and gHashNodeCount.
+ * gHashLocks is an array of HNODE_HASH_NLOCKS mutexes. Hash chain i is
+ * protected by gHashLocks[i % HNODE_HASH_NLOCKS], which also protects all
+ * fields (except the immutable ones) of the HNodes on that chain. The
+ * chains of different mounts, and of different inodes on one mount, thus
+ * mostly do not contend. When more than one of these locks is needed, they
+ * are taken in index order.
  */
 
-static lck_mtx_t *gHashMutex;
+#define HNODE_HASH_NLOCKS 64
+
+static lck_mtx_t *gHashLocks[HNODE_HASH_NLOCKS];
 
 /*
  * gHashNodeCount is a count of the number of HNodes in the hash table. 
  * This is used solely for debugging (if it's non-zero when HNodeTerm is
- * called, the debug version of the code will panic).
+ * called, the debug version of the code will panic). It is updated
+ * atomically.
  */
 
-static size_t gHashNodeCount;
+static SInt32 gHashNodeCount;
 
 /*
  * gHashTable is a pointer to an array of HNodeHashHead structures that
@@ -145,6 +157,27 @@ typedef struct HNodeHashHead HNodeHashHead;
 
 static u_long gHashTableMask;
 
+/*
+ * Given a device number and an inode number, return the index of the hash
+ * chain. The inputs are run through a 64-bit mixing function so that the
+ * sequential inode numbers of several mounts do not pile up on the same
+ * chains.
+ */
+static u_long
+HNodeHashIndex(fuse_device_t dev, uint64_t ino)
+{
+    uint64_t h;
+
+    h = ino + (uint64_t)(uintptr_t)dev * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (u_long)h & gHashTableMask;
+}
+
 /*
  * Given a device number and an inode number, return a pointer to the 
  * hash chain head.
@@ -152,7 +185,62 @@ static u_long gHashTableMask;
 static HNodeHashHead *
 HNodeGetFirstFromHashTable(fuse_device_t dev, uint64_t ino)
 {
-    return (HNodeHashHead *)&gHashTable[((uint64_t)(u_long)dev + ino) & gHashTableMask];
+    return (HNodeHashHead *)&gHashTable[HNodeHashIndex(dev, ino)];
+}
+
+/*
+ * Given a device number and an inode number, return the lock that protects
+ * the hash chain (and the HNodes on it).
+ */
+static lck_mtx_t *
+HNodeGetLock(fuse_device_t dev, uint64_t ino)
+{
+    return gHashLocks[HNodeHashIndex(dev, ino) % HNODE_HASH_NLOCKS];
+}
+
+/*
+ * Lock the hash chain of an HNode that the caller already holds. The
+ * identity is read before the lock is held, and HNodeExchangeFromFSNode may
+ * change it meanwhile, so it is checked again under the lock; if it moved,
+ * we unlock and try the new chain. Returns the lock that is now held.
+ */
+static lck_mtx_t *
+HNodeLockNode(HNodeRef hnode)
+{
+    fuse_device_t dev;
+    uint64_t      ino;
+    lck_mtx_t    *lock;
+
+    for (;;) {
+        dev = hnode->dev;
+        ino = hnode->ino;
+        lock = HNodeGetLock(dev, ino);
+        lck_mtx_lock(lock);
+        if (hnode->dev == dev && hnode->ino == ino) {
+            return lock;
+        }
+        lck_mtx_unlock(lock);
+    }
+}
+
+static void
+HNodeLockAll(void)
+{
+    int i;
+
+    for (i = 0; i < HNODE_HASH_NLOCKS; i++) {
+        lck_mtx_lock(gHashLocks[i]);
+    }
+}
+
+static void
+HNodeUnlockAll(void)
+{
+    int i;
+
+    for (i = HNODE_HASH_NLOCKS - 1; i >= 0; i--) {
+        lck_mtx_unlock(gHashLocks[i]);
+    }
 }
 
 extern errno_t
@@ -163,6 +251,7 @@ HNodeInit(lck_grp_t   *lockGroup,
           size_t       fsNodeSize)
 {
     errno_t     err;
+    int         i;
     
     assert(lockGroup != NULL);
     // lockAttr may be NULL
@@ -174,10 +263,15 @@ HNodeInit(lck_grp_t   *lockGroup,
     gOSMallocTag = mallocTag;
     gLockGroup   = lockGroup;
 
-    gHashMutex = lck_mtx_alloc_init(lockGroup, lockAttr);
-    gHashTable = hashinit(desiredvnodes, M_TEMP, &gHashTableMask);
     err = 0;
-    if ((gHashMutex == NULL) || (gHashTable == NULL)) {
+    for (i = 0; i < HNODE_HASH_NLOCKS; i++) {
+        gHashLocks[i] = lck_mtx_alloc_init(lockGroup, lockAttr);
+        if (gHashLocks[i] == NULL) {
+            err = ENOMEM;
+        }
+    }
+    gHashTable = hashinit(desiredvnodes, M_TEMP, &gHashTableMask);
+    if ((err != 0) || (gHashTable == NULL)) {
         HNodeTerm(); /* Clean up any partial allocations */
         err = ENOMEM;
     }
@@ -187,6 +281,8 @@ HNodeInit(lck_grp_t   *lockGroup,
 extern void
 HNodeTerm(void)
 {
+    int i;
+
     /*
      * Free the hash table. Also, if there are any hash nodes left, we
      * shouldn't be terminating.
@@ -207,11 +303,13 @@ HNodeTerm(void)
         gHashTable = NULL;
     }
     
-    if (gHashMutex != NULL) {
-        assert(gLockGroup != NULL);
-        
-        lck_mtx_free(gHashMutex, gLockGroup);
-        gHashMutex = NULL;
+    for (i = 0; i < HNODE_HASH_NLOCKS; i++) {
+        if (gHashLocks[i] != NULL) {
+            assert(gLockGroup != NULL);
+
+            lck_mtx_free(gHashLocks[i], gLockGroup);
+            gHashLocks[i] = NULL;
+        }
     }
 
     gLockGroup = NULL;
@@ -275,23 +373,24 @@ extern vnode_t
 HNodeGetVNodeForForkAtIndex(HNodeRef hnode, __unused size_t forkIndex)
 {
     vnode_t     vn;
+    lck_mtx_t  *lock;
     
     assert(hnode != NULL);
     assert(hnode->magic == gMagic);
     assert(forkIndex < hnode->forkVNodesSize);
     
     /*
-     * Locking and unlocking gHashMutex /is/ needed, because another thread
-     * might be swapping in an expanded forkVNodes array. Because of the
-     * multi-threaded nature of the kernel, no amount of clever ordering of
-     * this swap can prevent the possibility of us seeing inconsistent data.
+     * Locking and unlocking the chain lock /is/ needed, because another
+     * thread might be swapping in an expanded forkVNodes array. Because of
+     * the multi-threaded nature of the kernel, no amount of clever ordering
+     * of this swap can prevent the possibility of us seeing inconsistent data.
      */
     
-    lck_mtx_lock(gHashMutex);
+    lock = HNodeLockNode(hnode);
 
     vn = hnode->forkVNodes[forkIndex];
 
-    lck_mtx_unlock(gHashMutex);
+    lck_mtx_unlock(lock);
     
     return vn;
 }
@@ -307,6 +406,7 @@ HNodeGetForkIndexForVNode(vnode_t vn)
     HNodeRef    hnode;
     size_t      forkCount;
     size_t      forkIndex;
+    lck_mtx_t  *lock;
     
     assert(vn != NULL);
     
@@ -314,11 +414,11 @@ HNodeGetForkIndexForVNode(vnode_t vn)
     hnode = HNodeFromVNode(vn);
     
     /*
-     * Locking and unlocking gHashMutex is needed, because another thread might 
-     * be switching in an expanded forkVNodes array.
+     * Locking and unlocking the chain lock is needed, because another thread
+     * might be switching in an expanded forkVNodes array.
      */
     
-    lck_mtx_lock(gHashMutex);
+    lock = HNodeLockNode(hnode);
 
     forkCount = hnode->forkVNodesSize;
     for (forkIndex = 0; forkIndex < forkCount; forkIndex++) {
@@ -329,33 +429,91 @@ HNodeGetForkIndexForVNode(vnode_t vn)
     /* That is, that vn is in forkVNodes */
     assert(forkIndex != forkCount);
 
-    lck_mtx_unlock(gHashMutex);
+    lck_mtx_unlock(lock);
     
     return forkIndex;
 }
 
+/*
+ * This swaps the identities (device and inode numbers) of the two HNodes,
+ * so it holds the locks of both hash chains, taken in index order. The
+ * identities are read before those locks are held, so once they are, we
+ * check that neither HNode has been exchanged meanwhile, and start over if
+ * one has. The caller must make sure that no other thread is using either
+ * HNode meanwhile.
+ */
 extern void
 HNodeExchangeFromFSNode(void *fsnode1, void *fsnode2)
 {
-    struct HNode tmpHNode;
-
-    lck_mtx_lock(gHashMutex);
+    struct HNode  tmpHNode;
+    fuse_device_t dev1;
+    fuse_device_t dev2;
+    uint64_t      ino1;
+    uint64_t      ino2;
+    u_long        index1;
+    u_long        index2;
 
     HNodeRef hnode1 = HNodeFromFSNodeGeneric(fsnode1);
     HNodeRef hnode2 = HNodeFromFSNodeGeneric(fsnode2);
 
+    for (;;) {
+        dev1 = hnode1->dev;
+        ino1 = hnode1->ino;
+        dev2 = hnode2->dev;
+        ino2 = hnode2->ino;
+
+        index1 = HNodeHashIndex(dev1, ino1) % HNODE_HASH_NLOCKS;
+        index2 = HNodeHashIndex(dev2, ino2) % HNODE_HASH_NLOCKS;
+        if (index1 > index2) {
+            u_long tmpIndex = index1;
+            index1 = index2;
+            index2 = tmpIndex;
+        }
+
+        lck_mtx_lock(gHashLocks[index1]);
+        if (index2 != index1) {
+            lck_mtx_lock(gHashLocks[index2]);
+        }
+
+        if (hnode1->dev == dev1 && hnode1->ino == ino1 &&
+            hnode2->dev == dev2 && hnode2->ino == ino2) {
+            break;
+        }
+
+        if (index2 != index1) {
+            lck_mtx_unlock(gHashLocks[index2]);
+        }
+        lck_mtx_unlock(gHashLocks[index1]);
+    }
+
+    /*
+     * Unlink both before swapping; swapping the links of two HNodes that
+     * are next to each other on one chain would corrupt that chain.
+     */
+    LIST_REMOVE(hnode1, hashLink);
+    LIST_REMOVE(hnode2, hashLink);
+
     memcpy(&tmpHNode, hnode1, sizeof(struct HNode));
     memcpy(hnode1, hnode2, sizeof(struct HNode));
     memcpy(hnode2, &tmpHNode, sizeof(struct HNode));
 
-    LIST_REMOVE(hnode1, hashLink);
-    LIST_REMOVE(hnode2, hashLink);
+    /* A single fork vnode is stored inside the HNode; point back at it. */
+    if (hnode1->forkVNodesSize == 1) {
+        hnode1->forkVNodes = &hnode1->forkVNodesStorage.internal;
+    }
+    if (hnode2->forkVNodesSize == 1) {
+        hnode2->forkVNodes = &hnode2->forkVNodesStorage.internal;
+    }
+
     LIST_INSERT_HEAD(HNodeGetFirstFromHashTable(hnode1->dev, hnode1->ino),
                      hnode1, hashLink);
     LIST_INSERT_HEAD(HNodeGetFirstFromHashTable(hnode2->dev, hnode2->ino),
                      hnode2, hashLink);
 
-    lck_mtx_unlock(gHashMutex);
+    if (index2 != index1) {
+        lck_mtx_unlock(gHashLocks[index2]);
+    }
+    lck_mtx_unlock(gHashLocks[index1]);
 }
 
 extern errno_t
@@ -372,6 +530,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
     boolean_t  needsUnlock;
     vnode_t    resultVN;
     uint32_t   vid;
+    lck_mtx_t *lock;
     
     assert( hnodePtr != NULL);
     assert(*hnodePtr == NULL);
@@ -385,17 +544,18 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
      * a memory access exception inside lck_mtx_lock).
      */
     
-    assert(gHashMutex != NULL);
+    assert(gHashTable != NULL);
 
     newNode = NULL;
     newForkBuffer = NULL;
     needsUnlock = TRUE;
     resultVN = NULL;
     
-    lck_mtx_lock(gHashMutex);
+    lock = HNodeGetLock(dev, ino);
+    lck_mtx_lock(lock);
     
     do {
-        LCK_MTX_ASSERT(gHashMutex, LCK_MTX_ASSERT_OWNED);
+        LCK_MTX_ASSERT(lock, LCK_MTX_ASSERT_OWNED);
 
         err = EAGAIN;
         
@@ -423,7 +583,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
         
         if (thisNode == NULL) {
             if (newNode == NULL) {
-                lck_mtx_unlock(gHashMutex);
+                lck_mtx_unlock(lock);
 
                 /* Allocate a new node. */
                 
@@ -467,11 +627,11 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
                     }
                 }
 
-                lck_mtx_lock(gHashMutex);
+                lck_mtx_lock(lock);
             } else {
                 LIST_INSERT_HEAD(HNodeGetFirstFromHashTable(dev, ino),
                                  newNode, hashLink);
-                gHashNodeCount += 1;
+                OSAddAtomic(1, &gHashNodeCount);
 
                 /*
                  * Set thisNode to the node that we inserted, and clear
@@ -487,7 +647,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
                  * the new node into the hash table, it can be discovered by
                  * other threads. This would be bad, because it's only
                  * partially constructed at this point. We prevent this
-                 * problem by not dropping gHashMutex from this point to
+                 * problem by not dropping the chain lock from this point to
                  * the point that we're done. This only works because we
                  * allocate the new node with a fork buffer that's adequate
                  * to meet our needs.
@@ -515,7 +675,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
 
                 thisNode->waiting = TRUE;
                 
-                (void)fuse_msleep(thisNode, gHashMutex, PINOD,
+                (void)fuse_msleep(thisNode, lock, PINOD,
                                   "HNodeLookupCreatingIfNecessary", NULL);
                 
                 /*
@@ -537,7 +697,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
                      * start again from scratch.
                      */
 
-                    lck_mtx_unlock(gHashMutex);
+                    lck_mtx_unlock(lock);
 
                     newForkBuffer = FUSE_OSMalloc(sizeof(*newForkBuffer) * (forkIndex + 1), gOSMallocTag);
                     if (newForkBuffer == NULL) {
@@ -546,14 +706,14 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
                         memset(newForkBuffer, 0, sizeof(*newForkBuffer) * (forkIndex + 1));
                     }
                     
-                    lck_mtx_lock(gHashMutex);
+                    lck_mtx_lock(lock);
                 } else {
 
                     /*
                      * Insert the newForkBuffer into theNode. This only works
                      * because readers of the thisNode->forkVNodes array
                      * (notably this routine and HNodeGetVNodeForForkAtIndex)
-                     * always take gHashMutex. If that wasn't the case, you
+                     * always take the chain lock. If that wasn't the case, you
                      * could get into some subtle race conditions as thread A
                      * brings a copy of thisNode->forkVNodes into a register 
                      * and then gets blocked, then thread B runs and expands
@@ -590,7 +750,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
                      * again from scratch.
                      */
 
-                    lck_mtx_unlock(gHashMutex);
+                    lck_mtx_unlock(lock);
                     
                     if (oldForkBuffer != NULL) {
                         FUSE_OSFree(oldForkBuffer,
@@ -598,7 +758,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
                                     gOSMallocTag);
                     }
                     
-                    lck_mtx_lock(gHashMutex);                       
+                    lck_mtx_lock(lock);                       
                 }
             } else if (thisNode->forkVNodes[forkIndex] == NULL) {
                 /*
@@ -637,13 +797,13 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
                 /*
                  * Check that our vnode hasn't been recycled. If this succeeds,
                  * it acquires a reference on the vnode, which is the one we
-                 * return to our caller. We do this with gHashMutex unlocked
+                 * return to our caller. We do this with the chain lock unlocked
                  * to avoid any deadlock concerns.
                  */
                 
                 vid = vnode_vid(candidateVN);
                 
-                lck_mtx_unlock(gHashMutex);
+                lck_mtx_unlock(lock);
                 
                 err = vnode_getwithvid(candidateVN, vid);
 
@@ -656,7 +816,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
                 } else {
                     /* We're going to loop and retry, so relock the mutex. */
                     
-                    lck_mtx_lock(gHashMutex);
+                    lck_mtx_lock(lock);
 
                     err = EAGAIN;
                 }
@@ -674,7 +834,7 @@ HNodeLookupCreatingIfNecessary(fuse_device_t dev,
     /* Clean up. */
     
     if (needsUnlock) {
-        lck_mtx_unlock(gHashMutex);
+        lck_mtx_unlock(lock);
     }
 
     /* Free newForkBuffer if we allocated it but didn't use it. */
@@ -705,7 +865,7 @@ HNodeAttachComplete(HNodeRef hnode)
     assert(hnode != NULL);
     assert(hnode->magic == gMagic);
     
-    LCK_MTX_ASSERT(gHashMutex, LCK_MTX_ASSERT_OWNED);
+    LCK_MTX_ASSERT(HNodeGetLock(hnode->dev, hnode->ino), LCK_MTX_ASSERT_OWNED);
 
     assert(hnode->attachOutstanding);
     hnode->attachOutstanding = FALSE;
@@ -729,7 +889,7 @@ HNodeForkVNodeDecrement(HNodeRef hnode)
     assert(hnode != NULL);
     assert(hnode->magic == gMagic);
 
-    LCK_MTX_ASSERT(gHashMutex, LCK_MTX_ASSERT_OWNED);
+    LCK_MTX_ASSERT(HNodeGetLock(hnode->dev, hnode->ino), LCK_MTX_ASSERT_OWNED);
 
     scrubIt = FALSE;
 
@@ -741,7 +901,7 @@ HNodeForkVNodeDecrement(HNodeRef hnode)
         /* We test for this case before decrementing it because it's unsigned */
         assert(gHashNodeCount > 0);
 
-        gHashNodeCount -= 1;
+        OSAddAtomic(-1, &gHashNodeCount);
 
         scrubIt = TRUE;
     }
@@ -752,19 +912,21 @@ HNodeForkVNodeDecrement(HNodeRef hnode)
 extern void
 HNodeAttachVNodeSucceeded(HNodeRef hnode, size_t forkIndex, vnode_t vn)
 {
-    errno_t junk;
+    errno_t    junk;
+    lck_mtx_t *lock;
     
-    lck_mtx_lock(gHashMutex);
-
     assert(hnode != NULL);
     assert(hnode->magic == gMagic);
+
+    lock = HNodeLockNode(hnode);
+
     assert(forkIndex < hnode->forkVNodesSize);
     assert(vn != NULL);
     assert(vnode_fsnode(vn) == hnode);
     
     /*
      * If someone is waiting for the HNode, wake them up. They won't actually 
-     * start running until we drop gHashMutex.
+     * start running until we drop the chain lock.
      */
     
     HNodeAttachComplete(hnode);
@@ -776,23 +938,25 @@ HNodeAttachVNodeSucceeded(HNodeRef hnode, size_t forkIndex, vnode_t vn)
     junk = vnode_addfsref(vn);
     assert(junk == 0);
     
-    lck_mtx_unlock(gHashMutex);
+    lck_mtx_unlock(lock);
 }
 
 extern boolean_t
 HNodeAttachVNodeFailed(HNodeRef hnode, __unused size_t forkIndex)
 {
     boolean_t   scrubIt;
+    lck_mtx_t  *lock;
     
-    lck_mtx_lock(gHashMutex);
-
     assert(hnode != NULL);
     assert(hnode->magic == gMagic);
+
+    lock = HNodeLockNode(hnode);
+
     assert(forkIndex < hnode->forkVNodesSize);
     
     /*
      * If someone is waiting for the HNode, wake them up. They won't actually 
-     * start running until we drop gHashMutex.
+     * start running until we drop the chain lock.
      */
     
     HNodeAttachComplete(hnode);
@@ -804,7 +968,7 @@ HNodeAttachVNodeFailed(HNodeRef hnode, __unused size_t forkIndex)
 
     scrubIt = HNodeForkVNodeDecrement(hnode);
 
-    lck_mtx_unlock(gHashMutex);
+    lck_mtx_unlock(lock);
 
     return scrubIt;
 }
@@ -815,13 +979,14 @@ HNodeDetachVNode(HNodeRef hnode, vnode_t vn)
     errno_t   junk;
     size_t    forkIndex;
     boolean_t scrubIt;
+    lck_mtx_t *lock;
     
-    lck_mtx_lock(gHashMutex);
-
     assert(hnode != NULL);
     assert(hnode->magic == gMagic);
     assert(vn != NULL);
 
+    lock = HNodeLockNode(hnode);
+
     /* Find the fork index for vn. */
     
     for (forkIndex = 0; forkIndex < hnode->forkVNodesSize; forkIndex++) {
@@ -847,7 +1012,7 @@ HNodeDetachVNode(HNodeRef hnode, vnode_t vn)
 
     scrubIt = HNodeForkVNodeDecrement(hnode);
 
-    lck_mtx_unlock(gHashMutex);
+    lck_mtx_unlock(lock);
 
     return scrubIt;
 }
@@ -905,9 +1070,9 @@ HNodePrintState(void)
         
         if (err == 0) {
 
-            lck_mtx_lock(gHashMutex);
+            HNodeLockAll();
             
-            if (gHashNodeCount > nodeCount) {
+            if ((size_t)gHashNodeCount > nodeCount) {
                 /* Whoops, it changed size, let's try again. */
                 FUSE_OSFree(nodes, sizeof(*nodes) * nodeCount, gOSMallocTag);
                 err = EAGAIN;
@@ -915,7 +1080,7 @@ HNodePrintState(void)
 
                 nodeIndex = 0;
 
-                for (hashBucketIndex = 0; hashBucketIndex < gHashTableMask;
+                for (hashBucketIndex = 0; hashBucketIndex <= gHashTableMask;
                      hashBucketIndex++) {
 
                     HNode *thisNode;
@@ -930,7 +1095,7 @@ HNodePrintState(void)
                 assert(nodeIndex == nodeCount);
             }
             
-            lck_mtx_unlock(gHashMutex);
+            HNodeUnlockAll();
         }
     } while (err == EAGAIN);
 
@@ -985,19 +1150,21 @@ HNodeLookupRealQuickIfExists(fuse_device_t dev,
     boolean_t needsUnlock;
     vnode_t   resultVN;
     uint32_t  vid;
+    lck_mtx_t *lock;
     
     assert(hnodePtr != NULL);
     assert(*hnodePtr == NULL);
     assert(vnPtr != NULL);
     assert(*vnPtr == NULL);
-    assert(gHashMutex != NULL);
+    assert(gHashTable != NULL);
 
     needsUnlock = TRUE;
     resultVN = NULL;
     
-    lck_mtx_lock(gHashMutex);
+    lock = HNodeGetLock(dev, ino);
+    lck_mtx_lock(lock);
     
-    LCK_MTX_ASSERT(gHashMutex, LCK_MTX_ASSERT_OWNED);
+    LCK_MTX_ASSERT(lock, LCK_MTX_ASSERT_OWNED);
 
     thisNode = LIST_FIRST(HNodeGetFirstFromHashTable(dev, ino));
 
@@ -1022,7 +1189,7 @@ HNodeLookupRealQuickIfExists(fuse_device_t dev,
             vnode_t candidateVN = thisNode->forkVNodes[forkIndex];
             assert(candidateVN != NULL);
             vid = vnode_vid(candidateVN);
-            lck_mtx_unlock(gHashMutex);
+            lck_mtx_unlock(lock);
             err = vnode_getwithvid(candidateVN, vid);
             needsUnlock = FALSE;
             if (err == 0) {
@@ -1041,7 +1208,7 @@ HNodeLookupRealQuickIfExists(fuse_device_t dev,
     }
     
     if (needsUnlock) {
-        lck_mtx_unlock(gHashMutex);
+        lck_mtx_unlock(lock);
     }
 
     assert((err == 0) == (*hnodePtr != NULL));
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#include "fuse_pool.h"
+
+static __inline__
+int
+fuse_iov_pool_class(size_t size)
+{
+    int c;
+
+    if (size <= ((size_t)1 << FUSE_IOV_POOL_MINSHIFT)) {
+        return -1;
+    }
+
+    for (c = 0; c < FUSE_IOV_POOL_NCLASSES; c++) {
+        if (size <= FUSE_IOV_POOL_CLASSSIZE(c)) {
+            return c;
+        }
+    }
+
+    return -1;
+}
+
+static __inline__
+void
+fuse_iov_pool_stat(const struct fuse_iov_pool_ops *ops, int c, int event)
+{
+    if (ops->po_stat) {
+        ops->po_stat(c, event);
+    }
+}
+
+void
+fuse_iov_pool_init(struct fuse_iov_pool *pool, void *mtx)
+{
+    int c;
+
+    pool->mtx = mtx;
+    for (c = 0; c < FUSE_IOV_POOL_NCLASSES; c++) {
+        pool->freelist[c] = NULL;
+        pool->nfree[c] = 0;
+    }
+    pool->cached_bytes = 0;
+}
+
+size_t
+fuse_iov_pool_roundup(struct fuse_iov_pool *pool, size_t size)
+{
+    int c = pool ? fuse_iov_pool_class(size) : -1;
+
+    return (c >= 0) ? FUSE_IOV_POOL_CLASSSIZE(c) : size;
+}
+
+void
+fuse_iov_pool_shrink(const struct fuse_iov_pool_ops *ops,
+                     struct fuse_iov_pool *pool, size_t target)
+{
+    int c;
+    void *buf;
+
+    for (c = FUSE_IOV_POOL_NCLASSES - 1; c >= 0; c--) {
+        for (;;) {
+            ops->po_lock(pool->mtx);
+            if (pool->cached_bytes <= target ||
+                !(buf = pool->freelist[c])) {
+                ops->po_unlock(pool->mtx);
+                break;
+            }
+            pool->freelist[c] = *(void **)buf;
+            pool->nfree[c]--;
+            pool->cached_bytes -= FUSE_IOV_POOL_CLASSSIZE(c);
+            ops->po_unlock(pool->mtx);
+
+            ops->po_free(buf, FUSE_IOV_POOL_CLASSSIZE(c));
+            fuse_iov_pool_stat(ops, c, FUSE_IOV_POOL_UNCACHE);
+        }
+    }
+}
+
+void *
+fuse_iov_pool_get(const struct fuse_iov_pool_ops *ops,
+                  struct fuse_iov_pool *pool, size_t size, size_t *asize)
+{
+    void *buf = NULL;
+    int c = pool ? fuse_iov_pool_class(size) : -1;
+
+    if (c >= 0) {
+        size = FUSE_IOV_POOL_CLASSSIZE(c);
+
+        ops->po_lock(pool->mtx);
+        if ((buf = pool->freelist[c])) {
+            pool->freelist[c] = *(void **)buf;
+            pool->nfree[c]--;
+            pool->cached_bytes -= size;
+        }
+        ops->po_unlock(pool->mtx);
+
+        if (buf) {
+            fuse_iov_pool_stat(ops, c, FUSE_IOV_POOL_HIT);
+            *asize = size;
+            return buf;
+        }
+    }
+
+    buf = ops->po_alloc(size);
+    if (buf && c >= 0) {
+        fuse_iov_pool_stat(ops, c, FUSE_IOV_POOL_MISS);
+    }
+
+    *asize = size;
+
+    return buf;
+}
+
+void
+fuse_iov_pool_put(const struct fuse_iov_pool_ops *ops,
+                  struct fuse_iov_pool *pool, void *buf, size_t asize,
+                  size_t maxbytes)
+{
+    int c = pool ? fuse_iov_pool_class(asize) : -1;
+
+    if (c >= 0 && asize == FUSE_IOV_POOL_CLASSSIZE(c)) {
+        int cached = 0;
+
+        ops->po_lock(pool->mtx);
+        if (pool->cached_bytes + asize <= maxbytes) {
+            *(void **)buf = pool->freelist[c];
+            pool->freelist[c] = buf;
+            pool->nfree[c]++;
+            pool->cached_bytes += asize;
+            cached = 1;
+        }
+        ops->po_unlock(pool->mtx);
+
+        if (cached) {
+            fuse_iov_pool_stat(ops, c, FUSE_IOV_POOL_CACHE);
+            return;
+        }
+
+        /* The limit may have been lowered since these were cached. */
+        fuse_iov_pool_shrink(ops, pool, maxbytes);
+    }
+
+    ops->po_free(buf, asize);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#ifndef _FUSE_POOL_H_
+#define _FUSE_POOL_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fuse_param.h>
+
+/*
+ * The per-mount pool that ticket buffers bigger than a page are borrowed
+ * from. Sizes are rounded up to a class (see FUSE_IOV_POOL_CLASSSIZE()),
+ * and a buffer put back is kept on its class's free list while the pool
+ * holds no more than maxbytes; free buffers are linked through their first
+ * word. A NULL pool, or a size outside the classes, goes straight to the
+ * allocator.
+ *
+ * Locking and allocation are done through the ops below, so that this code
+ * has no kernel dependencies and can be measured in user space.
+ */
+
+struct fuse_iov_pool_ops {
+    void   (*po_lock)(void *mtx);
+    void   (*po_unlock)(void *mtx);
+
+    /* Returns NULL if the allocation failed. */
+    void  *(*po_alloc)(size_t size);
+    void   (*po_free)(void *buf, size_t size);
+
+    /* Counts an event (below) for size class c; may be NULL. */
+    void   (*po_stat)(int c, int event);
+};
+
+enum {
+    FUSE_IOV_POOL_HIT,     /* a get was served from the pool */
+    FUSE_IOV_POOL_MISS,    /* a get of a class size had to allocate */
+    FUSE_IOV_POOL_CACHE,   /* a put kept the buffer */
+    FUSE_IOV_POOL_UNCACHE  /* a shrink freed a kept buffer */
+};
+
+struct fuse_iov_pool {
+    void      *mtx;  /* set up by the caller */
+    void      *freelist[FUSE_IOV_POOL_NCLASSES];
+    uint32_t   nfree[FUSE_IOV_POOL_NCLASSES];
+    size_t     cached_bytes;
+};
+
+void   fuse_iov_pool_init(struct fuse_iov_pool *pool, void *mtx);
+
+/* The size a get of size bytes would allocate. */
+size_t fuse_iov_pool_roundup(struct fuse_iov_pool *pool, size_t size);
+
+/*
+ * Get a buffer of at least size bytes. Returns NULL if the allocation
+ * failed; *asize is set to the size actually allocated.
+ */
+void  *fuse_iov_pool_get(const struct fuse_iov_pool_ops *ops,
+                         struct fuse_iov_pool *pool, size_t size,
+                         size_t *asize);
+
+/* Gives back a buffer of asize bytes, as returned by a get. */
+void   fuse_iov_pool_put(const struct fuse_iov_pool_ops *ops,
+                         struct fuse_iov_pool *pool, void *buf, size_t asize,
+                         size_t maxbytes);
+
+/*
+ * Free kept buffers, biggest first, until no more than target bytes remain
+ * in the pool. Shrinking to 0 empties it for teardown.
+ */
+void   fuse_iov_pool_shrink(const struct fuse_iov_pool_ops *ops,
+                            struct fuse_iov_pool *pool, size_t target);
+
+#endif /* _FUSE_POOL_H_ */
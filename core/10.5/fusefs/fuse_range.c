@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#include "fuse_range.h"
+
+static void
+fuse_rangeset_delete(struct fuse_rangeset *rs, uint32_t i)
+{
+    for (; i + 1 < rs->count; i++) {
+        rs->ranges[i] = rs->ranges[i + 1];
+    }
+    rs->count--;
+}
+
+void
+fuse_rangeset_init(struct fuse_rangeset *rs)
+{
+    rs->count = 0;
+    rs->bytes = 0;
+}
+
+void
+fuse_rangeset_add(struct fuse_rangeset *rs, off_t start, off_t end)
+{
+    uint32_t i, j, best;
+    off_t    gap, bestgap, lgap, rgap;
+
+    if (start >= end) {
+        return;
+    }
+
+    /* Find the first range that ends at or after start. */
+    for (i = 0; i < rs->count && rs->ranges[i].end < start; i++) {
+        continue;
+    }
+
+    /* Absorb every range that overlaps or touches [start, end). */
+    for (j = i; j < rs->count && rs->ranges[j].start <= end; j++) {
+        if (rs->ranges[j].start < start) {
+            start = rs->ranges[j].start;
+        }
+        if (rs->ranges[j].end > end) {
+            end = rs->ranges[j].end;
+        }
+        rs->bytes -= rs->ranges[j].end - rs->ranges[j].start;
+    }
+
+    if (j > i) {
+        /* Ranges i through j - 1 collapse into slot i. */
+        rs->ranges[i].start = start;
+        rs->ranges[i].end = end;
+        rs->bytes += end - start;
+        while (j > i + 1) {
+            fuse_rangeset_delete(rs, i + 1);
+            j--;
+        }
+        return;
+    }
+
+    if (rs->count == FUSE_RANGESET_SIZE) {
+
+        /*
+         * No slot left. Of the new range's gaps to its neighbours and the
+         * gaps between existing neighbours, close the smallest one.
+         */
+        best = 0;
+        bestgap = -1;
+
+        for (j = 0; j + 1 < rs->count; j++) {
+            gap = rs->ranges[j + 1].start - rs->ranges[j].end;
+            if (bestgap < 0 || gap < bestgap) {
+                best = j;
+                bestgap = gap;
+            }
+        }
+
+        lgap = (i > 0) ? start - rs->ranges[i - 1].end : -1;
+        rgap = (i < rs->count) ? rs->ranges[i].start - end : -1;
+
+        if (lgap >= 0 && (rgap < 0 || lgap <= rgap) &&
+            (bestgap < 0 || lgap < bestgap)) {
+            /* Touches range i - 1 now, so this call takes the merge path. */
+            fuse_rangeset_add(rs, rs->ranges[i - 1].end, end);
+            return;
+        }
+
+        if (rgap >= 0 && (bestgap < 0 || rgap < bestgap)) {
+            fuse_rangeset_add(rs, start, rs->ranges[i].start);
+            return;
+        }
+
+        rs->bytes += bestgap;
+        rs->ranges[best].end = rs->ranges[best + 1].end;
+        fuse_rangeset_delete(rs, best + 1);
+
+        if (best < i) {
+            i--;
+        }
+    }
+
+    for (j = rs->count; j > i; j--) {
+        rs->ranges[j] = rs->ranges[j - 1];
+    }
+
+    rs->ranges[i].start = start;
+    rs->ranges[i].end = end;
+    rs->bytes += end - start;
+    rs->count++;
+}
+
+void
+fuse_rangeset_remove(struct fuse_rangeset *rs, off_t start, off_t end)
+{
+    uint32_t i = 0;
+    uint32_t j;
+    struct fuse_range *r;
+
+    if (start >= end) {
+        return;
+    }
+
+    while (i < rs->count) {
+
+        r = &rs->ranges[i];
+
+        if (r->end <= start) {
+            i++;
+            continue;
+        }
+
+        if (r->start >= end) {
+            break;
+        }
+
+        if (r->start >= start && r->end <= end) {
+            /* Entirely covered. */
+            rs->bytes -= r->end - r->start;
+            fuse_rangeset_delete(rs, i);
+            continue;
+        }
+
+        if (r->start < start && r->end > end) {
+            /*
+             * A hole in the middle. If there is no slot for the second half,
+             * the range is left alone: the set may overstate, never miss.
+             */
+            if (rs->count == FUSE_RANGESET_SIZE) {
+                break;
+            }
+            for (j = rs->count; j > i + 1; j--) {
+                rs->ranges[j] = rs->ranges[j - 1];
+            }
+            rs->ranges[i + 1].start = end;
+            rs->ranges[i + 1].end = r->end;
+            r->end = start;
+            rs->count++;
+            rs->bytes -= end - start;
+            break;
+        }
+
+        if (r->start < start) {
+            /* Tail covered. */
+            rs->bytes -= r->end - start;
+            r->end = start;
+            i++;
+        } else {
+            /* Head covered. */
+            rs->bytes -= end - r->start;
+            r->start = end;
+            break;
+        }
+    }
+}
+
+/*
+ * Takes the lowest range out of the set, or, if maxlen is positive and the
+ * range is longer than that, its first maxlen bytes. Returns 0 if the set
+ * is empty.
+ */
+int
+fuse_rangeset_pop(struct fuse_rangeset *rs, off_t maxlen,
+                  off_t *startp, off_t *endp)
+{
+    struct fuse_range *r = &rs->ranges[0];
+
+    if (rs->count == 0) {
+        return 0;
+    }
+
+    *startp = r->start;
+
+    if (maxlen > 0 && r->end - r->start > maxlen) {
+        *endp = r->start + maxlen;
+        r->start += maxlen;
+        rs->bytes -= maxlen;
+    } else {
+        *endp = r->end;
+        rs->bytes -= r->end - r->start;
+        fuse_rangeset_delete(rs, 0);
+    }
+
+    return 1;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#ifndef _FUSE_RANGE_H_
+#define _FUSE_RANGE_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * A small, sorted set of disjoint byte ranges, used to remember which parts
+ * of a file have been written but not yet sent to the daemon. The set has a
+ * fixed number of slots and never allocates; when it runs out of slots, the
+ * two ranges with the smallest gap between them are merged, so the set may
+ * grow to cover bytes that were not actually added. Callers must therefore
+ * treat it as an upper bound on what is dirty.
+ *
+ * Nothing here depends on the kernel, so the same code can be exercised and
+ * measured in user space. Locking is up to the caller.
+ */
+
+#define FUSE_RANGESET_SIZE 8
+
+struct fuse_range {
+    off_t start;
+    off_t end;                  /* exclusive */
+};
+
+struct fuse_rangeset {
+    uint32_t          count;
+    off_t             bytes;    /* sum of the lengths of the ranges */
+    struct fuse_range ranges[FUSE_RANGESET_SIZE];
+};
+
+void fuse_rangeset_init(struct fuse_rangeset *rs);
+void fuse_rangeset_add(struct fuse_rangeset *rs, off_t start, off_t end);
+void fuse_rangeset_remove(struct fuse_rangeset *rs, off_t start, off_t end);
+int  fuse_rangeset_pop(struct fuse_rangeset *rs, off_t maxlen,
+                       off_t *startp, off_t *endp);
+
+#endif /* _FUSE_RANGE_H_ */
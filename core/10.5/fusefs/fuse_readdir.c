@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#include <sys/errno.h>
+#include <sys/stat.h>
+#include <stddef.h>
+
+#include "fuse_kernel.h"
+#include "fuse_readdir.h"
+
+static __inline__
+int
+fuse_readdir_counted(const struct fuse_direntplus *fudgeplus)
+{
+    const char *name = fudgeplus->dirent.name;
+    uint32_t namelen = fudgeplus->dirent.namelen;
+
+    if (fudgeplus->entry_out.nodeid == 0 ||
+        fudgeplus->entry_out.nodeid == FUSE_ROOT_ID) {
+        return 0;
+    }
+
+    if ((namelen == 1 && name[0] == '.') ||
+        (namelen == 2 && name[0] == '.' && name[1] == '.')) {
+        return 0;
+    }
+
+    return 1;
+}
+
+int
+fuse_readdir_take(const struct fuse_readdir_ops *ops, void *arg,
+                  const void *buf, size_t bufsize, int plus, int *nump)
+{
+    int err  = 0;
+    int cou  = 0;
+    int n    = 0;
+    int stop = 0; /* what ended the copying out: -1 or an errno */
+    size_t freclen;
+    size_t nameoff;
+
+    const struct fuse_dirent     *fudge;
+    const struct fuse_direntplus *fudgeplus;
+
+    nameoff = (plus) ? FUSE_NAME_OFFSET_DIRENTPLUS : FUSE_NAME_OFFSET;
+
+    if (bufsize < nameoff) {
+        return -1;
+    }
+
+    for (;;) {
+
+        if (bufsize < nameoff) {
+            err = -1;
+            break;
+        }
+
+        if (plus) {
+            fudgeplus = (const struct fuse_direntplus *)buf;
+            fudge = &fudgeplus->dirent;
+            freclen = FUSE_DIRENTPLUS_SIZE(fudgeplus);
+        } else {
+            fudgeplus = NULL;
+            fudge = (const struct fuse_dirent *)buf;
+            freclen = FUSE_DIRENT_SIZE(fudge);
+        }
+
+        cou++;
+
+        if (bufsize < freclen) {
+            err = ((cou == 1) ? -1 : 0);
+            break;
+        }
+
+        if (!fudge->namelen) {
+            err = EINVAL;
+            break;
+        }
+
+        if (fudge->namelen > FUSE_MAXNAMLEN) {
+            err = EIO;
+            break;
+        }
+
+        if (!stop) {
+            stop = ops->ro_emit(arg, fudge);
+            if (!stop) {
+                n++;
+            } else if (!plus) {
+                err = stop;
+                break;
+            }
+        }
+
+        /*
+         * Past the first entry that didn't go out, the rest of the answer is
+         * only walked to give back the lookups it carries.
+         */
+        if (fudgeplus && fuse_readdir_counted(fudgeplus)) {
+            if (stop ||
+                (fudgeplus->entry_out.attr.mode & S_IFMT) == 0 ||
+                ops->ro_cache(arg, &fudgeplus->entry_out, fudge->name,
+                              fudge->namelen)) {
+                ops->ro_forget(arg, fudgeplus->entry_out.nodeid);
+            }
+        }
+
+        buf = (const char *)buf + freclen;
+        bufsize -= freclen;
+    }
+
+    if (stop && err <= 0) {
+        err = stop;
+    }
+
+    if (!err && nump) {
+        *nump = n;
+    }
+
+    return err;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#ifndef _FUSE_READDIR_H_
+#define _FUSE_READDIR_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <fuse_param.h>
+
+struct fuse_dirent;
+struct fuse_entry_out;
+
+/*
+ * The walk behind fuse_internal_readdir_processdata(): takes in bufsize bytes
+ * of a FUSE_READDIR (or, with plus, FUSE_READDIRPLUS) answer, handing entries
+ * to the caller until one doesn't fit in its buffer.
+ *
+ * With plus, every entry that carries a nodeid has been looked up by the
+ * daemon, and each such lookup is accounted for exactly once: the node is
+ * cached if its entry went out, and forgotten otherwise -- if it didn't fit,
+ * if a copy out failed, if it has no file type, or if the cache refused it.
+ * An entry left out is sent again by the next call, which starts where this
+ * one stopped. As with lookups, "." and ".." and the root are not counted.
+ *
+ * The caller's side is reached through the ops below, so that this code has
+ * no kernel dependencies and can be run against a daemon in user space.
+ */
+
+struct fuse_readdir_ops {
+
+    /*
+     * Copies one entry out and moves the caller's offset to fudge->off.
+     * Returns 0, -1 if the entry doesn't fit in what is left, or an errno.
+     */
+    int  (*ro_emit)(void *arg, const struct fuse_dirent *fudge);
+
+    /* Caches the node an entry that went out names; returns an errno. */
+    int  (*ro_cache)(void *arg, const struct fuse_entry_out *feo,
+                     const char *name, size_t namelen);
+
+    /* Tells the daemon to drop one lookup of nodeid. */
+    void (*ro_forget)(void *arg, uint64_t nodeid);
+};
+
+/*
+ * Returns -1 once the caller's buffer is full or the answer is used up, 0 if
+ * the answer ended in a partial entry, or an errno. On 0, *nump (if not NULL)
+ * is set to the number of entries that went out.
+ */
+int fuse_readdir_take(const struct fuse_readdir_ops *ops, void *arg,
+                      const void *buf, size_t bufsize, int plus, int *nump);
+
+#endif /* _FUSE_READDIR_H_ */
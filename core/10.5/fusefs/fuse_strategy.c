@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#include <sys/errno.h>
+
+#include "fuse_strategy.h"
+
+struct fuse_strategy_chunk {
+    void   *req;
+    size_t  start; /* relative to the beginning of the transfer */
+    size_t  size;
+};
+
+static int
+fuse_strategy_slot_get(const struct fuse_strategy_ops *ops, void *arg,
+                       uint32_t limit, uint32_t outstanding)
+{
+    if (outstanding >= limit && outstanding > 0) {
+        return 0;
+    }
+
+    if ((uint32_t)ops->so_inflight_add(arg, 1) < limit || outstanding == 0) {
+        return 1;
+    }
+
+    (void)ops->so_inflight_add(arg, -1);
+
+    return 0;
+}
+
+int
+fuse_strategy_transfer(const struct fuse_strategy_ops *ops, void *arg,
+                       int iswrite, size_t count, size_t iosize,
+                       uint32_t limit, size_t *donep, int *eofp)
+{
+    struct fuse_strategy_chunk  window[FUSE_MAX_STRATEGY_INFLIGHT];
+    struct fuse_strategy_chunk *chunk;
+
+    uint32_t head = 0;
+    uint32_t outstanding = 0;
+    size_t   issued = 0; /* bytes sent                   */
+    size_t   done = 0;   /* bytes answered, in buf order */
+    size_t   got;
+    int      draining = 0;
+    int      eof = 0;
+    int      err = 0;
+
+    if (limit > FUSE_MAX_STRATEGY_INFLIGHT) {
+        limit = FUSE_MAX_STRATEGY_INFLIGHT;
+    }
+
+    for (;;) {
+
+        while (!draining && issued < count &&
+               fuse_strategy_slot_get(ops, arg, limit, outstanding)) {
+
+            chunk = &window[(head + outstanding) % FUSE_MAX_STRATEGY_INFLIGHT];
+            chunk->start = issued;
+            chunk->size = count - issued;
+            if (chunk->size > iosize) {
+                chunk->size = iosize;
+            }
+            chunk->req = ops->so_send(arg, chunk->start, chunk->size);
+
+            issued += chunk->size;
+            outstanding++;
+        }
+
+        if (outstanding == 0) {
+            if (draining && !err && !eof && done < count) {
+                /* Pick up after the short answer. */
+                issued = done;
+                draining = 0;
+                continue;
+            }
+            break;
+        }
+
+        chunk = &window[head];
+        head = (head + 1) % FUSE_MAX_STRATEGY_INFLIGHT;
+        outstanding--;
+
+        if (draining) {
+            ops->so_discard(arg, chunk->req);
+            (void)ops->so_inflight_add(arg, -1);
+            continue;
+        }
+
+        err = ops->so_wait(arg, chunk->req, &got);
+        (void)ops->so_inflight_add(arg, -1);
+
+        if (!err) {
+            if (iswrite) {
+                if (got > chunk->size) {
+                    err = EINVAL;
+                } else if (got == 0) {
+                    err = EIO;
+                }
+            } else if (got > chunk->size) {
+                err = EIO;
+            } else if (got == 0) {
+                eof = 1;
+            }
+        }
+
+        if (err) {
+            draining = 1;
+            continue;
+        }
+
+        done += got;
+
+        if (got < chunk->size) {
+            draining = 1;
+        }
+    }
+
+    *donep = done;
+    *eofp = eof;
+
+    return err;
+}
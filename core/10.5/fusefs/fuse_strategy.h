@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#ifndef _FUSE_STRATEGY_H_
+#define _FUSE_STRATEGY_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <fuse_param.h>
+
+/*
+ * The chunking behind fuse_internal_strategy_io(). A transfer of count bytes
+ * is cut into chunks of at most iosize bytes, of which up to limit (itself
+ * at most FUSE_MAX_STRATEGY_INFLIGHT) are outstanding at once. Answers are
+ * taken in the order the chunks went out.
+ *
+ * A short answer ends the window at that point: the chunks still in flight
+ * are waited for and their answers thrown away, and the transfer picks up
+ * right after the data that did arrive. A read answered with no data is end
+ * of file. An answer larger than its chunk fails, as does a write answered
+ * with nothing.
+ *
+ * The mount-wide count of chunks in flight is kept by the caller and bounded
+ * by limit too, except that every transfer may have one chunk out, so that
+ * transfers never wait on each other.
+ *
+ * Requests are made through the ops below, so that this code has no kernel
+ * dependencies and can be run against a simulated daemon in user space.
+ */
+
+struct fuse_strategy_ops {
+
+    /* Sends [start, start + size) of the transfer; returns the request. */
+    void   *(*so_send)(void *arg, size_t start, size_t size);
+
+    /*
+     * Waits for the answer to a request and disposes of the request. Returns
+     * an errno, or 0 with the number of bytes transferred in *gotp.
+     */
+    int     (*so_wait)(void *arg, void *req, size_t *gotp);
+
+    /* Waits for a request whose answer is not wanted and disposes of it. */
+    void    (*so_discard)(void *arg, void *req);
+
+    /* Adds delta to the mount's chunks in flight; returns the old count. */
+    int32_t (*so_inflight_add)(void *arg, int32_t delta);
+};
+
+/*
+ * Returns an errno, or 0. Either way, *donep is set to the length of the
+ * prefix that was transferred, and *eofp to whether a read hit end of file.
+ */
+int fuse_strategy_transfer(const struct fuse_strategy_ops *ops, void *arg,
+                           int iswrite, size_t count, size_t iosize,
+                           uint32_t limit, size_t *donep, int *eofp);
+
+#endif /* _FUSE_STRATEGY_H_ */
@@ -26,6 +26,7 @@ uint32_t fuse_fh_zombies             = 0;                                  // r
 int32_t  fuse_iov_credit             = FUSE_DEFAULT_IOV_CREDIT;            // rw
 int32_t  fuse_iov_current            = 0;                                  // r
 uint32_t fuse_iov_permanent_bufsize  = FUSE_DEFAULT_IOV_PERMANENT_BUFSIZE; // rw
+uint32_t fuse_iov_pool_maxbytes      = FUSE_DEFAULT_IOV_POOL_MAXBYTES;     // rw
 int32_t  fuse_kill                   = -1;                                 // w
 int32_t  fuse_print_vnodes           = -1;                                 // w
 uint32_t fuse_lookup_cache_hits      = 0;                                  // r
@@ -36,9 +37,17 @@ uint32_t fuse_max_tickets            = 0;                                  // rw
 int32_t  fuse_mount_count            = 0;                                  // r
 int32_t  fuse_memory_allocated       = 0;                                  // r
 int32_t  fuse_realloc_count          = 0;                                  // r
+uint32_t fuse_strategy_inflight      = FUSE_DEFAULT_STRATEGY_INFLIGHT;     // rw
 int32_t  fuse_tickets_current        = 0;                                  // r
 uint32_t fuse_userkernel_bufsize     = FUSE_DEFAULT_USERKERNEL_BUFSIZE;    // rw
 int32_t  fuse_vnodes_current         = 0;                                  // r
+uint32_t fuse_writeback_maxdirty     = FUSE_DEFAULT_WRITEBACK_MAXDIRTY;    // rw
+
+/* Per size class; see FUSE_IOV_POOL_CLASSSIZE(). */
+
+int32_t  fuse_iov_pool_allocs[FUSE_IOV_POOL_NCLASSES];                     // r
+int32_t  fuse_iov_pool_cached[FUSE_IOV_POOL_NCLASSES];                     // r
+int32_t  fuse_iov_pool_hits[FUSE_IOV_POOL_NCLASSES];                       // r
 
 SYSCTL_DECL(_macfuse);
 SYSCTL_NODE(, OID_AUTO, macfuse, CTLFLAG_RW, 0,
@@ -59,6 +68,7 @@ SYSCTL_NODE(_macfuse, OID_AUTO, version, CTLFLAG_RW, 0,
 int sysctl_macfuse_control_kill_handler SYSCTL_HANDLER_ARGS;
 int sysctl_macfuse_control_print_vnodes_handler SYSCTL_HANDLER_ARGS;
 int sysctl_macfuse_tunables_userkernel_bufsize_handler SYSCTL_HANDLER_ARGS;
+int sysctl_macfuse_resourceusage_ipc_iov_pool_handler SYSCTL_HANDLER_ARGS;
 
 int
 sysctl_macfuse_control_kill_handler SYSCTL_HANDLER_ARGS
@@ -154,6 +164,39 @@ sysctl_macfuse_tunables_userkernel_bufsize_handler SYSCTL_HANDLER_ARGS
     return error;
 }
 
+int
+sysctl_macfuse_resourceusage_ipc_iov_pool_handler SYSCTL_HANDLER_ARGS
+{
+    int c;
+    int error = 0;
+    size_t len;
+    char buf[96]; /* one line at a time; kernel stacks are small */
+    (void)oidp;
+    (void)arg1;
+    (void)arg2;
+
+    if (req->newptr) {
+        return EPERM;
+    }
+
+    for (c = 0; c < FUSE_IOV_POOL_NCLASSES && !error; c++) {
+        len = snprintf(buf, sizeof(buf), "\n%lu: allocs=%d hits=%d cached=%d",
+                       (unsigned long)FUSE_IOV_POOL_CLASSSIZE(c),
+                       fuse_iov_pool_allocs[c], fuse_iov_pool_hits[c],
+                       fuse_iov_pool_cached[c]);
+        if (len >= sizeof(buf)) {
+            len = sizeof(buf) - 1;
+        }
+        error = SYSCTL_OUT(req, buf, len);
+    }
+
+    if (!error) {
+        error = SYSCTL_OUT(req, "", 1);
+    }
+
+    return error;
+}
+
 SYSCTL_PROC(_macfuse_control, // our parent
             OID_AUTO,         // automatically assign object ID
             kill,             // our name
@@ -207,6 +250,15 @@ SYSCTL_INT(_macfuse_resourceusage, OID_AUTO, filehandles_zombies, CTLFLAG_RD,
            &fuse_fh_zombies, 0, "");
 SYSCTL_INT(_macfuse_resourceusage, OID_AUTO, ipc_iovs, CTLFLAG_RD,
            &fuse_iov_current, 0, "");
+SYSCTL_PROC(_macfuse_resourceusage,     // our parent
+            OID_AUTO,                   // automatically assign object ID
+            ipc_iov_pool,               // our name
+            (CTLTYPE_STRING | CTLFLAG_RD), // type flag/access flag
+            0,                          // location of our data
+            0,                          // argument passed to our handler
+            sysctl_macfuse_resourceusage_ipc_iov_pool_handler,
+            "A",                        // our data type (string)
+            "MacFUSE Resource Usage: IPC Buffer Pool by Size Class");
 SYSCTL_INT(_macfuse_resourceusage, OID_AUTO, ipc_tickets, CTLFLAG_RD,
            &fuse_tickets_current, 0, "");
 SYSCTL_INT(_macfuse_resourceusage, OID_AUTO, memory_bytes, CTLFLAG_RD,
@@ -225,10 +277,14 @@ SYSCTL_INT(_macfuse_tunables, OID_AUTO, iov_credit, CTLFLAG_RW,
            &fuse_iov_credit, 0, "");
 SYSCTL_INT(_macfuse_tunables, OID_AUTO, iov_permanent_bufsize, CTLFLAG_RW,
            &fuse_iov_permanent_bufsize, 0, "");
+SYSCTL_INT(_macfuse_tunables, OID_AUTO, iov_pool_maxbytes, CTLFLAG_RW,
+           &fuse_iov_pool_maxbytes, 0, "");
 SYSCTL_INT(_macfuse_tunables, OID_AUTO, max_freetickets, CTLFLAG_RW,
            &fuse_max_freetickets, 0, "");
 SYSCTL_INT(_macfuse_tunables, OID_AUTO, max_tickets, CTLFLAG_RW,
            &fuse_max_tickets, 0, "");
+SYSCTL_INT(_macfuse_tunables, OID_AUTO, strategy_inflight, CTLFLAG_RW,
+           &fuse_strategy_inflight, 0, "");
 SYSCTL_PROC(_macfuse_tunables,          // our parent
             OID_AUTO,                   // automatically assign object ID
             userkernel_bufsize,         // our name
@@ -238,6 +294,8 @@ SYSCTL_PROC(_macfuse_tunables,          // our parent
             sysctl_macfuse_tunables_userkernel_bufsize_handler,    
             "I",                        // our data type (integer)
             "MacFUSE Tunables");        // our description
+SYSCTL_INT(_macfuse_tunables, OID_AUTO, writeback_maxdirty, CTLFLAG_RW,
+           &fuse_writeback_maxdirty, 0, "");
 
 /* fuse.version */
 SYSCTL_INT(_macfuse_version, OID_AUTO, api_major, CTLFLAG_RD,
@@ -267,6 +325,7 @@ static struct sysctl_oid *fuse_sysctl_list[] =
     &sysctl__macfuse_resourceusage_filehandles,
     &sysctl__macfuse_resourceusage_filehandles_zombies,
     &sysctl__macfuse_resourceusage_ipc_iovs,
+    &sysctl__macfuse_resourceusage_ipc_iov_pool,
     &sysctl__macfuse_resourceusage_ipc_tickets,
     &sysctl__macfuse_resourceusage_memory_bytes,
     &sysctl__macfuse_resourceusage_mounts,
@@ -275,9 +334,12 @@ static struct sysctl_oid *fuse_sysctl_list[] =
     &sysctl__macfuse_tunables_allow_other,
     &sysctl__macfuse_tunables_iov_credit,
     &sysctl__macfuse_tunables_iov_permanent_bufsize,
+    &sysctl__macfuse_tunables_iov_pool_maxbytes,
     &sysctl__macfuse_tunables_max_freetickets,
     &sysctl__macfuse_tunables_max_tickets,
+    &sysctl__macfuse_tunables_strategy_inflight,
     &sysctl__macfuse_tunables_userkernel_bufsize,
+    &sysctl__macfuse_tunables_writeback_maxdirty,
     &sysctl__macfuse_version_api_major,
     &sysctl__macfuse_version_api_minor,
     &sysctl__macfuse_version_number,
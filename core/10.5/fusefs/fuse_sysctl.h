@@ -15,17 +15,23 @@ extern uint32_t fuse_fh_zombies;
 extern int32_t  fuse_iov_credit;
 extern int32_t  fuse_iov_current;
 extern uint32_t fuse_iov_permanent_bufsize;
+extern int32_t  fuse_iov_pool_allocs[];
+extern int32_t  fuse_iov_pool_cached[];
+extern int32_t  fuse_iov_pool_hits[];
+extern uint32_t fuse_iov_pool_maxbytes;
 extern uint32_t fuse_lookup_cache_hits;
 extern uint32_t fuse_lookup_cache_misses;
 extern uint32_t fuse_lookup_cache_overrides;
 extern uint32_t fuse_max_tickets;
 extern uint32_t fuse_max_freetickets;
+extern uint32_t fuse_strategy_inflight;
 extern int32_t  fuse_memory_allocated;
 extern int32_t  fuse_mount_count;
 extern int32_t  fuse_realloc_count;
 extern int32_t  fuse_tickets_current;
 extern uint32_t fuse_userkernel_bufsize;
 extern int32_t  fuse_vnodes_current;
+extern uint32_t fuse_writeback_maxdirty;
 
 extern void fuse_sysctl_start(void);
 extern void fuse_sysctl_stop(void);
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#include "fuse_ticketcache.h"
+
+static __inline__
+struct fuse_ticket_cache *
+fuse_ticketcache_get(struct fuse_ticketcache *tcs, uintptr_t key)
+{
+    return &tcs->tcs_caches[((key >> 4) ^ (key >> 12)) &
+                            (FUSE_TICKET_NCACHES - 1)];
+}
+
+void
+fuse_ticketcache_init(struct fuse_ticketcache *tcs,
+                      const struct fuse_ticketcache_ops *ops)
+{
+    int i;
+
+    tcs->tcs_ops = ops;
+    tcs->tcs_count = 0;
+
+    for (i = 0; i < FUSE_TICKET_NCACHES; i++) {
+        tcs->tcs_caches[i].tc_mtx = NULL;
+        tcs->tcs_caches[i].tc_head = NULL;
+        tcs->tcs_caches[i].tc_count = 0;
+    }
+}
+
+struct fuse_tclink *
+fuse_ticketcache_fetch(struct fuse_ticketcache *tcs, uintptr_t key)
+{
+    const struct fuse_ticketcache_ops *ops = tcs->tcs_ops;
+    struct fuse_ticket_cache *tc = fuse_ticketcache_get(tcs, key);
+    struct fuse_tclink *tl;
+
+    ops->tco_lock(tc->tc_mtx);
+
+    if ((tl = tc->tc_head)) {
+        tc->tc_head = tl->tl_next;
+        tc->tc_count--;
+        ops->tco_add(&tcs->tcs_count, -1);
+    }
+
+    ops->tco_unlock(tc->tc_mtx);
+
+    return tl;
+}
+
+int
+fuse_ticketcache_put(struct fuse_ticketcache *tcs, uintptr_t key,
+                     struct fuse_tclink *tl, uint32_t limit, uint32_t nfree)
+{
+    const struct fuse_ticketcache_ops *ops = tcs->tcs_ops;
+    struct fuse_ticket_cache *tc = fuse_ticketcache_get(tcs, key);
+    int32_t cached;
+
+    ops->tco_lock(tc->tc_mtx);
+
+    if (tc->tc_count >= FUSE_TICKET_CACHE_SIZE) {
+        ops->tco_unlock(tc->tc_mtx);
+        return 0;
+    }
+
+    /*
+     * Count the ticket before comparing with the limit, so that puts to
+     * different caches cannot all take the last place under it.
+     */
+    cached = ops->tco_add(&tcs->tcs_count, 1);
+    if (limit <= nfree + (uint32_t)cached) {
+        ops->tco_add(&tcs->tcs_count, -1);
+        ops->tco_unlock(tc->tc_mtx);
+        return 0;
+    }
+
+    /* Reserve a slot so that we can refresh the ticket unlocked. */
+    tc->tc_count++;
+
+    ops->tco_unlock(tc->tc_mtx);
+
+    ops->tco_refresh(tl);
+
+    ops->tco_lock(tc->tc_mtx);
+    tl->tl_next = tc->tc_head;
+    tc->tc_head = tl;
+    ops->tco_unlock(tc->tc_mtx);
+
+    return 1;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2006-2008 Google. All Rights Reserved.
+ * Amit Singh <singh@>
+ */
+
+#ifndef _FUSE_TICKETCACHE_H_
+#define _FUSE_TICKETCACHE_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fuse_param.h>
+
+/*
+ * The small caches of refreshed tickets that sit in front of a mount's free
+ * ticket list. A thread uses the cache its key (the kernel passes the thread
+ * pointer) hashes to, so most fetches and drops take only that cache's lock.
+ * Links are embedded in the tickets, as with the answer-wait hash.
+ *
+ * Locking, refreshing a ticket and atomic counting are done through the ops
+ * below, so that this code has no kernel dependencies and can be measured
+ * in user space.
+ */
+
+#if (FUSE_TICKET_NCACHES & (FUSE_TICKET_NCACHES - 1)) != 0
+#error FUSE_TICKET_NCACHES must be a power of two
+#endif
+
+struct fuse_tclink {
+    struct fuse_tclink *tl_next;
+};
+
+/* The object that embeds a given link, as with the kernel's queue macros. */
+#define FUSE_TCLINK_OBJECT(tl, type, field) \
+    ((type *)((char *)(tl) - offsetof(type, field)))
+
+struct fuse_ticketcache_ops {
+    void    (*tco_lock)(void *mtx);
+    void    (*tco_unlock)(void *mtx);
+
+    /* Readies a dropped ticket for reuse; called with no lock held. */
+    void    (*tco_refresh)(struct fuse_tclink *tl);
+
+    /* Atomically adds delta to *counter; returns the old value. */
+    int32_t (*tco_add)(int32_t *counter, int32_t delta);
+};
+
+struct fuse_ticket_cache {
+    void               *tc_mtx;    /* set up by the caller */
+    struct fuse_tclink *tc_head;
+    uint32_t            tc_count;  /* includes slots reserved by a put */
+};
+
+struct fuse_ticketcache {
+    const struct fuse_ticketcache_ops *tcs_ops;
+    struct fuse_ticket_cache           tcs_caches[FUSE_TICKET_NCACHES];
+    int32_t                            tcs_count;  /* over all caches */
+};
+
+void fuse_ticketcache_init(struct fuse_ticketcache *tcs,
+                           const struct fuse_ticketcache_ops *ops);
+
+/* Returns a refreshed ticket from the key's cache, or NULL. */
+struct fuse_tclink *fuse_ticketcache_fetch(struct fuse_ticketcache *tcs,
+                                           uintptr_t key);
+
+/*
+ * Refreshes a ticket and keeps it in the key's cache, unless that cache is
+ * full or limit is no more than nfree plus the tickets already cached.
+ * Returns whether the ticket was taken.
+ *
+ * nfree, the caller's count of free tickets outside the caches, is
+ * expected to be read without the lock that guards it, and drops to
+ * different caches are not serialized, so the limit is approximate: racing
+ * drops may leave a few more idle tickets than limit.
+ */
+int fuse_ticketcache_put(struct fuse_ticketcache *tcs, uintptr_t key,
+                         struct fuse_tclink *tl, uint32_t limit,
+                         uint32_t nfree);
+
+#endif /* _FUSE_TICKETCACHE_H_ */
@@ -528,6 +528,11 @@ out:
 
             vfs_ioattr(mp, &ioattr);
             ioattr.io_devblocksize = data->blocksize;
+            if (fuse_isnosyncwrites_mp(mp)) {
+                /* Let write-back pushes build bufs as large as we send. */
+                ioattr.io_maxwritecnt = FUSE_MAX_WRITEBACK_WRITE;
+                ioattr.io_segwritecnt = FUSE_MAX_WRITEBACK_WRITE;
+            }
             vfs_setioattr(mp, &ioattr);
         }
     }
@@ -604,6 +609,8 @@ fuse_vfsop_unmount(mount_t mp, int mntflags, vfs_context_t context)
         goto alreadydead;
     }
 
+    fuse_internal_forget_flush(data, context);
+
     fdisp_init(&fdi, 0 /* no data to send along */);
     fdisp_make(&fdi, FUSE_DESTROY, mp, FUSE_ROOT_ID, context);
 
@@ -1141,6 +1148,9 @@ fuse_vfsop_sync(mount_t mp, int waitfor, vfs_context_t context)
         return 0;
     }
 
+    /* Read-only mounts have forgets to deliver too. */
+    fuse_internal_forget_flush(fuse_get_mpdata(mp), context);
+
     if (vfs_isupdate(mp)) {
         return 0;
     } 
@@ -272,6 +272,10 @@ fuse_vnop_close(struct vnop_close_args *ap)
      * writing before we close this precious writable descriptor, we might
      * be doomed.
      */
+    if (!fuse_isnosynconclose(vp)) {
+        (void)fuse_internal_writeback_flush(vp);
+    }
+
     if (vnode_hasdirtyblks(vp) && !fuse_isnosynconclose(vp)) {
         (void)cluster_push(vp, IO_SYNC | IO_CLOSE);
     }
@@ -628,6 +632,8 @@ fuse_vnop_fsync(struct vnop_fsync_args *ap)
         return 0;
     }
 
+    (void)fuse_internal_writeback_flush(vp);
+
     cluster_push(vp, 0);
 
     /*
@@ -3063,6 +3069,7 @@ out:
     if (!err && sizechanged) {
         VTOFUD(vp)->filesize = newsize;
         ubc_setsize(vp, (off_t)newsize);
+        fuse_internal_writeback_remove(vp, round_page_64(newsize), INT64_MAX);
     }
 
     if (err == 0) {
@@ -3522,6 +3529,18 @@ fuse_vnop_write(struct vnop_write_args *ap)
             FUSE_KNOTE(vp, NOTE_WRITE);
         }
         fuse_invalidate_attr(vp);
+
+        /*
+         * On a write-back mount, the data stays in the UBC for now; remember
+         * where it is so that it can go out in large writes later.
+         */
+        if (!(lflag & IO_SYNC) && fuse_internal_iswriteback(vp)) {
+            if (fuse_internal_writeback_add(vp, (lflag & IO_HEADZEROFILL) ?
+                                                zero_off : offset,
+                                            uio_offset(uio))) {
+                (void)fuse_internal_writeback_flush(vp);
+            }
+        }
     }
 
     /*
@@ -25,6 +25,18 @@
 #define ANCIENTFS_USTAR     0x00040000
 #define ANCIENTFS_NEWCRC    0x00020000
 
+/*
+ * Format probes for autodetection. A backend takes part by exporting a
+ * function named ancientfs_probe_<canonical type name>. The probe is handed
+ * the first ANCIENTFS_PROBESIZE bytes of the image (fewer if the image is
+ * smaller), the size of the image, and the flags of the type being tried. It
+ * returns nonzero if the data looks like its format. Probes do no I/O.
+ */
+#define ANCIENTFS_PROBESIZE 8192
+
+typedef int (*ancientfs_probe_t)(const char* buf, size_t buflen,
+                                 off_t imagesize, uint32_t flags);
+
 #define TAPEDIR_BEGIN_BLOCK_GENERIC 1
 #define TAPEDIR_END_BLOCK_GENERIC   (1024*1024)
 
@@ -18,6 +18,34 @@
 
 DECL_UNIXFS("2.11BSD", 211bsd);
 
+/*
+ * Blocks 0..NADDR-4 are direct blocks. Addresses NADDR - 3, NADDR - 2, and
+ * NADDR - 1 have single, double, and triple indirect blocks.
+ */
+static struct unixfs_bmap bsd211_bmap = {
+    .bm_nslots  = { NADDR - 3, 1, 1, 1 },
+    .bm_ptrsize = sizeof(a_daddr_t),
+    .bm_nshift  = NSHIFT,
+    .bm_stride  = 1,
+    .bm_bread   = unixfs_internal_bread,
+};
+
+static int
+bsd211_inuse(const void* dinode)
+{
+    const struct dinode* dip = (const struct dinode*)dinode;
+    return (fs16_to_host(unixfs->s_endian, dip->di_nlink) != 0);
+}
+
+static struct unixfs_fsstat bsd211_fsstat = {
+    .fs_ifirst    = 2,
+    .fs_inodesize = sizeof(struct dinode),
+    .fs_inuse     = bsd211_inuse,
+    .fs_bread     = unixfs_internal_bread,
+    .fs_alloc     = unixfs_internal_alloc,
+    .fs_lock      = PTHREAD_MUTEX_INITIALIZER,
+};
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -69,6 +97,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
     unixfs->s_flags = flags;
     unixfs->s_endian = (fse == UNIXFS_FS_INVALID) ? UNIXFS_FS_PDP : fse;
+    bsd211_bmap.bm_endian = unixfs->s_endian;
     unixfs->s_fs_info = (void*)fs;
     unixfs->s_bdev = fd;
 
@@ -87,7 +116,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     unixfs->s_statvfs.f_frsize = DEV_BSIZE;
 
     /* must initialize the inode layer before sanity checking */
-    if ((err = unixfs_inodelayer_init(0)) != 0)
+    if ((err = unixfs_inodelayer_init(sizeof(struct bsd211_node_info))) != 0)
         goto out;
 
     if (unixfs_internal_sanitycheck(fs, stbuf.st_size) != 0) {
@@ -99,37 +128,8 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
         }
     }
 
-    int iblock;
-    unixfs->s_statvfs.f_files = 0;
-    unixfs->s_statvfs.f_ffree = 0;
-
-    char* ubuf = malloc(UNIXFS_IOSIZE(unixfs));
-    if (!ubuf) {
-        err = ENOMEM;
-        goto out;
-    }
-
-    for (iblock = 2; iblock < fs->s_isize; iblock++) {
-        if (unixfs_internal_bread((off_t)iblock, ubuf) != 0)
-            continue;
-        struct dinode* dip = (struct dinode*)ubuf;
-        for (i = 0; i < INOPB; i++, dip++) {
-            if (fs16_to_host(unixfs->s_endian, dip->di_nlink) == 0)
-                unixfs->s_statvfs.f_ffree++;
-            else
-                unixfs->s_statvfs.f_files++;
-        }
-    }
-
-    free(ubuf);
-
     unixfs->s_statvfs.f_blocks = fs->s_fsize;
-    unixfs->s_statvfs.f_bfree = 0;
-
-    while (unixfs_internal_alloc())
-        unixfs->s_statvfs.f_bfree++;
-
-    unixfs->s_statvfs.f_bavail = unixfs->s_statvfs.f_bfree;
+    bsd211_fsstat.fs_ilast = fs->s_isize;
     unixfs->s_dentsize = 0; /* no fixed size */
     unixfs->s_statvfs.f_namemax = MAXNAMLEN;
 
@@ -208,87 +208,29 @@ nospace:
     return (off_t)0; /* ENOSPC */
 }
 
+/*
+ * Map a logical block, also returning in *count how many blocks starting
+ * with it follow one another on disk.
+ */
 static off_t
-unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
+unixfs_internal_bmaprun(struct inode* ip, off_t lblkno, off_t* count,
+                        int* error)
 {
-    a_daddr_t bn = (a_daddr_t)lblkno;
-
-    if (bn < 0) {
-        *error = EFBIG;
-        return (off_t)0;
-    }
-
-    *error = EROFS;
-
-    /*
-     * blocks 0..NADDR-4 are direct blocks
-     */
+    struct bsd211_node_info* ni = (struct bsd211_node_info*)ip->I_private;
 
-    int i;
-    a_daddr_t nb;
-
-    if (bn < (NADDR - 3)) {
-        i = bn;
-        nb = ip->I_daddr[i];
-        if (nb == 0)
-            return (off_t)0; /* !writable; should be -1 rather */
-        *error = 0;
-        return (off_t)nb;
-    }
-
-    /*
-     * addresses NADDR - 3, NADDR - 2, and NADDR - 1 have single, double,
-     * and triple indirect blocks. the first step is to determine how many
-     * levels of indirection.
-     */
-
-    int j, sh = 0;
-    nb = 1;
-    bn -= NADDR - 3;
-    for (j = 3; j > 0; j--) { 
-        sh += NSHIFT;
-        nb <<= NSHIFT;
-        if (bn < nb)
-            break;
-        bn -= nb;
-    }
-    if (j == 0) {
-        *error = EFBIG;
-        return (off_t)0;
-    }
-
-    /*
-     * fetch the first indirect block
-     */
-
-    nb = ip->I_daddr[NADDR - j];
-    if (nb == 0)
-        return (off_t)0; /* !writable; should be -1 rather */
-
-    /*
-     * fetch through the indirect blocks
-     */
-
-    for (; j <= 3; j++) {
-        char ubuf[UNIXFS_IOSIZE(unixfs)];
-        int ret = unixfs_internal_bread((off_t)nb, ubuf);
-        if (ret) {
-            *error = ret;
-            return (off_t)0;
-        }
-        a_daddr_t* bap = (a_daddr_t*)ubuf;
-        sh -= NSHIFT;
-        i = (bn >> sh) & NMASK;
-        nb = fs32_to_host(unixfs->s_endian, bap[i]);
-        if (nb == 0)
-            return (off_t)0; /* !writable; should be -1 rather */
-    }
+    off_t bn = unixfs_bmap(&bsd211_bmap, ip, &ni->ni_bmap, lblkno, count, error);
+    if ((bn == 0) && (*error == 0))
+        *error = EROFS; /* !writable; should be -1 rather */
 
-    /* calculate read-ahead here. */
+    return bn;
+}
 
-    *error = 0;
+static off_t
+unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
+{
+    off_t count;
 
-    return (off_t)nb;
+    return unixfs_internal_bmaprun(ip, lblkno, &count, error);
 }
 
 static int
@@ -557,19 +499,49 @@ unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
     size_t tomove = 0;
     ssize_t remaining = nbyte;
     ssize_t iosize = UNIXFS_IOSIZE(unixfs);
+    off_t stride = iosize / unixfs->s_statvfs.f_frsize;
+    off_t fsize = ((struct fs*)unixfs->s_fs_info)->s_fsize;
     char blkbuf[iosize];
     char* p = buf;
 
     while (remaining > 0) {
         off_t lbn = offset / DEV_BSIZE;
-        off_t bn = unixfs_internal_bmap(ip, lbn, error);
+        off_t run;
+        off_t bn = unixfs_internal_bmaprun(ip, lbn, &run, error);
         if (UNIXFS_BADBLOCK(bn, *error))
             break;
-        *error = unixfs_internal_bread(bn, blkbuf);
-        if (*error != 0)
-            break;
-        tomove = (remaining > iosize) ? iosize : remaining;
-        memcpy(p, blkbuf, tomove);
+
+        /*
+         * Whole blocks that also follow one another on the disk image are
+         * read straight into the caller's buffer with a single pread.
+         */
+        off_t nblks = 1;
+        if (bn != 0) {
+            nblks = run;
+            if (nblks > remaining / iosize)
+                nblks = remaining / iosize;
+            if (nblks > (fsize - bn) / stride)
+                nblks = (fsize - bn) / stride;
+            if (nblks < 1)
+                nblks = 1;
+        }
+
+        if (nblks > 1) {
+            tomove = nblks * iosize;
+            if (pread(unixfs->s_bdev, p, tomove,
+                      bn * (off_t)unixfs->s_statvfs.f_frsize) !=
+                (ssize_t)tomove) {
+                *error = EIO;
+                break;
+            }
+        } else {
+            *error = unixfs_internal_bread(bn, blkbuf);
+            if (*error != 0)
+                break;
+            tomove = (remaining > iosize) ? iosize : remaining;
+            memcpy(p, blkbuf, tomove);
+        }
+
         remaining -= tomove;
         done += tomove;
         offset += tomove;
@@ -659,6 +631,7 @@ unixfs_internal_sanitycheck(void* filsys, off_t disksize)
 static int
 unixfs_internal_statvfs(struct statvfs* svb)
 {
+    unixfs_fsstat(&bsd211_fsstat, unixfs);
     memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
     return 0;
 }
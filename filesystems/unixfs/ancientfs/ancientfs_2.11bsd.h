@@ -226,4 +226,11 @@ struct fblk {
     a_daddr_t df_free[NICFREE];
 } __attribute__((packed));
 
+/*
+ * In-core inode private data: the block mapping cache (see unixfs_bmap()).
+ */
+struct bsd211_node_info {
+    struct unixfs_bmapcache ni_bmap;
+};
+
 #endif /* _ANCIENTFS_211BSD_H_ */
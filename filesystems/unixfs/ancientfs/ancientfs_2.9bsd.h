@@ -168,4 +168,11 @@ struct fblk {
     a_daddr_t df_free[NICFREE];
 } __attribute__((packed));
 
+/*
+ * In-core inode private data: the block mapping cache (see unixfs_bmap()).
+ */
+struct bsd29_node_info {
+    struct unixfs_bmapcache ni_bmap;
+};
+
 #endif /* _ANCIENTFS_29BSD_H_ */
@@ -76,17 +76,18 @@ struct chdr {
     char    name[UNIXFS_MAXNAMLEN + 1]; /* name */
 };
 
-static int ancientfs_ar_readheader(int fd, struct chdr* chdr);
+static int ancientfs_ar_readheader(struct unixfs_scanner* sc,
+                                   struct chdr* chdr);
 
 static int
-ancientfs_ar_readheader(int fd, struct chdr* chdr)
+ancientfs_ar_readheader(struct unixfs_scanner* sc, struct chdr* chdr)
 {
     int len, nr;
     char *p, buf[20];
-    char hb[sizeof(struct ar_hdr) + 1];
-    struct ar_hdr* hdr;
+    const struct ar_hdr* hdr;
 
-    nr = read(fd, hb, sizeof(struct ar_hdr));
+    /* zero-copy view of the header; valid until the long name is read */
+    nr = unixfs_scanner_peek(sc, (const void**)&hdr, sizeof(struct ar_hdr));
     if (nr != sizeof(struct ar_hdr)) {
         if (!nr)
             return 1;
@@ -94,7 +95,7 @@ ancientfs_ar_readheader(int fd, struct chdr* chdr)
             return -1;
     }
 
-    hdr = (struct ar_hdr*)hb;
+    unixfs_scanner_skip(sc, sizeof(struct ar_hdr));
     if (strncmp(hdr->ar_fmag, ARFMAG, sizeof(ARFMAG) - 1))
         return -2;
 
@@ -120,7 +121,7 @@ ancientfs_ar_readheader(int fd, struct chdr* chdr)
         chdr->lname = len = atoi(hdr->ar_name + sizeof(AR_EFMT1) - 1);
         if (len <= 0 || len > UNIXFS_MAXNAMLEN)
                 return -1;
-        nr = read(fd, chdr->name, len);
+        nr = unixfs_scanner_read(sc, chdr->name, len);
         if (nr != len) {
             if (nr < 0)
                 return -1; 
@@ -137,7 +138,7 @@ ancientfs_ar_readheader(int fd, struct chdr* chdr)
     }
 
     /* limiting to 32-bit offsets */
-    chdr->addr = (uint32_t)lseek(fd, (off_t)0, SEEK_CUR);
+    chdr->addr = (uint32_t)unixfs_scanner_tell(sc);
 
     return 0;
 }
@@ -233,12 +234,18 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
+    struct unixfs_scanner sc;
+
+    if ((err = unixfs_scanner_init(&sc, fd, (off_t)SARMAG,
+                                   UNIXFS_SCANNER_CHUNKSIZE)) != 0)
+        goto out;
+
     struct chdr ar;
     ino_t parent_ino = ROOTINO;
 
     for (;;) {
 
-        if (ancientfs_ar_readheader(fd, &ar) != 0)
+        if (ancientfs_ar_readheader(&sc, &ar) != 0)
             break;
 
         int missing = unixfs_internal_namei(parent_ino, ar.name, &stbuf);
@@ -292,9 +299,11 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
         fs->s_lastino++;
 next:
-        (void)lseek(fd, (off_t)(ar.size + (ar.size & 1)), SEEK_CUR);
+        unixfs_scanner_skip(&sc, (off_t)(ar.size + (ar.size & 1)));
     }
 
+    unixfs_scanner_fini(&sc);
+
     unixfs->s_statvfs.f_bsize = BSIZE;
     unixfs->s_statvfs.f_frsize = BSIZE;
     unixfs->s_statvfs.f_ffree = 0;
@@ -538,3 +547,13 @@ unixfs_internal_statvfs(struct statvfs* svb)
     memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
     return 0;
 }
+
+int
+ancientfs_probe_ar(const char* buf, size_t buflen, off_t imagesize,
+                   uint32_t flags)
+{
+    if (buflen < SARMAG)
+        return 0;
+
+    return (memcmp(buf, ARMAG, SARMAG) == 0);
+}
@@ -25,15 +25,18 @@ struct bcpio_entry {
     struct stat stat;
 };
 
-static int ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce);
+static int ancientfs_bcpio_readheader(struct unixfs_scanner* sc,
+                                      struct bcpio_entry* ce);
 
 static int
-ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
+ancientfs_bcpio_readheader(struct unixfs_scanner* sc, struct bcpio_entry* ce)
 {
     int nr;
-    struct bcpio_header _hdr, *hdr = &_hdr;
+    const struct bcpio_header* hdr;
 
-    nr = read(fd, hdr, sizeof(struct bcpio_header));
+    /* zero-copy view of the header; valid until the name is read */
+    nr = unixfs_scanner_peek(sc, (const void**)&hdr,
+                             sizeof(struct bcpio_header));
     if (nr != sizeof(struct bcpio_header)) {
         if (!nr)
             return 1;
@@ -41,9 +44,11 @@ ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
             return -1;
     }
 
+    unixfs_scanner_skip(sc, sizeof(struct bcpio_header));
+
     if (fs16_to_host(unixfs->s_endian, hdr->h_magic) != BCPIO_MAGIC) {
         fprintf(stderr, "*** fatal error: bad magic in record @ %llu\n",
-                lseek(fd, (off_t)0, SEEK_CUR));
+                unixfs_scanner_tell(sc));
         return -1;
     }
 
@@ -77,29 +82,29 @@ ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
 
     if (namesize > UNIXFS_MAXPATHLEN) {
         fprintf(stderr, "*** fatal error: file name too large (%#hx) @ %llu\n",
-                namesize, lseek(fd, (off_t)0, SEEK_CUR));
+                namesize, unixfs_scanner_tell(sc));
         return -1;
     }
 
-    if (read(fd, &ce->name, namesize) != namesize)
+    if (unixfs_scanner_read(sc, ce->name, namesize) != namesize)
         return -1;
 
     if (ce->name[0] == '\0' || ce->name[namesize - 1] != '\0') { /* corrupt */
         fprintf(stderr, "*** fatal error: file name corrupt @ %llu\n",
-                lseek(fd, (off_t)0, SEEK_CUR));
+                unixfs_scanner_tell(sc));
         return -1;
     }
 
     /* header + namesize aligned to 2-byte boundary */
 
-    ce->daddr = lseek(fd, (off_t)0, SEEK_CUR);
+    ce->daddr = unixfs_scanner_tell(sc);
     if (ce->daddr < 0) {
         fprintf(stderr, "*** fatal error: cannot read archive\n");
         return -1;
     }
     if (ce->daddr & (off_t)1) {
         ce->daddr++;
-        (void)lseek(fd, (off_t)1, SEEK_CUR);
+        unixfs_scanner_skip(sc, (off_t)1);
     }
 
     /* ce->daddr now contains the start of data */
@@ -111,7 +116,7 @@ ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
     if (!S_ISLNK(ce->stat.st_mode) || !ce->stat.st_size) {
         off_t dataend = ce->stat.st_size;
         dataend += (dataend & 1) ? 1 : 0;
-        (void)lseek(fd, dataend, SEEK_CUR); 
+        unixfs_scanner_skip(sc, dataend); 
         return 0;
     }
 
@@ -127,7 +132,8 @@ ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
         return -1;
     }
 
-    if (read(fd, ce->linktargetname, ce->stat.st_size) != ce->stat.st_size)
+    if (unixfs_scanner_read(sc, ce->linktargetname,
+                            ce->stat.st_size) != ce->stat.st_size)
         return -1;
 
     if (ce->linktargetname[0] == '\0') {
@@ -138,7 +144,7 @@ ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
     ce->linktargetname[ce->stat.st_size] = '\0';
 
     if ((ce->daddr + ce->stat.st_size) & 1)
-        (void)lseek(fd, (off_t)1, SEEK_CUR);
+        unixfs_scanner_skip(sc, (off_t)1);
 
     return 0;
 }
@@ -259,17 +265,23 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
-    lseek(fd, (off_t)0, SEEK_SET); /* rewind archive */
+    struct unixfs_scanner sc;
+
+    /* rewind archive */
+    if ((err = unixfs_scanner_init(&sc, fd, (off_t)0,
+                                   UNIXFS_SCANNER_CHUNKSIZE)) != 0)
+        goto out;
 
     struct bcpio_entry _ce, *ce = &_ce;
 
     for (;;) {
-        if ((err = ancientfs_bcpio_readheader(fd, ce)) != 0) {
+        if ((err = ancientfs_bcpio_readheader(&sc, ce)) != 0) {
             if (err == 1)
                 break;
             else {
                 fprintf(stderr,
                         "*** fatal error: cannot read block (error %d)\n", err);
+                unixfs_scanner_fini(&sc);
                 err = EIO;
                 goto out;
             }
@@ -396,6 +408,8 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
     } /* for each block */
 
+    unixfs_scanner_fini(&sc);
+
     err = 0;
 
     unixfs->s_statvfs.f_bsize = BCBLOCK;
@@ -666,3 +680,18 @@ unixfs_internal_statvfs(struct statvfs* svb)
     memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
     return 0;
 }
+
+int
+ancientfs_probe_bcpio(const char* buf, size_t buflen, off_t imagesize,
+                      uint32_t flags)
+{
+    uint16_t magic;
+
+    if (buflen < sizeof(struct bcpio_header))
+        return 0;
+
+    memcpy(&magic, buf, sizeof(magic));
+
+    return ((fs16_to_host(UNIXFS_FS_LITTLE, magic) == BCPIO_MAGIC) ||
+            (fs16_to_host(UNIXFS_FS_BIG, magic) == BCPIO_MAGIC));
+}
@@ -33,16 +33,20 @@ struct cpio_newc_entry {
     struct stat stat;
 };
 
-static int ancientfs_cpio_newc_readheader(int fd, struct cpio_newc_entry* ce);
+static int ancientfs_cpio_newc_readheader(struct unixfs_scanner* sc,
+                                          struct cpio_newc_entry* ce);
 
 static int
-ancientfs_cpio_newc_readheader(int fd, struct cpio_newc_entry* ce)
+ancientfs_cpio_newc_readheader(struct unixfs_scanner* sc,
+                               struct cpio_newc_entry* ce)
 {
     int nr;
     char buf[20];
-    struct cpio_newc_header _hdr, *hdr = &_hdr;
+    const struct cpio_newc_header* hdr;
 
-    nr = read(fd, hdr, sizeof(struct cpio_newc_header));
+    /* zero-copy view of the header; valid until the name is read */
+    nr = unixfs_scanner_peek(sc, (const void**)&hdr,
+                             sizeof(struct cpio_newc_header));
     if (nr != sizeof(struct cpio_newc_header)) {
         if (!nr)
             return 1;
@@ -50,13 +54,15 @@ ancientfs_cpio_newc_readheader(int fd, struct cpio_newc_entry* ce)
             return -1;
     }
 
+    unixfs_scanner_skip(sc, sizeof(struct cpio_newc_header));
+
     char* magic = CPIO_NEWC_MAGIC;
     if (unixfs->s_flags & ANCIENTFS_NEWCRC)
         magic = CPIO_NEWCRC_MAGIC;
 
     if (strncmp(hdr->c_magic, magic, CPIO_NEWC_MAGLEN) != 0) {
         fprintf(stderr, "*** fatal error: bad magic in record @ %llu - %lu\n",
-                lseek(fd, (off_t)0, SEEK_CUR),
+                unixfs_scanner_tell(sc),
                 (unsigned long)sizeof(struct cpio_newc_header));
         return -1;
     }
@@ -96,20 +102,20 @@ ancientfs_cpio_newc_readheader(int fd, struct cpio_newc_entry* ce)
 
     if (namesize > UNIXFS_MAXPATHLEN) {
         fprintf(stderr, "*** fatal error: file name too large (%#lx) @ %llu\n",
-                namesize, lseek(fd, (off_t)0, SEEK_CUR));
+                namesize, unixfs_scanner_tell(sc));
         return -1;
     }
 
-    if (read(fd, &ce->name, namesize) != namesize)
+    if (unixfs_scanner_read(sc, ce->name, namesize) != namesize)
         return -1;
 
     if (ce->name[0] == '\0' || ce->name[namesize - 1] != '\0') { /* corrupt */
         fprintf(stderr, "*** fatal error: file name corrupt @ %llu\n",
-                lseek(fd, (off_t)0, SEEK_CUR));
+                unixfs_scanner_tell(sc));
         return -1;
     }
 
-    ce->daddr = lseek(fd, (off_t)0, SEEK_CUR);
+    ce->daddr = unixfs_scanner_tell(sc);
     if (ce->daddr < 0) {
         fprintf(stderr, "*** fatal error: cannot read archive\n");
         return -1;
@@ -117,7 +123,7 @@ ancientfs_cpio_newc_readheader(int fd, struct cpio_newc_entry* ce)
     if (ce->daddr & (off_t)3) {
         off_t pad = 4 - (ce->daddr % 4);
         ce->daddr += pad;
-        (void)lseek(fd, pad, SEEK_CUR);
+        unixfs_scanner_skip(sc, pad);
     }
 
     /* ce->daddr now contains the start of data */
@@ -129,7 +135,7 @@ ancientfs_cpio_newc_readheader(int fd, struct cpio_newc_entry* ce)
     if (!S_ISLNK(ce->stat.st_mode) || !ce->stat.st_size) {
         off_t dataend = ce->stat.st_size;
         dataend += (dataend & 3) ? (4 - (dataend % 4)) : 0;
-        (void)lseek(fd, dataend, SEEK_CUR); 
+        unixfs_scanner_skip(sc, dataend); 
         return 0;
     }
 
@@ -145,7 +151,8 @@ ancientfs_cpio_newc_readheader(int fd, struct cpio_newc_entry* ce)
         return -1;
     }
 
-    if (read(fd, ce->linktargetname, ce->stat.st_size) != ce->stat.st_size)
+    if (unixfs_scanner_read(sc, ce->linktargetname,
+                            ce->stat.st_size) != ce->stat.st_size)
         return -1;
 
     if (ce->linktargetname[0] == '\0') {
@@ -156,8 +163,8 @@ ancientfs_cpio_newc_readheader(int fd, struct cpio_newc_entry* ce)
     ce->linktargetname[ce->stat.st_size] = '\0';
 
     if ((ce->daddr + ce->stat.st_size) & 3)
-        (void)lseek(fd, (off_t)(4 - ((ce->daddr + ce->stat.st_size) % 4)),
-                    SEEK_CUR);
+        unixfs_scanner_skip(sc,
+                            (off_t)(4 - ((ce->daddr + ce->stat.st_size) % 4)));
 
     return 0;
 }
@@ -265,17 +272,23 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
-    lseek(fd, (off_t)0, SEEK_SET); /* rewind tape */
+    struct unixfs_scanner sc;
+
+    /* rewind tape */
+    if ((err = unixfs_scanner_init(&sc, fd, (off_t)0,
+                                   UNIXFS_SCANNER_CHUNKSIZE)) != 0)
+        goto out;
 
     struct cpio_newc_entry _ce, *ce = &_ce;
 
     for (;;) {
-        if ((err = ancientfs_cpio_newc_readheader(fd, ce)) != 0) {
+        if ((err = ancientfs_cpio_newc_readheader(&sc, ce)) != 0) {
             if (err == 1)
                 break;
             else {
                 fprintf(stderr,
                         "*** fatal error: cannot read block (error %d)\n", err);
+                unixfs_scanner_fini(&sc);
                 err = EIO;
                 goto out;
             }
@@ -405,6 +418,8 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
     } /* for each block */
 
+    unixfs_scanner_fini(&sc);
+
     err = 0;
 
     unixfs->s_statvfs.f_bsize = CPIO_NEWC_BLOCK;
@@ -677,3 +692,17 @@ unixfs_internal_statvfs(struct statvfs* svb)
     memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
     return 0;
 }
+
+int
+ancientfs_probe_cpio_newc(const char* buf, size_t buflen, off_t imagesize,
+                          uint32_t flags)
+{
+    char* magic = CPIO_NEWC_MAGIC;
+    if (flags & ANCIENTFS_NEWCRC)
+        magic = CPIO_NEWCRC_MAGIC;
+
+    if (buflen < sizeof(struct cpio_newc_header))
+        return 0;
+
+    return (strncmp(buf, magic, CPIO_NEWC_MAGLEN) == 0);
+}
@@ -23,14 +23,15 @@ DECL_UNIXFS("UNIX dump1024/restor", dump1024);
 DECL_UNIXFS("UNIX dump/restor", dump);
 #endif
 
-static int ancientfs_dump_readheader(int fd, struct spcl* spcl);
+static int ancientfs_dump_readheader(struct unixfs_scanner* sc,
+                                     struct spcl* spcl);
 
 static int
-ancientfs_dump_readheader(int fd, struct spcl* spcl)
+ancientfs_dump_readheader(struct unixfs_scanner* sc, struct spcl* spcl)
 {
     ssize_t ret;
 
-    if ((ret = read(fd, (char*)spcl, BSIZE)) != BSIZE) {
+    if ((ret = unixfs_scanner_read(sc, (char*)spcl, BSIZE)) != BSIZE) {
         if (ret == 0) /* EOF */
             return 1;
         return -1;
@@ -134,16 +135,24 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     if ((err = unixfs_inodelayer_init(sizeof(struct tap_node_info))) != 0)
         goto out;
 
+    struct unixfs_scanner sc;
+
+    if ((err = unixfs_scanner_init(&sc, fd, (off_t)0,
+                                   UNIXFS_SCANNER_CHUNKSIZE)) != 0)
+        goto out;
+
     struct spcl spcl;
 
-    if (ancientfs_dump_readheader(fd, &spcl) != 0) {
+    if (ancientfs_dump_readheader(&sc, &spcl) != 0) {
         fprintf(stderr, "failed to read dump header\n");
+        unixfs_scanner_fini(&sc);
         err = EINVAL;
         goto out;
     }
 
     if (spcl.c_type != TS_TAPE) {
        fprintf(stderr, "failed to recognize image as a tape dump\n");
+       unixfs_scanner_fini(&sc);
        err = EINVAL;
        goto out;
     }
@@ -154,13 +163,14 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     int done = 0;
 
     while (!done) {
-        err = ancientfs_dump_readheader(fd, &spcl);
+        err = ancientfs_dump_readheader(&sc, &spcl);
         if (err) {
             if (err != 1) {
                 fprintf(stderr, "*** warning: no tape header: retrying\n");
                 continue;
             } else {
                 fprintf(stderr, "failed to read next header (%d)\n", err);
+                unixfs_scanner_fini(&sc);
                 err = EINVAL;
                 goto out;
             }
@@ -182,9 +192,10 @@ next:
                 int count = spcl.c_count;
                 char* bmp = (char*)fs->s_dumpmap;
                 while (count--) {
-                   if (read(fd, bmp, BSIZE) != BSIZE) {
+                   if (unixfs_scanner_read(&sc, bmp, BSIZE) != BSIZE) {
                        fprintf(stderr,
                                "*** fatal error: failed to read bitmap\n");
+                       unixfs_scanner_fini(&sc);
                        err = EIO;
                        goto out;
                    }
@@ -197,7 +208,7 @@ next:
            } else {
                fprintf(stderr, "*** warning: duplicate inode map\n");
                /* ignore the data */
-               (void)lseek(fd, (off_t)(spcl.c_count * BSIZE), SEEK_CUR);
+               unixfs_scanner_skip(&sc, (off_t)(spcl.c_count * BSIZE));
            }
            break;
 
@@ -249,7 +260,7 @@ next:
 
             for (i = 0; i < nblocks; i++) {
                 if (block_index >= spcl.c_count) {
-                    if (ancientfs_dump_readheader(fd, &spcl) == -1) {
+                    if (ancientfs_dump_readheader(&sc, &spcl) == -1) {
                         fprintf(stderr,
                                 "*** fatal error: cannot read header\n");
                         abort();
@@ -266,11 +277,7 @@ next:
                 }
 
                 if (spcl.c_addr[block_index]) {
-                    off_t nextb = lseek(fd, (off_t)BSIZE, SEEK_CUR);
-                    if (nextb == -1) {
-                        fprintf(stderr, "*** fatal error: cannot read tape\n");
-                        abort();
-                    }
+                    unixfs_scanner_skip(&sc, (off_t)BSIZE);
                     ti->ti_daddr[i] = spcl.c_tapea + block_index + 1;
                 } else {
                     ti->ti_daddr[i] = 0; /* zero fill */
@@ -302,6 +309,8 @@ next:
          }
     }
 
+    unixfs_scanner_fini(&sc);
+
     unixfs->s_statvfs.f_ffree = 0;
     unixfs->s_statvfs.f_files = fs->s_files + fs->s_directories;  
     unixfs->s_statvfs.f_blocks = fs->s_fsize;
@@ -91,6 +91,9 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     if ((err = unixfs_inodelayer_init(sizeof(struct tap_node_info))) != 0)
         goto out;
 
+    if ((err = unixfs_namehash_init()) != 0)
+        goto out;
+
     struct inode* rootip = unixfs_inodelayer_iget((ino_t)ROOTINO);
     if (!rootip) {
         fprintf(stderr, "*** fatal error: no root inode\n");
@@ -118,12 +121,25 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
+    /*
+     * The directory occupies consecutive tape blocks, so stream it through
+     * the scanner rather than reading it one block at a time. We stop as
+     * soon as we see the end of the directory.
+     */
+    struct unixfs_scanner sc;
+
+    if ((err = unixfs_scanner_init(&sc, fd,
+                                   (off_t)tapedir_begin_block * BSIZE,
+                                   UNIXFS_SCANNER_CHUNKSIZE)) != 0)
+        goto out;
+
     char tapeblock[BSIZE];
 
     for (i = tapedir_begin_block; i < tapedir_end_block; i++) {
-        if (pread(fd, tapeblock, BSIZE, (off_t)(i * BSIZE)) != BSIZE) {
+        if (unixfs_scanner_read(&sc, tapeblock, BSIZE) != BSIZE) {
             fprintf(stderr, "*** fatal error: cannot read tape block %llu\n",
                     (off_t)i);
+            unixfs_scanner_fini(&sc);
             err = EIO;
             goto out;
         }
@@ -202,6 +218,12 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                 ti->ti_parent = (struct tap_node_info*)(parent_ip->I_private);
                 ti->ti_next_sibling = ti->ti_parent->ti_children;
                 ti->ti_parent->ti_children = ti;
+                if (unixfs_namehash_add(parent_ino, cnp, strlen(cnp),
+                                        ip->I_ino) != 0) {
+                    fprintf(stderr,
+                            "*** fatal error: cannot allocate memory\n");
+                    abort();
+                }
                 if (S_ISDIR(ancientfs_itp_mode(ip->I_mode, flags))) {
                     fs->s_directories++;
                     parent_ino = fs->s_lastino + 1;
@@ -217,6 +239,8 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
         }
     }
 
+    unixfs_scanner_fini(&sc);
+
     unixfs->s_statvfs.f_bsize = BSIZE;
     unixfs->s_statvfs.f_frsize = BSIZE;
     unixfs->s_statvfs.f_ffree = 0;
@@ -264,6 +288,7 @@ unixfs_internal_fini(void* filsys)
         }
     }
 
+    unixfs_namehash_fini();
     unixfs_inodelayer_fini();
 
     if (sb) {
@@ -374,28 +399,9 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
         goto out;
     }
 
-    struct tap_node_info* child =
-        ((struct tap_node_info*)dp->I_private)->ti_children;;
-
-    if (!child) {
-        ret = ENOENT;
-        goto out;
-    }
-
-    int found = 0;
-
-    do {
-        size_t target_namelen = strlen((const char*)child->ti_name);
-        if ((namelen == target_namelen) &&
-            (memcmp(name, child->ti_name, target_namelen) == 0)) {
-            found = 1;
-            break;
-        }
-        child = child->ti_next_sibling;
-    } while (child);
-
-    if (found)
-        ret = unixfs_internal_igetattr((ino_t)child->ti_self->I_ino, stbuf);
+    ino_t ino = unixfs_namehash_lookup(parentino, name, namelen);
+    if (ino)
+        ret = unixfs_internal_igetattr(ino, stbuf);
 
 out:
     unixfs_internal_iput(dp);
@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #if __linux__ || (__FreeBSD__ < 10)
 #define __USE_GNU 1
 #define __private_extern__
@@ -30,112 +31,86 @@ static struct filesystems {
     char*    fstypename_canonical;
     uint32_t flags;
     char*    description;
-    uint32_t magicoffset;
-    char     magicbytes[32];
-    char     magiclen;
 } filesystems[] = {
 
     {
         0, "v1tap", "tap",
         ANCIENTFS_UNIX_V1 | ANCIENTFS_GENTAPE,
         "DECtape 'tap' tape archive; UNIX V1",
-        0, { 0 }, 0,
     },
     {
         0, "v2tap", "tap",
         ANCIENTFS_UNIX_V2 | ANCIENTFS_GENTAPE,
         "DECtape 'tap' tape archive; UNIX V2",
-        0, { 0 }, 0,
     },
     {
         0, "v3tap", "tap",
         ANCIENTFS_UNIX_V3 | ANCIENTFS_GENTAPE,
         "DECtape 'tap' tape archive; UNIX V3",
-        0, { 0 }, 0,
     },
     {
         0, "ntap", "tap",
         ANCIENTFS_GENTAPE,
         "DECtape/magtape 'tap' tape archive; 1970 epoch",
-        0, { 0 }, 0,
     },
     {
         0, "tp", "tp",
         ANCIENTFS_GENTAPE,
         "DECtape/magtape 'tp' tape archive",
-        0, { 0 }, 0,
     },
     {
         0, "itp", "itp",
         ANCIENTFS_GENTAPE,
         "UNIX 'itp' tape archive",
-        0, { 0 }, 0,
     },
     {   0, "dtp", "dtp",
         ANCIENTFS_GENTAPE,
         "UNIX 'dtp' tape archive",
-        0, { 0 }, 0,
     },
     {   0, "dump", "dump",
         0,
         "Incremental file system dump (512-byte blocks, V7/bsd)",
-        0, { 0 }, 0,
     },
     {   1, "dump512" , "dump",
         0,
         "Incremental file system dump (512-byte blocks, V7/bsd)",
-        0, { 0 }, 0,
     },
     {   0, "dump1k", "dump1024",
         ANCIENTFS_DUMP1KB,
         "Incremental file system dump (1024-byte blocks, V7/bsd)",
-        0, { 0 }, 0,
     },
     {   0, "dump-vn", "dumpvn",
         0,
         "Incremental file system dump (512-byte blocks, bsd-vn)",
-        0, { 0 }, 0,
     },
     {   0, "dump1k-vn", "dumpvn1024",
         ANCIENTFS_DUMP1KB,
         "Incremental file system dump (1024-byte blocks, bsd-vn)",
-        0, { 0 }, 0,
+    },
+    {
+        1, "ar", "voar",
+        0,
+        "Very old (0177555) archive (.a)",
     },
     {
         0, "v1ar", "voar",
         ANCIENTFS_UNIX_V1,
         "Very old (0177555) archive (.a) from First Edition UNIX",
-        0, { 0x6d, 0xff }, 2,
     },
     {
         0, "v2ar", "voar",
         ANCIENTFS_UNIX_V2,
         "Very old (0177555) archive (.a) from Second Edition UNIX",
-        0, { 0x6d, 0xff }, 2,
     },
     {
         0, "v3ar", "voar",
         ANCIENTFS_UNIX_V3,
         "Very old (0177555) archive (.a) from Third Edition UNIX",
-        0, { 0x6d, 0xff }, 2,
-    },
-    {
-        1, "ar", "voar",
-        0,
-        "Very old (0177555) archive (.a)",
-        0, { 0x6d, 0xff }, 2,
     },
     {
         1, "ar", "oar",
         0,
         "Old (0177545) archive (.a)",
-        0, { 0x65, 0xff }, 2,
-    },
-    {
-        1, "ar", "oar",
-        0,
-        "Old (0177545) archive (.a)",
-        0, { 0xff, 0x65 }, 2,
     },
     {
         0, "ar", "ar",
@@ -143,135 +118,98 @@ static struct filesystems {
         "Current (!<arch>\\n), old (0177545), or very old (0177555)\n"
         "                     archive (.a); use (v1|v2|v3)ar for UNIX V1/V2/V3 "
         "archives",
-        0, { 0x21, 0x3c, 0x61, 0x72, 0x63, 0x68, 0x3e, 0x0a }, 8,
     },
     {
         0, "bcpio", "bcpio",
         0,
         "Binary cpio archive (old); may be byte-swapped",
-        0, { 0x71, 0xc7 }, 2,
-    },
-    {
-        1, "bcpio", "bcpio",
-        0,
-        "Binary cpio archive (old); may be byte-swapped",
-        0, { 0xc7, 0x71 }, 2,
     },
     {
         0, "cpio_odc", "cpio_odc",
         0,
         "ASCII (odc) cpio archive",
-        0, { 0x30, 0x37, 0x30, 0x37, 0x30, 0x37 }, 6,
     },
     {
         0, "cpio_newc", "cpio_newc",
         0,
         "New ASCII (newc) cpio archive",
-        0, { 0x30, 0x37, 0x30, 0x37, 0x30, 0x31 }, 6,
     },
     {
         0, "cpio_newcrc", "cpio_newc",
         ANCIENTFS_NEWCRC,
         "New ASCII (newc) cpio archive with checksum",
-        0, { 0x30, 0x37, 0x30, 0x37, 0x30, 0x32 }, 6,
     },
     {
         0, "tar", "tar",
         0,
         "ustar, pre-POSIX ustar, or V7 tar archive",
-        257, { 0x75, 0x73, 0x74, 0x61, 0x72, 0x0 }, 6, /* POSIX ustar */
-    },
-    {
-        1, "tar", "tar",
-        0,
-        "ustar, pre-POSIX ustar, or V7 tar archive",
-        257, { 0x75, 0x73, 0x74, 0x61, 0x72, 0x20 }, 6, /* pre-POSIX ustar */
-    },
-    {
-        1, "tar", "tar",
-        0,
-        "ustar, pre-POSIX ustar, or V7 tar archive",
-        0, { 0 }, 0, /* V7 tar */
     },
     {
         0, "v1", "v123",
         ANCIENTFS_UNIX_V1,
         "First Edition UNIX file system",
-        0, { 0 }, 0,
     },
     {
         0, "v2", "v123",
         ANCIENTFS_UNIX_V2,
         "Second Edition UNIX file system",
-        0, { 0 }, 0,
     },
     {
         0, "v3", "v123",
         ANCIENTFS_UNIX_V3,
         "Third Edition UNIX file system",
-        0, { 0 }, 0,
     }, 
     {
         0, "v4", "v456",
         ANCIENTFS_UNIX_V4,
         "Fourth Edition UNIX file system",
-        0, { 0 }, 0,
     },
     {
         0, "v5", "v456",
         ANCIENTFS_UNIX_V5,
         "Fifth Edition UNIX file system",
-        0, { 0 }, 0,
     },
     {
         0, "v6", "v456",
         ANCIENTFS_UNIX_V6,
         "Sixth Edition UNIX file system",
-        0, { 0 }, 0,
     },
     {
         0, "v7", "v7",
         0,
         "Seventh Edition UNIX file system",
-        0, { 0 }, 0,
     },
     {
         0, "v10", "v10",
         ANCIENTFS_UNIX_V10,
         "Tenth Edition UNIX file system",
-        0, { 0 }, 0,
     },
     {
         0, "32v", "32v",
         0,
         "UNIX/32V file system",
-        0, { 0 }, 0,
     },
     {
         1, "32/v", "32v",
         0,
         "UNIX/32V file system",
-        0, { 0 }, 0,
     },
     {
         1, "2.9bsd", "29bsd",
         0,
         "BSD file system (V7-style with fixed-length file names)",
-        0, { 0 }, 0,
     },
     {
         1, "29bsd", "29bsd",
         0,
         "BSD file system (V7-style with fixed-length file names;\n"
         "                   e.g. 2.9BSD or 4.0BSD)",
-        0, { 0 }, 0,
     },
     {
         0, "bsd", "29bsd",
         0,
         "BSD file system (V7-style with fixed-length file names;\n"
         "                     e.g. 2.9BSD or 4.0BSD)",
-        0, { 0 }, 0,
     },
     {
         1, "2.11bsd", "211bsd",
@@ -279,7 +217,6 @@ static struct filesystems {
         "BSD file system (pre 'fast-file-system' \"UFS\" with\n"
         "                     variable-length file names; e.g. 2.11BSD "
         "for PDP-11)",
-        0, { 0 }, 0,
     },
     {
         1, "211bsd", "211bsd",
@@ -287,7 +224,6 @@ static struct filesystems {
         "BSD file system (pre 'fast-file-system' \"UFS\" with\n"
         "                     variable-length file names; e.g. 2.11BSD "
         "for PDP-11)",
-        0, { 0 }, 0,
     },
     {
         0, "bsd-vn", "211bsd",
@@ -295,7 +231,6 @@ static struct filesystems {
         "BSD file system (pre 'fast-file-system' \"UFS\" with\n"
         "                     variable-length file names; e.g. 2.11BSD "
         "for PDP-11)",
-        0, { 0 }, 0,
     },
     /* done */
     { 0, NULL, NULL,  0 },
@@ -325,22 +260,36 @@ PROGVERS, PROGNAME);
 
     fprintf(stderr, "%s",
     "     . --force attempts mounting even if there are warnings or errors\n"
+    "     . --trace FILE records the FUSE requests and replies of the mount\n"
+    "       in FILE (see support/tracing)\n"
+    "     . --replay FILE runs the requests recorded in FILE against DMG,\n"
+    "       without mounting, and reports per-opcode latency and throughput\n"
     );
 }
 
+static ancientfs_probe_t
+ancientfs_probe(int i)
+{
+    char symb[255];
+    snprintf(symb, 255, "%s_%s", "ancientfs_probe",
+             filesystems[i].fstypename_canonical);
+    return (ancientfs_probe_t)dlsym(RTLD_DEFAULT, symb);
+}
+
 __private_extern__
 struct unixfs*
 unixfs_preflight(char* dmg, char** type, struct unixfs** unixfsp)
 {
-    int i;
+    int i, fd, candidate = -1, fallback = -1;
+    ssize_t buflen;
+    struct stat stbuf;
+    char buf[ANCIENTFS_PROBESIZE];
+
     *unixfsp = NULL;
 
     if (!type)
         goto out;
 
-    int fd;
-    char buf[512];
-
     if (!dmg) {
         fprintf(stderr, "no image specified\n");
         goto out;
@@ -351,54 +300,55 @@ unixfs_preflight(char* dmg, char** type, struct unixfs** unixfsp)
         goto out;
     }
 
-    if (read(fd, buf, 512) != 512) {
+    /*
+     * Read the head of the image once. Every probe works off this buffer,
+     * so trying all of them costs no more I/O than trying one.
+     */
+    if ((fstat(fd, &stbuf) != 0) ||
+        ((buflen = pread(fd, buf, ANCIENTFS_PROBESIZE, (off_t)0)) <= 0)) {
         close(fd);
         fprintf(stderr, "failed to read data from %s\n", dmg);
+        goto out;
     }
 
     close(fd);
 
-    if (!*type) {
-
-        /* no type; try some matching */
-        for (i = 0; filesystems[i].fstypename != NULL; i++) {
-            if (filesystems[i].magiclen == 0)
+    /*
+     * With no type, the first entry whose probe recognizes the image wins;
+     * types without a probe can't be autodetected. With a type, the probes
+     * only pick among entries sharing that name (e.g. the flavors of "ar").
+     * If none of them speaks up, the user's word is taken for it.
+     */
+    for (i = 0; filesystems[i].fstypename != NULL; i++) {
+        if (*type && (strcasecmp(*type, filesystems[i].fstypename) != 0))
+            continue;
+        if (fallback < 0)
+            fallback = i;
+        ancientfs_probe_t probe = ancientfs_probe(i);
+        if (probe == NULL) {
+            if (!*type)
                 continue;
-            /* ok, got something; try */
-            if (memcmp(filesystems[i].magicbytes,
-                       (char*)&buf[filesystems[i].magicoffset],
-                       filesystems[i].magiclen) == 0) {
-                *type = filesystems[i].fstypename;
-                goto findhandler;
-            }
-        }
-
-        goto out;
+        } else if (!probe(buf, (size_t)buflen, stbuf.st_size,
+                          filesystems[i].flags))
+            continue;
+        candidate = i;
+        break;
     }
 
-findhandler:
+    if ((candidate < 0) && *type)
+        candidate = fallback;
 
-    for (i = 0; filesystems[i].fstypename != NULL; i++) {
-        if (strcasecmp(*type, filesystems[i].fstypename) == 0) {
-            /* If this has a non-zero magic length, must do magic too. */
-            if (filesystems[i].magiclen) {
-                if (memcmp(filesystems[i].magicbytes,
-                           (char*)&buf[filesystems[i].magicoffset],
-                           filesystems[i].magiclen) != 0) {
-                    /* not this one */
-                    continue;
-                }
-            }
-            char symb[255];
-            snprintf(symb, 255, "%s_%s", "unixfs",
-                     filesystems[i].fstypename_canonical);
-            void* impl = dlsym(RTLD_DEFAULT, symb);
-            if (impl != NULL) {
-                *unixfsp = (struct unixfs*)impl;
-                (*unixfsp)->flags = filesystems[i].flags;
-                break;
-            }
-        }
+    if (candidate < 0)
+        goto out;
+
+    char symb[255];
+    snprintf(symb, 255, "%s_%s", "unixfs",
+             filesystems[candidate].fstypename_canonical);
+    void* impl = dlsym(RTLD_DEFAULT, symb);
+    if (impl != NULL) {
+        *type = filesystems[candidate].fstypename;
+        *unixfsp = (struct unixfs*)impl;
+        (*unixfsp)->flags = filesystems[candidate].flags;
     }
 
 out:
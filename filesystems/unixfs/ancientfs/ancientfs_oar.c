@@ -18,14 +18,15 @@
 
 DECL_UNIXFS("UNIX Old ar", oar);
 
-static int ancientfs_ar_readheader(int fd, struct ar_hdr* ar);
+static int ancientfs_ar_readheader(struct unixfs_scanner* sc,
+                                   struct ar_hdr* ar);
 
 static int
-ancientfs_ar_readheader(int fd, struct ar_hdr* ar)
+ancientfs_ar_readheader(struct unixfs_scanner* sc, struct ar_hdr* ar)
 {
     ssize_t ret;
 
-    if ((ret = read(fd, ar, sizeof(struct ar_hdr)))
+    if ((ret = unixfs_scanner_read(sc, ar, sizeof(struct ar_hdr)))
                     != sizeof(struct ar_hdr)) {
         if (ret == 0) /* EOF */
             return 1;
@@ -138,13 +139,19 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
+    struct unixfs_scanner sc;
+
+    if ((err = unixfs_scanner_init(&sc, fd, (off_t)sizeof(uint16_t),
+                                   UNIXFS_SCANNER_CHUNKSIZE)) != 0)
+        goto out;
+
     char cnp[DIRSIZ + 1];
     struct ar_hdr ar;
     ino_t parent_ino = ROOTINO;
 
     for (;;) {
 
-        if (ancientfs_ar_readheader(fd, &ar) != 0)
+        if (ancientfs_ar_readheader(&sc, &ar) != 0)
             break;
 
         snprintf(cnp, DIRSIZ + 1, "%s", ar.ar_name);
@@ -169,7 +176,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
         struct ar_node_info* ai = (struct ar_node_info*)ip->I_private;
 
-        ip->I_daddr[0] = (uint32_t)lseek(fd, (off_t)0, SEEK_CUR);
+        ip->I_daddr[0] = (uint32_t)unixfs_scanner_tell(&sc);
 
         memcpy(ai->ar_name, cnp, strlen(cnp));
 
@@ -195,9 +202,11 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
         fs->s_lastino++;
 next:
-        (void)lseek(fd, (off_t)(ar.ar_size + (ar.ar_size & 1)), SEEK_CUR);
+        unixfs_scanner_skip(&sc, (off_t)(ar.ar_size + (ar.ar_size & 1)));
     }
 
+    unixfs_scanner_fini(&sc);
+
     unixfs->s_statvfs.f_bsize = BSIZE;
     unixfs->s_statvfs.f_frsize = BSIZE;
     unixfs->s_statvfs.f_ffree = 0;
@@ -438,3 +447,18 @@ unixfs_internal_statvfs(struct statvfs* svb)
     memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
     return 0;
 }
+
+int
+ancientfs_probe_oar(const char* buf, size_t buflen, off_t imagesize,
+                    uint32_t flags)
+{
+    uint16_t magic;
+
+    if (buflen < sizeof(magic))
+        return 0;
+
+    memcpy(&magic, buf, sizeof(magic));
+
+    return ((fs16_to_host(UNIXFS_FS_PDP, magic) == ARMAG) ||
+            (fs16_to_host(UNIXFS_FS_BIG, magic) == ARMAG));
+}
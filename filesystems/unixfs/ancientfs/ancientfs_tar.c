@@ -33,7 +33,8 @@ struct tar_entry {
     struct stat stat;
 };
 
-static int ancientfs_tar_readheader(int fd, struct tar_entry* te);
+static int ancientfs_tar_readheader(struct unixfs_scanner* sc,
+                                    struct tar_entry* te);
 static int ancientfs_tar_chksum(union hblock* hb);
 
 int
@@ -52,7 +53,7 @@ ancientfs_tar_chksum(union hblock* hb)
 }
 
 static int
-ancientfs_tar_readheader(int fd, struct tar_entry* te)
+ancientfs_tar_readheader(struct unixfs_scanner* sc, struct tar_entry* te)
 {
     static int cksum_failed = 0;
     int  nr, ustar;
@@ -63,7 +64,7 @@ ancientfs_tar_readheader(int fd, struct tar_entry* te)
 retry:
 
     ustar = unixfs->s_flags & ANCIENTFS_USTAR;
-    nr = read(fd, hb, sizeof(union hblock));
+    nr = unixfs_scanner_read(sc, hb, sizeof(union hblock));
     if (nr != sizeof(union hblock)) {
         if (!nr)
             return 1;
@@ -280,7 +281,12 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
-    lseek(fd, (off_t)0, SEEK_SET); /* rewind tape */
+    struct unixfs_scanner sc;
+
+    /* rewind tape */
+    if ((err = unixfs_scanner_init(&sc, fd, (off_t)0,
+                                   UNIXFS_SCANNER_CHUNKSIZE)) != 0)
+        goto out;
 
     struct tar_entry _te, *te = &_te;
 
@@ -288,12 +294,13 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
         off_t toseek = 0;
 
-        if ((err = ancientfs_tar_readheader(fd, te)) != 0) {
+        if ((err = ancientfs_tar_readheader(&sc, te)) != 0) {
             if (err == 1)
                 break;
             else {
                 fprintf(stderr,
                         "*** fatal error: cannot read block (error %d)\n", err);
+                unixfs_scanner_fini(&sc);
                 err = EIO;
                 goto out;
             }
@@ -373,7 +380,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                 ti->ti_linktargetname[namelen] = '\0';
             } else if (S_ISREG(ip->I_mode)) {
 
-                ip->I_daddr[0] = (uint32_t)lseek(fd, (off_t)0, SEEK_CUR);
+                ip->I_daddr[0] = (uint32_t)unixfs_scanner_tell(&sc);
                 toseek = ip->I_size;
 
             }
@@ -404,11 +411,13 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
         if (toseek) {
             toseek = (toseek + TBLOCK - 1)/TBLOCK;
             toseek *= TBLOCK;
-            (void)lseek(fd, (off_t)toseek, SEEK_CUR);
+            unixfs_scanner_skip(&sc, (off_t)toseek);
         }
 
     } /* for each block */
 
+    unixfs_scanner_fini(&sc);
+
     err = 0;
 
     unixfs->s_statvfs.f_bsize = TBLOCK;
@@ -680,3 +689,35 @@ unixfs_internal_statvfs(struct statvfs* svb)
     memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
     return 0;
 }
+
+/*
+ * ustar archives say so at offset 257. V7 tar archives carry no magic, so
+ * settle for a named first header whose checksum adds up.
+ */
+int
+ancientfs_probe_tar(const char* buf, size_t buflen, off_t imagesize,
+                    uint32_t flags)
+{
+    union hblock hb;
+
+    if (buflen < TBLOCK)
+        return 0;
+
+    memcpy(&hb, buf, TBLOCK);
+
+    if (memcmp(hb.dbuf.magic, TMAGIC, TMAGLEN - 1) == 0)
+        return 1;
+
+    if (hb.dbuf.name[0] == '\0')
+        return 0;
+
+    char cbuf[sizeof(hb.dbuf.chksum) + 1];
+    char* end;
+    memcpy(cbuf, hb.dbuf.chksum, sizeof(hb.dbuf.chksum));
+    cbuf[sizeof(hb.dbuf.chksum)] = '\0';
+    long chksum = strtol(cbuf, &end, 8);
+    if (end == cbuf)
+        return 0;
+
+    return (chksum == ancientfs_tar_chksum(&hb));
+}
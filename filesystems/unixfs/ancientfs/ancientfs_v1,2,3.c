@@ -18,6 +18,26 @@
 
 DECL_UNIXFS("UNIX V1/V2/V3", v123);
 
+/*
+ * A small file has up to eight direct blocks, a large one up to eight
+ * indirect blocks.
+ */
+static struct unixfs_bmap v123_bmap_small = {
+    .bm_nslots  = { 8, 0, 0, 0 },
+    .bm_ptrsize = sizeof(a_int),
+    .bm_nshift  = 8,
+    .bm_stride  = 1,
+    .bm_bread   = unixfs_internal_bread,
+};
+
+static struct unixfs_bmap v123_bmap_large = {
+    .bm_nslots  = { 0, 8, 0, 0 },
+    .bm_ptrsize = sizeof(a_int),
+    .bm_nshift  = 8,
+    .bm_stride  = 1,
+    .bm_bread   = unixfs_internal_bread,
+};
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -67,6 +87,8 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
     unixfs->s_flags = flags; 
     unixfs->s_endian = (fse == UNIXFS_FS_INVALID) ? UNIXFS_FS_PDP : fse;
+    v123_bmap_small.bm_endian = unixfs->s_endian;
+    v123_bmap_large.bm_endian = unixfs->s_endian;
     unixfs->s_fs_info = (void*)fs;
     unixfs->s_bdev = fd;
    
@@ -103,7 +125,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     unixfs->s_statvfs.f_favail = unixfs->s_statvfs.f_favail;
 
     /* must initialize the inode layer before sanity checking */
-    if ((err = unixfs_inodelayer_init(0)) != 0)
+    if ((err = unixfs_inodelayer_init(sizeof(struct v123_node_info))) != 0)
         goto out;
 
     if (unixfs_internal_sanitycheck(fs, stbuf.st_size) != 0) {
@@ -172,57 +194,22 @@ unixfs_internal_alloc(void)
 static off_t
 unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
 {
-    a_int bn = (a_int)lblkno;
-
-    if (bn & ~077777) {
-        *error = EFBIG;
-        return 0;
-    }
-
-    *error = EROFS;
+    struct v123_node_info* ni = (struct v123_node_info*)ip->I_private;
+    off_t count;
 
-    int ret;
-    a_int i, nb;
-    a_int* bap;
-    char ubuf[UNIXFS_IOSIZE(unixfs)];
-
-    if (((a_int)ip->I_mode & ILARG) == 0) {
-        /* small file algorithm */
-        if ((bn & ~7) != 0) /* convert small to large */
-            return 0; /* !writable */
-        nb = (a_int)(ip->I_daddr[bn]);
-        if (nb == 0)
-            return 0; /* !writable */
-        *error = 0;
-        return (off_t)nb;
-    }
-
-/* large: */
-
-    i = bn >> 8;
-    if (i >= 8) {
+    if (lblkno & ~077777) {
         *error = EFBIG;
         return 0;
     }
-    if ((nb = (a_int)(ip->I_daddr[i])) == 0)
-        return 0; /* !writable */
-    else {
-        ret = unixfs_internal_bread((off_t)nb, ubuf);
-        if (ret) {
-            *error = ret;
-            return 0;
-        }
-    }
-
-    bap = (a_int*)ubuf;
 
-    i = bn & 0377;
-    if ((nb = fs16_to_host(unixfs->s_endian, bap[i])) == 0)
-        return 0; /* !writable */
+    const struct unixfs_bmap* bm =
+        ((a_int)ip->I_mode & ILARG) ? &v123_bmap_large : &v123_bmap_small;
 
-    *error = 0;
+    off_t bn = unixfs_bmap(bm, ip, &ni->ni_bmap, lblkno, &count, error);
+    if ((bn == 0) && (*error == 0))
+        *error = EROFS; /* !writable */
 
-    return (off_t)nb;
+    return bn;
 }
 
 static int
@@ -146,4 +146,11 @@ struct dent {
     char  u_name[DIRSIZ]; /* component name */
 } __attribute__((packed));
 
+/*
+ * In-core inode private data: the block mapping cache (see unixfs_bmap()).
+ */
+struct v123_node_info {
+    struct unixfs_bmapcache ni_bmap;
+};
+
 #endif /* _ANCIENTFS_V123_H_ */
@@ -18,6 +18,43 @@
 
 DECL_UNIXFS("UNIX V4/V5/V6", v456);
 
+/*
+ * A small file has up to eight direct blocks. A large one has seven
+ * indirect blocks and, in the last address, a "huge" double indirect one.
+ */
+static struct unixfs_bmap v456_bmap_small = {
+    .bm_nslots  = { 8, 0, 0, 0 },
+    .bm_ptrsize = sizeof(a_int),
+    .bm_nshift  = 8,
+    .bm_stride  = 1,
+    .bm_bread   = unixfs_internal_bread,
+};
+
+static struct unixfs_bmap v456_bmap_large = {
+    .bm_nslots  = { 0, 7, 1, 0 },
+    .bm_ptrsize = sizeof(a_int),
+    .bm_nshift  = 8,
+    .bm_stride  = 1,
+    .bm_bread   = unixfs_internal_bread,
+};
+
+/* Here s_isize counts inode blocks only; the list starts at block 2. */
+static int
+v456_inuse(const void* dinode)
+{
+    const struct dinode* dip = (const struct dinode*)dinode;
+    return (dip->di_nlink != 0);
+}
+
+static struct unixfs_fsstat v456_fsstat = {
+    .fs_ifirst    = 2,
+    .fs_inodesize = sizeof(struct dinode),
+    .fs_inuse     = v456_inuse,
+    .fs_bread     = unixfs_internal_bread,
+    .fs_alloc     = unixfs_internal_alloc,
+    .fs_lock      = PTHREAD_MUTEX_INITIALIZER,
+};
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -67,6 +104,8 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
 
     unixfs->s_flags = flags; 
     unixfs->s_endian = (fse == UNIXFS_FS_INVALID) ? UNIXFS_FS_PDP : fse;
+    v456_bmap_small.bm_endian = unixfs->s_endian;
+    v456_bmap_large.bm_endian = unixfs->s_endian;
     unixfs->s_fs_info = (void*)fs;
     unixfs->s_bdev = fd;
    
@@ -85,7 +124,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     unixfs->s_statvfs.f_frsize = BSIZE;
 
     /* must initialize the inode layer before sanity checking */
-    if ((err = unixfs_inodelayer_init(0)) != 0)
+    if ((err = unixfs_inodelayer_init(sizeof(struct v456_node_info))) != 0)
         goto out;
 
     if (unixfs_internal_sanitycheck(fs, stbuf.st_size) != 0) {
@@ -97,37 +136,8 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
         }
     }
 
-    int iblock, INOPB = (BSIZE / sizeof(struct dinode));
-    unixfs->s_statvfs.f_files = 0;
-    unixfs->s_statvfs.f_ffree = 0;
-
-    char* ubuf = malloc(UNIXFS_IOSIZE(unixfs));
-    if (!ubuf) {
-        err = ENOMEM;
-        goto out;
-    }
-
-    for (iblock = 2; iblock < fs->s_isize + 2; iblock++) {
-        if (unixfs_internal_bread((off_t)iblock, ubuf) != 0)
-            continue;
-        struct dinode* dip = (struct dinode*)ubuf;
-        for (i = 0; i < INOPB; i++, dip++) {
-            if (dip->di_nlink == 0)
-                unixfs->s_statvfs.f_ffree++;
-            else
-                unixfs->s_statvfs.f_files++;
-        }
-    }
-
-    free(ubuf);
-
     unixfs->s_statvfs.f_blocks = fs->s_fsize;
-    unixfs->s_statvfs.f_bfree = 0;
-
-    while (unixfs_internal_alloc())
-        unixfs->s_statvfs.f_bfree++;
-
-    unixfs->s_statvfs.f_bavail = unixfs->s_statvfs.f_bfree;
+    v456_fsstat.fs_ilast = fs->s_isize + 2;
     unixfs->s_dentsize = DIRSIZ + 2;
     unixfs->s_statvfs.f_namemax = DIRSIZ;
 
@@ -213,76 +223,37 @@ nospace:
     return (off_t)0; /* ENOSPC */
 }
 
+/*
+ * Map a logical block, also returning in *count how many blocks starting
+ * with it follow one another on disk.
+ */
 static off_t
-unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
+unixfs_internal_bmaprun(struct inode* ip, off_t lblkno, off_t* count,
+                        int* error)
 {
-    a_int bn = (a_int)lblkno;
+    struct v456_node_info* ni = (struct v456_node_info*)ip->I_private;
 
-    if (bn & ~077777) {
+    if (lblkno & ~077777) {
         *error = EFBIG;
         return 0;
     }
 
-    *error = EROFS;
+    const struct unixfs_bmap* bm =
+        ((a_int)ip->I_mode & ILARG) ? &v456_bmap_large : &v456_bmap_small;
 
-    int ret;
-    a_int i, nb;
-    a_int* bap;
-    char ubuf[UNIXFS_IOSIZE(unixfs)];
+    off_t bn = unixfs_bmap(bm, ip, &ni->ni_bmap, lblkno, count, error);
+    if ((bn == 0) && (*error == 0))
+        *error = EROFS; /* !writable */
 
-    if (((a_int)ip->I_mode & ILARG) == 0) {
-        /* small file algorithm */
-        if ((bn & ~7) != 0) /* convert small to large */
-            return 0; /* !writable */
-        nb = (a_int)(ip->I_daddr[bn]);
-        if (nb == 0)
-            return 0; /* !writable */
-        *error = 0;
-        return (off_t)nb;
-    }
-
-/* large: */
-
-    i = bn >> 8;
-    if (bn & 0174000)
-        i = 7;
-    if ((nb = (a_int)(ip->I_daddr[i])) == 0)
-        return 0; /* !writable */
-    else {
-        ret = unixfs_internal_bread((off_t)nb, ubuf);
-        if (ret) {
-            *error = ret;
-            return 0;
-        }
-    }
-
-    bap = (a_int*)ubuf;
-
-    /* "huge" fetch of double indirect block */
-
-    if (i == 7) {
-        i = ((bn >> 8) & 0377) - 7;
-        if ((nb = fs16_to_host(unixfs->s_endian, bap[i])) == 0)
-            return 0; /* !writable */
-        else {
-            ret = unixfs_internal_bread((off_t)nb, ubuf);
-            if (ret) {
-                *error = ret;
-                return 0;
-            }
-            bap = (a_int*)ubuf;
-        }
-    }
-
-    /* normal indirect fetch */
-
-    *error = 0;
+    return bn;
+}
 
-    i = bn & 0377;
-    if ((nb = fs16_to_host(unixfs->s_endian, bap[i])) == 0)
-        return 0; /* !writable */
+static off_t
+unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
+{
+    off_t count;
 
-    return (off_t)nb;
+    return unixfs_internal_bmaprun(ip, lblkno, &count, error);
 }
 
 static int
@@ -353,7 +324,7 @@ unixfs_internal_iget(ino_t ino)
     int i;
 
     for (i = 0; i < 8; i++)
-        ip->I_daddr[i] = (a_int)fs16_to_host(unixfs->s_endian, dip->di_addr[i]);
+        ip->I_daddr[i] = fs16_to_host(unixfs->s_endian, dip->di_addr[i]);
 
     a_int newmode = ancientfs_v456_mode(ip->I_mode);
     if (S_ISCHR(newmode) || S_ISBLK(newmode)) {
@@ -494,19 +465,47 @@ unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
     size_t tomove = 0;
     ssize_t remaining = nbyte;
     ssize_t iosize = UNIXFS_IOSIZE(unixfs);
+    off_t fsize = ((struct filsys*)unixfs->s_fs_info)->s_fsize;
     char blkbuf[iosize];
     char* p = buf;
 
     while (remaining > 0) {
         off_t lbn = offset / BSIZE;
-        off_t bn = unixfs_internal_bmap(ip, lbn, error);
+        off_t run;
+        off_t bn = unixfs_internal_bmaprun(ip, lbn, &run, error);
         if (UNIXFS_BADBLOCK(bn, *error))
             break;
-        *error = unixfs_internal_bread(bn, blkbuf);
-        if (*error != 0)
-            break;
-        tomove = (remaining > iosize) ? iosize : remaining;
-        memcpy(p, blkbuf, tomove);
+
+        /*
+         * Whole blocks that also follow one another on the disk image are
+         * read straight into the caller's buffer with a single pread.
+         */
+        off_t nblks = 1;
+        if (bn != 0) {
+            nblks = run;
+            if (nblks > remaining / iosize)
+                nblks = remaining / iosize;
+            if (nblks > fsize - bn)
+                nblks = fsize - bn;
+            if (nblks < 1)
+                nblks = 1;
+        }
+
+        if (nblks > 1) {
+            tomove = nblks * iosize;
+            if (pread(unixfs->s_bdev, p, tomove, bn * (off_t)BSIZE) !=
+                (ssize_t)tomove) {
+                *error = EIO;
+                break;
+            }
+        } else {
+            *error = unixfs_internal_bread(bn, blkbuf);
+            if (*error != 0)
+                break;
+            tomove = (remaining > iosize) ? iosize : remaining;
+            memcpy(p, blkbuf, tomove);
+        }
+
         remaining -= tomove;
         done += tomove;
         offset += tomove;
@@ -580,6 +579,7 @@ unixfs_internal_sanitycheck(void* filsys, off_t disksize)
 static int
 unixfs_internal_statvfs(struct statvfs* svb)
 {
+    unixfs_fsstat(&v456_fsstat, unixfs);
     memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
     return 0;
 }
@@ -95,4 +95,11 @@ struct dent {
     char    u_name[DIRSIZ]; /* component name */
 } __attribute__((packed));
 
+/*
+ * In-core inode private data: the block mapping cache (see unixfs_bmap()).
+ */
+struct v456_node_info {
+    struct unixfs_bmapcache ni_bmap;
+};
+
 #endif /* _ANCIENTFS_V456_H_ */
@@ -135,4 +135,11 @@ struct fblk {
     a_daddr_t df_free[NICFREE];
 } __attribute__((packed));
 
+/*
+ * In-core inode private data: the block mapping cache (see unixfs_bmap()).
+ */
+struct v7_node_info {
+    struct unixfs_bmapcache ni_bmap;
+};
+
 #endif /* _ANCIENTFS_V7_H_ */
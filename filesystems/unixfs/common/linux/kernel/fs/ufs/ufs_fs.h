@@ -203,7 +203,7 @@ typedef __u16 __bitwise __fs16;
  * Cylinder group macros to locate things in cylinder groups.
  * They calc file system addresses of cylinder group data structures.
  */
-#define	ufs_cgbase(c)	(uspi->s_fpg * (c))
+#define	ufs_cgbase(c)	((u64)uspi->s_fpg * (c))
 #define ufs_cgstart(c)	((uspi)->fs_magic == UFS2_MAGIC ?  ufs_cgbase(c) : \
 	(ufs_cgbase(c)  + uspi->s_cgoffset * ((c) & ~uspi->s_cgmask)))
 #define	ufs_cgsblock(c)	(ufs_cgstart(c) + uspi->s_sblkno)	/* super blk */
@@ -18,10 +18,13 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <dlfcn.h>
+#include <sys/uio.h>
 
 #include <fuse/fuse_opt.h>
 #include <fuse/fuse_lowlevel.h>
 
+#include "fusetrace.h"
+
 #define UNIXFS_META_TIMEOUT 60.0 /* timeout for nodes and their attributes */
 
 static struct unixfs* unixfs = (struct unixfs*)0;
@@ -117,6 +120,7 @@ unixfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     memset(&b, 0, sizeof(b));
 
     struct unixfs_dirbuf dirbuf;
+    dirbuf.flags.initialized = 0;
 
     while (unixfs->ops->nextdirentry(dp, &dirbuf, &offset, &dent) == 0) {
 
@@ -243,11 +247,456 @@ static struct fuse_lowlevel_ops unixfs_ll_oper = {
     .read       = unixfs_ll_read,
 };
 
+#if (__FreeBSD__ >= 10)
+
+/*
+ * Batched message loop.
+ *
+ * If the kernel offers FUSE_MULTI_MESSAGE at INIT time, one read() on the
+ * device can return several requests back to back and one write() can carry
+ * several replies. libfuse knows nothing of this, so the loop below sits
+ * between it and the device: it splits each read into messages for
+ * fuse_session_process(), gathers the replies they produce, writes them out
+ * together once the read has been consumed, and adds the flag to libfuse's
+ * own INIT reply. The wire structures mirror fuse_kernel.h, which libfuse
+ * does not install.
+ *
+ * The loop also answers FUSE_READDIRPLUS itself (see unixfs_readdirplus())
+ * and consumes FUSE_BATCH_FORGET (see unixfs_batch_forget()), since libfuse
+ * has no such operations.
+ */
+
+#define UNIXFS_FUSE_INIT            26
+#define UNIXFS_FUSE_BATCH_FORGET    42
+#define UNIXFS_FUSE_READDIRPLUS     44
+#define UNIXFS_FUSE_DO_READDIRPLUS  (1 << 13)
+#define UNIXFS_FUSE_MULTI_MESSAGE   (1 << 27)
+#define UNIXFS_FUSE_BATCH_FORGETS   (1 << 28)
+#define UNIXFS_REPLYBUF_SIZE        (64 * 1024)
+
+struct unixfs_in_header {
+    uint32_t len;
+    uint32_t opcode;
+    uint64_t unique;
+    uint64_t nodeid;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t pid;
+    uint32_t padding;
+};
+
+struct unixfs_out_header {
+    uint32_t len;
+    int32_t  error;
+    uint64_t unique;
+};
+
+struct unixfs_init_in {
+    uint32_t major;
+    uint32_t minor;
+    uint32_t max_readahead;
+    uint32_t flags;
+};
+
+struct unixfs_init_out {
+    uint32_t major;
+    uint32_t minor;
+    uint32_t max_readahead;
+    uint32_t flags;
+    uint32_t unused;
+    uint32_t max_write;
+};
+
+struct unixfs_forget_one {
+    uint64_t nodeid;
+    uint64_t nlookup;
+};
+
+struct unixfs_batch_forget_in {
+    uint32_t count;
+    uint32_t dummy;
+};
+
+struct unixfs_read_in {
+    uint64_t fh;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t padding;
+};
+
+struct unixfs_attr {
+    uint64_t ino;
+    uint64_t size;
+    uint64_t blocks;
+    uint64_t atime;
+    uint64_t mtime;
+    uint64_t ctime;
+    uint64_t crtime;
+    uint32_t atimensec;
+    uint32_t mtimensec;
+    uint32_t ctimensec;
+    uint32_t crtimensec;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t rdev;
+    uint32_t flags;
+};
+
+struct unixfs_entry_out {
+    uint64_t nodeid;
+    uint64_t generation;
+    uint64_t entry_valid;
+    uint64_t attr_valid;
+    uint32_t entry_valid_nsec;
+    uint32_t attr_valid_nsec;
+    struct unixfs_attr attr;
+};
+
+struct unixfs_dirent {
+    uint64_t ino;
+    uint64_t off;
+    uint32_t namelen;
+    uint32_t type;
+    char     name[0];
+};
+
+struct unixfs_direntplus {
+    struct unixfs_entry_out entry_out;
+    struct unixfs_dirent    dirent;
+};
+
+#define UNIXFS_DIRENTPLUS_SIZE(namelen) \
+    ((offsetof(struct unixfs_direntplus, dirent.name) + (namelen) + 7) & ~7)
+
+struct unixfs_batch {
+    int      fd;
+    struct fusetrace* trace;
+    int      multi;       /* negotiated */
+    uint32_t offered;     /* INIT flags offered by the kernel that we take */
+    uint64_t init_unique; /* of the INIT request, until it is answered */
+    char*    buf;         /* gathered replies */
+    size_t   used;
+};
+
+static int
+unixfs_batch_flush(struct unixfs_batch* b)
+{
+    if (!b->used)
+        return 0;
+
+    ssize_t ret = write(b->fd, b->buf, b->used);
+    b->used = 0;
+
+    if (ret == -1 && errno != ENOENT) {
+        perror("fuse: writing device");
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int
+unixfs_batch_send(struct fuse_chan* ch, const struct iovec iov[], size_t count)
+{
+    struct unixfs_batch* b = (struct unixfs_batch*)fuse_chan_data(ch);
+    struct unixfs_out_header* out = (struct unixfs_out_header*)iov[0].iov_base;
+    size_t i, len = 0;
+
+    if (b->trace)
+        fusetrace_log_replies(b->trace, iov, count);
+
+    for (i = 0; i < count; i++)
+        len += iov[i].iov_len;
+
+    if (b->init_unique && out->unique == b->init_unique) {
+        b->init_unique = 0;
+        if (b->offered && !out->error && count > 1 &&
+            iov[1].iov_len >= offsetof(struct unixfs_init_out, unused)) {
+            ((struct unixfs_init_out*)iov[1].iov_base)->flags |= b->offered;
+            b->multi = (b->offered & UNIXFS_FUSE_MULTI_MESSAGE) != 0;
+        }
+    }
+
+    if (!b->multi || len > UNIXFS_REPLYBUF_SIZE) {
+        int error = unixfs_batch_flush(b);
+        if (error)
+            return error;
+        if (writev(b->fd, iov, (int)count) == -1) {
+            if (errno == ENOENT) /* the request was interrupted */
+                return 0;
+            perror("fuse: writing device");
+            return -errno;
+        }
+        return 0;
+    }
+
+    if (b->used + len > UNIXFS_REPLYBUF_SIZE) {
+        int error = unixfs_batch_flush(b);
+        if (error)
+            return error;
+    }
+
+    for (i = 0; i < count; i++) {
+        memcpy(b->buf + b->used, iov[i].iov_base, iov[i].iov_len);
+        b->used += iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+static void
+unixfs_batch_destroy(struct fuse_chan* ch)
+{
+    /* The device descriptor belongs to the channel from fuse_mount(). */
+}
+
+static void
+unixfs_fill_entry(struct unixfs_entry_out* e, struct stat* stbuf)
+{
+    e->nodeid           = stbuf->st_ino;
+    e->generation       = 0;
+    e->entry_valid      = (uint64_t)UNIXFS_META_TIMEOUT;
+    e->attr_valid       = (uint64_t)UNIXFS_META_TIMEOUT;
+    e->entry_valid_nsec = 0;
+    e->attr_valid_nsec  = 0;
+
+    e->attr.ino         = stbuf->st_ino;
+    e->attr.size        = stbuf->st_size;
+    e->attr.blocks      = stbuf->st_blocks;
+    e->attr.atime       = stbuf->st_atimespec.tv_sec;
+    e->attr.mtime       = stbuf->st_mtimespec.tv_sec;
+    e->attr.ctime       = stbuf->st_ctimespec.tv_sec;
+    e->attr.crtime      = stbuf->st_birthtimespec.tv_sec;
+    e->attr.atimensec   = (uint32_t)stbuf->st_atimespec.tv_nsec;
+    e->attr.mtimensec   = (uint32_t)stbuf->st_mtimespec.tv_nsec;
+    e->attr.ctimensec   = (uint32_t)stbuf->st_ctimespec.tv_nsec;
+    e->attr.crtimensec  = (uint32_t)stbuf->st_birthtimespec.tv_nsec;
+    e->attr.mode        = stbuf->st_mode;
+    e->attr.nlink       = stbuf->st_nlink;
+    e->attr.uid         = stbuf->st_uid;
+    e->attr.gid         = stbuf->st_gid;
+    e->attr.rdev        = stbuf->st_rdev;
+    e->attr.flags       = stbuf->st_flags;
+}
+
+/*
+ * FUSE_READDIRPLUS is a readdir whose entries also carry what a lookup of
+ * each name would have returned, which lets the kernel fill its name and
+ * attribute caches from the listing. The offset of each entry is the back
+ * end's directory offset just past it, so the next call picks up there and
+ * only the entries that go out are looked at. "." and ".." go out without a
+ * node ID, as the kernel doesn't take them as looked up.
+ */
+static void
+unixfs_readdirplus(struct fuse_chan* ch, struct unixfs_in_header* in)
+{
+    struct unixfs_read_in* arg = (struct unixfs_read_in*)(in + 1);
+    struct unixfs_out_header out;
+    struct iovec iov[2];
+    struct inode* dp = NULL;
+    struct stat stbuf;
+    struct unixfs_direntry dent;
+    struct unixfs_dirbuf dirbuf;
+    off_t offset, next;
+    char* buf = NULL;
+    size_t used = 0;
+    int error = 0;
+
+    if (in->len < sizeof(*in) + sizeof(*arg)) {
+        error = EINVAL;
+        goto reply;
+    }
+
+    if (!(dp = unixfs->ops->iget(in->nodeid))) {
+        error = ENOENT;
+        goto reply;
+    }
+
+    unixfs->ops->istat(dp, &stbuf);
+
+    if (!S_ISDIR(stbuf.st_mode)) {
+        error = ENOTDIR;
+        goto reply;
+    }
+
+    if (!(buf = (char*)malloc(arg->size ? arg->size : 1))) {
+        error = ENOMEM;
+        goto reply;
+    }
+
+    dirbuf.flags.initialized = 0;
+
+    for (offset = (off_t)arg->offset; ; offset = next) {
+
+        next = offset;
+        if (unixfs->ops->nextdirentry(dp, &dirbuf, &next, &dent) != 0)
+            break;
+
+        if (dent.ino == 0)
+            continue;
+
+        size_t namelen = strlen(dent.name);
+        size_t reclen = UNIXFS_DIRENTPLUS_SIZE(namelen);
+        if (used + reclen > arg->size)
+            break;
+
+        if (unixfs->ops->igetattr(dent.ino, &stbuf) != 0)
+            continue;
+
+        struct unixfs_direntplus* dep = (struct unixfs_direntplus*)(buf + used);
+        memset(dep, 0, reclen);
+
+        if (strcmp(dent.name, ".") != 0 && strcmp(dent.name, "..") != 0)
+            unixfs_fill_entry(&dep->entry_out, &stbuf);
+
+        dep->dirent.ino = stbuf.st_ino;
+        dep->dirent.off = (uint64_t)next;
+        dep->dirent.namelen = (uint32_t)namelen;
+        dep->dirent.type = (stbuf.st_mode & S_IFMT) >> 12;
+        memcpy(dep->dirent.name, dent.name, namelen);
+
+        used += reclen;
+    }
+
+reply:
+    if (dp)
+        unixfs->ops->iput(dp);
+
+    out.len = sizeof(out) + (error ? 0 : used);
+    out.error = -error;
+    out.unique = in->unique;
+
+    iov[0].iov_base = &out;
+    iov[0].iov_len = sizeof(out);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = used;
+
+    fuse_chan_send(ch, iov, (error || !used) ? 1 : 2);
+
+    free(buf);
+}
+
+/*
+ * FUSE_BATCH_FORGET carries a count and that many (nodeid, nlookup) pairs.
+ * unixfs doesn't hold inodes across requests (every operation does its own
+ * iget/iput), so there are no lookup counts to drop, and like FUSE_FORGET
+ * the message gets no reply. A malformed one is only reported.
+ */
+static void
+unixfs_batch_forget(struct unixfs_in_header* in)
+{
+    struct unixfs_batch_forget_in* arg =
+        (struct unixfs_batch_forget_in*)(in + 1);
+
+    if (in->len < sizeof(*in) + sizeof(*arg) ||
+        arg->count > (in->len - sizeof(*in) - sizeof(*arg)) /
+                     sizeof(struct unixfs_forget_one))
+        fprintf(stderr, "fuse: malformed batch forget\n");
+}
+
+static int
+unixfs_session_loop(struct fuse_session* se, struct fuse_chan* mch,
+                    struct fusetrace* trace)
+{
+    struct fuse_chan_ops ops = {
+        .receive = NULL,
+        .send    = unixfs_batch_send,
+        .destroy = unixfs_batch_destroy,
+    };
+
+    struct unixfs_batch b;
+    memset(&b, 0, sizeof(b));
+    b.fd = fuse_chan_fd(mch);
+    b.trace = trace;
+
+    size_t bufsize = fuse_chan_bufsize(mch);
+    char* buf = (char*)malloc(bufsize);
+    b.buf = (char*)malloc(UNIXFS_REPLYBUF_SIZE);
+    struct fuse_chan* ch = fuse_chan_new(&ops, b.fd, bufsize, &b);
+    if (!buf || !b.buf || !ch) {
+        fprintf(stderr, "fuse: failed to allocate read buffer\n");
+        free(buf);
+        free(b.buf);
+        return -1;
+    }
+
+    fuse_session_add_chan(se, ch);
+
+    int err = 0;
+
+    while (!fuse_session_exited(se)) {
+
+        ssize_t res = read(b.fd, buf, bufsize);
+        if (res == 0)
+            break;
+        if (res == -1) {
+            if (errno == EINTR || errno == EAGAIN || errno == ENOENT)
+                continue;
+            if (errno != ENODEV) {
+                perror("fuse: reading device");
+                err = -1;
+            }
+            break;
+        }
+
+        if (trace)
+            fusetrace_log_requests(trace, buf, res);
+
+        char* p = buf;
+
+        while (res > 0) {
+            struct unixfs_in_header* in = (struct unixfs_in_header*)p;
+            if ((size_t)res < sizeof(*in) || in->len < sizeof(*in) ||
+                in->len > (size_t)res) {
+                fprintf(stderr, "fuse: malformed message from device\n");
+                break;
+            }
+            if (in->opcode == UNIXFS_FUSE_INIT) {
+                struct unixfs_init_in* arg = (struct unixfs_init_in*)(in + 1);
+                b.init_unique = in->unique;
+                b.offered = 0;
+                if (in->len >= sizeof(*in) + sizeof(*arg))
+                    b.offered = arg->flags & (UNIXFS_FUSE_MULTI_MESSAGE |
+                                              UNIXFS_FUSE_DO_READDIRPLUS |
+                                              UNIXFS_FUSE_BATCH_FORGETS);
+            }
+            if (in->opcode == UNIXFS_FUSE_READDIRPLUS)
+                unixfs_readdirplus(ch, in);
+            else if (in->opcode == UNIXFS_FUSE_BATCH_FORGET)
+                unixfs_batch_forget(in);
+            else
+                fuse_session_process(se, p, in->len, ch);
+            p += in->len;
+            res -= in->len;
+        }
+
+        if (unixfs_batch_flush(&b) != 0) {
+            err = -1;
+            break;
+        }
+    }
+
+    fuse_chan_destroy(ch); /* also removes it from the session */
+    free(b.buf);
+    free(buf);
+
+    fuse_session_reset(se);
+
+    return err;
+}
+
+#endif /* __FreeBSD__ >= 10 */
+
 struct options {
     char* dmg;
     int   force;
     char* fsendian;
     char* type;
+    int   trustsb;
+    char* trace;
+    char* replay;
 } options;
 
 #define UNIXFS_OPT_KEY(t, p, v) { t, offsetof(struct options, p), v }
@@ -258,6 +707,9 @@ static struct fuse_opt unixfs_opts[] = {
     UNIXFS_OPT_KEY("--force", force, 1),
     UNIXFS_OPT_KEY("--fsendian %s", fsendian, 0),
     UNIXFS_OPT_KEY("--type %s", type, 0),
+    UNIXFS_OPT_KEY("--trustsb", trustsb, 1),
+    UNIXFS_OPT_KEY("--trace %s", trace, 0),
+    UNIXFS_OPT_KEY("--replay %s", replay, 0),
 
     FUSE_OPT_END
 };
@@ -296,6 +748,9 @@ main(int argc, char* argv[])
     if (options.force)
         unixfs->flags |= UNIXFS_FORCE;
 
+    if (options.trustsb)
+        unixfs->flags |= UNIXFS_TRUSTSB;
+
     unixfs->fsname = options.type; /* XXX quick fix */
 
     unixfs->fsendian = UNIXFS_FS_INVALID;
@@ -320,6 +775,30 @@ main(int argc, char* argv[])
         return -1;
     }
 
+    if (options.replay) {
+        /* Drive the lowlevel operations from a trace; nothing is mounted. */
+        struct fuse_args rargs = FUSE_ARGS_INIT(0, NULL);
+        fuse_opt_add_arg(&rargs, argv[0]);
+        struct fuse_session* se;
+        int err = -1;
+        se = fuse_lowlevel_new(&rargs, &unixfs_ll_oper, sizeof(unixfs_ll_oper),
+                               (void*)&unixfs);
+        if (se != NULL) {
+            err = fusetrace_replay(se, options.replay, stdout);
+            fuse_session_destroy(se);
+        }
+        fuse_opt_free_args(&rargs);
+        fuse_opt_free_args(&args);
+        return err ? 1 : 0;
+    }
+
+    struct fusetrace* trace = NULL;
+
+    if (options.trace && !(trace = fusetrace_open(options.trace))) {
+        perror(options.trace);
+        return -1;
+    }
+
     char extra_args[UNIXFS_ARGLEN] = { 0 };
     unixfs_postflight(unixfs->fsname, unixfs->volname, extra_args);
 
@@ -338,13 +817,27 @@ main(int argc, char* argv[])
             if ((err = fuse_daemonize(foregrounded)) == -1)
                 goto bailout;
             if (fuse_set_signal_handlers(se) != -1) {
-                fuse_session_add_chan(se, ch);
-                if (multithreaded)
-                    err = fuse_session_loop_mt(se);
-                else
-                    err = fuse_session_loop(se);
+#if (__FreeBSD__ >= 10)
+                if (!multithreaded) {
+                    err = unixfs_session_loop(se, ch, trace);
+                } else
+#endif
+                {
+                    struct fuse_chan* sch = ch;
+                    if (trace && !(sch = fusetrace_chan_new(ch, trace))) {
+                        fprintf(stderr, "failed to set up tracing\n");
+                        sch = ch;
+                    }
+                    fuse_session_add_chan(se, sch);
+                    if (multithreaded)
+                        err = fuse_session_loop_mt(se);
+                    else
+                        err = fuse_session_loop(se);
+                    fuse_session_remove_chan(sch);
+                    if (sch != ch)
+                        fuse_chan_destroy(sch);
+                }
                 fuse_remove_signal_handlers(se);
-                fuse_session_remove_chan(ch);
             }
 bailout:
             fuse_session_destroy(se);
@@ -354,5 +847,7 @@ bailout:
 
     fuse_opt_free_args(&args);
 
+    fusetrace_close(trace);
+
     return err ? 1 : 0;
 }
@@ -44,6 +44,7 @@ struct unixfs {
 /* flags */
 
 #define UNIXFS_FORCE           0x00000001 /* mount even if things look fishy */
+#define UNIXFS_TRUSTSB         0x00000002 /* take free counts from superblock */
 
 /* Our encapsulation of an Ancient Unix directory entry. */
 
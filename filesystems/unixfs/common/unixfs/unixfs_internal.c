@@ -17,6 +17,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 static int desirednodes = 65536;
 static pthread_mutex_t ihash_lock;
@@ -282,3 +284,765 @@ unixfs_inodelayer_dump(unixfs_inodelayer_iterator_t it)
 out:
     pthread_mutex_unlock(&ihash_lock);
 }
+
+struct namehash_entry {
+    LIST_ENTRY(namehash_entry) ne_link;
+    ino_t                      ne_parent;
+    ino_t                      ne_ino;
+    size_t                     ne_namelen;
+    char                       ne_name[];
+};
+
+static pthread_mutex_t nhash_lock;
+static LIST_HEAD(nhash_head, namehash_entry) *nhash_table = NULL;
+static u_long nhash_mask;
+
+static u_long
+unixfs_namehash_hash(ino_t parent, const char* name, size_t namelen)
+{
+    /* FNV-1a over the name, seeded with the parent inode number */
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)parent;
+    size_t i;
+    for (i = 0; i < namelen; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 1099511628211ULL;
+    }
+    return (u_long)(h ^ (h >> 32)) & nhash_mask;
+}
+
+int
+unixfs_namehash_init(void)
+{
+    if (pthread_mutex_init(&nhash_lock, (const pthread_mutexattr_t*)0)) {
+        fprintf(stderr, "failed to initialize the name hash lock\n");
+        return -1;
+    }
+
+    u_long i, hashsize;
+
+    for (hashsize = 1; hashsize <= desirednodes; hashsize <<= 1)
+            continue;
+
+    nhash_table = malloc(hashsize * sizeof(*nhash_table));
+    if (nhash_table == NULL) {
+        (void)pthread_mutex_destroy(&nhash_lock);
+        return -1;
+    }
+
+    for (i = 0; i < hashsize; i++)
+        LIST_INIT(&nhash_table[i]);
+    nhash_mask = hashsize - 1;
+
+    return 0;
+}
+
+void
+unixfs_namehash_fini(void)
+{
+    if (nhash_table == NULL)
+        return;
+
+    u_long i;
+    for (i = 0; i < (nhash_mask + 1); i++) {
+        struct namehash_entry* ne;
+        while ((ne = LIST_FIRST(&nhash_table[i])) != NULL) {
+            LIST_REMOVE(ne, ne_link);
+            free(ne);
+        }
+    }
+
+    free(nhash_table);
+    nhash_table = NULL;
+
+    (void)pthread_mutex_destroy(&nhash_lock);
+}
+
+int
+unixfs_namehash_add(ino_t parent, const char* name, size_t namelen, ino_t ino)
+{
+    if (nhash_table == NULL)
+        return EINVAL;
+
+    struct namehash_entry* ne = malloc(sizeof(*ne) + namelen);
+    if (ne == NULL)
+        return ENOMEM;
+
+    ne->ne_parent = parent;
+    ne->ne_ino = ino;
+    ne->ne_namelen = namelen;
+    memcpy(ne->ne_name, name, namelen);
+
+    pthread_mutex_lock(&nhash_lock);
+    LIST_INSERT_HEAD(&nhash_table[unixfs_namehash_hash(parent, name, namelen)],
+                     ne, ne_link);
+    pthread_mutex_unlock(&nhash_lock);
+
+    return 0;
+}
+
+ino_t
+unixfs_namehash_lookup(ino_t parent, const char* name, size_t namelen)
+{
+    ino_t ino = 0;
+    struct namehash_entry* ne;
+
+    pthread_mutex_lock(&nhash_lock);
+    LIST_FOREACH(ne,
+                 &nhash_table[unixfs_namehash_hash(parent, name, namelen)],
+                 ne_link) {
+        if ((ne->ne_parent == parent) && (ne->ne_namelen == namelen) &&
+            (memcmp(ne->ne_name, name, namelen) == 0)) {
+            ino = ne->ne_ino;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nhash_lock);
+
+    return ino;
+}
+
+int
+unixfs_scanner_init(struct unixfs_scanner* sc, int fd, off_t start,
+                    size_t chunksize)
+{
+    if (chunksize < UNIXFS_SCANNER_ALIGN)
+        chunksize = UNIXFS_SCANNER_ALIGN;
+
+    chunksize = (chunksize + UNIXFS_SCANNER_ALIGN - 1) &
+                    ~((size_t)UNIXFS_SCANNER_ALIGN - 1);
+
+    memset(sc, 0, sizeof(*sc));
+
+    void* buf = NULL;
+    if (posix_memalign(&buf, UNIXFS_SCANNER_ALIGN, chunksize) != 0)
+        return ENOMEM;
+
+    sc->sc_fd = fd;
+    sc->sc_buf = (char*)buf;
+    sc->sc_bufsize = chunksize;
+    sc->sc_buflen = 0;
+    sc->sc_bufoff = 0;
+    sc->sc_cursor = start;
+
+    return 0;
+}
+
+void
+unixfs_scanner_fini(struct unixfs_scanner* sc)
+{
+    if (sc->sc_buf)
+        free(sc->sc_buf);
+    sc->sc_buf = NULL;
+    sc->sc_bufsize = sc->sc_buflen = 0;
+}
+
+/*
+ * Make up to nbyte bytes at the cursor available in the chunk buffer and
+ * point *datap at them. The cursor is not advanced. Returns the number of
+ * bytes available (less than nbyte only at the end of the image), or -1 on
+ * error. The pointer is valid until the next peek/read on the scanner.
+ */
+ssize_t
+unixfs_scanner_peek(struct unixfs_scanner* sc, const void** datap,
+                    size_t nbyte)
+{
+    off_t cursor = sc->sc_cursor;
+
+    if ((cursor < sc->sc_bufoff) ||
+        ((cursor + (off_t)nbyte) > (sc->sc_bufoff + (off_t)sc->sc_buflen))) {
+
+        off_t base = cursor & ~((off_t)UNIXFS_SCANNER_ALIGN - 1);
+
+        if ((size_t)(cursor - base) + nbyte > sc->sc_bufsize) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        size_t done = 0;
+        while (done < sc->sc_bufsize) {
+            ssize_t ret = pread(sc->sc_fd, sc->sc_buf + done,
+                                sc->sc_bufsize - done, base + done);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                sc->sc_buflen = 0;
+                return -1;
+            }
+            if (ret == 0)
+                break;
+            done += ret;
+        }
+
+        sc->sc_bufoff = base;
+        sc->sc_buflen = done;
+    }
+
+    off_t avail = (sc->sc_bufoff + (off_t)sc->sc_buflen) - cursor;
+    if (avail < 0)
+        avail = 0;
+
+    *datap = sc->sc_buf + (cursor - sc->sc_bufoff);
+
+    return (ssize_t)min((size_t)avail, nbyte);
+}
+
+ssize_t
+unixfs_scanner_read(struct unixfs_scanner* sc, void* buf, size_t nbyte)
+{
+    const void* data;
+    ssize_t ret = unixfs_scanner_peek(sc, &data, nbyte);
+    if (ret > 0) {
+        memcpy(buf, data, ret);
+        sc->sc_cursor += ret;
+    }
+    return ret;
+}
+
+long
+unixfs_slotdir_find(const struct unixfs_slotdir* sd, const char* slots,
+                    size_t nbytes, const char* name, size_t namelen)
+{
+    uint64_t key = 0, mask = 0, w;
+    size_t plen, i;
+    const char* p;
+    const char* end = slots + nbytes;
+    size_t ntail = (namelen < sd->sd_namemax) ? 1 : 0; /* the NUL, if any */
+
+    if (namelen == 0 || namelen > sd->sd_namemax)
+        return -1;
+
+    /*
+     * Nearly every slot differs from the name somewhere in its first eight
+     * bytes (counting the NUL that ends a short name), so those are
+     * compared as a single word and the rest only on a hit.
+     */
+    plen = min(namelen + ntail, sizeof(key));
+    memcpy(&key, name, min(namelen, plen));
+    memset(&mask, 0xff, plen);
+
+    for (p = slots, i = 0; p + sd->sd_slotsize <= end;
+         p += sd->sd_slotsize, i++) {
+
+        const char* slotname = p + sd->sd_inosize;
+
+        memcpy(&w, slotname, sizeof(w));
+        if ((w & mask) != key)
+            continue;
+
+        if (namelen + ntail > plen) {
+            if (memcmp(slotname + plen, name + plen, namelen - plen) != 0)
+                continue;
+            if (ntail && slotname[namelen] != '\0')
+                continue;
+        }
+
+        size_t j;
+        for (j = 0; j < sd->sd_inosize; j++)
+            if (p[j])
+                return (long)i;
+    }
+
+    return -1;
+}
+
+#define DIRINDEX_BUCKETS 64
+#define DIRINDEX_MAXMEM  (4 * 1024 * 1024)
+
+struct dirindex_entry {
+    ino_t    de_ino;
+    uint32_t de_hash;
+    uint32_t de_nameoff;
+    uint32_t de_namelen;
+};
+
+struct unixfs_dirindex {
+    TAILQ_ENTRY(unixfs_dirindex) di_lru;
+    LIST_ENTRY(unixfs_dirindex)  di_link;
+    ino_t                        di_dir;
+    size_t                       di_memsize;
+    uint32_t                     di_count;
+    uint32_t                     di_capacity;
+    struct dirindex_entry*       di_entries;
+    uint32_t                     di_mask;
+    uint32_t*                    di_slots;   /* entry index + 1, 0 if free */
+    size_t                       di_namebytes;
+    size_t                       di_namecap;
+    char*                        di_names;
+};
+
+static pthread_mutex_t dindex_lock = PTHREAD_MUTEX_INITIALIZER;
+static TAILQ_HEAD(dindex_lru, unixfs_dirindex) dindex_lru =
+    TAILQ_HEAD_INITIALIZER(dindex_lru);
+static LIST_HEAD(, unixfs_dirindex) dindex_table[DIRINDEX_BUCKETS];
+static size_t dindex_memsize = 0;
+
+static uint32_t
+unixfs_dirindex_hash(const char* name, size_t namelen)
+{
+    uint32_t h = 2166136261U;
+    size_t i;
+    for (i = 0; i < namelen; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static void
+unixfs_dirindex_free(struct unixfs_dirindex* di)
+{
+    free(di->di_entries);
+    free(di->di_slots);
+    free(di->di_names);
+    free(di);
+}
+
+/* Must be called with dindex_lock held. */
+static struct unixfs_dirindex*
+unixfs_dirindex_find(ino_t dir)
+{
+    struct unixfs_dirindex* di;
+
+    LIST_FOREACH(di, &dindex_table[dir % DIRINDEX_BUCKETS], di_link) {
+        if (di->di_dir == dir) {
+            TAILQ_REMOVE(&dindex_lru, di, di_lru);
+            TAILQ_INSERT_HEAD(&dindex_lru, di, di_lru);
+            return di;
+        }
+    }
+
+    return NULL;
+}
+
+struct unixfs_dirindex*
+unixfs_dirindex_alloc(ino_t dir)
+{
+    struct unixfs_dirindex* di = calloc(1, sizeof(struct unixfs_dirindex));
+    if (di)
+        di->di_dir = dir;
+    return di;
+}
+
+int
+unixfs_dirindex_add(struct unixfs_dirindex* di, const char* name,
+                    size_t namelen, ino_t ino)
+{
+    if (di->di_count == di->di_capacity) {
+        uint32_t newcap = di->di_capacity ? di->di_capacity * 2 : 256;
+        void* p = realloc(di->di_entries,
+                          newcap * sizeof(struct dirindex_entry));
+        if (!p)
+            return ENOMEM;
+        di->di_entries = p;
+        di->di_capacity = newcap;
+    }
+
+    if (di->di_namebytes + namelen > di->di_namecap) {
+        size_t newcap = di->di_namecap ? di->di_namecap * 2 : 4096;
+        while (newcap < di->di_namebytes + namelen)
+            newcap *= 2;
+        void* p = realloc(di->di_names, newcap);
+        if (!p)
+            return ENOMEM;
+        di->di_names = p;
+        di->di_namecap = newcap;
+    }
+
+    struct dirindex_entry* de = &di->di_entries[di->di_count++];
+    de->de_ino = ino;
+    de->de_hash = unixfs_dirindex_hash(name, namelen);
+    de->de_nameoff = (uint32_t)di->di_namebytes;
+    de->de_namelen = (uint32_t)namelen;
+    memcpy(di->di_names + di->di_namebytes, name, namelen);
+    di->di_namebytes += namelen;
+
+    return 0;
+}
+
+void
+unixfs_dirindex_abort(struct unixfs_dirindex* di)
+{
+    unixfs_dirindex_free(di);
+}
+
+int
+unixfs_dirindex_commit(struct unixfs_dirindex* di)
+{
+    uint32_t i, nslots;
+
+    for (nslots = 64; nslots < di->di_count * 2; nslots <<= 1)
+        continue;
+
+    di->di_slots = calloc(nslots, sizeof(uint32_t));
+    if (!di->di_slots) {
+        unixfs_dirindex_free(di);
+        return ENOMEM;
+    }
+    di->di_mask = nslots - 1;
+
+    /* Linear probing keeps the first of any duplicate names in front. */
+    for (i = 0; i < di->di_count; i++) {
+        uint32_t slot = di->di_entries[i].de_hash & di->di_mask;
+        while (di->di_slots[slot])
+            slot = (slot + 1) & di->di_mask;
+        di->di_slots[slot] = i + 1;
+    }
+
+    di->di_memsize = sizeof(struct unixfs_dirindex) + di->di_namecap +
+                     (di->di_capacity * sizeof(struct dirindex_entry)) +
+                     (nslots * sizeof(uint32_t));
+
+    if (di->di_memsize > DIRINDEX_MAXMEM) {
+        unixfs_dirindex_free(di);
+        return EFBIG;
+    }
+
+    struct unixfs_dirindex* victim;
+    TAILQ_HEAD(, unixfs_dirindex) victims = TAILQ_HEAD_INITIALIZER(victims);
+
+    pthread_mutex_lock(&dindex_lock);
+
+    if (unixfs_dirindex_find(di->di_dir) != NULL) { /* lost a race */
+        pthread_mutex_unlock(&dindex_lock);
+        unixfs_dirindex_free(di);
+        return 0;
+    }
+
+    while (dindex_memsize + di->di_memsize > DIRINDEX_MAXMEM &&
+           (victim = TAILQ_LAST(&dindex_lru, dindex_lru)) != NULL) {
+        TAILQ_REMOVE(&dindex_lru, victim, di_lru);
+        LIST_REMOVE(victim, di_link);
+        dindex_memsize -= victim->di_memsize;
+        TAILQ_INSERT_TAIL(&victims, victim, di_lru);
+    }
+
+    TAILQ_INSERT_HEAD(&dindex_lru, di, di_lru);
+    LIST_INSERT_HEAD(&dindex_table[di->di_dir % DIRINDEX_BUCKETS], di,
+                     di_link);
+    dindex_memsize += di->di_memsize;
+
+    pthread_mutex_unlock(&dindex_lock);
+
+    while ((victim = TAILQ_FIRST(&victims)) != NULL) {
+        TAILQ_REMOVE(&victims, victim, di_lru);
+        unixfs_dirindex_free(victim);
+    }
+
+    return 0;
+}
+
+int
+unixfs_dirindex_lookup(ino_t dir, const char* name, size_t namelen,
+                       ino_t* ino)
+{
+    struct unixfs_dirindex* di;
+    uint32_t hash = unixfs_dirindex_hash(name, namelen);
+
+    *ino = 0;
+
+    pthread_mutex_lock(&dindex_lock);
+
+    if ((di = unixfs_dirindex_find(dir)) == NULL) {
+        pthread_mutex_unlock(&dindex_lock);
+        return ENOENT;
+    }
+
+    uint32_t slot = hash & di->di_mask, idx;
+    while ((idx = di->di_slots[slot]) != 0) {
+        struct dirindex_entry* de = &di->di_entries[idx - 1];
+        if (de->de_hash == hash && de->de_namelen == namelen &&
+            memcmp(di->di_names + de->de_nameoff, name, namelen) == 0) {
+            *ino = de->de_ino;
+            break;
+        }
+        slot = (slot + 1) & di->di_mask;
+    }
+
+    pthread_mutex_unlock(&dindex_lock);
+
+    return 0;
+}
+
+void
+unixfs_dirindex_fini(void)
+{
+    struct unixfs_dirindex* di;
+
+    pthread_mutex_lock(&dindex_lock);
+    while ((di = TAILQ_FIRST(&dindex_lru)) != NULL) {
+        TAILQ_REMOVE(&dindex_lru, di, di_lru);
+        LIST_REMOVE(di, di_link);
+        unixfs_dirindex_free(di);
+    }
+    dindex_memsize = 0;
+    pthread_mutex_unlock(&dindex_lock);
+}
+
+/* Block mapping */
+
+/*
+ * Indirect blocks are cached in a small direct-mapped table shared by all
+ * inodes rather than per inode: a copy of the last block read at every
+ * height would cost each in-core inode 12 KiB, most of it for files that
+ * have no indirect blocks at all. A slot is keyed by the mapping that read
+ * the block and its address.
+ */
+#define BMAP_NCACHE 64 /* power of two */
+
+struct unixfs_bmap_indir {
+    const struct unixfs_bmap* bi_bmap; /* NULL if the slot is empty */
+    off_t                     bi_blkno;
+    char                      bi_data[UNIXFS_BMAP_MAXBSIZE];
+};
+
+static struct unixfs_bmap_indir bmap_indir[BMAP_NCACHE];
+
+/*
+ * One lock covers every inode's mapping cache and the indirect block cache.
+ * It is held only while looking at or updating a cache; indirect blocks are
+ * read without it.
+ */
+static pthread_mutex_t bmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline off_t
+unixfs_bmap_ptr(const struct unixfs_bmap* bm, const char* blk, off_t i)
+{
+    if (bm->bm_ptrsize == sizeof(uint16_t))
+        return (off_t)fs16_to_host(bm->bm_endian, ((const uint16_t*)blk)[i]);
+    else
+        return (off_t)fs32_to_host(bm->bm_endian, ((const uint32_t*)blk)[i]);
+}
+
+/*
+ * Number of pointers, starting with pointer i of the n in an indirect block
+ * (or in the inode's I_daddr[] if blk is NULL), that either all address
+ * blocks following one another on disk or are all zero.
+ */
+static off_t
+unixfs_bmap_runlen(const struct unixfs_bmap* bm, const char* blk,
+                   const uint32_t* daddr, off_t i, off_t n)
+{
+    off_t first = blk ? unixfs_bmap_ptr(bm, blk, i) : (off_t)daddr[i];
+    off_t j;
+
+    for (j = i + 1; j < n; j++) {
+        off_t next = blk ? unixfs_bmap_ptr(bm, blk, j) : (off_t)daddr[j];
+        if (first == 0) {
+            if (next != 0)
+                break;
+        } else if (next != first + (j - i) * bm->bm_stride)
+            break;
+    }
+
+    return j - i;
+}
+
+/*
+ * Fetch pointer i of the indirect block nb, going through the shared cache
+ * of indirect blocks. If run is not NULL, also return the length of the run
+ * that starts at pointer i.
+ */
+static int
+unixfs_bmap_indirect(const struct unixfs_bmap* bm, off_t nb, off_t i,
+                     off_t* bnp, off_t* run)
+{
+    uint32_t ubuf[UNIXFS_BMAP_MAXBSIZE / sizeof(uint32_t)];
+    size_t bsize = (size_t)bm->bm_ptrsize << bm->bm_nshift;
+    off_t nindir = (off_t)1 << bm->bm_nshift;
+    struct unixfs_bmap_indir* bi =
+        &bmap_indir[(size_t)nb & (BMAP_NCACHE - 1)];
+
+    pthread_mutex_lock(&bmap_lock);
+    if ((bi->bi_bmap == bm) && (bi->bi_blkno == nb)) {
+        *bnp = unixfs_bmap_ptr(bm, bi->bi_data, i);
+        if (run)
+            *run = unixfs_bmap_runlen(bm, bi->bi_data, NULL, i, nindir);
+        pthread_mutex_unlock(&bmap_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&bmap_lock);
+
+    int ret = bm->bm_bread(nb + bm->bm_base, (char*)ubuf);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&bmap_lock);
+    memcpy(bi->bi_data, ubuf, bsize);
+    bi->bi_bmap = bm;
+    bi->bi_blkno = nb;
+    pthread_mutex_unlock(&bmap_lock);
+
+    *bnp = unixfs_bmap_ptr(bm, (char*)ubuf, i);
+    if (run)
+        *run = unixfs_bmap_runlen(bm, (char*)ubuf, NULL, i, nindir);
+
+    return 0;
+}
+
+off_t
+unixfs_bmap(const struct unixfs_bmap* bm, struct inode* ip,
+            struct unixfs_bmapcache* bc, off_t lbn, off_t* count, int* error)
+{
+    off_t bn = lbn, nb, span = 1, run = 1;
+    uint32_t slot = 0;
+    int level;
+
+    *count = 0;
+
+    if (lbn < 0) {
+        *error = EFBIG;
+        return (off_t)0;
+    }
+
+    if (((size_t)bm->bm_ptrsize << bm->bm_nshift) > UNIXFS_BMAP_MAXBSIZE) {
+        *error = EINVAL;
+        return (off_t)0;
+    }
+
+    pthread_mutex_lock(&bmap_lock);
+    if ((bc->bc_count != 0) && (lbn >= bc->bc_lbn) &&
+        (lbn - bc->bc_lbn < bc->bc_count)) {
+        off_t skip = lbn - bc->bc_lbn;
+        nb = (bc->bc_pbn) ? bc->bc_pbn + skip : 0;
+        *count = bc->bc_count - skip;
+        pthread_mutex_unlock(&bmap_lock);
+        *error = 0;
+        return nb;
+    }
+    pthread_mutex_unlock(&bmap_lock);
+
+    /*
+     * Find the level of indirection that covers the block, and the I_daddr[]
+     * slot within that level. Each slot at a level maps span blocks.
+     */
+
+    for (level = 0; level <= UNIXFS_BMAP_NLEVELS; level++) {
+        off_t n = (off_t)bm->bm_nslots[level] * span;
+        if (bn < n)
+            break;
+        bn -= n;
+        slot += bm->bm_nslots[level];
+        span <<= bm->bm_nshift;
+    }
+
+    if (level > UNIXFS_BMAP_NLEVELS) {
+        *error = EFBIG;
+        return (off_t)0;
+    }
+
+    slot += (uint32_t)(bn / span);
+    bn %= span;
+
+    if (level == 0) {
+        nb = (off_t)ip->I_daddr[slot];
+        run = unixfs_bmap_runlen(bm, NULL, ip->I_daddr, slot,
+                                 bm->bm_nslots[0]);
+        goto found;
+    }
+
+    /*
+     * Walk down through the indirect blocks. A missing block anywhere on the
+     * way is a hole as big as the part of the file it would have mapped.
+     */
+
+    nb = (off_t)ip->I_daddr[slot];
+
+    for (; level > 0; level--) {
+        if (nb == 0) {
+            run = span - bn;
+            goto found;
+        }
+        span >>= bm->bm_nshift;
+        off_t i = bn / span;
+        bn %= span;
+        int ret = unixfs_bmap_indirect(bm, nb, i, &nb,
+                                       (level == 1) ? &run : NULL);
+        if (ret) {
+            *error = ret;
+            return (off_t)0;
+        }
+    }
+
+found:
+    if (nb != 0)
+        nb += bm->bm_base;
+
+    pthread_mutex_lock(&bmap_lock);
+    bc->bc_lbn = lbn;
+    bc->bc_pbn = nb;
+    bc->bc_count = run;
+    pthread_mutex_unlock(&bmap_lock);
+
+    *count = run;
+    *error = 0;
+
+    return nb;
+}
+
+/* Lazy statistics */
+
+void
+unixfs_fsstat(struct unixfs_fsstat* fst, struct super_block* sb)
+{
+    pthread_mutex_lock(&fst->fs_lock);
+
+    if (fst->fs_valid) {
+        pthread_mutex_unlock(&fst->fs_lock);
+        return;
+    }
+
+    struct statvfs* svb = &sb->s_statvfs;
+    size_t bsize = (size_t)svb->f_frsize;
+    size_t inopb = bsize / fst->fs_inodesize;
+    size_t chunksize = min((size_t)(fst->fs_ilast - fst->fs_ifirst) * bsize,
+                           (size_t)UNIXFS_SCANNER_CHUNKSIZE);
+    char* blkbuf = malloc(bsize);
+    struct unixfs_scanner sc;
+    off_t iblock;
+    size_t i;
+
+    svb->f_files = 0;
+    svb->f_ffree = 0;
+
+    if (blkbuf && unixfs_scanner_init(&sc, sb->s_bdev,
+                                      fst->fs_ifirst * (off_t)bsize,
+                                      chunksize) == 0) {
+        for (iblock = fst->fs_ifirst; iblock < fst->fs_ilast; iblock++) {
+            const void* data;
+            if (unixfs_scanner_peek(&sc, &data, bsize) != (ssize_t)bsize) {
+                /*
+                 * The chunk around this block can't be read in one go.
+                 * Read just this block, and skip it if that fails too.
+                 */
+                if (fst->fs_bread(iblock, blkbuf) != 0) {
+                    unixfs_scanner_skip(&sc, (off_t)bsize);
+                    continue;
+                }
+                data = blkbuf;
+            }
+            const char* dip = (const char*)data;
+            for (i = 0; i < inopb; i++, dip += fst->fs_inodesize) {
+                if (fst->fs_inuse(dip))
+                    svb->f_files++;
+                else
+                    svb->f_ffree++;
+            }
+            unixfs_scanner_skip(&sc, (off_t)bsize);
+        }
+        unixfs_scanner_fini(&sc);
+    }
+
+    if (blkbuf)
+        free(blkbuf);
+
+    svb->f_bfree = 0;
+
+    while (fst->fs_alloc())
+        svb->f_bfree++;
+
+    svb->f_bavail = svb->f_bfree;
+
+    fst->fs_valid = 1;
+
+    pthread_mutex_unlock(&fst->fs_lock);
+}
@@ -183,6 +183,181 @@ void          unixfs_inodelayer_isucceeded(struct inode* ip);
 void          unixfs_inodelayer_ifailed(struct inode* ip);
 void          unixfs_inodelayer_dump(unixfs_inodelayer_iterator_t);
 
+/*
+ * Name hash interface.
+ *
+ * Backends that synthesize their directory tree in memory (tape and archive
+ * formats) keep children on a singly-linked sibling list. The name hash maps
+ * { parent inode, component name } to the child's inode number so that
+ * lookups--including those done while building the tree at mount time--do
+ * not have to walk the sibling list.
+ */
+
+int   unixfs_namehash_init(void);
+void  unixfs_namehash_fini(void);
+int   unixfs_namehash_add(ino_t parent, const char* name, size_t namelen,
+                          ino_t ino);
+ino_t unixfs_namehash_lookup(ino_t parent, const char* name, size_t namelen);
+
+/*
+ * Sequential scanner interface.
+ *
+ * Archive and tape formats (tar, cpio, ar, dump, ...) are laid out as a
+ * stream of headers, each followed by member data that we only need to skip
+ * over at mount time. Rather than issuing a read() for every header and an
+ * lseek() for every member, the scanner reads the image in large aligned
+ * chunks, hands out pointers into its buffer, and skips data by simply
+ * moving its cursor.
+ */
+
+#define UNIXFS_SCANNER_CHUNKSIZE (1024 * 1024)
+#define UNIXFS_SCANNER_ALIGN     4096
+
+struct unixfs_scanner {
+    int     sc_fd;
+    char*   sc_buf;     /* UNIXFS_SCANNER_ALIGN-aligned chunk buffer */
+    size_t  sc_bufsize; /* capacity of sc_buf */
+    size_t  sc_buflen;  /* valid bytes in sc_buf */
+    off_t   sc_bufoff;  /* image offset of sc_buf[0] */
+    off_t   sc_cursor;  /* image offset of the next unconsumed byte */
+};
+
+int     unixfs_scanner_init(struct unixfs_scanner* sc, int fd, off_t start,
+                            size_t chunksize);
+void    unixfs_scanner_fini(struct unixfs_scanner* sc);
+ssize_t unixfs_scanner_peek(struct unixfs_scanner* sc, const void** datap,
+                            size_t nbyte);
+ssize_t unixfs_scanner_read(struct unixfs_scanner* sc, void* buf,
+                            size_t nbyte);
+
+static inline void
+unixfs_scanner_skip(struct unixfs_scanner* sc, off_t nbyte)
+{
+    sc->sc_cursor += nbyte;
+}
+
+static inline void
+unixfs_scanner_seek(struct unixfs_scanner* sc, off_t offset)
+{
+    sc->sc_cursor = offset;
+}
+
+static inline off_t
+unixfs_scanner_tell(struct unixfs_scanner* sc)
+{
+    return sc->sc_cursor;
+}
+
+/*
+ * Fixed-slot directory interface.
+ *
+ * System V and Minix directories are arrays of fixed-size slots: an inode
+ * number, zero in a free slot, followed by a name of at most namemax bytes
+ * that is NUL-terminated only when shorter than that. unixfs_slotdir_find()
+ * returns the index of the first live slot matching a name, or -1. namemax
+ * must be at least 8.
+ *
+ * Lookups in large directories can go through a directory index instead:
+ * the backend feeds every entry of the directory to a fresh index once and
+ * commits it, after which unixfs_dirindex_lookup() answers with a hash probe
+ * (returning ENOENT if the directory has no index). Indexes are kept for
+ * the most recently used directories, within a fixed memory budget.
+ */
+
+struct unixfs_slotdir {
+    size_t sd_slotsize; /* bytes per slot */
+    size_t sd_inosize;  /* bytes of inode number at the start of a slot */
+    size_t sd_namemax;  /* bytes of name following the inode number */
+};
+
+long unixfs_slotdir_find(const struct unixfs_slotdir* sd, const char* slots,
+                         size_t nbytes, const char* name, size_t namelen);
+
+#define UNIXFS_DIRINDEX_MINSIZE 4096 /* directories smaller than this scan */
+
+struct unixfs_dirindex;
+
+struct unixfs_dirindex* unixfs_dirindex_alloc(ino_t dir);
+int  unixfs_dirindex_add(struct unixfs_dirindex* di, const char* name,
+                         size_t namelen, ino_t ino);
+int  unixfs_dirindex_commit(struct unixfs_dirindex* di);
+void unixfs_dirindex_abort(struct unixfs_dirindex* di);
+int  unixfs_dirindex_lookup(ino_t dir, const char* name, size_t namelen,
+                            ino_t* ino);
+void unixfs_dirindex_fini(void);
+
+/*
+ * Block mapping interface.
+ *
+ * The classic Unix inode addresses its data through a handful of direct
+ * block pointers followed by single, double and triple indirect ones. The
+ * backends that use this scheme differ only in the details, which a
+ * struct unixfs_bmap describes: how many of the inode's I_daddr[] slots
+ * (host order) sit at each level of indirection, the width and byte order
+ * of the pointers in indirect blocks, how many of them fit in a block, how
+ * far apart on disk two consecutive blocks of a file are when laid out
+ * contiguously, and a base that is added to every address.
+ *
+ * unixfs_bmap() maps a logical block of an inode to a physical one, zero
+ * for a hole, and also reports in *count how many blocks starting there
+ * are laid out contiguously (or are all holes). Each inode carries a
+ * struct unixfs_bmapcache that remembers the last run it mapped, and
+ * recently read indirect blocks are kept in a small cache shared by all
+ * inodes, so sequential access rarely goes to disk for metadata at all.
+ */
+
+#define UNIXFS_BMAP_NLEVELS  3    /* direct, plus up to triple indirect */
+#define UNIXFS_BMAP_MAXBSIZE 4096 /* largest indirect block */
+
+struct unixfs_bmap {
+    uint32_t    bm_nslots[UNIXFS_BMAP_NLEVELS + 1]; /* I_daddr[] per level */
+    uint32_t    bm_ptrsize;  /* bytes per pointer in an indirect block */
+    uint32_t    bm_nshift;   /* log2(pointers per indirect block) */
+    uint32_t    bm_stride;   /* address units per block */
+    fs_endian_t bm_endian;   /* byte order of indirect blocks */
+    off_t       bm_base;     /* added to every block address */
+    int       (*bm_bread)(off_t blkno, char* blkbuf);
+};
+
+struct unixfs_bmapcache {
+    off_t bc_lbn;   /* last run mapped: first logical block */
+    off_t bc_pbn;   /* its physical block, 0 for a hole */
+    off_t bc_count; /* its length in blocks, 0 if none */
+};
+
+off_t unixfs_bmap(const struct unixfs_bmap* bm, struct inode* ip,
+                  struct unixfs_bmapcache* bc, off_t lbn, off_t* count,
+                  int* error);
+
+/*
+ * Lazy statistics interface.
+ *
+ * Counting allocated inodes means reading the whole inode list, and counting
+ * free blocks means walking the whole free list. Neither is needed to mount,
+ * so backends with a classic inode list describe it in a struct
+ * unixfs_fsstat and call unixfs_fsstat() from their statvfs handler. The
+ * first call fills in f_files, f_ffree, f_bfree and f_bavail of the super
+ * block's statvfs, reading the inode list in large sequential chunks; later
+ * calls return right away.
+ *
+ * fs_inuse() tells whether an on-disk inode is allocated. fs_alloc() is the
+ * backend's free-list walker: it pops a free block off the in-memory super
+ * block and returns it, or 0 once the list is exhausted.
+ */
+
+struct unixfs_fsstat {
+    off_t           fs_ifirst;    /* first block of the inode list */
+    off_t           fs_ilast;     /* block just past the inode list */
+    size_t          fs_inodesize; /* bytes per on-disk inode */
+    int           (*fs_inuse)(const void* dinode);
+    int           (*fs_bread)(off_t blkno, char* blkbuf);
+    off_t         (*fs_alloc)(void);
+    pthread_mutex_t fs_lock;
+    int             fs_valid;
+};
+
+void unixfs_fsstat(struct unixfs_fsstat* fst, struct super_block* sb);
+
 /* Byte Swappers */
 
 #define cpu_to_le32(x) OSSwapHostToLittleInt32(x)
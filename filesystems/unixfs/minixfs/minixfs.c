@@ -21,60 +21,58 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 
-static unsigned long count_free(struct buffer_head*[], unsigned, __u32);
-static unsigned long minix_count_free_blocks(struct minix_sb_info*);
+static unsigned long count_free(const char*, unsigned long, __u32);
+static unsigned long minix_count_free_blocks(struct super_block*);
 static struct minix_inode*  minix_V1_raw_inode(struct super_block*, ino_t,
                                                struct buffer_head**);
 static struct minix2_inode* minix_V2_raw_inode(struct super_block*, ino_t,
                                                struct buffer_head**);
-static unsigned long minix_count_free_inodes(struct minix_sb_info*);
+static unsigned long minix_count_free_inodes(struct super_block*);
 static int           minix_iget_v1(struct super_block*, struct inode*);
 static int           minix_iget_v2(struct super_block*, struct inode*);
 static unsigned      minix_last_byte(struct inode*, unsigned long);
 static int           minix_get_dirpage(struct inode*, sector_t, char*);
 static ino_t         minix_find_entry(struct inode*, const char*);
 
-extern int           minix_get_block_v1(struct inode*, sector_t, off_t*);
-extern int           minix_get_block_v2(struct inode*, sector_t, off_t*);
-
-static const int nibblemap[] = { 4,3,3,2,3,2,2,1,3,2,2,1,2,1,1,0 };
+static inline unsigned
+minix_popcount32(__u32 w)
+{
+    w = w - ((w >> 1) & 0x55555555);
+    w = (w & 0x33333333) + ((w >> 2) & 0x33333333);
+    return (((w + (w >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+}
 
+/*
+ * Counts the clear bits among the first numbits bits of a bitmap that is
+ * numbytes long, a 32-bit word at a time. Bit n of the map is bit (n % 32)
+ * of host word (n / 32), as with minix_set_bit(), so the trailing partial
+ * word just needs its low bits masked.
+ */
 static unsigned long
-count_free(struct buffer_head* map[], unsigned numblocks, __u32 numbits)
+count_free(const char* map, unsigned long numbytes, __u32 numbits)
 {
-    unsigned i, j, sum = 0;
-    struct buffer_head* bh;
-  
-    for (i = 0; i < numblocks - 1; i++) {
-        if (!(bh = map[i])) 
-            return 0;
-        for (j = 0; j < bh->b_size; j++)
-            sum += nibblemap[bh->b_data[j] & 0xf]
-                + nibblemap[(bh->b_data[j] >> 4) & 0xf];
-    }
+    const __u32* words = (const __u32*)map;
+    unsigned long i, nwords, sum = 0;
 
-    if (numblocks == 0 || !(bh = map[numblocks - 1]))
-        return 0;
+    if (numbits > numbytes * 8) /* don't walk off a bad superblock */
+        numbits = numbytes * 8;
 
-    i = ((numbits - (numblocks - 1) * bh->b_size * 8) / 16) * 2;
-    for (j = 0; j < i; j++) {
-        sum += nibblemap[bh->b_data[j] & 0xf]
-            + nibblemap[(bh->b_data[j] >> 4) & 0xf];
-    }
+    nwords = numbits / 32;
+    for (i = 0; i < nwords; i++)
+        sum += 32 - minix_popcount32(words[i]);
 
-    i = numbits % 16;
-    if (i != 0) {
-        i = *(__u16*)(&bh->b_data[j]) | ~((1 << i) - 1);
-        sum += nibblemap[i & 0xf] + nibblemap[(i >> 4) & 0xf];
-        sum += nibblemap[(i >> 8) & 0xf] + nibblemap[(i >> 12) & 0xf];
-    }
-    return(sum);
+    if ((i = numbits % 32) != 0)
+        sum += i - minix_popcount32(words[nwords] & ((1U << i) - 1));
+
+    return sum;
 }
 
 static unsigned long
-minix_count_free_blocks(struct minix_sb_info* sbi)
+minix_count_free_blocks(struct super_block* sb)
 {
-    return (count_free(sbi->s_zmap, sbi->s_zmap_blocks,
+    struct minix_sb_info* sbi = minix_sb(sb);
+
+    return (count_free(sbi->s_zmap, sbi->s_zmap_blocks * sb->s_blocksize,
             sbi->s_nzones - sbi->s_firstdatazone + 1) << sbi->s_log_zone_size);
 }
 
@@ -129,9 +127,12 @@ minix_V2_raw_inode(struct super_block* sb, ino_t ino, struct buffer_head** bh)
 }
 
 static unsigned long
-minix_count_free_inodes(struct minix_sb_info* sbi)
+minix_count_free_inodes(struct super_block* sb)
 {
-    return count_free(sbi->s_imap, sbi->s_imap_blocks, sbi->s_ninodes + 1);
+    struct minix_sb_info* sbi = minix_sb(sb);
+
+    return count_free(sbi->s_imap, sbi->s_imap_blocks * sb->s_blocksize,
+                      sbi->s_ninodes + 1);
 }
 
 static int
@@ -160,7 +161,7 @@ minix_iget_v1(struct super_block* sb, struct inode* inode)
     inode->I_ctime.tv_nsec = 0;
     inode->I_blocks = 0;
     for (i = 0; i < 9; i++)
-        minix_inode->u.i1_data[i] = raw_inode->di_zone[i];
+        inode->I_daddr[i] = raw_inode->di_zone[i];
     if (S_ISCHR(inode->I_mode) || S_ISBLK(inode->I_mode))
         inode->I_rdev = old_decode_dev(raw_inode->di_zone[0]);
     minix_inode->i_dir_start_lookup = 0;
@@ -195,7 +196,7 @@ minix_iget_v2(struct super_block* sb, struct inode* inode)
     inode->I_ctime.tv_nsec = 0;
     inode->I_blocks = 0;
     for (i = 0; i < 10; i++)
-        minix_inode->u.i2_data[i] = raw_inode->di_zone[i];
+        inode->I_daddr[i] = raw_inode->di_zone[i];
     if (S_ISCHR(inode->I_mode) || S_ISBLK(inode->I_mode))
         inode->I_rdev = old_decode_dev(raw_inode->di_zone[0]);
     minix_inode->i_dir_start_lookup = 0;
@@ -282,7 +283,7 @@ minixfs_fill_super(int fd, void* data, int silent)
     unsigned long i, block;
     int ret = -EINVAL;
 
-    struct buffer_head** map;
+    char* map;
     struct buffer_head _bh;
     struct buffer_head* bh = &_bh;
     bh->b_flags.dynamic = 0;
@@ -360,36 +361,29 @@ minixfs_fill_super(int fd, void* data, int silent)
         sbi->s_link_max = MINIX2_LINK_MAX;
         sbi->s_mount_state = MINIX_VALID_FS;
         sb->s_blocksize = m3s->s_blocksize;
-        sb->s_blocksize_bits = m3s->s_blocksize;
+        sb->s_blocksize_bits = blksize_bits(m3s->s_blocksize);
     } else
         goto out_no_fs;
 
     /*
-     * Allocate the buffer map to keep the superblock small.
+     * The inode and zone bitmaps are adjacent on disk, right after the
+     * superblock. Read them both in one go.
      */
     if (sbi->s_imap_blocks == 0 || sbi->s_zmap_blocks == 0)
         goto out_illegal_sb;
-    i = (sbi->s_imap_blocks + sbi->s_zmap_blocks) * sizeof(bh);
-    map = kzalloc(i, GFP_KERNEL);
+    i = (sbi->s_imap_blocks + sbi->s_zmap_blocks) * sb->s_blocksize;
+    map = malloc(i);
     if (!map)
         goto out_no_map;
-    sbi->s_imap = &map[0];
-    sbi->s_zmap = &map[sbi->s_imap_blocks];
-
-    block=2;
-    for (i=0 ; i < sbi->s_imap_blocks ; i++) {
-        if (!(sbi->s_imap[i] = sb_bread(sb, block)))
-            goto out_no_bitmap;
-            block++;
-    }
-    for (i=0 ; i < sbi->s_zmap_blocks ; i++) {
-        if (!(sbi->s_zmap[i] = sb_bread(sb, block)))
-            goto out_no_bitmap;
-        block++;
-    }
+    sbi->s_imap = map;
+    sbi->s_zmap = map + sbi->s_imap_blocks * sb->s_blocksize;
 
-    minix_set_bit(0, sbi->s_imap[0]->b_data);
-    minix_set_bit(0, sbi->s_zmap[0]->b_data);
+    block = 2;
+    if (pread(sb->s_bdev, map, i, (off_t)block * sb->s_blocksize) != i)
+        goto out_no_bitmap;
+
+    minix_set_bit(0, sbi->s_imap);
+    minix_set_bit(0, sbi->s_zmap);
 
     /* read the root inode */
 
@@ -406,13 +400,7 @@ out_no_bitmap:
     printk("MINIX-fs: bad superblock or unable to read bitmaps\n");
 
 /* out_freemap: */
-    for (i = 0; i < sbi->s_imap_blocks; i++)
-        brelse(sbi->s_imap[i]);
-
-    for (i = 0; i < sbi->s_zmap_blocks; i++)
-        brelse(sbi->s_zmap[i]);
-
-    kfree(sbi->s_imap);
+    free(map);
 
     goto out_release;
 
@@ -462,10 +450,10 @@ minixfs_statvfs(struct super_block* sb, struct statvfs* buf)
     buf->f_frsize  = sb->s_blocksize;
     buf->f_blocks  =
         (sbi->s_nzones - sbi->s_firstdatazone) << sbi->s_log_zone_size;
-    buf->f_bfree   = minix_count_free_blocks(sbi);
+    buf->f_bfree   = minix_count_free_blocks(sb);
     buf->f_bavail  = buf->f_bfree;
     buf->f_files   = sbi->s_ninodes;
-    buf->f_ffree   = minix_count_free_inodes(sbi);
+    buf->f_ffree   = minix_count_free_inodes(sb);
     buf->f_namemax = sbi->s_namelen;
 
     return 0;
@@ -543,13 +531,28 @@ minixfs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
     return 0;
 }
 
+/*
+ * Maps a logical block of the inode, also returning in *count how many
+ * blocks starting with it are contiguous on disk (or are all holes).
+ */
 int
-minixfs_get_block(struct inode* inode, sector_t iblock, off_t* result)
+minixfs_get_block(struct inode* inode, sector_t iblock, off_t* result,
+                  off_t* count)
 {
-    if (INODE_VERSION(inode) == MINIX_V1)
-        return minix_get_block_v1(inode, iblock, result);
-    else
-        return minix_get_block_v2(inode, iblock, result);
+    struct super_block* sb = inode->I_sb;
+    struct minix_sb_info* sbi = minix_sb(sb);
+    int err;
+
+    *result = (off_t)0;
+    *count = 0;
+
+    if (iblock >= (sbi->s_max_size / sb->s_blocksize))
+        return -EIO;
+
+    *result = unixfs_bmap(&sbi->s_bmap, inode, &minix_i(inode)->i_bmap,
+                          (off_t)iblock, count, &err);
+
+    return -err;
 }
 
 int
@@ -569,20 +572,26 @@ minixfs_get_page(struct inode* inode, sector_t index, char* pagebuf)
 
     int bytes = 0, err = 0;
     struct super_block* sb = inode->I_sb;
-    struct buffer_head _bh;
     char* p = pagebuf;
 
     do {
-        off_t phys64 = 0;
-        int ret = minixfs_get_block(inode, iblock, &phys64);
+        off_t phys64 = 0, run = 0;
+        int ret = minixfs_get_block(inode, iblock, &phys64, &run);
+
+        /* blocks of the page that lie in this run (at least one) */
+        sector_t n = (PAGE_SIZE - bytes) / blocksize;
+        if (n > run)
+            n = run;
+        if (n > lblock - iblock)
+            n = lblock - iblock;
+        if (n < 1)
+            n = 1;
+
         if (phys64) {
-            struct buffer_head* bh = &_bh;
-            bh->b_flags.dynamic = 0;
-            if (sb_bread_intobh(sb, phys64, bh) == 0) {
-                memcpy(p, bh->b_data, blocksize);
-                p += blocksize;
-                bytes += blocksize;
-                brelse(bh); 
+            ssize_t len = (ssize_t)(n * blocksize);
+            if (pread(sb->s_bdev, p, len, phys64 * (off_t)blocksize) == len) {
+                p += len;
+                bytes += len;
             } else {
                 err = EIO;
                 fprintf(stderr, "*** fatal error: I/O error reading page\n");
@@ -590,16 +599,16 @@ minixfs_get_page(struct inode* inode, sector_t index, char* pagebuf)
                 exit(10);
             }
         } else if (ret == 0) { /* zero fill */
-            memset(p, 0, blocksize);
-            p += blocksize;
-            bytes += blocksize;
+            memset(p, 0, n * blocksize);
+            p += n * blocksize;
+            bytes += n * blocksize;
         } else {
             err = EIO;
             fprintf(stderr, "*** fatal error: block mapping failed\n");
             abort();
         }
 
-        iblock++;
+        iblock += n;
 
         if ((bytes >= PAGE_SIZE) || (iblock >= lblock))
             break;
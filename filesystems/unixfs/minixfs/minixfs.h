@@ -25,11 +25,8 @@
 #define MINIX_V3 0x0003 /* minix V3 fs */
 
 struct minix_inode_info {
-    union {
-        __u16 i1_data[16];
-        __u32 i2_data[16];
-    } u;
     u32 i_dir_start_lookup;
+    struct unixfs_bmapcache i_bmap; /* zone mapping cache */
 };
 
 struct minix_sb_info {
@@ -43,12 +40,13 @@ struct minix_sb_info {
     int s_dirsize;
     int s_namelen;
     int s_link_max;
-    struct buffer_head** s_imap;
-    struct buffer_head** s_zmap;
+    char*                s_imap; /* inode bitmap, s_imap_blocks blocks */
+    char*                s_zmap; /* zone bitmap, follows s_imap */
     struct buffer_head*  s_sbh;
     struct minix_super_block* s_ms;
     unsigned short s_mount_state;
     unsigned short s_version;
+    struct unixfs_bmap s_bmap; /* zone layout of an inode */
 };
 
 typedef struct minix_dir_entry minix_dirent;
@@ -94,7 +92,8 @@ int   minixfs_iget(struct super_block* sb, struct inode* ip);
 ino_t minixfs_inode_by_name(struct inode* dir, const char* name);
 int   minixfs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
                           off_t* offset, struct unixfs_direntry* dent);
-int   minixfs_get_block(struct inode* ip, sector_t fragment, off_t* result);
+int   minixfs_get_block(struct inode* ip, sector_t fragment, off_t* result,
+                        off_t* count);
 int   minixfs_get_page(struct inode* ip, sector_t index, char* pagebuf);
 
 #endif /* _MINIXFS_H_ */
@@ -38,7 +38,11 @@ unixfs_usage(void)
     "      %s [--force] --dmg DMG MOUNTPOINT [MacFUSE args...]\n"
     "where:\n"
     "     . DMG must point to a Minix disk image\n"
-    "     . --force attempts mounting even if there are warnings or errors\n",
+    "     . --force attempts mounting even if there are warnings or errors\n"
+    "     . --trace FILE records the FUSE requests and replies of the mount\n"
+    "       in FILE (see support/tracing)\n"
+    "     . --replay FILE runs the requests recorded in FILE against DMG,\n"
+    "       without mounting, and reports per-opcode latency and throughput\n",
     PROGNAME, PROGVERS, PROGNAME);
 }
 
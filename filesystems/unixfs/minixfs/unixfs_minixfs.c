@@ -58,6 +58,33 @@ unixfs_internal_init(const char* dmg, uint32_t flags, __unused fs_endian_t fse,
     unixfs = sb;
     unixfs->s_flags = flags;
 
+    /*
+     * V1 zone numbers are 16 bits wide and go up to double indirect; later
+     * versions have 32-bit zone numbers and a triple indirect zone. Zone
+     * numbers are in host byte order throughout.
+     */
+    struct unixfs_bmap* bm = &sbi->s_bmap;
+    bm->bm_nslots[0] = 7;
+    bm->bm_nslots[1] = 1;
+    bm->bm_nslots[2] = 1;
+    if (sbi->s_version == MINIX_V1) {
+        bm->bm_nslots[3] = 0;
+        bm->bm_ptrsize = sizeof(u16);
+        bm->bm_nshift = sb->s_blocksize_bits - 1;
+    } else {
+        bm->bm_nslots[3] = 1;
+        bm->bm_ptrsize = sizeof(u32);
+        bm->bm_nshift = sb->s_blocksize_bits - 2;
+    }
+    bm->bm_stride = 1;
+#ifdef __LITTLE_ENDIAN__
+    bm->bm_endian = UNIXFS_FS_LITTLE;
+#else
+    bm->bm_endian = UNIXFS_FS_BIG;
+#endif
+    bm->bm_base = 0;
+    bm->bm_bread = unixfs_internal_bread;
+
     (void)minixfs_statvfs(sb, &(unixfs->s_statvfs));
 
     unixfs->s_dentsize = 0;
@@ -91,12 +118,16 @@ static void
 unixfs_internal_fini(void* filsys)
 {
     unixfs_inodelayer_fini();
+    unixfs_dirindex_fini();
 
     struct super_block* sb = (struct super_block*)filsys;
     if (sb) {
         struct minix_sb_info* sbi = minix_sb(sb);
-        if (sbi)
+        if (sbi) {
+            if (sbi->s_imap)
+                free(sbi->s_imap);
             free(sbi);
+        }
         free(sb);
     }
 }
@@ -110,8 +141,8 @@ unixfs_internal_alloc(void)
 static off_t
 unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
 {
-    off_t result;
-    *error = minixfs_get_block(ip, lblkno, &result);
+    off_t result, count;
+    *error = minixfs_get_block(ip, lblkno, &result, &count);
     return result;
 }
 
@@ -190,6 +221,51 @@ unixfs_internal_istat(struct inode* ip, struct stat* stbuf)
     memcpy(stbuf, &ip->I_stat, sizeof(struct stat));
 }
 
+static inline ino_t
+unixfs_internal_slotino(struct inode* dir, const char* slot)
+{
+    if (INODE_VERSION(dir) == MINIX_V3)
+        return ((minix3_dirent*)slot)->inode;
+
+    return ((minix_dirent*)slot)->inode;
+}
+
+static int
+unixfs_internal_dirindex(struct inode* dir, const struct unixfs_slotdir* sd)
+{
+    unsigned long n, npages = minix_dir_pages(dir);
+    char page[PAGE_SIZE];
+    struct unixfs_dirindex* di = unixfs_dirindex_alloc(dir->I_ino);
+    if (!di)
+        return ENOMEM;
+
+    for (n = 0; n < npages; n++) {
+        int error = minixfs_get_page(dir, n, page);
+        if (error) {
+            unixfs_dirindex_abort(di);
+            return error;
+        }
+        size_t nbytes = min((off_t)PAGE_CACHE_SIZE,
+                            dir->I_size - (off_t)(n << PAGE_CACHE_SHIFT));
+        char* p;
+        for (p = page; p + sd->sd_slotsize <= page + nbytes;
+             p += sd->sd_slotsize) {
+            ino_t ino = unixfs_internal_slotino(dir, p);
+            if (!ino)
+                continue;
+            const char* name = p + sd->sd_inosize;
+            error = unixfs_dirindex_add(di, name,
+                                        strnlen(name, sd->sd_namemax), ino);
+            if (error) {
+                unixfs_dirindex_abort(di);
+                return error;
+            }
+        }
+    }
+
+    return unixfs_dirindex_commit(di);
+}
+
 static int
 unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
 {
@@ -212,52 +288,44 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
     unsigned long namelen = strlen(name);
     unsigned long start, n;
     unsigned long npages = minix_dir_pages(dir);
-    minix3_dirent* de3;
-    minix_dirent* de;
     char page[PAGE_SIZE];
-    char* kaddr = NULL;
-
 
     struct super_block* sb = dir->I_sb;
     struct minix_sb_info* sbi = minix_sb(sb);
-    unsigned chunk_size = sbi->s_dirsize;
     struct minix_inode_info* minix_inode = minix_i(dir);
+    struct unixfs_slotdir sd;
+
+    sd.sd_slotsize = sbi->s_dirsize;
+    sd.sd_inosize = (INODE_VERSION(dir) == MINIX_V3) ? 4 : 2;
+    sd.sd_namemax = sbi->s_namelen;
+
+    ino_t found_ino = 0;
+
+    if (dir->I_size >= UNIXFS_DIRINDEX_MINSIZE) {
+        int error = unixfs_dirindex_lookup(parentino, name, namelen,
+                                           &found_ino);
+        if ((error == ENOENT) && !unixfs_internal_dirindex(dir, &sd))
+            error = unixfs_dirindex_lookup(parentino, name, namelen,
+                                           &found_ino);
+        if (!error)
+            goto out;
+    }
 
     start = minix_inode->i_dir_start_lookup;
     if (start >= npages)
         start = 0;
     n = start;
 
-    ino_t found_ino = 0;
-
     do {
         int error = minixfs_get_page(dir, n, page);
         if (!error) {
-            kaddr = (char*)page;
-            if (INODE_VERSION(dir) == MINIX_V3) {
-                de3 = (minix3_dirent*)kaddr;
-                kaddr += PAGE_CACHE_SIZE - chunk_size;
-                for (; (char*)de3 <= kaddr; de3++) {
-                    if (!de3->inode)
-                        continue;
-                    if (minix_namecompare(namelen, chunk_size,
-                                          name, de3->name)) {
-                        found_ino = de3->inode;
-                        goto found;
-                    }
-                }
-            } else {
-                de = (minix_dirent*)kaddr;
-                kaddr += PAGE_CACHE_SIZE - chunk_size;
-                for (; (char*)de <= kaddr; de++) {
-                    if (!de->inode)
-                        continue;
-                    if (minix_namecompare(namelen, chunk_size,
-                                          name, de->name)) {
-                        found_ino = de->inode;
-                        goto found;
-                    }
-                }
+            size_t nbytes = min((off_t)PAGE_CACHE_SIZE,
+                                dir->I_size - (off_t)(n << PAGE_CACHE_SHIFT));
+            long slot = unixfs_slotdir_find(&sd, page, nbytes, name, namelen);
+            if (slot >= 0) {
+                found_ino =
+                    unixfs_internal_slotino(dir, page + slot * sd.sd_slotsize);
+                goto found;
             }
         }
 
@@ -270,6 +338,8 @@ found:
     if (found_ino)
         minix_inode->i_dir_start_lookup = n;
 
+out:
+
     unixfs_internal_iput(dir);
 
     if (found_ino)
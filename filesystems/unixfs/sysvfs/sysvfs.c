@@ -458,7 +458,7 @@ sysv_count_free_blocks(struct super_block* sb)
 
     sb_count = fs32_to_host(sbi->s_bytesex, *sbi->s_free_blocks);
 
-    if (0)
+    if (sb->s_flags & UNIXFS_TRUSTSB)
         goto trust_sb;
 
     count = 0;
@@ -529,33 +529,42 @@ sysv_count_free_inodes(struct super_block* sb)
 {
     struct sysv_sb_info* sbi = SYSV_SB(sb);
     int ino, count, sb_count;
-    struct sysv_dinode* raw_inode;
-
-    struct buffer_head bh;
+    const struct sysv_dinode* raw_inode;
+    struct unixfs_scanner sc;
+    size_t chunksize;
 
     sb_count = fs16_to_host(sbi->s_bytesex, *sbi->s_sb_total_free_inodes);
 
-    if (0)
+    if (sb->s_flags & UNIXFS_TRUSTSB)
         goto trust_sb;
 
     count = 0;
     ino = SYSV_ROOT_INO+1;
 
-    raw_inode = sysv_raw_inode(sb, ino, &bh);
-    if (!raw_inode)
+    /* The inode table is contiguous; read it in large sequential chunks. */
+    chunksize = min((size_t)sbi->s_ninodes * sizeof(struct sysv_dinode),
+                    (size_t)UNIXFS_SCANNER_CHUNKSIZE);
+    if (unixfs_scanner_init(&sc, sb->s_bdev,
+                            (off_t)(sbi->s_firstinodezone + sbi->s_block_base) *
+                            sb->s_blocksize +
+                            (off_t)(ino - 1) * sizeof(struct sysv_dinode),
+                            chunksize) != 0)
         goto Eio;
 
-    while (ino <= sbi->s_ninodes) {
+    for (; ino <= sbi->s_ninodes; ino++) {
+        if (unixfs_scanner_peek(&sc, (const void**)&raw_inode,
+                                sizeof(struct sysv_dinode)) !=
+            sizeof(struct sysv_dinode)) {
+            unixfs_scanner_fini(&sc);
+            goto Eio;
+        }
         if (raw_inode->di_mode == 0 && raw_inode->di_nlink == 0)
             count++;
-        if ((ino++ & sbi->s_inodes_per_block_1) == 0) {
-            raw_inode = sysv_raw_inode(sb, ino, &bh);
-            if (!raw_inode)
-                goto Eio;
-        } else
-            raw_inode++;
+        unixfs_scanner_skip(&sc, sizeof(struct sysv_dinode));
     }
 
+    unixfs_scanner_fini(&sc);
+
     if (count != sb_count)
         goto Einval;
 out:
@@ -573,147 +582,21 @@ trust_sb:
     goto out;
 }
 
-enum { DIRECT = 10, DEPTH = 4 };  /* Have triple indirect */
-
-static int
-block_to_path(struct inode* inode, long block, int offsets[DEPTH])
-{
-    struct super_block* sb = inode->I_sb;
-    struct sysv_sb_info* sbi = SYSV_SB(sb);
-
-    int ptrs_bits = sbi->s_ind_per_block_bits;
-
-    unsigned long indirect_blocks = sbi->s_ind_per_block;
-    unsigned long double_blocks = sbi->s_ind_per_block_2;
-
-    int n = 0;
-
-    if (block < 0) {
-        printk("sysv_block_map: block < 0\n");
-    } else if (block < DIRECT) {
-        offsets[n++] = block;
-    } else if ( (block -= DIRECT) < indirect_blocks) {
-        offsets[n++] = DIRECT;
-        offsets[n++] = block;
-    } else if ((block -= indirect_blocks) < double_blocks) {
-        offsets[n++] = DIRECT+1;
-        offsets[n++] = block >> ptrs_bits;
-        offsets[n++] = block & (indirect_blocks - 1);
-    } else if (((block -= double_blocks) >> (ptrs_bits * 2)) < indirect_blocks) {
-        offsets[n++] = DIRECT+2;
-        offsets[n++] = block >> (ptrs_bits * 2);
-        offsets[n++] = (block >> ptrs_bits) & (indirect_blocks - 1);
-        offsets[n++] = block & (indirect_blocks - 1);
-    } else {
-        /* nothing */;
-    }
-
-    return n;
-}
-
-static inline int
-block_to_host(struct sysv_sb_info* sbi, sysv_zone_t nr)
-{
-        return sbi->s_block_base + fs32_to_host(sbi->s_bytesex, nr);
-}
-
-typedef struct {
-    sysv_zone_t* p;
-    sysv_zone_t  key;
-    struct buffer_head* bh;
-} Indirect;
-
-static inline void
-add_chain(Indirect* p, struct buffer_head* bh, sysv_zone_t* v)
-{
-    p->key = *(p->p = v);
-    p->bh = bh;
-}
-
-static inline int
-verify_chain(Indirect* from, Indirect* to)
-{
-    while (from <= to && from->key == *from->p)
-        from++;
-    return (from > to);
-}
-
-static Indirect*
-get_branch(struct inode* inode, int depth, int offsets[], Indirect chain[],
-           int* err)
-{
-    struct super_block* sb = inode->I_sb;
-    Indirect* p = chain;
-    struct buffer_head* bh = 0;
-
-    *err = 0;
-    add_chain(chain, NULL, SYSV_I(inode)->i_data + *offsets);
-    if (!p->key)
-        goto no_block;
-
-    while (--depth) {
-        int block = block_to_host(SYSV_SB(sb), p->key);
-        bh = malloc(sizeof(struct buffer_head));
-        if (sb_bread_intobh(sb, block, bh) != 0)
-            goto failure;
-        if (!verify_chain(chain, p))
-            goto changed;
-        add_chain(++p, bh, (sysv_zone_t*)bh->b_data + *++offsets);
-        if (!p->key)
-            goto no_block;
-    }
-
-    return NULL;
-
-changed:
-    brelse(bh);
-    *err = -EAGAIN;
-    goto no_block;
-
-failure:
-    *err = -EIO;
-
-no_block:
-    return p;
-}
-
+/*
+ * Maps a logical block of the inode, also returning in *count how many
+ * blocks starting with it are contiguous on disk (or are all holes).
+ */
 int
-sysv_get_block(struct inode* inode, sector_t iblock, off_t* result)
+sysv_get_block(struct inode* inode, sector_t iblock, off_t* result,
+               off_t* count)
 {
-    *result = (off_t)0;
-
-    int err = -EIO;
-    int offsets[DEPTH];
-    Indirect chain[DEPTH];
-    Indirect* partial;
-
-    struct super_block* sb = inode->I_sb;
+    struct sysv_sb_info* sbi = SYSV_SB(inode->I_sb);
+    int err;
 
-    int depth = block_to_path(inode, iblock, offsets);
+    *result = unixfs_bmap(&sbi->s_bmap, inode, &SYSV_I(inode)->i_bmap,
+                          (off_t)iblock, count, &err);
 
-    if (depth == 0)
-        goto out;
-
-/* reread: */
-    partial = get_branch(inode, depth, offsets, chain, &err);
-
-    /* simplest case - block found, no allocation needed */
-    if (!partial) {
-        *result = (off_t)(block_to_host(SYSV_SB(sb), chain[depth-1].key));
-        /* clean up and exit */
-        partial = chain + depth - 1; /* the whole chain */
-        goto cleanup;
-    }
-
-    /* Next simple case - plain lookup or failed read of indirect block */
-cleanup:
-    while (partial > chain) {
-        brelse(partial->bh);
-        partial--;
-    }
-
-out:
-    return err;
+    return -err;
 }
 
 int
@@ -733,32 +616,39 @@ sysv_get_page(struct inode* inode, sector_t index, char* pagebuf)
     char *p = pagebuf;
 
     do {
-        off_t phys64 = 0;
-        int ret = sysv_get_block(inode, iblock, &phys64);
+        off_t phys64 = 0, run = 0;
+        int ret = sysv_get_block(inode, iblock, &phys64, &run);
+
+        /* blocks of the page that lie in this run (at least one) */
+        sector_t n = (PAGE_SIZE - byte_count) / blocksize;
+        if (n > run)
+            n = run;
+        if (n > lblock - iblock)
+            n = lblock - iblock;
+        if (n < 1)
+            n = 1;
+
         if (phys64) {
-            struct buffer_head bh;
-            memset(&bh, 0, sizeof(bh));
-            ret = sb_bread_intobh(sb, phys64, &bh);
-            if (ret == 0) {
-                memcpy(p, bh.b_data, blocksize);
-                p += blocksize;
-                byte_count += blocksize;
+            ssize_t len = (ssize_t)(n * blocksize);
+            if (pread(sb->s_bdev, p, len, phys64 * (off_t)blocksize) == len) {
+                p += len;
+                byte_count += len;
             } else {
                 err = EIO;
                 fprintf(stderr, "*** fatal error: I/O error\n");
                 abort();
             }
         } else if (ret == 0) {
-            memset(p, 0, blocksize);
-            p += blocksize;
-            byte_count += blocksize;
+            memset(p, 0, n * blocksize);
+            p += n * blocksize;
+            byte_count += n * blocksize;
         } else {
             err = EIO;
             fprintf(stderr, "*** fatal error: block mapping failed\n");
             abort();
         }
 
-        iblock++;
+        iblock += n;
 
         if ((byte_count >= PAGE_SIZE) || (iblock >= lblock))
             break;
@@ -53,6 +53,7 @@ struct sysv_dinode { /* on disk */
 struct sysv_inode_info { /* in memory */
     __fs32  i_data[13];
     u32     i_dir_start_lookup;
+    struct unixfs_bmapcache i_bmap; /* block mapping cache */
 };
 
 static inline struct sysv_inode_info*
@@ -128,6 +129,8 @@ struct sysv_sb_info { /* in memory */
     u32 s_nzones;                         /* same as s_sbd->s_fsize */
     u16 s_namelen;                        /* max length of dir entry */
     int s_forced_ro;
+
+    struct unixfs_bmap s_bmap;            /* block layout of an inode */
 };
 
 static inline struct sysv_sb_info*
@@ -322,7 +325,8 @@ struct sysv_dinode* sysv_raw_inode(struct super_block* sb, ino_t ino,
 int sysv_next_direntry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
                        off_t* offset, struct unixfs_direntry* dent);
 
-int sysv_get_block(struct inode* ip, sector_t block, off_t* result);
+int sysv_get_block(struct inode* ip, sector_t block, off_t* result,
+                   off_t* count);
 int sysv_get_page(struct inode* ip, sector_t index, char* pagebuf);
 
 #endif /* _SYSVFS_H_ */
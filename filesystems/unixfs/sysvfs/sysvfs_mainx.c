@@ -35,11 +35,17 @@ unixfs_usage(void)
     "%s (version %s): System V family of file systems for MacFUSE\n"
     "Amit Singh <http://osxbook.com>\n"
     "usage:\n"
-    "      %s [--force] --dmg DMG MOUNTPOINT [MacFUSE args...]\n"
+    "      %s [--force] [--trustsb] --dmg DMG MOUNTPOINT [MacFUSE args...]\n"
     "where:\n"
     "     . DMG must point to a disk image of a valid type; one of:\n"
     "         SVR4, SVR2, Xenix, Coherent, SCO EAFS, and related\n" 
-    "     . --force attempts mounting even if there are warnings or errors\n",
+    "     . --force attempts mounting even if there are warnings or errors\n"
+    "     . --trustsb reports the free block and inode counts recorded in\n"
+    "       the superblock instead of recounting them\n"
+    "     . --trace FILE records the FUSE requests and replies of the mount\n"
+    "       in FILE (see support/tracing)\n"
+    "     . --replay FILE runs the requests recorded in FILE against DMG,\n"
+    "       without mounting, and reports per-opcode latency and throughput\n",
     PROGNAME, PROGVERS, PROGNAME);
 }
 
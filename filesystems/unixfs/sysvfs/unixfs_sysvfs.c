@@ -18,6 +18,9 @@
 
 DECL_UNIXFS("UNIX System V", sysv);
 
+static pthread_mutex_t fsstat_lock = PTHREAD_MUTEX_INITIALIZER;
+static int fsstat_valid = 0; /* free counts in s_statvfs are current */
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, __unused fs_endian_t fse,
                      char** fsname, char** volname)
@@ -58,13 +61,23 @@ unixfs_internal_init(const char* dmg, uint32_t flags, __unused fs_endian_t fse,
     unixfs = sb;
     unixfs->s_flags = flags;
 
+    /* ten direct blocks, then single, double and triple indirect */
+    struct unixfs_bmap* bm = &sbi->s_bmap;
+    bm->bm_nslots[0] = 10;
+    bm->bm_nslots[1] = 1;
+    bm->bm_nslots[2] = 1;
+    bm->bm_nslots[3] = 1;
+    bm->bm_ptrsize = sizeof(sysv_zone_t);
+    bm->bm_nshift = sbi->s_ind_per_block_bits;
+    bm->bm_stride = 1;
+    bm->bm_endian = sbi->s_bytesex;
+    bm->bm_base = sbi->s_block_base;
+    bm->bm_bread = unixfs_internal_bread;
+
     unixfs->s_statvfs.f_bsize   = max(PAGE_SIZE, sb->s_blocksize);
     unixfs->s_statvfs.f_frsize  = sb->s_blocksize;
     unixfs->s_statvfs.f_blocks  = sbi->s_ndatazones;
-    unixfs->s_statvfs.f_bavail  = sysv_count_free_blocks(sb);
-    unixfs->s_statvfs.f_bfree   = unixfs->s_statvfs.f_bavail;
     unixfs->s_statvfs.f_files   = sbi->s_ninodes;
-    unixfs->s_statvfs.f_ffree   = sysv_count_free_inodes(sb);
     unixfs->s_statvfs.f_namemax = SYSV_NAMELEN;
     unixfs->s_dentsize = 0;
 
@@ -104,6 +117,8 @@ static void
 unixfs_internal_fini(void* filsys)
 {
     unixfs_inodelayer_fini();
+    unixfs_dirindex_fini();
+    fsstat_valid = 0;
 
     struct super_block* sb = (struct super_block*)filsys;
 
@@ -134,8 +149,8 @@ unixfs_internal_alloc(void)
 static off_t
 unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
 {
-    off_t result;
-    *error = sysv_get_block(ip, lblkno, &result);
+    off_t result, count;
+    *error = sysv_get_block(ip, lblkno, &result, &count);
     return result;
 }
 
@@ -206,9 +221,11 @@ unixfs_internal_iget(ino_t ino)
     inode->I_blkbits = sb->s_blocksize_bits;
 
     unsigned int block;
-    for (block = 0; block < (10 + 1 + 1 + 1); block++)
+    for (block = 0; block < (10 + 1 + 1 + 1); block++) {
         sysv_read3byte(sbi, &raw_inode->di_data[3 * block],
                        (u8*)&si->i_data[block]);
+        inode->I_daddr[block] = fs32_to_host(sbi->s_bytesex, si->i_data[block]);
+    }
 
     if (S_ISCHR(inode->I_mode) || S_ISBLK(inode->I_mode)) {
         uint32_t rdev = fs32_to_host(unixfs->s_endian, si->i_data[0]);
@@ -254,6 +271,45 @@ unixfs_internal_istat(struct inode* ip, struct stat* stbuf)
     memcpy(stbuf, &ip->I_stat, sizeof(struct stat));
 }
 
+static const struct unixfs_slotdir sysv_slotdir = {
+    SYSV_DIRSIZE, sizeof(sysv_ino_t), SYSV_NAMELEN
+};
+
+static int
+unixfs_internal_dirindex(struct inode* dir)
+{
+    unsigned long n, npages = sysv_dir_pages(dir);
+    char page[PAGE_SIZE];
+    struct unixfs_dirindex* di = unixfs_dirindex_alloc(dir->I_ino);
+    if (!di)
+        return ENOMEM;
+
+    for (n = 0; n < npages; n++) {
+        int error = sysv_get_page(dir, n, page);
+        if (error) {
+            unixfs_dirindex_abort(di);
+            return error;
+        }
+        size_t nbytes = min((off_t)PAGE_CACHE_SIZE,
+                            dir->I_size - (off_t)(n << PAGE_CACHE_SHIFT));
+        struct sysv_dir_entry* de = (struct sysv_dir_entry*)page;
+        for (; (char*)(de + 1) <= page + nbytes; de++) {
+            if (!de->inode)
+                continue;
+            error = unixfs_dirindex_add(di, de->name,
+                                        strnlen(de->name, SYSV_NAMELEN),
+                                        fs16_to_host(unixfs->s_endian,
+                                                     de->inode));
+            if (error) {
+                unixfs_dirindex_abort(di);
+                return error;
+            }
+        }
+    }
+
+    return unixfs_dirindex_commit(di);
+}
+
 static int
 unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
 {
@@ -271,14 +327,24 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
         return ENOTDIR;
     }
 
-    int ret = ENOENT, found = 0;
+    int ret = ENOENT;
 
     unsigned long namelen = strlen(name);
     unsigned long start, n;
     unsigned long npages = sysv_dir_pages(dir);
-    struct sysv_dir_entry* de;
     char page[PAGE_SIZE];
-    char* kaddr = NULL;
+
+    ino_t found_ino = 0;
+
+    if (dir->I_size >= UNIXFS_DIRINDEX_MINSIZE) {
+        int error = unixfs_dirindex_lookup(parentino, name, namelen,
+                                           &found_ino);
+        if ((error == ENOENT) && !unixfs_internal_dirindex(dir))
+            error = unixfs_dirindex_lookup(parentino, name, namelen,
+                                           &found_ino);
+        if (!error)
+            goto out;
+    }
 
     start = SYSV_I(dir)->i_dir_start_lookup;
     if (start >= npages)
@@ -288,16 +354,14 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
     do {
         int error = sysv_get_page(dir, n, page);
         if (!error) {
-            kaddr = (char*)page;
-            de = (struct sysv_dir_entry*) kaddr;
-            kaddr += PAGE_CACHE_SIZE - SYSV_DIRSIZE;
-            for ( ; (char*) de <= kaddr ; de++) {
-                if (!de->inode)
-                    continue;
-                if (sysv_namecompare(namelen, SYSV_NAMELEN, name, de->name)) {
-                    found = 1;
-                    goto found;
-                }
+            size_t nbytes = min((off_t)PAGE_CACHE_SIZE,
+                                dir->I_size - (off_t)(n << PAGE_CACHE_SHIFT));
+            long slot = unixfs_slotdir_find(&sysv_slotdir, page, nbytes,
+                                            name, namelen);
+            if (slot >= 0) {
+                struct sysv_dir_entry* de = (struct sysv_dir_entry*)page;
+                found_ino = fs16_to_host(unixfs->s_endian, de[slot].inode);
+                goto found;
             }
         }
 
@@ -307,14 +371,15 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
 
 found:
 
-    if (found)
+    if (found_ino)
         SYSV_I(dir)->i_dir_start_lookup = n;
 
+out:
+
     unixfs_internal_iput(dir);
 
-    if (found)
-        ret = unixfs_internal_igetattr((ino_t)fs16_to_host(unixfs->s_endian,
-                                       de->inode), stbuf);
+    if (found_ino)
+        ret = unixfs_internal_igetattr(found_ino, stbuf);
 
     return ret;
 }
@@ -389,9 +454,32 @@ unixfs_internal_sanitycheck(void* filsys, off_t disksize)
     return 0;
 }
 
+/*
+ * Counting free blocks means following the on-disk free list, and counting
+ * free inodes means reading the entire inode table. Neither is needed to
+ * mount, so both are put off until somebody asks for the statistics, and
+ * the results are kept for the life of the (read-only) mount.
+ */
+
+static void
+unixfs_internal_fsstat(void)
+{
+    pthread_mutex_lock(&fsstat_lock);
+
+    if (!fsstat_valid) {
+        unixfs->s_statvfs.f_bavail = sysv_count_free_blocks(unixfs);
+        unixfs->s_statvfs.f_bfree  = unixfs->s_statvfs.f_bavail;
+        unixfs->s_statvfs.f_ffree  = sysv_count_free_inodes(unixfs);
+        fsstat_valid = 1;
+    }
+
+    pthread_mutex_unlock(&fsstat_lock);
+}
+
 static int
 unixfs_internal_statvfs(struct statvfs* svb)
 {
+    unixfs_internal_fsstat();
     memcpy(svb, &unixfs->s_statvfs, sizeof(struct statvfs));
     return 0;
 }
@@ -485,106 +485,68 @@ ufs_block_to_path(struct inode* inode, sector_t i_block, sector_t offsets[4])
     return n;
 }
 
-/* Returns the location of the fragment from the begining of the filesystem. */
+static pthread_mutex_t indir_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static u64
-ufs_frag_map(struct inode* inode, sector_t frag, int* error)
+static inline u64
+ufs_get_ptr(struct super_block* sb, const void* ptrs, unsigned i, int ufs2)
 {
-    struct ufs_inode_info* ufsi = inode->I_private;
-    struct super_block* sb = inode->I_sb;
-    struct ufs_sb_private_info* uspi = UFS_SB(sb)->s_uspi;
+    if (ufs2)
+        return fs64_to_cpu(sb, ((__fs64*)ptrs)[i]);
 
-    u64 mask = (u64)uspi->s_apbmask>>uspi->s_fpbshift;
-    int shift = uspi->s_apbshift-uspi->s_fpbshift;
-    unsigned flags = UFS_SB(sb)->s_flags;
-
-    sector_t offsets[4];
-    sector_t* p;
-
-    int depth = ufs_block_to_path(inode, frag >> uspi->s_fpbshift, offsets);
-
-    u64 ret = 0L;
-    u64 temp = 0L;
+    return fs32_to_cpu(sb, ((__fs32*)ptrs)[i]);
+}
 
-    __fs32 block;
-    __fs64 u2_block = 0L;
+/*
+ * Reads the indirect block fragment frag, used at the given level of
+ * indirection, into bh. The per-inode copy of the fragment last used at
+ * that level is tried first; sequential access hits it every time.
+ */
+static int
+ufs_get_indirect(struct inode* inode, int level, u64 frag,
+                 struct buffer_head* bh)
+{
+    struct ufs_node_info* ni = inode->I_private;
+    struct super_block* sb = inode->I_sb;
 
-    UFSD(": frag = %llu  depth = %d\n", (unsigned long long)frag, depth);
-    UFSD(": uspi->s_fpbshift = %d ,uspi->s_apbmask = %x, mask=%llx\n",
-         uspi->s_fpbshift, uspi->s_apbmask, (unsigned long long)mask);
+    bh->b_flags.dynamic = 0;
 
-    if (depth == 0)
+    pthread_mutex_lock(&indir_lock);
+    if (ni->ni_indirfrag[level] == frag) {
+        memcpy(bh->b_data, ni->ni_indir[level], sb->s_blocksize);
+        pthread_mutex_unlock(&indir_lock);
         return 0;
-
-    p = offsets;
-
-    lock_kernel();
-
-    if ((flags & UFS_TYPE_MASK) == UFS_TYPE_UFS2)
-        goto ufs2;
-
-    block = ufsi->i_u1.i_data[*p++];
-    if (!block)
-        goto out;
-
-    while (--depth) {
-
-        struct buffer_head _bh;
-        struct buffer_head* bh = &_bh;
-        sector_t n = *p++;
-
-        bh->b_flags.dynamic = 0;
-
-        if (sb_bread_intobh(sb, uspi->s_sbbase +
-                            fs32_to_cpu(sb, block) + (n >> shift), bh) != 0)
-            goto out;
-
-        block = ((__fs32 *) bh->b_data)[n & mask];
-
-        brelse (bh);
-
-        if (!block)
-            goto out;
     }
+    pthread_mutex_unlock(&indir_lock);
 
-    ret = (u64)(uspi->s_sbbase + fs32_to_cpu(sb, block) +
-                (frag & uspi->s_fpbmask));
-
-    goto out;
-
-ufs2:
-
-    u2_block = ufsi->i_u1.u2_i_data[*p++];
-    if (!u2_block)
-        goto out;
-
-    while (--depth) {
-
-        struct buffer_head _bh;
-        struct buffer_head* bh = &_bh;
-        sector_t n = *p++;
+    if (sb_bread_intobh(sb, frag, bh) != 0)
+        return EIO;
 
-        temp = (u64)(uspi->s_sbbase) + fs64_to_cpu(sb, u2_block);
+    pthread_mutex_lock(&indir_lock);
+    memcpy(ni->ni_indir[level], bh->b_data, sb->s_blocksize);
+    ni->ni_indirfrag[level] = frag;
+    pthread_mutex_unlock(&indir_lock);
 
-        bh->b_flags.dynamic = 0;
-        if (sb_bread_intobh(sb, temp +(u64) (n>>shift), bh) != 0)
-            goto out;
+    return 0;
+}
 
-        u2_block = ((__fs64 *)bh->b_data)[n & mask];
+/* Returns the location of the fragment from the begining of the filesystem. */
 
-        brelse(bh);
+static u64
+ufs_frag_map(struct inode* inode, sector_t frag, int* error)
+{
+    struct ufs_sb_private_info* uspi = UFS_SB(inode->I_sb)->s_uspi;
 
-        if (!u2_block)
-            goto out;
-    }
+    u64 block;
+    unsigned count;
 
-    temp = (u64)uspi->s_sbbase + fs64_to_cpu(sb, u2_block);
-    ret = temp + (u64)(frag & uspi->s_fpbmask);
+    UFSD(": frag = %llu\n", (unsigned long long)frag);
 
-out:
-    unlock_kernel();
+    *error = U_ufs_get_blocks(inode, frag >> uspi->s_fpbshift, 1,
+                              &block, &count);
+    if (*error || !block)
+        return 0;
 
-    return ret;
+    return block + (u64)(frag & uspi->s_fpbmask);
 }
 
 int
@@ -900,16 +862,82 @@ ufs_get_dirpage(struct inode* inode, sector_t index, char* pagebuf)
     return ret;
 }
 
+/*
+ * Directory indexing.
+ *
+ * ufs_find_entry_s() scans a directory linearly, re-reading every page from
+ * the image, so each lookup in a directory with tens of thousands of entries
+ * costs a read of the whole directory. Much like FreeBSD's dirhash, the
+ * first lookup in a directory of at least UNIXFS_DIRINDEX_MINSIZE bytes
+ * reads it once into a directory index (see unixfs_internal.h), which then
+ * answers later lookups without touching the image. The indexes are shared
+ * with the other back ends and live within one memory budget; the file
+ * system is read-only, so an index never has to be updated.
+ */
+
+/* Reads the whole directory into a new index; returns an errno. */
+static int
+ufs_dirindex_build(struct inode* dir)
+{
+    struct super_block* sb = dir->I_sb;
+    unsigned long npages = ufs_dir_pages(dir);
+    unsigned long n;
+    int error;
+
+    struct unixfs_dirindex* di = unixfs_dirindex_alloc(dir->I_ino);
+    if (!di)
+        return ENOMEM;
+
+    for (n = 0; n < npages; n++) {
+        char page[PAGE_SIZE];
+        struct ufs_dir_entry* p;
+        unsigned limit = ufs_last_byte(dir, n);
+        unsigned offs, reclen, namlen;
+
+        if (ufs_get_dirpage(dir, n, page) != 0) {
+            error = EIO;
+            goto bad;
+        }
+
+        for (offs = 0; offs + UFS_DIR_REC_LEN(1) <= limit; offs += reclen) {
+            p = (struct ufs_dir_entry*)(page + offs);
+            reclen = fs16_to_cpu(sb, p->d_reclen);
+            if (reclen == 0) {
+                fprintf(stderr, "zero-length directory entry\n");
+                error = EIO;
+                goto bad;
+            }
+            if (!p->d_ino)
+                continue;
+            namlen = ufs_get_de_namlen(sb, p);
+            if ((namlen > UFS_MAXNAMLEN) ||
+                (offs + UFS_DIR_REC_LEN(namlen) > limit)) {
+                error = EIO;
+                goto bad;
+            }
+            error = unixfs_dirindex_add(di, (char*)p->d_name, namlen,
+                                        (ino_t)fs32_to_cpu(sb, p->d_ino));
+            if (error)
+                goto bad;
+        }
+    }
+
+    return unixfs_dirindex_commit(di);
+
+bad:
+    unixfs_dirindex_abort(di);
+    return error;
+}
+
 static ino_t
 ufs_find_entry_s(struct inode* dir, const char* name)
 {
     struct super_block* sb = dir->I_sb;
-    struct ufs_inode_info* ui = dir->I_private;
 
     int namelen = strlen(name);
     unsigned reclen = UFS_DIR_REC_LEN(namelen);
     unsigned long npages = ufs_dir_pages(dir);
-    unsigned long start, n;
+    unsigned long n;
     struct ufs_dir_entry* de;
 
     ino_t result = 0;
@@ -920,14 +948,24 @@ ufs_find_entry_s(struct inode* dir, const char* name)
     if (npages == 0 || namelen > UFS_MAXNAMLEN)
         goto out;
 
-    start = ui->i_dir_start_lookup;
-
-    if (start >= npages)
-        start = 0;
+    if (dir->I_size >= UNIXFS_DIRINDEX_MINSIZE) {
+        int error = unixfs_dirindex_lookup(dir->I_ino, name, namelen,
+                                           &result);
+        if ((error == ENOENT) && !ufs_dirindex_build(dir))
+            error = unixfs_dirindex_lookup(dir->I_ino, name, namelen,
+                                           &result);
+        if (!error)
+            goto out;
+    }
 
-    n = start;
+    /*
+     * Directories this small (or ones we could not index) are simply scanned
+     * from the start. We used to start at the page of the last hit, kept in
+     * i_dir_start_lookup, but that hint was shared by every thread looking
+     * up or reading the directory.
+     */
 
-    do {
+    for (n = 0; n < npages; n++) {
         char page[PAGE_SIZE];
         char* kaddr;
 
@@ -942,23 +980,135 @@ ufs_find_entry_s(struct inode* dir, const char* name)
                 }
                 if (ufs_match(sb, namelen, (char*)name, de)) {
                     result = fs32_to_cpu(sb, de->d_ino);
-                    goto found;
+                    goto out;
                 }
                 de = ufs_next_entry(sb, de);
             }
         }
-
-        if (++n >= npages)
-            n = 0;
-    } while (n != start);
+    }
 
 out:
     return result;
+}
+
+/*
+ * Inode block cache.
+ *
+ * A stat storm (readdir followed by a stat of every entry) touches the
+ * inodes of a cylinder group in order, and an inode block holds 32 to 128
+ * of them. Rather than reading the inode's fragment afresh for every iget,
+ * we read whole inode blocks and keep the most recently used
+ * UFS_ICACHE_NBLOCKS of them, keyed by their fragment address. The on-disk
+ * inodes are kept as they are; ufs1_read_inode()/ufs2_read_inode() do the
+ * endian conversion when an inode is actually instantiated.
+ */
 
-found:
-    ui->i_dir_start_lookup = n;
+#define UFS_ICACHE_NBLOCKS  64
+#define UFS_ICACHE_NBUCKETS 32
 
-    return result;
+struct ufs_iblock {
+    TAILQ_ENTRY(ufs_iblock) ib_lru;
+    LIST_ENTRY(ufs_iblock)  ib_link;
+    u64                     ib_fsba; /* fragment address of the block */
+    char                    ib_data[];
+};
+
+static pthread_mutex_t icache_lock = PTHREAD_MUTEX_INITIALIZER;
+static TAILQ_HEAD(ufs_iblock_lru, ufs_iblock) icache_lru =
+    TAILQ_HEAD_INITIALIZER(icache_lru);
+static LIST_HEAD(, ufs_iblock) icache_table[UFS_ICACHE_NBUCKETS];
+static unsigned icache_count = 0;
+
+/* Must be called with icache_lock held. */
+static struct ufs_iblock*
+ufs_icache_find(u64 fsba)
+{
+    struct ufs_iblock* ib;
+
+    LIST_FOREACH(ib, &icache_table[fsba % UFS_ICACHE_NBUCKETS], ib_link) {
+        if (ib->ib_fsba == fsba) {
+            TAILQ_REMOVE(&icache_lru, ib, ib_lru);
+            TAILQ_INSERT_HEAD(&icache_lru, ib, ib_lru);
+            return ib;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Copies the on-disk inode ino (isize bytes) into dinode, reading its inode
+ * block into the cache if need be.
+ */
+static int
+ufs_icache_get(struct super_block* sb, ino_t ino, char* dinode, size_t isize)
+{
+    struct ufs_sb_private_info* uspi = UFS_SB(sb)->s_uspi;
+    struct ufs_iblock* ib;
+    struct ufs_iblock* victim = NULL;
+
+    u32 cgoff = ufs_inotocgoff(ino);
+    u64 fsba = uspi->s_sbbase + ufs_cgimin(ufs_inotocg(ino)) +
+               (u64)(cgoff / uspi->s_inopb) * uspi->s_fpb;
+    size_t off = (cgoff % uspi->s_inopb) * isize;
+
+    pthread_mutex_lock(&icache_lock);
+    if ((ib = ufs_icache_find(fsba)) != NULL) {
+        memcpy(dinode, ib->ib_data + off, isize);
+        pthread_mutex_unlock(&icache_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&icache_lock);
+
+    ib = malloc(sizeof(struct ufs_iblock) + uspi->s_bsize);
+    if (!ib)
+        return ENOMEM;
+
+    if (pread(sb->s_bdev, ib->ib_data, uspi->s_bsize,
+              (off_t)fsba * sb->s_blocksize) != uspi->s_bsize) {
+        free(ib);
+        return EIO;
+    }
+
+    ib->ib_fsba = fsba;
+    memcpy(dinode, ib->ib_data + off, isize);
+
+    pthread_mutex_lock(&icache_lock);
+    if (ufs_icache_find(fsba) != NULL) { /* somebody beat us to it */
+        pthread_mutex_unlock(&icache_lock);
+        free(ib);
+        return 0;
+    }
+    if (icache_count >= UFS_ICACHE_NBLOCKS) {
+        victim = TAILQ_LAST(&icache_lru, ufs_iblock_lru);
+        TAILQ_REMOVE(&icache_lru, victim, ib_lru);
+        LIST_REMOVE(victim, ib_link);
+        icache_count--;
+    }
+    TAILQ_INSERT_HEAD(&icache_lru, ib, ib_lru);
+    LIST_INSERT_HEAD(&icache_table[fsba % UFS_ICACHE_NBUCKETS], ib, ib_link);
+    icache_count++;
+    pthread_mutex_unlock(&icache_lock);
+
+    if (victim)
+        free(victim);
+
+    return 0;
+}
+
+void
+U_ufs_icache_fini(void)
+{
+    struct ufs_iblock* ib;
+
+    pthread_mutex_lock(&icache_lock);
+    while ((ib = TAILQ_FIRST(&icache_lru)) != NULL) {
+        TAILQ_REMOVE(&icache_lru, ib, ib_lru);
+        LIST_REMOVE(ib, ib_link);
+        free(ib);
+    }
+    icache_count = 0;
+    pthread_mutex_unlock(&icache_lock);
 }
 
 struct super_block*
@@ -1434,7 +1584,11 @@ magic_found:
 
     ufs_setup_cstotal(sb);
 
-    /* Read cylinder group structures */
+    /*
+     * Read cylinder group structures. Only a writable mount needs them, and
+     * every mount is read-only (see above), so mounting never pays for one
+     * read per cylinder group.
+     */
 
     if (!(sb->s_flags & MS_RDONLY))
         if (!ufs_read_cylinder_structures(sb))
@@ -1522,7 +1676,7 @@ U_ufs_iget(struct super_block* sb, struct inode* inode)
 
     UFSD("ENTER, ino %lu\n", ino);
 
-    if (ino < UFS_ROOTINO || ino > (uspi->s_ncg * uspi->s_ipg)) {
+    if (ino < UFS_ROOTINO || ino > ((u64)uspi->s_ncg * uspi->s_ipg)) {
         fprintf(stderr, "ufs_read_inode: bad inode number (%lu)\n", ino);
         return EIO;
     }
@@ -1532,26 +1686,20 @@ U_ufs_iget(struct super_block* sb, struct inode* inode)
     inode->I_nlink = 1;
 
     ufsi = inode->I_private;
-    ufsi->i_unused1 = 0;
     ufsi->i_dir_start_lookup = 0;
 
-    struct buffer_head _bh;
-    struct buffer_head* bh = &_bh;
-
-    bh->b_flags.dynamic = 0;
-    if (sb_bread_intobh(sb, uspi->s_sbbase +
-                        ufs_inotofsba(inode->I_ino), bh) != 0) {
-        fprintf(stderr,
-                "ufs_read_inode: unable to read inode %llu\n", inode->I_ino);
-        goto bad_inode;
-    }
-
     if ((UFS_SB(sb)->s_flags & UFS_TYPE_MASK) == UFS_TYPE_UFS2) {
-        struct ufs2_inode* ufs2_inode = (struct ufs2_inode*)bh->b_data;
-        err = ufs2_read_inode(inode, ufs2_inode + ufs_inotofsbo(inode->I_ino));
+        struct ufs2_inode ufs2_inode;
+        if (ufs_icache_get(sb, ino, (char*)&ufs2_inode,
+                           sizeof(ufs2_inode)) != 0)
+            goto bad_read;
+        err = ufs2_read_inode(inode, &ufs2_inode);
     } else {
-        struct ufs_inode* ufs_inode = (struct ufs_inode*)bh->b_data;
-        err = ufs1_read_inode(inode, ufs_inode + ufs_inotofsbo(inode->I_ino));
+        struct ufs_inode ufs_inode;
+        if (ufs_icache_get(sb, ino, (char*)&ufs_inode,
+                           sizeof(ufs_inode)) != 0)
+            goto bad_read;
+        err = ufs1_read_inode(inode, &ufs_inode);
     }
 
     if (err)
@@ -1562,12 +1710,14 @@ U_ufs_iget(struct super_block* sb, struct inode* inode)
     ufsi->i_lastfrag = (inode->I_size + uspi->s_fsize - 1) >> uspi->s_fshift;
     ufsi->i_osync = 0;
 
-    brelse(bh);
-
     UFSD("EXIT\n");
 
     return 0;
 
+bad_read:
+    fprintf(stderr,
+            "ufs_read_inode: unable to read inode %llu\n", inode->I_ino);
+
 bad_inode:
 
     return -1;
@@ -1579,15 +1729,21 @@ U_ufs_inode_by_name(struct inode* dir, const char* name)
     return ufs_find_entry_s(dir, name);
 }
 
+/*
+ * The position in the directory lives entirely in *offset, which is a byte
+ * offset into the directory, and in dirpagebuf, which holds the page that
+ * offset falls in. Nothing is kept in the inode, so any number of readers
+ * (and lookups) can go through the same directory at the same time.
+ */
 int
 U_ufs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirpagebuf,
                     off_t* offset, struct unixfs_direntry* dent)
 {
     struct super_block* sb = dir->I_sb;
-    struct ufs_inode_info* ui = dir->I_private;
 
     unsigned long npages = ufs_dir_pages(dir);
-    unsigned long start, n;
+    unsigned long n;
+    unsigned pgoff, reclen, nl;
     struct ufs_dir_entry* de;
 
     UFSD("ENTER, dir_ino %llu\n", dir->I_ino);
@@ -1598,29 +1754,103 @@ U_ufs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirpagebuf,
     if (npages == 0)
         return -1;
 
-    start = ui->i_dir_start_lookup;
-    n = start;
-
-    if (start > npages)
+    n = *offset >> PAGE_CACHE_SHIFT; /* which page from offset */
+    if (n >= npages)
         return -1;
 
-    if ((ui->i_unused1 == 0) || (*offset & ((PAGE_SIZE - 1))) == 0) {
+    pgoff = *offset & (PAGE_SIZE - 1);
+
+    if (!dirpagebuf->flags.initialized || (pgoff == 0)) {
         int ret = ufs_get_dirpage(dir, n, dirpagebuf->data);
         if (ret != 0)
             return ret;
-        ui->i_dir_start_lookup++;
-        ui->i_unused1 = ui->i_dir_start_lookup;
+        dirpagebuf->flags.initialized = 1;
     }
 
-    de = (struct ufs_dir_entry*)((char*)dirpagebuf->data +
-                                 (*offset & (PAGE_SIZE - 1)));
+    de = (struct ufs_dir_entry*)((char*)dirpagebuf->data + pgoff);
+
+    reclen = fs16_to_cpu(sb, de->d_reclen);
+    nl = ufs_get_de_namlen(sb, de);
+    if ((reclen < UFS_DIR_REC_LEN(1)) || (nl > UFS_MAXNAMLEN) ||
+        (pgoff + reclen > ufs_last_byte(dir, n))) {
+        fprintf(stderr, "bad directory entry in directory #%llu at %llu\n",
+                dir->I_ino, (unsigned long long)*offset);
+        return -1;
+    }
 
     dent->ino = fs32_to_cpu(sb, de->d_ino);
-    size_t nl = ufs_get_de_namlen(sb, de);;
     memcpy(dent->name, de->d_name, nl);
     dent->name[nl] = '\0';
 
-    *offset += fs16_to_cpu(sb, de->d_reclen);
+    *offset += reclen;
+
+    return 0;
+}
+
+/*
+ * Maps a run of logical blocks. On return, *result holds the fragment
+ * address of logical block lblock (0 for a hole) and *count the number of
+ * blocks, at most maxblocks, starting at lblock that either follow each
+ * other on disk or are all holes. A run never extends past the indirect
+ * block fragment (or the inode's direct pointers) in which lblock was
+ * found, so each call costs at most one walk of the indirect chain.
+ */
+int
+U_ufs_get_blocks(struct inode* inode, sector_t lblock, unsigned maxblocks,
+                 u64* result, unsigned* count)
+{
+    struct ufs_inode_info* ufsi = inode->I_private;
+    struct super_block* sb = inode->I_sb;
+    struct ufs_sb_private_info* uspi = UFS_SB(sb)->s_uspi;
+
+    int ufs2 = ((UFS_SB(sb)->s_flags & UFS_TYPE_MASK) == UFS_TYPE_UFS2);
+    int shift = uspi->s_apbshift - uspi->s_fpbshift;
+    unsigned mask = (1U << shift) - 1;
+
+    struct buffer_head _bh;
+    sector_t offsets[4];
+    const void* ptrs;
+    unsigned nptrs, i, n;
+    int level, depth;
+    u64 block;
+
+    *result = 0;
+    *count = 1;
+
+    depth = ufs_block_to_path(inode, lblock, offsets);
+    if (depth == 0)
+        return EIO;
+
+    if (maxblocks == 0)
+        maxblocks = 1;
+
+    ptrs = ufs2 ? (void*)ufsi->i_u1.u2_i_data : (void*)ufsi->i_u1.i_data;
+    nptrs = (depth == 1) ? UFS_NDADDR : (UFS_NDADDR + UFS_NINDIR);
+    i = offsets[0];
+
+    for (level = 0; level < depth - 1; level++) {
+        sector_t off = offsets[level + 1];
+        block = ufs_get_ptr(sb, ptrs, i, ufs2);
+        if (!block)
+            return 0; /* hole */
+        if (ufs_get_indirect(inode, level,
+                             uspi->s_sbbase + block + (off >> shift), &_bh))
+            return EIO;
+        ptrs = _bh.b_data;
+        nptrs = mask + 1;
+        i = off & mask;
+    }
+
+    block = ufs_get_ptr(sb, ptrs, i, ufs2);
+
+    for (n = 1; (n < maxblocks) && (i + n < nptrs); n++) {
+        u64 next = ufs_get_ptr(sb, ptrs, i + n, ufs2);
+        if (block ? (next != block + (u64)n * uspi->s_fpb) : (next != 0))
+            break;
+    }
+
+    *result = block ? (uspi->s_sbbase + block) : 0;
+    *count = n;
 
     return 0;
 }
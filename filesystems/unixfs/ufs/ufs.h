@@ -17,14 +17,28 @@
 #include <ufs/swab.h>
 #include <linux/parser.h>
 
+/*
+ * In-core inode private data: the Linux ufs_inode_info, followed by a copy
+ * of the indirect block fragment last used at each level of indirection.
+ * A fragment is never larger than PAGE_SIZE.
+ */
+struct ufs_node_info {
+    struct ufs_inode_info ni_ufsi; /* must be first */
+    u64                   ni_indirfrag[3];
+    char                  ni_indir[3][PAGE_SIZE];
+};
+
 struct super_block*
       U_ufs_fill_super(int fd, void* args, int silent);
 int   U_ufs_statvfs(struct super_block* sb, struct statvfs* buf);
 int   U_ufs_iget(struct super_block* sb, struct inode* ip);
 ino_t U_ufs_inode_by_name(struct inode* dir, const char* name);
+void  U_ufs_icache_fini(void);
 int   U_ufs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
                           off_t* offset, struct unixfs_direntry* dent);
 int   U_ufs_get_block(struct inode* ip, sector_t fragment, off_t* result);
+int   U_ufs_get_blocks(struct inode* ip, sector_t lblock, unsigned maxblocks,
+                       u64* result, unsigned* count);
 int   U_ufs_get_page(struct inode* ip, sector_t index, char* pagebuf);
 
 #endif /* _UFS_H_ */
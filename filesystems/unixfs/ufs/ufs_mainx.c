@@ -60,6 +60,10 @@ unixfs_usage(void)
 
     fprintf(stderr, "%s",
     "     . --force attempts mounting even if there are warnings or errors\n"
+    "     . --trace FILE records the FUSE requests and replies of the mount\n"
+    "       in FILE (see support/tracing)\n"
+    "     . --replay FILE runs the requests recorded in FILE against DMG,\n"
+    "       without mounting, and reports per-opcode latency and throughput\n"
     );
 }
 
@@ -44,7 +44,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, __unused fs_endian_t fse,
         goto out;
     }
 
-    if ((err = unixfs_inodelayer_init(sizeof(struct ufs_inode_info))) != 0)
+    if ((err = unixfs_inodelayer_init(sizeof(struct ufs_node_info))) != 0)
         goto out;
 
     char args[UNIXFS_MNAMELEN];
@@ -90,6 +90,8 @@ static void
 unixfs_internal_fini(void* filsys)
 {
     unixfs_inodelayer_fini();
+    unixfs_dirindex_fini();
+    U_ufs_icache_fini();
 
     struct super_block* sb = (struct super_block*)filsys;
     if (sb)
@@ -227,23 +229,41 @@ static ssize_t
 unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
                        int* error)
 {
+    struct super_block* sb = unixfs;
+    size_t iosize = UNIXFS_IOSIZE(unixfs);
     char* p = buf;
     ssize_t done = 0;
-    ssize_t tomove = 0;
-    ssize_t remaining = nbyte;
-    char page[PAGE_SIZE];
-    sector_t beginpgno = offset >> PAGE_CACHE_SHIFT;
+    size_t remaining = nbyte;
+
+    *error = 0;
 
-    while (remaining > 0) { /* page sized reads */
-        *error = U_ufs_get_page(ip, beginpgno, page);
+    while (remaining > 0) { /* one read per contiguous run of blocks */
+        sector_t lblkno = offset / iosize;
+        size_t blkoff = offset % iosize;
+        unsigned maxblocks = (blkoff + remaining + iosize - 1) / iosize;
+        unsigned nblocks;
+        u64 frag;
+
+        *error = U_ufs_get_blocks(ip, lblkno, maxblocks, &frag, &nblocks);
         if (*error)
             break;
-        tomove = (remaining > PAGE_SIZE) ? PAGE_SIZE : remaining;
-        memcpy(p, page, tomove);
+
+        size_t tomove = (nblocks * iosize) - blkoff;
+        if (tomove > remaining)
+            tomove = remaining;
+
+        if (frag == 0) /* hole */
+            memset(p, 0, tomove);
+        else if (pread(sb->s_bdev, p, tomove,
+                       (off_t)frag * sb->s_blocksize + blkoff) != tomove) {
+            *error = EIO;
+            break;
+        }
+
         remaining -= tomove;
         done += tomove;
+        offset += tomove;
         p += tomove;
-        beginpgno++;
     }
 
     if ((done == 0) && *error)
@@ -0,0 +1,143 @@
+/*
+ * awhash_bench: time answer matching with the answer-wait hash against the
+ * list walk it replaced.
+ *
+ * For each number of requests in flight, tickets with sequential uniques
+ * are queued, and then answers arrive in random order: each answer is
+ * looked up by unique, removed, and a new request is queued in its place,
+ * so the number in flight stays constant.
+ *
+ * Usage: awhash_bench [-r answers]
+ */
+
+#include <sys/queue.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fuse_awhash.h"
+
+struct ticket {
+    uint64_t               unique;
+    struct fuse_awlink     link;
+    TAILQ_ENTRY(ticket)    tailq;
+};
+
+static TAILQ_HEAD(, ticket) aw_head = TAILQ_HEAD_INITIALIZER(aw_head);
+static struct fuse_awhash ah;
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* The replaced answer matching: walk the whole list in arrival order. */
+static struct ticket *
+list_find(uint64_t unique)
+{
+    struct ticket *t;
+
+    TAILQ_FOREACH(t, &aw_head, tailq) {
+        if (t->unique == unique) {
+            break;
+        }
+    }
+    return t;
+}
+
+static struct ticket *
+hash_find(uint64_t unique)
+{
+    struct fuse_awlink *al = fuse_awhash_find(&ah, unique);
+
+    return al ? FUSE_AWLINK_OBJECT(al, struct ticket, link) : NULL;
+}
+
+static double
+run(struct ticket *t, unsigned long n, unsigned long answers, int hashed)
+{
+    uint64_t next = 1;
+    unsigned long i, r;
+    double t0;
+
+    for (i = 0; i < n; i++) {
+        t[i].unique = next++;
+        if (hashed) {
+            fuse_awhash_insert(&ah, &t[i].link, t[i].unique);
+        } else {
+            TAILQ_INSERT_TAIL(&aw_head, &t[i], tailq);
+        }
+    }
+
+    srand(1);
+    t0 = now();
+    for (r = 0; r < answers; r++) {
+        struct ticket *tk = &t[rand() % n];
+        struct ticket *found;
+
+        found = hashed ? hash_find(tk->unique) : list_find(tk->unique);
+        if (found != tk) {
+            fprintf(stderr, "FAIL: unique %llu not matched\n",
+                    (unsigned long long)tk->unique);
+            exit(1);
+        }
+        if (hashed) {
+            fuse_awhash_remove(&ah, &tk->link);
+            tk->unique = next++;
+            fuse_awhash_insert(&ah, &tk->link, tk->unique);
+        } else {
+            TAILQ_REMOVE(&aw_head, tk, tailq);
+            tk->unique = next++;
+            TAILQ_INSERT_TAIL(&aw_head, tk, tailq);
+        }
+    }
+    t0 = now() - t0;
+
+    for (i = 0; i < n; i++) {
+        if (hashed) {
+            fuse_awhash_remove(&ah, &t[i].link);
+        } else {
+            TAILQ_REMOVE(&aw_head, &t[i], tailq);
+        }
+    }
+
+    return t0 * 1e9 / answers;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const unsigned long inflight[] = { 1, 16, 256, 4096, 65536 };
+    unsigned long answers = 200000, k;
+    int c;
+
+    while ((c = getopt(argc, argv, "r:")) != -1) {
+        switch (c) {
+        case 'r': answers = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: awhash_bench [-r answers]\n");
+            return 1;
+        }
+    }
+
+    fuse_awhash_init(&ah);
+
+    printf("%10s %14s %14s\n", "in flight", "list ns/ans", "hash ns/ans");
+    for (k = 0; k < sizeof(inflight) / sizeof(inflight[0]); k++) {
+        unsigned long n = inflight[k];
+        struct ticket *t = calloc(n, sizeof(*t));
+        /* The list walk is O(n); keep its run time bounded. */
+        unsigned long la = answers / (n > 256 ? n / 256 : 1);
+        double list_ns = run(t, n, la ? la : 1, 0);
+        double hash_ns = run(t, n, answers, 1);
+
+        printf("%10lu %14.1f %14.1f\n", n, list_ns, hash_ns);
+        free(t);
+    }
+
+    return 0;
+}
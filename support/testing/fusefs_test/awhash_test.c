@@ -0,0 +1,133 @@
+/*
+ * awhash_test: check the answer-wait hash against a simple model.
+ *
+ * Tickets are inserted, removed and looked up at random, and after every
+ * step the hash must agree with an array saying which tickets are in it.
+ * Unique IDs are drawn so that many of them land on the same chain.
+ *
+ * Usage: awhash_test [-n steps] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fuse_awhash.h"
+
+#define NTICKETS 1024
+
+struct ticket {
+    int                present;
+    uint64_t           unique;
+    struct fuse_awlink link;
+};
+
+static struct ticket tickets[NTICKETS];
+static struct fuse_awhash ah;
+
+static void
+fail(const char *what, int i)
+{
+    fprintf(stderr, "FAIL: %s (ticket %d, unique %llu)\n", what, i,
+            (unsigned long long)tickets[i].unique);
+    exit(1);
+}
+
+static void
+check(void)
+{
+    uint32_t count = 0;
+    int i;
+
+    for (i = 0; i < NTICKETS; i++) {
+        struct fuse_awlink *al = fuse_awhash_find(&ah, tickets[i].unique);
+
+        if (tickets[i].present) {
+            count++;
+            if (!al) {
+                fail("present ticket not found", i);
+            }
+            if (FUSE_AWLINK_OBJECT(al, struct ticket, link) != &tickets[i]) {
+                fail("lookup returned the wrong ticket", i);
+            }
+        } else if (al) {
+            fail("absent ticket found", i);
+        }
+    }
+
+    if (ah.ah_count != count) {
+        fprintf(stderr, "FAIL: count %u, expected %u\n", ah.ah_count, count);
+        exit(1);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned long steps = 200000, seed = 1, s;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "n:s:")) != -1) {
+        switch (c) {
+        case 'n': steps = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: awhash_test [-n steps] [-s seed]\n");
+            return 1;
+        }
+    }
+
+    srand(seed);
+    fuse_awhash_init(&ah);
+
+    /*
+     * Uniques are distinct, and a quarter of them differ only by multiples
+     * of the table size, so those all share one chain.
+     */
+    for (i = 0; i < NTICKETS; i++) {
+        if (i % 4 == 0) {
+            tickets[i].unique = 7 + (uint64_t)i * FUSE_AW_HASH_SIZE;
+        } else {
+            tickets[i].unique = ((uint64_t)i << 32) | (i * 2654435761U);
+        }
+    }
+    check();
+
+    for (s = 0; s < steps; s++) {
+        i = rand() % NTICKETS;
+
+        if (tickets[i].present) {
+            fuse_awhash_remove(&ah, &tickets[i].link);
+            tickets[i].present = 0;
+        } else {
+            fuse_awhash_insert(&ah, &tickets[i].link, tickets[i].unique);
+            tickets[i].present = 1;
+        }
+
+        /* A full check is O(n); do it often, but not on every step. */
+        if (s % 64 == 0 || s < 4096) {
+            check();
+        }
+    }
+    check();
+
+    /* Drain in order, so heads, middles and tails of chains all go. */
+    for (i = 0; i < NTICKETS; i++) {
+        if (tickets[i].present) {
+            fuse_awhash_remove(&ah, &tickets[i].link);
+            tickets[i].present = 0;
+            check();
+        }
+    }
+    for (i = 0; i < FUSE_AW_HASH_SIZE; i++) {
+        if (ah.ah_chains[i]) {
+            fprintf(stderr, "FAIL: chain %d not empty after draining\n", i);
+            return 1;
+        }
+    }
+
+    printf("%lu random steps over %d tickets: hash matches the model\n",
+           steps, NTICKETS);
+
+    return 0;
+}
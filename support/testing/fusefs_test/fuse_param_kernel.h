@@ -0,0 +1,19 @@
+/*
+ * The tunables in the KERNEL block of fuse_param.h are plain macros. This
+ * makes them visible to user-space harnesses without defining KERNEL for
+ * the system headers, so include it after those and before anything else
+ * that includes fuse_param.h.
+ */
+
+#ifndef _FUSE_PARAM_KERNEL_H_
+#define _FUSE_PARAM_KERNEL_H_
+
+#ifdef _FUSE_PARAM_H_
+#error fuse_param.h was included before fuse_param_kernel.h
+#endif
+
+#define KERNEL
+#include <fuse_param.h>
+#undef KERNEL
+
+#endif /* _FUSE_PARAM_KERNEL_H_ */
@@ -0,0 +1,304 @@
+/*
+ * nodehash_stress: hammer fuse_nodehash.c from several threads and time it.
+ *
+ * fuse_nodehash.c is built unchanged against the pthread stand-ins in xnu/.
+ * Worker threads look up random inodes on a few devices, attaching a new
+ * vnode when the HNode is new, and sometimes reclaim the vnode when they
+ * drop the last reference, so HNodes are created and freed all the time.
+ * Each lookup checks the identity and fork vnode of the HNode it got.
+ *
+ * Meanwhile exchanger threads swap the identities of random pairs from a
+ * fixed set of HNodes on another device, while the workers also look
+ * those up. Every identity in the set must stay findable throughout. Two
+ * exchanges may share an HNode, which the kext's caller would not allow,
+ * but the hash must survive it.
+ *
+ * At the end every HNode is detached and HNodeTerm() checks that the hash
+ * table is empty.
+ *
+ * Usage: nodehash_stress [-n ops] [-x exchangers] [-t threads]...
+ */
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "fuse.h"
+#include "fuse_nodehash.h"
+
+#define NDEV   4
+#define NINO   2000
+#define NXINO  64
+
+#define DEV(i) ((fuse_device_t)(uintptr_t)(0x1000 * ((i) + 1)))
+#define XDEV   DEV(NDEV)
+
+static unsigned long ops = 200000;
+static volatile int  done;
+
+static vnode_t xvnodes[NXINO];
+static long    nexchanges;
+
+static void
+fail(const char *what, fuse_device_t dev, uint64_t ino)
+{
+    fprintf(stderr, "FAIL: %s (dev %p, ino %llu)\n", what, (void *)dev,
+            (unsigned long long)ino);
+    exit(1);
+}
+
+static vnode_t
+vnode_create(HNodeRef hnode)
+{
+    vnode_t vn = calloc(1, sizeof(*vn));
+
+    pthread_mutex_init(&vn->v_lock, NULL);
+    vn->v_fsnode = hnode;
+    vn->v_iocount = 1;
+
+    return vn;
+}
+
+static int
+is_exchanged_vnode(vnode_t vn)
+{
+    int i;
+
+    for (i = 0; i < NXINO; i++) {
+        if (xvnodes[i] == vn) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Look up one inode of the exchanged set; it must always be there. An
+ * exchange takes the vnode along with the identity, and nothing here swaps
+ * the vnodes' fsnode pointers to match (the kext cannot either), so all we
+ * can check is that the vnode is one of the set.
+ */
+static void
+lookup_exchanged(unsigned *seed)
+{
+    uint64_t ino = 1 + rand_r(seed) % NXINO;
+    HNodeRef hnode = NULL;
+    vnode_t  vn = NULL;
+    errno_t  err;
+
+    err = HNodeLookupRealQuickIfExists(XDEV, ino, 0, &hnode, &vn);
+    if (err) {
+        fail("exchanged HNode missing from the hash", XDEV, ino);
+    }
+    if (!is_exchanged_vnode(vn) ||
+        !is_exchanged_vnode(HNodeGetVNodeForForkAtIndex(hnode, 0))) {
+        fail("exchanged HNode lost its vnode", XDEV, ino);
+    }
+    vnode_put(vn);
+}
+
+static void *
+worker(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    unsigned long i;
+
+    for (i = 0; i < ops; i++) {
+        fuse_device_t dev = DEV(rand_r(&seed) % NDEV);
+        uint64_t ino = 1 + rand_r(&seed) % NINO;
+        HNodeRef hnode = NULL;
+        vnode_t  vn = NULL;
+        int      reclaim;
+
+        if (i % 8 == 0) {
+            lookup_exchanged(&seed);
+            continue;
+        }
+
+        if (HNodeLookupCreatingIfNecessary(dev, ino, 0, &hnode, &vn)) {
+            fail("lookup failed", dev, ino);
+        }
+        if (vn == NULL) {
+            /* Now we are attaching; sometimes pretend vnode_create failed. */
+            if (rand_r(&seed) % 50 == 0) {
+                if (HNodeAttachVNodeFailed(hnode, 0)) {
+                    HNodeScrubDone(hnode);
+                }
+                continue;
+            }
+            vn = vnode_create(hnode);
+            HNodeAttachVNodeSucceeded(hnode, 0, vn);
+        }
+
+        if (HNodeGetDevice(hnode) != dev || HNodeGetInodeNumber(hnode) != ino) {
+            fail("lookup returned the wrong HNode", dev, ino);
+        }
+        if (HNodeGetVNodeForForkAtIndex(hnode, 0) != vn) {
+            fail("HNode has the wrong vnode", dev, ino);
+        }
+
+        pthread_mutex_lock(&vn->v_lock);
+        reclaim = (--vn->v_iocount == 0) && rand_r(&seed) % 4 == 0;
+        if (reclaim) {
+            vn->v_dead = 1;
+            __atomic_add_fetch(&vn->v_id, 1, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&vn->v_lock);
+
+        /* The vnode itself is leaked; a later lookup may still peek at it. */
+        if (reclaim && HNodeDetachVNode(hnode, vn)) {
+            HNodeScrubDone(hnode);
+        }
+    }
+
+    return NULL;
+}
+
+static void *
+exchanger(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    long n = 0;
+
+    while (!done) {
+        int a = rand_r(&seed) % NXINO;
+        int b = rand_r(&seed) % NXINO;
+
+        if (a == b) {
+            continue;
+        }
+        HNodeExchangeFromFSNode(FSNodeGenericFromVNode(xvnodes[a]),
+                                FSNodeGenericFromVNode(xvnodes[b]));
+        n++;
+    }
+    __sync_fetch_and_add(&nexchanges, n);
+
+    return NULL;
+}
+
+static void
+setup_exchanged(void)
+{
+    uint64_t ino;
+
+    for (ino = 1; ino <= NXINO; ino++) {
+        HNodeRef hnode = NULL;
+        vnode_t  vn = NULL;
+
+        if (HNodeLookupCreatingIfNecessary(XDEV, ino, 0, &hnode, &vn) ||
+            vn != NULL) {
+            fail("could not create an exchanged HNode", XDEV, ino);
+        }
+        xvnodes[ino - 1] = vnode_create(hnode);
+        HNodeAttachVNodeSucceeded(hnode, 0, xvnodes[ino - 1]);
+    }
+}
+
+/* Detach every vnode left in the hash, so that HNodeTerm() finds it empty. */
+static void
+teardown(void)
+{
+    uint64_t ino;
+    int d;
+
+    for (d = 0; d <= NDEV; d++) {
+        for (ino = 1; ino <= NINO; ino++) {
+            HNodeRef hnode = NULL;
+            vnode_t  vn = NULL;
+
+            if (HNodeLookupRealQuickIfExists(DEV(d), ino, 0, &hnode, &vn)) {
+                continue;
+            }
+            if (HNodeGetDevice(hnode) != DEV(d) ||
+                HNodeGetInodeNumber(hnode) != ino) {
+                fail("hash holds an HNode on the wrong chain", DEV(d), ino);
+            }
+            vnode_put(vn);
+            if (HNodeDetachVNode(hnode, vn)) {
+                HNodeScrubDone(hnode);
+            } else {
+                fail("HNode still referenced at teardown", DEV(d), ino);
+            }
+        }
+    }
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int default_threads[] = { 1, 2, 4, 8 };
+    int threads[16], nthreads = 0, nexchangers = 2, c, k, i;
+    lck_grp_t grp;
+
+    while ((c = getopt(argc, argv, "n:x:t:")) != -1) {
+        switch (c) {
+        case 'n': ops = strtoul(optarg, NULL, 0); break;
+        case 'x': nexchangers = atoi(optarg); break;
+        case 't':
+            if (nthreads < 16) {
+                threads[nthreads++] = atoi(optarg);
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: nodehash_stress [-n ops] [-x exchangers] "
+                    "[-t threads]...\n");
+            return 1;
+        }
+    }
+    if (nthreads == 0) {
+        memcpy(threads, default_threads, sizeof(default_threads));
+        nthreads = sizeof(default_threads) / sizeof(default_threads[0]);
+    }
+    if (nexchangers > 16) {
+        nexchangers = 16;
+    }
+
+    printf("%lu operations per thread, %d exchangers\n", ops, nexchangers);
+    printf("%8s %12s %10s %12s\n", "threads", "Mops/s", "ns/op", "exchanges");
+
+    for (k = 0; k < nthreads; k++) {
+        pthread_t tid[256], xtid[16];
+        int n = threads[k] > 256 ? 256 : threads[k];
+        double t0, t1;
+
+        if (HNodeInit(&grp, NULL, (OSMallocTag)&grp, 0x48737472, 64)) {
+            fprintf(stderr, "FAIL: HNodeInit\n");
+            return 1;
+        }
+        setup_exchanged();
+        done = 0;
+        nexchanges = 0;
+
+        for (i = 0; i < nexchangers; i++) {
+            pthread_create(&xtid[i], NULL, exchanger,
+                           (void *)(uintptr_t)(1000 + i));
+        }
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            pthread_create(&tid[i], NULL, worker, (void *)(uintptr_t)(i + 1));
+        }
+        for (i = 0; i < n; i++) {
+            pthread_join(tid[i], NULL);
+        }
+        t1 = now();
+        done = 1;
+        for (i = 0; i < nexchangers; i++) {
+            pthread_join(xtid[i], NULL);
+        }
+
+        printf("%8d %12.2f %10.1f %12ld\n", n, n * ops / (t1 - t0) / 1e6,
+               (t1 - t0) * 1e9 / (n * ops), nexchanges);
+
+        teardown();
+        HNodeTerm();
+    }
+
+    return 0;
+}
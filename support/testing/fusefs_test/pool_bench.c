@@ -0,0 +1,274 @@
+/*
+ * pool_bench: measure the ticket buffer pool against plain reallocation.
+ *
+ * The pool is fuse_pool.c itself, with pthread mutexes for lck_mtx_t.
+ * fiov_init/teardown/refresh and fiov_adjust_canfail() are transcribed from
+ * fuse_ipc.c. The kernel allocator is stood in for by mmap() above a page,
+ * as kmem_alloc maps fresh pages, and by malloc() below it.
+ *
+ * A few tickets are used in rotation. Each request sizes the answer buffer
+ * for a read, fills it the way the daemon's copy would, and refreshes the
+ * ticket as fuse_ticket_drop() does. With -p 0 the tickets have no pool,
+ * which is how every buffer was handled before.
+ *
+ * At the end all tickets are torn down and the pool destroyed, and every
+ * allocation must have been freed.
+ *
+ * Usage: pool_bench [-p 0|1] [-n requests] [-t tickets] [-m maxbytes]
+ */
+
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fuse_param_kernel.h"
+#include "fuse_pool.h"
+
+#define PAGE_SIZE 4096
+#define FU_AT_LEAST(siz) \
+    ((size_t)(siz) > 160 ? (size_t)(siz) : (size_t)160)
+
+struct fuse_iov {
+    void                 *base;
+    size_t                len;
+    size_t                allocated_size;
+    ssize_t               credit;
+    struct fuse_iov_pool *pool;
+};
+
+static int32_t  fuse_iov_credit = FUSE_DEFAULT_IOV_CREDIT;
+static uint32_t fuse_iov_permanent_bufsize =
+    FUSE_DEFAULT_IOV_PERMANENT_BUFSIZE;
+static uint32_t fuse_iov_pool_maxbytes = FUSE_DEFAULT_IOV_POOL_MAXBYTES;
+
+static long     nallocs, nfrees, nlive;
+
+static void *
+kalloc(size_t size)
+{
+    void *p;
+
+    nallocs++;
+    nlive++;
+    if (size > PAGE_SIZE) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON,
+                 -1, 0);
+        return (p == MAP_FAILED) ? NULL : p;
+    }
+    return malloc(size);
+}
+
+static void
+kfree(void *p, size_t size)
+{
+    nfrees++;
+    nlive--;
+    if (size > PAGE_SIZE) {
+        munmap(p, size);
+    } else {
+        free(p);
+    }
+}
+
+static void
+pool_lock(void *mtx)
+{
+    pthread_mutex_lock((pthread_mutex_t *)mtx);
+}
+
+static void
+pool_unlock(void *mtx)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)mtx);
+}
+
+static const struct fuse_iov_pool_ops pool_ops = {
+    pool_lock,
+    pool_unlock,
+    kalloc,
+    kfree,
+    NULL,
+};
+
+static void
+fiov_init(struct fuse_iov *fiov, size_t size)
+{
+    size_t msize = FU_AT_LEAST(size);
+
+    fiov->len = 0;
+    fiov->pool = NULL;
+    fiov->base = kalloc(msize);
+    memset(fiov->base, 0, msize);
+    fiov->allocated_size = msize;
+    fiov->credit = fuse_iov_credit;
+}
+
+static void
+fiov_teardown(struct fuse_iov *fiov)
+{
+    fuse_iov_pool_put(&pool_ops, fiov->pool, fiov->base,
+                      fiov->allocated_size, fuse_iov_pool_maxbytes);
+    fiov->allocated_size = 0;
+}
+
+static int
+fiov_adjust_canfail(struct fuse_iov *fiov, size_t size)
+{
+    if (fiov->allocated_size < size ||
+        (fuse_iov_permanent_bufsize >= 0 &&
+         fiov->allocated_size - size > fuse_iov_permanent_bufsize &&
+             --fiov->credit < 0)) {
+
+        void  *tmpbase = NULL;
+        size_t tmpsize = fuse_iov_pool_roundup(fiov->pool, FU_AT_LEAST(size));
+
+        if (tmpsize != fiov->allocated_size) {
+            tmpbase = fuse_iov_pool_get(&pool_ops, fiov->pool,
+                                        FU_AT_LEAST(size), &tmpsize);
+            if (!tmpbase) {
+                return 1;
+            }
+
+            fuse_iov_pool_put(&pool_ops, fiov->pool, fiov->base,
+                              fiov->allocated_size, fuse_iov_pool_maxbytes);
+
+            fiov->base = tmpbase;
+            fiov->allocated_size = tmpsize;
+        }
+
+        fiov->credit = fuse_iov_credit;
+    }
+
+    fiov->len = size;
+
+    return 0;
+}
+
+static void
+fiov_refresh(struct fuse_iov *fiov)
+{
+    memset(fiov->base, 0, fiov->len);
+    fiov_adjust_canfail(fiov, 0);
+}
+
+/* The answer to a read of size bytes: a 16-byte out header and the data. */
+static void
+request(struct fuse_iov *fiov, size_t size)
+{
+    if (fiov_adjust_canfail(fiov, 16 + size)) {
+        fprintf(stderr, "FAIL: allocation of %zu bytes\n", 16 + size);
+        exit(1);
+    }
+    memset((char *)fiov->base + 16, 0x5a, size);
+    fiov_refresh(fiov);
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+enum { W_FIXED, W_ALTERNATE, W_MIXED };
+
+struct workload {
+    const char *name;
+    int         kind;
+    size_t      size;
+};
+
+static const struct workload workloads[] = {
+    { "4K reads",           W_FIXED,     4096 },
+    { "64K reads",          W_FIXED,     65536 },
+    { "1M reads",           W_FIXED,     1 << 20 },
+    { "4K/1M alternating",  W_ALTERNATE, 0 },
+    { "4K..1M mixed",       W_MIXED,     0 },
+};
+
+int
+main(int argc, char **argv)
+{
+    unsigned long nrequests = 20000, r;
+    int usepool = 1, ntickets = 8, c, i;
+    size_t k;
+
+    while ((c = getopt(argc, argv, "p:n:t:m:")) != -1) {
+        switch (c) {
+        case 'p': usepool = atoi(optarg); break;
+        case 'n': nrequests = strtoul(optarg, NULL, 0); break;
+        case 't': ntickets = atoi(optarg); break;
+        case 'm': fuse_iov_pool_maxbytes = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: pool_bench [-p 0|1] [-n requests] "
+                    "[-t tickets] [-m maxbytes]\n");
+            return 1;
+        }
+    }
+    if (ntickets < 1) {
+        ntickets = 1;
+    }
+
+    printf("%s, %d tickets, %lu requests\n",
+           usepool ? "pool" : "no pool", ntickets, nrequests);
+    printf("%-20s %10s %14s\n", "workload", "us/req", "allocs/req");
+
+    for (k = 0; k < sizeof(workloads) / sizeof(workloads[0]); k++) {
+        const struct workload *w = &workloads[k];
+        struct fuse_iov_pool pool;
+        pthread_mutex_t pool_mtx;
+        struct fuse_iov *fiov = calloc(ntickets, sizeof(*fiov));
+        long allocs0;
+        double t0, t1;
+
+        pthread_mutex_init(&pool_mtx, NULL);
+        fuse_iov_pool_init(&pool, &pool_mtx);
+        for (i = 0; i < ntickets; i++) {
+            fiov_init(&fiov[i], 0);
+            fiov[i].pool = usepool ? &pool : NULL;
+        }
+
+        srand(1);
+        allocs0 = nallocs;
+        t0 = now();
+        for (r = 0; r < nrequests; r++) {
+            size_t size = w->size;
+
+            if (w->kind == W_ALTERNATE) {
+                size = ((r / ntickets) & 1) ? (1 << 20) : 4096;
+            } else if (w->kind == W_MIXED) {
+                size = (size_t)4096 << (rand() % 9);
+            }
+            request(&fiov[r % ntickets], size);
+        }
+        t1 = now();
+
+        printf("%-20s %10.2f %14.3f\n", w->name,
+               (t1 - t0) * 1e6 / nrequests,
+               (double)(nallocs - allocs0) / nrequests);
+
+        if (pool.cached_bytes > fuse_iov_pool_maxbytes) {
+            fprintf(stderr, "FAIL: %zu bytes cached, limit %u\n",
+                    pool.cached_bytes, fuse_iov_pool_maxbytes);
+            return 1;
+        }
+        for (i = 0; i < ntickets; i++) {
+            fiov_teardown(&fiov[i]);
+        }
+        fuse_iov_pool_shrink(&pool_ops, &pool, 0);
+        free(fiov);
+
+        if (nlive != 0) {
+            fprintf(stderr, "FAIL: %ld buffers leaked\n", nlive);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * range_bench: time the write-back range set the way the write path uses it.
+ *
+ *   append     4 KiB writes one after the other; every add extends the
+ *              last range
+ *   random     4 KiB writes at random pages of a 64 MiB file; the set is
+ *              full most of the time, so most adds merge
+ *   flush      a full set popped in 1 MiB pieces after 64 random writes,
+ *              as fuse_internal_writeback_flush() does
+ *   remove     4 KiB removes at random pages, as strategy takes out what
+ *              a pageout wrote
+ *
+ * Usage: range_bench [-n operations]
+ */
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fuse_range.h"
+
+#define PAGE      4096
+#define FILEPAGES (64 * 1024 * 1024 / PAGE)
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+report(const char *what, unsigned long n, double t, off_t bytes)
+{
+    printf("%-8s %9lu ops: %6.1f ns/op (%lld bytes left in the set)\n",
+           what, n, (t * 1e9) / n, (long long)bytes);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct fuse_rangeset rs;
+    unsigned long n = 10000000, i, pops;
+    off_t *pages, start, end;
+    double t0;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+        case 'n': n = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: range_bench [-n operations]\n");
+            return 1;
+        }
+    }
+
+    /* Drawn up front so that rand() stays out of the timings. */
+    if (!(pages = malloc(n * sizeof(*pages)))) {
+        perror("range_bench");
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < n; i++) {
+        pages[i] = (off_t)(rand() % FILEPAGES) * PAGE;
+    }
+
+    fuse_rangeset_init(&rs);
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        fuse_rangeset_add(&rs, (off_t)i * PAGE, (off_t)(i + 1) * PAGE);
+    }
+    report("append", n, now() - t0, rs.bytes);
+
+    fuse_rangeset_init(&rs);
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        fuse_rangeset_add(&rs, pages[i], pages[i] + PAGE);
+    }
+    report("random", n, now() - t0, rs.bytes);
+
+    pops = 0;
+    t0 = now();
+    for (i = 0; i + 64 <= n; i += 64) {
+        unsigned long k;
+
+        fuse_rangeset_init(&rs);
+        for (k = 0; k < 64; k++) {
+            fuse_rangeset_add(&rs, pages[i + k], pages[i + k] + PAGE);
+        }
+        while (fuse_rangeset_pop(&rs, 1024 * 1024, &start, &end)) {
+            pops++;
+        }
+    }
+    printf("flush    %9lu sets: %6.1f ns/set, %.1f pops per set\n", i / 64,
+           ((now() - t0) * 1e9) / (i / 64 ? i / 64 : 1),
+           (double)pops / (i / 64 ? i / 64 : 1));
+
+    fuse_rangeset_init(&rs);
+    fuse_rangeset_add(&rs, 0, (off_t)FILEPAGES * PAGE);
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        fuse_rangeset_remove(&rs, pages[i], pages[i] + PAGE);
+    }
+    report("remove", n, now() - t0, rs.bytes);
+
+    free(pages);
+
+    return 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * range_test: check the write-back range set against a byte bitmap.
+ *
+ * A few fixed cases come first: the slot overflow, where the new range is
+ * merged into a neighbour (add calls itself to do it) or the two closest
+ * existing ranges are merged, and a remove that would split a range when
+ * there is no slot for the second half.
+ *
+ * Then random sequences of adds, removes and pops run over a small file,
+ * with two bitmaps alongside: the bytes that were written and not yet
+ * pushed, and the bytes the set covers. After every step the set must be
+ * sorted, disjoint and non-adjacent, its byte count must add up, and it must
+ * cover every written byte. A step that does not run out of slots must
+ * change the covered bytes exactly as asked; one that does may only close a
+ * single gap, or for a remove, leave the set as it was.
+ *
+ * Usage: range_test [-n sequences] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fuse_range.h"
+
+#define FILESIZE 4096
+#define STEPS    200
+
+static struct fuse_rangeset rs;
+static unsigned char written[FILESIZE]; /* added, not removed or popped */
+static unsigned char covered[FILESIZE]; /* what the set should cover */
+static unsigned long seq, step;
+
+static void
+fail(const char *what)
+{
+    uint32_t i;
+
+    fprintf(stderr, "FAIL: %s (sequence %lu, step %lu)\n", what, seq, step);
+    for (i = 0; i < rs.count; i++) {
+        fprintf(stderr, "  [%lld, %lld)\n", (long long)rs.ranges[i].start,
+                (long long)rs.ranges[i].end);
+    }
+    exit(1);
+}
+
+static void
+expect(uint32_t count, off_t bytes, const off_t *bounds)
+{
+    uint32_t i;
+
+    if (rs.count != count || rs.bytes != bytes) {
+        fail("wrong count or bytes");
+    }
+    for (i = 0; i < count; i++) {
+        if (rs.ranges[i].start != bounds[2 * i] ||
+            rs.ranges[i].end != bounds[2 * i + 1]) {
+            fail("wrong ranges");
+        }
+    }
+}
+
+/* Eight ranges of 10 bytes, 100 apart. */
+static void
+fill(void)
+{
+    int i;
+
+    fuse_rangeset_init(&rs);
+    for (i = 0; i < FUSE_RANGESET_SIZE; i++) {
+        fuse_rangeset_add(&rs, i * 100, i * 100 + 10);
+    }
+}
+
+static void
+fixed_cases(void)
+{
+    off_t start, end;
+
+    /* Closer to the left neighbour than any two ranges are to each other. */
+    fill();
+    fuse_rangeset_add(&rs, 12, 15);
+    {
+        static const off_t b[] = { 0, 15, 100, 110, 200, 210, 300, 310,
+                                   400, 410, 500, 510, 600, 610, 700, 710 };
+        expect(8, 85, b);
+    }
+
+    /* Closer to the right neighbour. */
+    fill();
+    fuse_rangeset_add(&rs, 195, 198);
+    {
+        static const off_t b[] = { 0, 10, 100, 110, 195, 210, 300, 310,
+                                   400, 410, 500, 510, 600, 610, 700, 710 };
+        expect(8, 85, b);
+    }
+
+    /* Before the first range and after the last. */
+    fill();
+    fuse_rangeset_add(&rs, -5, -2);
+    {
+        static const off_t b[] = { -5, 10, 100, 110, 200, 210, 300, 310,
+                                   400, 410, 500, 510, 600, 610, 700, 710 };
+        expect(8, 85, b);
+    }
+    fill();
+    fuse_rangeset_add(&rs, 712, 720);
+    {
+        static const off_t b[] = { 0, 10, 100, 110, 200, 210, 300, 310,
+                                   400, 410, 500, 510, 600, 610, 700, 720 };
+        expect(8, 90, b);
+    }
+
+    /* Far from everything: the two closest ranges are merged instead. */
+    fill();
+    fuse_rangeset_add(&rs, 305, 390); /* now [300, 390), 10 from [400, 410) */
+    fuse_rangeset_add(&rs, 2000, 2010);
+    {
+        static const off_t b[] = { 0, 10, 100, 110, 200, 210, 300, 410,
+                                   500, 510, 600, 610, 700, 710, 2000, 2010 };
+        expect(8, 180, b);
+    }
+    fill();
+    fuse_rangeset_add(&rs, 305, 390);
+    fuse_rangeset_add(&rs, 150, 160); /* lands before the merged pair */
+    {
+        static const off_t b[] = { 0, 10, 100, 110, 150, 160, 200, 210,
+                                   300, 410, 500, 510, 600, 610, 700, 710 };
+        expect(8, 180, b);
+    }
+    fill();
+    fuse_rangeset_add(&rs, 305, 390);
+    fuse_rangeset_add(&rs, 450, 455); /* lands after it */
+    {
+        static const off_t b[] = { 0, 10, 100, 110, 200, 210, 300, 410,
+                                   450, 455, 500, 510, 600, 610, 700, 710 };
+        expect(8, 175, b);
+    }
+
+    /* A hole with no slot for the second half leaves the range alone. */
+    fill();
+    fuse_rangeset_remove(&rs, 102, 105);
+    {
+        static const off_t b[] = { 0, 10, 100, 110, 200, 210, 300, 310,
+                                   400, 410, 500, 510, 600, 610, 700, 710 };
+        expect(8, 80, b);
+    }
+
+    /* With a slot free, the range is split. */
+    fuse_rangeset_remove(&rs, 700, 710);
+    fuse_rangeset_remove(&rs, 102, 105);
+    {
+        static const off_t b[] = { 0, 10, 100, 102, 105, 110, 200, 210,
+                                   300, 310, 400, 410, 500, 510, 600, 610 };
+        expect(8, 67, b);
+    }
+
+    /* A remove across several ranges: a tail, whole ones, a head. */
+    fuse_rangeset_remove(&rs, 5, 305);
+    {
+        static const off_t b[] = { 0, 5, 305, 310, 400, 410, 500, 510,
+                                   600, 610 };
+        expect(5, 40, b);
+    }
+
+    /* Pops take the lowest range, at most maxlen of it at a time. */
+    fuse_rangeset_add(&rs, 400, 480);
+    if (!fuse_rangeset_pop(&rs, 0, &start, &end) || start != 0 || end != 5 ||
+        !fuse_rangeset_pop(&rs, 2, &start, &end) || start != 305 ||
+        end != 307 ||
+        !fuse_rangeset_pop(&rs, 100, &start, &end) || start != 307 ||
+        end != 310) {
+        fail("wrong pop");
+    }
+    {
+        static const off_t b[] = { 400, 480, 500, 510, 600, 610 };
+        expect(3, 100, b);
+    }
+    while (fuse_rangeset_pop(&rs, 7, &start, &end)) {
+        continue;
+    }
+    if (rs.count != 0 || rs.bytes != 0) {
+        fail("set not empty after popping everything");
+    }
+}
+
+/* Checks the set itself and against the bitmaps; returns the bytes over. */
+static int
+check(void)
+{
+    unsigned char inset[FILESIZE];
+    off_t bytes = 0;
+    uint32_t i;
+    int over = 0;
+    int o;
+
+    memset(inset, 0, sizeof(inset));
+
+    if (rs.count > FUSE_RANGESET_SIZE) {
+        fail("too many ranges");
+    }
+    for (i = 0; i < rs.count; i++) {
+        const struct fuse_range *r = &rs.ranges[i];
+
+        if (r->start < 0 || r->end > FILESIZE || r->start >= r->end) {
+            fail("bad range");
+        }
+        if (i > 0 && rs.ranges[i - 1].end >= r->start) {
+            fail("ranges out of order, overlapping or adjacent");
+        }
+        memset(inset + r->start, 1, r->end - r->start);
+        bytes += r->end - r->start;
+    }
+    if (bytes != rs.bytes) {
+        fail("byte count does not add up");
+    }
+
+    for (o = 0; o < FILESIZE; o++) {
+        if (written[o] && !inset[o]) {
+            fail("written byte not covered");
+        }
+        if (inset[o] != covered[o]) {
+            if (!inset[o]) {
+                fail("covered byte dropped");
+            }
+            over++;
+        }
+    }
+
+    return over;
+}
+
+/*
+ * After an add that ran out of slots: the bytes newly covered beyond what
+ * was asked for must be one run, the gap that was closed.
+ */
+static void
+check_one_gap(void)
+{
+    int o, runs = 0, extra = 0;
+
+    for (o = 0; o < FILESIZE; o++) {
+        int inset = 0;
+        uint32_t i;
+
+        for (i = 0; i < rs.count; i++) {
+            if (o >= rs.ranges[i].start && o < rs.ranges[i].end) {
+                inset = 1;
+            }
+        }
+        if (inset && !covered[o]) {
+            if (!extra) {
+                runs++;
+            }
+            covered[o] = 1;
+            extra = 1;
+        } else {
+            extra = 0;
+        }
+    }
+    if (runs != 1) {
+        fail("overflow did not close exactly one gap");
+    }
+}
+
+/* Whether [start, end) touches or overlaps a range of the set. */
+static int
+touches(off_t start, off_t end)
+{
+    uint32_t i;
+
+    for (i = 0; i < rs.count; i++) {
+        if (rs.ranges[i].start <= end && rs.ranges[i].end >= start) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whether [start, end) lies strictly inside a range of the set. */
+static int
+inside(off_t start, off_t end)
+{
+    uint32_t i;
+
+    for (i = 0; i < rs.count; i++) {
+        if (rs.ranges[i].start < start && rs.ranges[i].end > end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+random_step(void)
+{
+    off_t start, end, len, maxlen;
+    int full = (rs.count == FUSE_RANGESET_SIZE);
+
+    /* Mostly small writes, some large; some page-aligned. */
+    len = (rand() % 8) ? 1 + rand() % 64 : 1 + rand() % 1024;
+    start = rand() % (FILESIZE - len + 1);
+    if (rand() % 4 == 0) {
+        start &= ~(off_t)255;
+        len = (len + 255) & ~(off_t)255;
+        if (start + len > FILESIZE) {
+            len = FILESIZE - start;
+        }
+    }
+    end = start + len;
+
+    switch (rand() % 10) {
+
+    case 0: case 1: case 2: case 3: case 4: case 5:
+        full = full && !touches(start, end);
+        fuse_rangeset_add(&rs, start, end);
+        memset(written + start, 1, len);
+        memset(covered + start, 1, len);
+        if (full) {
+            check_one_gap();
+        }
+        break;
+
+    case 6: case 7: case 8:
+        if (!(full && inside(start, end))) {
+            memset(covered + start, 0, len);
+        }
+        fuse_rangeset_remove(&rs, start, end);
+        memset(written + start, 0, len);
+        break;
+
+    default:
+        maxlen = (rand() % 2) ? 0 : 1 + rand() % 512;
+        {
+            off_t first = 0;
+            int ret;
+
+            while (first < FILESIZE && !covered[first]) {
+                first++;
+            }
+            ret = fuse_rangeset_pop(&rs, maxlen, &start, &end);
+            if (ret != (first < FILESIZE)) {
+                fail("pop of a non-empty set failed, or of an empty one not");
+            }
+            if (!ret) {
+                break;
+            }
+            if (start != first || end <= start ||
+                (maxlen > 0 && end - start > maxlen)) {
+                fail("pop did not take the start of the lowest range");
+            }
+            for (len = 0; start + len < end; len++) {
+                if (!covered[start + len]) {
+                    fail("pop went past the end of the range");
+                }
+            }
+            if (end < FILESIZE && covered[end] &&
+                (maxlen == 0 || end - start < maxlen)) {
+                fail("pop stopped short of the end of the range");
+            }
+            memset(covered + start, 0, len);
+            memset(written + start, 0, len);
+        }
+        break;
+    }
+
+    if (check() != 0) {
+        fail("set covers more than asked for");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned long seqs = 2000, seed = 1, overflows = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:s:")) != -1) {
+        switch (c) {
+        case 'n': seqs = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: range_test [-n sequences] [-s seed]\n");
+            return 1;
+        }
+    }
+
+    fixed_cases();
+
+    srand(seed);
+
+    for (seq = 0; seq < seqs; seq++) {
+        fuse_rangeset_init(&rs);
+        memset(written, 0, sizeof(written));
+        memset(covered, 0, sizeof(covered));
+        for (step = 0; step < STEPS; step++) {
+            if (rs.count == FUSE_RANGESET_SIZE) {
+                overflows++;
+            }
+            random_step();
+        }
+    }
+
+    printf("range_test: %lu sequences of %d steps, %lu steps on a full set: "
+           "PASS\n", seqs, STEPS, overflows);
+
+    return 0;
+}
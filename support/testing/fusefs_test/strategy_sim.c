@@ -0,0 +1,581 @@
+/*
+ * strategy_sim: run the strategy chunking in fuse_strategy.c against a
+ * simulated daemon.
+ *
+ * fuse_strategy.c is built as it is. Its ops queue each chunk as a request
+ * for a pool of daemon threads, which sleep for a given latency and then
+ * answer from an in-memory file. The daemon can be told to answer reads or
+ * writes short, to fail the request covering a given offset, to answer
+ * writes with nothing, or to answer more than was asked for.
+ *
+ * First a set of fixed cases is checked, then random transfers (file size,
+ * offset, length, chunk size, limit, short answers and errors) against a
+ * model that sends one chunk at a time, the way fuse_internal_strategy()
+ * did before chunks were sent in parallel. After each transfer no request
+ * may be left and the mount's count of chunks in flight must be back at 0.
+ * The bound on chunks in flight is checked with several transfers running
+ * at once.
+ *
+ * Last, 1 MiB reads are timed against each in-flight limit.
+ *
+ * Usage: strategy_sim [-d daemon threads] [-l latency_us] [-n bufs]
+ *                     [-r random transfers]
+ */
+
+#include <sys/time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fuse_strategy.h"
+
+#define FILEMAX    (8 << 20)
+#define MAXDAEMONS 64
+
+struct request {
+    struct request *next;
+    int             iswrite;
+    char           *bufdat;
+    off_t           offset;
+    size_t          size;
+    size_t          got;
+    int             error;
+    int             answered;
+    pthread_cond_t  cv;
+};
+
+/* What the daemon does; set between transfers. */
+static char     file[FILEMAX];
+static size_t   filesize;
+static size_t   shortcap;           /* answer at most this much, if not 0  */
+static off_t    erroff = -1;        /* fail the request covering this      */
+static int      zerowrite;          /* answer writes with nothing          */
+static int      overanswer;         /* answer one byte more than asked for */
+static int      latency_us;         /* answers take 1-2 times this      */
+
+static pthread_mutex_t  qmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   qcv = PTHREAD_COND_INITIALIZER;
+static struct request  *qhead, *qtail;
+static int              quit;
+static int              live;       /* requests sent and not yet disposed of */
+static int              pending;    /* requests sent and not yet answered    */
+static int              maxpending;
+static unsigned long    messages;
+
+static int32_t          mount_inflight;
+
+struct transfer {
+    int    iswrite;
+    char  *bufdat;
+    off_t  offset;
+};
+
+static void *
+sim_send(void *arg, size_t start, size_t size)
+{
+    struct transfer *t = arg;
+    struct request  *r = calloc(1, sizeof(*r));
+
+    r->iswrite = t->iswrite;
+    r->bufdat = t->bufdat + start;
+    r->offset = t->offset + start;
+    r->size = size;
+    pthread_cond_init(&r->cv, NULL);
+
+    pthread_mutex_lock(&qmtx);
+    live++;
+    if (++pending > maxpending) {
+        maxpending = pending;
+    }
+    messages++;
+    if (qtail) {
+        qtail->next = r;
+    } else {
+        qhead = r;
+    }
+    qtail = r;
+    pthread_cond_signal(&qcv);
+    pthread_mutex_unlock(&qmtx);
+
+    return r;
+}
+
+static int
+sim_wait(void *arg, void *req, size_t *gotp)
+{
+    struct request *r = req;
+    int error;
+
+    pthread_mutex_lock(&qmtx);
+    while (!r->answered) {
+        pthread_cond_wait(&r->cv, &qmtx);
+    }
+    live--;
+    pthread_mutex_unlock(&qmtx);
+
+    error = r->error;
+    *gotp = r->got;
+    pthread_cond_destroy(&r->cv);
+    free(r);
+
+    return error;
+}
+
+static void
+sim_discard(void *arg, void *req)
+{
+    size_t got;
+
+    (void)sim_wait(arg, req, &got);
+}
+
+static int32_t
+sim_inflight_add(void *arg, int32_t delta)
+{
+    return __sync_fetch_and_add(&mount_inflight, delta);
+}
+
+static const struct fuse_strategy_ops sim_ops = {
+    sim_send,
+    sim_wait,
+    sim_discard,
+    sim_inflight_add,
+};
+
+static void
+daemon_answer(struct request *r)
+{
+    size_t n = r->size;
+
+    if (r->offset <= erroff && erroff < r->offset + (off_t)r->size) {
+        r->error = EIO;
+        return;
+    }
+
+    if (shortcap && n > shortcap) {
+        n = shortcap;
+    }
+
+    if (r->iswrite) {
+        if (zerowrite) {
+            n = 0;
+        }
+        memcpy(file + r->offset, r->bufdat, n);
+        if (r->offset + n > filesize) {
+            filesize = r->offset + n;
+        }
+    } else {
+        if ((size_t)r->offset >= filesize) {
+            n = 0;
+        } else if (n > filesize - r->offset) {
+            n = filesize - r->offset;
+        }
+        memcpy(r->bufdat, file + r->offset, n);
+    }
+
+    r->got = n + (overanswer ? 1 : 0);
+}
+
+static void *
+daemon_main(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    struct request *r;
+
+    for (;;) {
+        pthread_mutex_lock(&qmtx);
+        while (!qhead && !quit) {
+            pthread_cond_wait(&qcv, &qmtx);
+        }
+        if (!qhead) {
+            pthread_mutex_unlock(&qmtx);
+            return NULL;
+        }
+        r = qhead;
+        qhead = r->next;
+        if (!qhead) {
+            qtail = NULL;
+        }
+        pthread_mutex_unlock(&qmtx);
+
+        /* Up to twice the latency, so that answers come back out of order. */
+        if (latency_us) {
+            usleep(latency_us + rand_r(&seed) % latency_us);
+        }
+
+        daemon_answer(r);
+
+        pthread_mutex_lock(&qmtx);
+        pending--;
+        r->answered = 1;
+        pthread_cond_signal(&r->cv);
+        pthread_mutex_unlock(&qmtx);
+    }
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+fill_file(void)
+{
+    size_t i;
+
+    for (i = 0; i < FILEMAX; i++) {
+        file[i] = (char)(i * 7 + (i >> 13));
+    }
+}
+
+static int
+transfer(int iswrite, char *bufdat, off_t offset, size_t count,
+         size_t iosize, uint32_t limit, size_t *donep, int *eofp)
+{
+    struct transfer t = { iswrite, bufdat, offset };
+
+    return fuse_strategy_transfer(&sim_ops, &t, iswrite, count, iosize,
+                                  limit, donep, eofp);
+}
+
+/*
+ * The old synchronous loop: one chunk at a time, stopping at the first
+ * error or empty read, and going on from wherever a short answer ended.
+ */
+static int
+model(int iswrite, off_t offset, size_t count, size_t iosize,
+      size_t *donep, int *eofp)
+{
+    size_t pos = 0, size, got;
+
+    *eofp = 0;
+
+    while (pos < count) {
+        size = (count - pos < iosize) ? count - pos : iosize;
+        if (offset + (off_t)pos <= erroff &&
+            erroff < offset + (off_t)(pos + size)) {
+            *donep = pos;
+            return EIO;
+        }
+        got = (shortcap && size > shortcap) ? shortcap : size;
+        if (iswrite) {
+            if (zerowrite) {
+                *donep = pos;
+                return EIO;
+            }
+        } else {
+            if ((size_t)offset + pos >= filesize) {
+                got = 0;
+            } else if (got > filesize - offset - pos) {
+                got = filesize - offset - pos;
+            }
+            if (got == 0) {
+                *eofp = 1;
+                break;
+            }
+        }
+        pos += got;
+    }
+
+    *donep = pos;
+    return 0;
+}
+
+static int failures;
+
+static void
+check(const char *name, int iswrite, off_t offset, size_t count,
+      size_t iosize, uint32_t limit, int experr, size_t expdone, int expeof)
+{
+    char  *buf = malloc(count);
+    size_t done = 12345, i;
+    int    eof = -1, err;
+
+    if (iswrite) {
+        for (i = 0; i < count; i++) {
+            buf[i] = (char)(i * 13 + 5);
+        }
+    } else {
+        memset(buf, 0xa5, count);
+    }
+
+    err = transfer(iswrite, buf, offset, count, iosize, limit, &done, &eof);
+
+    if (err != experr || done != expdone || eof != expeof) {
+        printf("FAIL %s: err %d done %zu eof %d, expected %d %zu %d\n",
+               name, err, done, eof, experr, expdone, expeof);
+        failures++;
+    } else if (memcmp(buf, file + offset, done) != 0) {
+        printf("FAIL %s: data differs\n", name);
+        failures++;
+    } else if (live != 0 || mount_inflight != 0) {
+        printf("FAIL %s: %d requests left, %d chunks counted in flight\n",
+               name, live, mount_inflight);
+        failures++;
+    } else if (name) {
+        printf("%-40s ok (err %d, done %zu, eof %d, %lu messages)\n",
+               name, err, done, eof, messages);
+    }
+
+    free(buf);
+}
+
+static void
+reset_daemon(void)
+{
+    shortcap = 0;
+    erroff = -1;
+    zerowrite = 0;
+    overanswer = 0;
+    messages = 0;
+    maxpending = 0;
+}
+
+static void
+fixed_cases(void)
+{
+    reset_daemon();
+    filesize = 4 << 20;
+    check("read 1M", 0, 0, 1 << 20, 65536, 8, 0, 1 << 20, 0);
+    maxpending = 0;
+    check("read 1M at limit 1", 0, 0, 1 << 20, 65536, 1, 0, 1 << 20, 0);
+    if (maxpending != 1) {
+        printf("FAIL read at limit 1: %d chunks were in flight\n", maxpending);
+        failures++;
+    }
+
+    filesize = 300001;
+    check("read across EOF", 0, 0, 1 << 20, 65536, 8, 0, 300001, 1);
+    check("read at EOF", 0, 300001, 65536, 65536, 8, 0, 0, 1);
+
+    filesize = 4 << 20;
+    shortcap = 40000;
+    check("read, daemon answers short", 0, 65536, 1 << 20, 65536, 8,
+          0, 1 << 20, 0);
+    shortcap = 0;
+
+    erroff = 5 * 65536 + 17;
+    check("read, error in chunk 5", 0, 0, 1 << 20, 65536, 8, EIO, 5 * 65536, 0);
+    check("read, error in chunk 0", 0, 5 * 65536, 1 << 20, 65536, 8,
+          EIO, 0, 0);
+    erroff = -1;
+
+    overanswer = 1;
+    check("read, daemon answers too much", 0, 0, 1 << 20, 65536, 8,
+          EIO, 0, 0);
+    overanswer = 0;
+
+    filesize = 4 << 20;
+    check("write 1M", 1, 1 << 20, 1 << 20, 65536, 8, 0, 1 << 20, 0);
+    shortcap = 30000;
+    check("write, daemon answers short", 1, 0, 1 << 20, 65536, 8,
+          0, 1 << 20, 0);
+    shortcap = 0;
+
+    zerowrite = 1;
+    check("write, daemon answers nothing", 1, 0, 1 << 20, 65536, 8,
+          EIO, 0, 0);
+    zerowrite = 0;
+
+    overanswer = 1;
+    check("write, daemon answers too much", 1, 0, 1 << 20, 65536, 8,
+          EINVAL, 0, 0);
+    overanswer = 0;
+
+    maxpending = 0;
+    check("read 2M, limit above the window", 0, 0, 2 << 20, 65536, 100,
+          0, 2 << 20, 0);
+    if (maxpending > FUSE_MAX_STRATEGY_INFLIGHT) {
+        printf("FAIL window: %d chunks in flight\n", maxpending);
+        failures++;
+    }
+}
+
+static void
+random_cases(unsigned long n)
+{
+    unsigned long k;
+    unsigned seed = 1;
+
+    for (k = 0; k < n && failures == 0; k++) {
+        int      iswrite = rand_r(&seed) % 4 == 0;
+        size_t   iosize = 4096 << (rand_r(&seed) % 5);
+        size_t   count = 1 + rand_r(&seed) % (1 << 20);
+        off_t    offset = rand_r(&seed) % (2 << 20);
+        uint32_t limit = rand_r(&seed) % 20;
+        size_t   done;
+        int      eof, err;
+
+        reset_daemon();
+        filesize = rand_r(&seed) % (3 << 20);
+        if (rand_r(&seed) % 3 == 0) {
+            shortcap = 1 + rand_r(&seed) % iosize;
+        }
+        if (rand_r(&seed) % 4 == 0) {
+            erroff = offset + rand_r(&seed) % count;
+        }
+        if (iswrite && rand_r(&seed) % 16 == 0) {
+            zerowrite = 1;
+        }
+
+        err = model(iswrite, offset, count, iosize, &done, &eof);
+        check(NULL, iswrite, offset, count, iosize, limit, err, done, eof);
+        if (failures) {
+            printf("  after %lu transfers: %s at %lld, %zu bytes, iosize %zu, "
+                   "limit %u, file %zu, short %zu, error at %lld\n", k,
+                   iswrite ? "write" : "read", (long long)offset, count,
+                   iosize, limit, filesize, shortcap, (long long)erroff);
+        }
+    }
+
+    if (!failures) {
+        printf("%lu random transfers match the one-chunk-at-a-time model\n",
+               n);
+    }
+}
+
+struct reader {
+    pthread_t tid;
+    off_t     offset;
+    int       bufs;
+    uint32_t  limit;
+    int       error;
+};
+
+static void *
+reader_main(void *arg)
+{
+    struct reader *rd = arg;
+    char  *buf = malloc(1 << 20);
+    size_t done;
+    int    i, eof;
+
+    for (i = 0; i < rd->bufs; i++) {
+        if (transfer(0, buf, rd->offset, 1 << 20, 65536, rd->limit,
+                     &done, &eof) != 0 || done != (1 << 20) ||
+            memcmp(buf, file + rd->offset, 1 << 20) != 0) {
+            rd->error = 1;
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void
+bound_case(void)
+{
+    struct reader rd[6];
+    int i;
+
+    reset_daemon();
+    filesize = 4 << 20;
+
+    for (i = 0; i < 6; i++) {
+        rd[i].offset = i * 65536;
+        rd[i].bufs = 20;
+        rd[i].limit = 4;
+        rd[i].error = 0;
+        pthread_create(&rd[i].tid, NULL, reader_main, &rd[i]);
+    }
+    for (i = 0; i < 6; i++) {
+        pthread_join(rd[i].tid, NULL);
+        failures += rd[i].error;
+    }
+
+    /* Each transfer may always have one chunk out. */
+    if (maxpending > 4 + 6 - 1 || live != 0 || mount_inflight != 0) {
+        printf("FAIL 6 readers at limit 4: %d in flight, %d left, %d counted\n",
+               maxpending, live, mount_inflight);
+        failures++;
+    } else {
+        printf("%-40s ok (at most %d in flight)\n", "6 readers at limit 4",
+               maxpending);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    pthread_t daemons[MAXDAEMONS];
+    unsigned long nrandom = 2000;
+    int ndaemons = 16, nbufs = 50, latency = 100, c, i;
+    uint32_t limit;
+
+    while ((c = getopt(argc, argv, "d:l:n:r:")) != -1) {
+        switch (c) {
+        case 'd': ndaemons = atoi(optarg); break;
+        case 'l': latency = atoi(optarg); break;
+        case 'n': nbufs = atoi(optarg); break;
+        case 'r': nrandom = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: strategy_sim [-d daemon threads] "
+                    "[-l latency_us] [-n bufs] [-r random transfers]\n");
+            return 1;
+        }
+    }
+    if (ndaemons < 1 || ndaemons > MAXDAEMONS) {
+        fprintf(stderr, "strategy_sim: 1 to %d daemon threads\n", MAXDAEMONS);
+        return 1;
+    }
+
+    fill_file();
+
+    for (i = 0; i < ndaemons; i++) {
+        pthread_create(&daemons[i], NULL, daemon_main, (void *)(uintptr_t)i);
+    }
+
+    /* Checks are run with short latencies; -l is for the timing. */
+    latency_us = 20;
+    fixed_cases();
+    bound_case();
+    latency_us = 0;
+    random_cases(nrandom);
+    latency_us = latency;
+
+    if (!failures && nbufs > 0) {
+        struct reader rd;
+        double t0, t1;
+
+        reset_daemon();
+        filesize = 4 << 20;
+        printf("1 MiB reads in 64K chunks, %d daemon threads, %d-%d us per "
+               "request:\n", ndaemons, latency_us, 2 * latency_us);
+        for (limit = 1; limit <= FUSE_MAX_STRATEGY_INFLIGHT; limit *= 2) {
+            rd.offset = 0;
+            rd.bufs = nbufs;
+            rd.limit = limit;
+            rd.error = 0;
+            maxpending = 0;
+            t0 = now();
+            reader_main(&rd);
+            t1 = now();
+            failures += rd.error;
+            printf("  limit %2u: %7.2f ms per buf, %7.1f MB/s, "
+                   "at most %d in flight\n", limit, (t1 - t0) * 1e3 / nbufs,
+                   nbufs / (t1 - t0), maxpending);
+        }
+    }
+
+    pthread_mutex_lock(&qmtx);
+    quit = 1;
+    pthread_cond_broadcast(&qcv);
+    pthread_mutex_unlock(&qmtx);
+    for (i = 0; i < ndaemons; i++) {
+        pthread_join(daemons[i], NULL);
+    }
+
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,380 @@
+/*
+ * ticket_bench: measure ticket fetch/drop throughput with and without the
+ * per-mount ticket caches, across thread counts.
+ *
+ * The caches are fuse_ticketcache.c itself, with pthread mutexes for
+ * lck_mtx_t. fuse_ticket_fetch() and fuse_ticket_drop(), which are tied to
+ * the kernel, are transcribed from fuse_ipc.c; the list handling, counters
+ * and limits are the same. Each thread loops fetching a
+ * ticket, filling in a request header, and dropping it. With -c 0 every
+ * fetch and drop goes through ticket_mtx, as before the caches; with -c 1
+ * (the default) the caches are tried first.
+ *
+ * At the end the accounting is checked: every ticket is free, cached or
+ * destroyed, and the idle ones never exceed max_freetickets.
+ *
+ * Usage: ticket_bench [-c 0|1] [-n ops] [-f max_freetickets] [-t threads]
+ */
+
+#include <sys/queue.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fuse_param_kernel.h"
+#include "fuse_ticketcache.h"
+
+/* Request header plus a small argument, and an answer of the same size. */
+#define FIOV_LEN 128
+
+struct fuse_ticket {
+    STAILQ_ENTRY(fuse_ticket)  tk_freetickets_link;
+    struct fuse_tclink         tk_tclink;
+    TAILQ_ENTRY(fuse_ticket)   tk_alltickets_link;
+    struct fuse_data          *tk_data;
+    uint64_t                   tk_unique;
+    char                       tk_ms_fiov[FIOV_LEN];
+    char                       tk_aw_fiov[FIOV_LEN];
+    int                        tk_flag;
+    int                        tk_age;
+};
+
+struct fuse_data {
+    pthread_mutex_t            ticket_mtx;
+    STAILQ_HEAD(, fuse_ticket) freetickets_head;
+    TAILQ_HEAD(, fuse_ticket)  alltickets_head;
+    uint32_t                   freeticket_counter;
+    uint32_t                   deadticket_counter;
+    uint64_t                   ticketer;
+    struct fuse_ticketcache    ticket_caches;
+};
+
+static int32_t  fuse_max_freetickets = FUSE_DEFAULT_MAX_FREE_TICKETS;
+static int      use_caches = 1;
+static int32_t  tickets_current;
+
+/*
+ * The kernel hashes current_thread(), a zone-allocated struct thread. A
+ * pthread_t is usually the (large, aligned) stack address, so hash a
+ * per-thread heap object of about the same size instead.
+ */
+static __thread void *current_thread_obj;
+
+static void *
+current_thread(void)
+{
+    if (!current_thread_obj) {
+        current_thread_obj = malloc(1536);
+    }
+    return current_thread_obj;
+}
+
+static struct fuse_ticket *
+fticket_alloc(struct fuse_data *data)
+{
+    struct fuse_ticket *ftick = calloc(1, sizeof(*ftick));
+
+    if (!ftick) {
+        perror("calloc");
+        exit(1);
+    }
+    __sync_fetch_and_add(&tickets_current, 1);
+    ftick->tk_unique = data->ticketer++;
+    ftick->tk_data = data;
+
+    return ftick;
+}
+
+static void
+fticket_refresh(struct fuse_ticket *ftick)
+{
+    memset(ftick->tk_ms_fiov, 0, sizeof(ftick->tk_ms_fiov));
+    memset(ftick->tk_aw_fiov, 0, sizeof(ftick->tk_aw_fiov));
+    ftick->tk_flag = 0;
+    ftick->tk_age++;
+}
+
+static void
+fticket_destroy(struct fuse_ticket *ftick)
+{
+    free(ftick);
+    __sync_fetch_and_sub(&tickets_current, 1);
+}
+
+static void
+cache_lock(void *mtx)
+{
+    pthread_mutex_lock((pthread_mutex_t *)mtx);
+}
+
+static void
+cache_unlock(void *mtx)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)mtx);
+}
+
+static void
+cache_refresh(struct fuse_tclink *tl)
+{
+    fticket_refresh(FUSE_TCLINK_OBJECT(tl, struct fuse_ticket, tk_tclink));
+}
+
+static int32_t
+cache_add(int32_t *counter, int32_t delta)
+{
+    return __sync_fetch_and_add(counter, delta);
+}
+
+static const struct fuse_ticketcache_ops cache_ops = {
+    cache_lock,
+    cache_unlock,
+    cache_refresh,
+    cache_add,
+};
+
+static pthread_mutex_t cache_mtx[FUSE_TICKET_NCACHES];
+
+static struct fuse_ticket *
+fuse_ticket_cache_fetch(struct fuse_data *data)
+{
+    struct fuse_tclink *tl;
+
+    tl = fuse_ticketcache_fetch(&data->ticket_caches,
+                                (uintptr_t)current_thread());
+
+    return tl ? FUSE_TCLINK_OBJECT(tl, struct fuse_ticket, tk_tclink) : NULL;
+}
+
+static int
+fuse_ticket_cache_put(struct fuse_ticket *ftick)
+{
+    struct fuse_data *data = ftick->tk_data;
+
+    return fuse_ticketcache_put(&data->ticket_caches,
+                                (uintptr_t)current_thread(),
+                                &ftick->tk_tclink,
+                                (uint32_t)fuse_max_freetickets,
+                                data->freeticket_counter);
+}
+
+static struct fuse_ticket *
+fuse_ticket_fetch(struct fuse_data *data)
+{
+    struct fuse_ticket *ftick;
+
+    if (use_caches && (ftick = fuse_ticket_cache_fetch(data))) {
+        return ftick;
+    }
+
+    pthread_mutex_lock(&data->ticket_mtx);
+    if (data->freeticket_counter == 0) {
+        pthread_mutex_unlock(&data->ticket_mtx);
+        ftick = fticket_alloc(data);
+        pthread_mutex_lock(&data->ticket_mtx);
+        TAILQ_INSERT_TAIL(&data->alltickets_head, ftick, tk_alltickets_link);
+    } else {
+        ftick = STAILQ_FIRST(&data->freetickets_head);
+        STAILQ_REMOVE_HEAD(&data->freetickets_head, tk_freetickets_link);
+        data->freeticket_counter--;
+    }
+    pthread_mutex_unlock(&data->ticket_mtx);
+
+    return ftick;
+}
+
+static void
+fuse_ticket_drop(struct fuse_ticket *ftick)
+{
+    struct fuse_data *data = ftick->tk_data;
+    int die = 0;
+
+    if (use_caches && fuse_ticket_cache_put(ftick)) {
+        return;
+    }
+
+    pthread_mutex_lock(&data->ticket_mtx);
+    if (fuse_max_freetickets >= 0 &&
+        (uint32_t)fuse_max_freetickets <=
+            data->freeticket_counter +
+            (uint32_t)data->ticket_caches.tcs_count) {
+        die = 1;
+    } else {
+        pthread_mutex_unlock(&data->ticket_mtx);
+        fticket_refresh(ftick);
+        pthread_mutex_lock(&data->ticket_mtx);
+    }
+
+    if (die) {
+        data->deadticket_counter++;
+        TAILQ_REMOVE(&data->alltickets_head, ftick, tk_alltickets_link);
+        pthread_mutex_unlock(&data->ticket_mtx);
+        fticket_destroy(ftick);
+    } else {
+        STAILQ_INSERT_TAIL(&data->freetickets_head, ftick,
+                           tk_freetickets_link);
+        data->freeticket_counter++;
+        pthread_mutex_unlock(&data->ticket_mtx);
+    }
+}
+
+static struct fuse_data data;
+static unsigned long ops;
+
+static void *
+worker(void *arg)
+{
+    unsigned long i;
+
+    (void)arg;
+
+    for (i = 0; i < ops; i++) {
+        struct fuse_ticket *ftick = fuse_ticket_fetch(&data);
+
+        /* What fuse_setup_ihead() would write. */
+        memcpy(ftick->tk_ms_fiov, &ftick->tk_unique, sizeof(uint64_t));
+        ftick->tk_flag |= 0x04;
+        fuse_ticket_drop(ftick);
+    }
+
+    return NULL;
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int
+check_accounting(void)
+{
+    struct fuse_ticket *ftick;
+    uint32_t all = 0, free = 0, cached = 0;
+    int i;
+
+    TAILQ_FOREACH(ftick, &data.alltickets_head, tk_alltickets_link) {
+        all++;
+    }
+    STAILQ_FOREACH(ftick, &data.freetickets_head, tk_freetickets_link) {
+        free++;
+    }
+    for (i = 0; i < FUSE_TICKET_NCACHES; i++) {
+        struct fuse_ticket_cache *tc = &data.ticket_caches.tcs_caches[i];
+        struct fuse_tclink *tl;
+        uint32_t n = 0;
+
+        for (tl = tc->tc_head; tl; tl = tl->tl_next) {
+            n++;
+        }
+        if (n != tc->tc_count || n > FUSE_TICKET_CACHE_SIZE) {
+            fprintf(stderr, "FAIL: cache %d holds %u, count says %u\n", i, n,
+                    tc->tc_count);
+            return 1;
+        }
+        cached += n;
+    }
+
+    if (free != data.freeticket_counter ||
+        cached != (uint32_t)data.ticket_caches.tcs_count ||
+        all != free + cached || all != (uint32_t)tickets_current ||
+        data.ticketer - data.deadticket_counter != all) {
+        fprintf(stderr, "FAIL: %u tickets, %u free (counter %u), %u cached "
+                "(counter %u), %d allocated, %llu created, %u destroyed\n",
+                all, free, data.freeticket_counter, cached,
+                data.ticket_caches.tcs_count, tickets_current,
+                (unsigned long long)data.ticketer, data.deadticket_counter);
+        return 1;
+    }
+
+    /* Racing drops may each see room for one more; allow one per cache. */
+    if (fuse_max_freetickets >= 0 &&
+        free + cached > (uint32_t)fuse_max_freetickets + FUSE_TICKET_NCACHES) {
+        fprintf(stderr, "FAIL: %u idle tickets, limit %d\n", free + cached,
+                fuse_max_freetickets);
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int default_threads[] = { 1, 2, 4, 8, 16 };
+    int threads[16], nthreads = 0, c, k, i;
+
+    ops = 1000000;
+
+    while ((c = getopt(argc, argv, "c:n:f:t:")) != -1) {
+        switch (c) {
+        case 'c': use_caches = atoi(optarg); break;
+        case 'n': ops = strtoul(optarg, NULL, 0); break;
+        case 'f': fuse_max_freetickets = atoi(optarg); break;
+        case 't':
+            if (nthreads < 16) {
+                threads[nthreads++] = atoi(optarg);
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: ticket_bench [-c 0|1] [-n ops] "
+                    "[-f max_freetickets] [-t threads]...\n");
+            return 1;
+        }
+    }
+    if (nthreads == 0) {
+        memcpy(threads, default_threads, sizeof(default_threads));
+        nthreads = sizeof(default_threads) / sizeof(default_threads[0]);
+    }
+
+    printf("%s, max_freetickets %d, %lu fetch/drop pairs per thread\n",
+           use_caches ? "ticket caches" : "ticket_mtx only",
+           fuse_max_freetickets, ops);
+    printf("%8s %12s %10s %10s\n", "threads", "Mops/s", "ns/op", "tickets");
+
+    for (k = 0; k < nthreads; k++) {
+        pthread_t tid[256];
+        struct fuse_ticket *ftick;
+        int n = threads[k] > 256 ? 256 : threads[k];
+        double t0, t1;
+
+        memset(&data, 0, sizeof(data));
+        pthread_mutex_init(&data.ticket_mtx, NULL);
+        STAILQ_INIT(&data.freetickets_head);
+        TAILQ_INIT(&data.alltickets_head);
+        fuse_ticketcache_init(&data.ticket_caches, &cache_ops);
+        for (i = 0; i < FUSE_TICKET_NCACHES; i++) {
+            pthread_mutex_init(&cache_mtx[i], NULL);
+            data.ticket_caches.tcs_caches[i].tc_mtx = &cache_mtx[i];
+        }
+
+        t0 = now();
+        for (i = 0; i < n; i++) {
+            pthread_create(&tid[i], NULL, worker, NULL);
+        }
+        for (i = 0; i < n; i++) {
+            pthread_join(tid[i], NULL);
+        }
+        t1 = now();
+
+        printf("%8d %12.2f %10.1f %10llu\n", n, n * ops / (t1 - t0) / 1e6,
+               (t1 - t0) * 1e9 / (n * ops),
+               (unsigned long long)data.ticketer);
+
+        if (check_accounting()) {
+            return 1;
+        }
+
+        while ((ftick = TAILQ_FIRST(&data.alltickets_head))) {
+            TAILQ_REMOVE(&data.alltickets_head, ftick, tk_alltickets_link);
+            fticket_destroy(ftick);
+        }
+    }
+
+    return 0;
+}
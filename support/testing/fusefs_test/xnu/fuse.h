@@ -0,0 +1,4 @@
+/* Stands in for the kext's fuse.h when fuse_nodehash.c is built here. */
+
+#include "xnu_shim.h"
+#include <fuse_param.h>
@@ -0,0 +1,3 @@
+/* fuse_device_t is all fuse_nodehash.h needs; see xnu_shim.h. */
+
+#include "xnu_shim.h"
@@ -0,0 +1 @@
+#include "../xnu_shim.h"
@@ -0,0 +1,153 @@
+/*
+ * The functions behind xnu_shim.h.
+ */
+
+#include "xnu_shim.h"
+
+#define MAXLOCKS 256
+
+static lck_mtx_t *alllocks[MAXLOCKS];
+static int        nalllocks;
+
+int desiredvnodes = 8192;
+
+lck_mtx_t *
+lck_mtx_alloc_init(lck_grp_t *grp, lck_attr_t *attr)
+{
+    lck_mtx_t *lock = calloc(1, sizeof(*lock));
+    int i;
+
+    (void)grp;
+    (void)attr;
+
+    if (!lock) {
+        return NULL;
+    }
+    pthread_mutex_init(&lock->m, NULL);
+    pthread_cond_init(&lock->c, NULL);
+
+    i = __sync_fetch_and_add(&nalllocks, 1);
+    assert(i < MAXLOCKS);
+    alllocks[i] = lock;
+
+    return lock;
+}
+
+void
+lck_mtx_free(lck_mtx_t *lock, lck_grp_t *grp)
+{
+    int i;
+
+    (void)grp;
+
+    assert(!lock->held);
+    for (i = 0; i < nalllocks; i++) {
+        if (alllocks[i] == lock) {
+            alllocks[i] = NULL;
+        }
+    }
+    pthread_mutex_destroy(&lock->m);
+    pthread_cond_destroy(&lock->c);
+    free(lock);
+}
+
+void
+lck_mtx_lock(lck_mtx_t *lock)
+{
+    pthread_mutex_lock(&lock->m);
+    lock->owner = pthread_self();
+    lock->held = 1;
+}
+
+void
+lck_mtx_unlock(lck_mtx_t *lock)
+{
+    assert(lock->held && pthread_equal(lock->owner, pthread_self()));
+    lock->held = 0;
+    pthread_mutex_unlock(&lock->m);
+}
+
+void
+lck_mtx_assert(lck_mtx_t *lock, int type)
+{
+    (void)type;
+    assert(lock->held && pthread_equal(lock->owner, pthread_self()));
+}
+
+int
+fuse_msleep(void *chan, lck_mtx_t *lock, int pri, const char *wmesg, void *ts)
+{
+    (void)chan;
+    (void)pri;
+    (void)wmesg;
+    (void)ts;
+
+    lock->held = 0;
+    pthread_cond_wait(&lock->c, &lock->m);
+    lock->owner = pthread_self();
+    lock->held = 1;
+
+    return 0;
+}
+
+void
+fuse_wakeup(void *chan)
+{
+    int i;
+
+    (void)chan;
+
+    for (i = 0; i < nalllocks; i++) {
+        if (alllocks[i]) {
+            pthread_cond_broadcast(&alllocks[i]->c);
+        }
+    }
+}
+
+void *
+hashinit(int elements, int type, u_long *hashmask)
+{
+    u_long size = 1;
+
+    (void)type;
+
+    while (size * 2 <= (u_long)elements) {
+        size *= 2;
+    }
+    *hashmask = size - 1;
+
+    return calloc(size, sizeof(void *));
+}
+
+uint32_t
+vnode_vid(vnode_t vp)
+{
+    return __atomic_load_n(&vp->v_id, __ATOMIC_SEQ_CST);
+}
+
+int
+vnode_getwithvid(vnode_t vp, uint32_t vid)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&vp->v_lock);
+    if (vp->v_dead || vp->v_id != vid) {
+        err = ENOENT;
+    } else {
+        vp->v_iocount++;
+    }
+    pthread_mutex_unlock(&vp->v_lock);
+
+    return err;
+}
+
+int
+vnode_put(vnode_t vp)
+{
+    pthread_mutex_lock(&vp->v_lock);
+    assert(vp->v_iocount > 0);
+    vp->v_iocount--;
+    pthread_mutex_unlock(&vp->v_lock);
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Just enough of the xnu KPI, on pthreads, to build fuse_nodehash.c in user
+ * space. Locks remember their owner so that lck_mtx_assert() can check it.
+ * Each lock has a condition variable for msleep(); since a wakeup channel
+ * does not say which lock its sleepers used, fuse_wakeup() broadcasts on
+ * all of them.
+ */
+
+#ifndef _XNU_SHIM_H_
+#define _XNU_SHIM_H_
+
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MACH_ASSERT 1
+
+typedef int     errno_t;
+typedef int     boolean_t;
+typedef int32_t SInt32;
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+typedef int   lck_grp_t;
+typedef int   lck_attr_t;
+typedef void *OSMallocTag;
+
+typedef struct {
+    pthread_mutex_t m;
+    pthread_cond_t  c;
+    pthread_t       owner;
+    int             held;
+} lck_mtx_t;
+
+#define LCK_MTX_ASSERT_OWNED 1
+
+lck_mtx_t *lck_mtx_alloc_init(lck_grp_t *grp, lck_attr_t *attr);
+void       lck_mtx_free(lck_mtx_t *lock, lck_grp_t *grp);
+void       lck_mtx_lock(lck_mtx_t *lock);
+void       lck_mtx_unlock(lck_mtx_t *lock);
+void       lck_mtx_assert(lck_mtx_t *lock, int type);
+
+int  fuse_msleep(void *chan, lck_mtx_t *lock, int pri, const char *wmesg,
+                 void *ts);
+void fuse_wakeup(void *chan);
+
+#define PINOD 0
+
+#define OSAddAtomic(amount, addr) __sync_fetch_and_add((addr), (amount))
+
+#define FUSE_OSMalloc(size, tag)     malloc(size)
+#define FUSE_OSFree(addr, size, tag) free(addr)
+
+#define M_TEMP 0
+#define FREE(addr, type) free(addr)
+
+extern int desiredvnodes;
+void *hashinit(int elements, int type, u_long *hashmask);
+
+/* A vnode is live until reclaimed; reclaiming bumps its vid. */
+typedef struct vnode {
+    pthread_mutex_t v_lock;
+    uint32_t        v_id;
+    int             v_iocount;
+    int             v_dead;
+    void           *v_fsnode;
+} *vnode_t;
+
+uint32_t vnode_vid(vnode_t vp);
+int      vnode_getwithvid(vnode_t vp, uint32_t vid);
+int      vnode_put(vnode_t vp);
+
+#define vnode_fsnode(vp)      ((vp)->v_fsnode)
+#define vnode_clearfsnode(vp) ((vp)->v_fsnode = NULL)
+#define vnode_addfsref(vp)    0
+#define vnode_removefsref(vp) 0
+
+typedef struct fuse_device *fuse_device_t;
+
+#endif /* _XNU_SHIM_H_ */
@@ -0,0 +1,655 @@
+/*
+ * readdirplus_test: FUSE_READDIRPLUS as unixfs answers it and as the kernel
+ * takes it in.
+ *
+ * unixfs.c is compiled in and its unixfs_session_loop() is run on one end of
+ * a SOCK_SEQPACKET socketpair; the main thread plays the kernel. The back end
+ * is a stub directory whose entries sit at uneven offsets, with a deleted
+ * slot (ino 0) and an entry whose getattr can be made to fail.
+ *
+ * The directory is read a small buffer at a time, each call resuming from the
+ * offset of the last entry that went out, as fuse_internal_readdir() does.
+ * Every reply is taken in by fuse_readdir.c itself, the walk behind
+ * fuse_internal_readdir_processdata(), with ops that check each entry's
+ * encoding and stand in for the uio, the caches and forgets. At the end every
+ * entry must have gone out and been cached exactly once, with its attributes,
+ * and every other lookup the daemon made must have been forgotten: those of
+ * entries that didn't fit in the caller's buffer and those the cache turned
+ * down. "." and ".." must be neither.
+ *
+ * Needs libfuse 2.7 and AF_UNIX SOCK_SEQPACKET sockets (Linux).
+ */
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <fuse/fuse_lowlevel.h>
+
+/* See msgloop_bench.c: unixfs.c builds its own loop only for MacFUSE. */
+#ifndef __FreeBSD__
+#define __FreeBSD__ 10
+#endif
+
+#define main unixfs_main
+#include "unixfs.c"
+#undef main
+
+#include "fuse_readdir.c"
+
+#define DIR_INO    2
+#define FILE_INO   3 /* not a directory */
+#define NENTRIES   60
+#define DELETED    9 /* slot whose ino is 0 */
+#define FLAKY      17
+#define ENTRY_INO(k) ((ino_t)(100 + (k)))
+#define LONGEST    16 /* "entry" and up to 11 digits */
+#define ROOMY      (64 * 1024)
+
+struct inode {
+    ino_t I_number;
+};
+
+/* Slot k of the directory starts at offset slot_off(k); the gaps vary. */
+static off_t
+slot_off(int k)
+{
+    return (off_t)k * 24 + (k % 5) * 4;
+}
+
+static int flaky_fails;        /* igetattr calls of FLAKY still to fail */
+static int getattrs[NENTRIES]; /* igetattr calls per slot that went through */
+static int igets, iputs;
+
+static int
+slot_of(ino_t ino)
+{
+    if (ino == DIR_INO)
+        return 0;
+    if (ino == 1)
+        return 1;
+    if (ino >= ENTRY_INO(2) && ino < ENTRY_INO(NENTRIES))
+        return (int)(ino - ENTRY_INO(0));
+    return -1;
+}
+
+static void
+stub_fini(void* filsys)
+{
+}
+
+static struct inode*
+stub_iget(ino_t ino)
+{
+    struct inode* ip;
+
+    if (ino != DIR_INO && ino != FILE_INO)
+        return NULL;
+    if (!(ip = calloc(1, sizeof(*ip))))
+        return NULL;
+    ip->I_number = ino;
+    igets++;
+
+    return ip;
+}
+
+static void
+stub_iput(struct inode* ip)
+{
+    iputs++;
+    free(ip);
+}
+
+static void
+fill_stat(ino_t ino, int k, struct stat* stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_ino = ino;
+    stbuf->st_mode = (k < 2 || k % 7 == 0) ? S_IFDIR | 0755 : S_IFREG | 0644;
+    stbuf->st_nlink = 1;
+    stbuf->st_size = k * 100;
+    stbuf->st_mtimespec.tv_sec = 1000 + k;
+}
+
+static int
+stub_igetattr(ino_t ino, struct stat* stbuf)
+{
+    int k = slot_of(ino);
+
+    if (k < 0)
+        return ENOENT;
+
+    if (ino == ENTRY_INO(FLAKY) && flaky_fails) {
+        flaky_fails--;
+        return EIO;
+    }
+    getattrs[k]++;
+    fill_stat(ino, k, stbuf);
+
+    return 0;
+}
+
+static void
+stub_istat(struct inode* ip, struct stat* stbuf)
+{
+    if (ip->I_number == FILE_INO)
+        fill_stat(FILE_INO, 3, stbuf); /* a regular file's mode */
+    else
+        fill_stat(ip->I_number, slot_of(ip->I_number), stbuf);
+}
+
+/* Like the real back ends: the entry at *offset or after it, and past it. */
+static int
+stub_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                  off_t* offset, struct unixfs_direntry* dent)
+{
+    int k;
+
+    for (k = 0; k < NENTRIES && slot_off(k) < *offset; k++)
+        ;
+    if (k == NENTRIES)
+        return -1;
+
+    if (k == 0) {
+        dent->ino = DIR_INO;
+        strcpy(dent->name, ".");
+    } else if (k == 1) {
+        dent->ino = 1;
+        strcpy(dent->name, "..");
+    } else {
+        dent->ino = (k == DELETED) ? 0 : ENTRY_INO(k);
+        snprintf(dent->name, sizeof(dent->name), "entry%0*d", k % 11 + 1, k);
+    }
+    *offset = (k + 1 < NENTRIES) ? slot_off(k + 1) : slot_off(k) + 24;
+
+    return 0;
+}
+
+static struct unixfs_ops stub_ops = {
+    .fini         = stub_fini,
+    .iget         = stub_iget,
+    .iput         = stub_iput,
+    .igetattr     = stub_igetattr,
+    .istat        = stub_istat,
+    .nextdirentry = stub_nextdirentry,
+};
+static struct unixfs stub_unixfs = { .ops = &stub_ops };
+
+void
+unixfs_usage(void)
+{
+}
+
+struct unixfs*
+unixfs_preflight(char* dmg, char** type, struct unixfs** unixfsp)
+{
+    return NULL;
+}
+
+void
+unixfs_postflight(char* fsname, char* volname, char* extra_args)
+{
+}
+
+static int
+plain_receive(struct fuse_chan** chp, char* buf, size_t size)
+{
+    ssize_t res = read(fuse_chan_fd(*chp), buf, size);
+    return (res == -1) ? -errno : (int)res;
+}
+
+static int
+plain_send(struct fuse_chan* ch, const struct iovec iov[], size_t count)
+{
+    return (writev(fuse_chan_fd(ch), iov, (int)count) == -1) ? -errno : 0;
+}
+
+static void
+plain_destroy(struct fuse_chan* ch)
+{
+}
+
+static struct fuse_session* se;
+static int sv[2];
+static uint64_t unique = 1;
+static char reply[64 * 1024];
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void*
+daemon_main(void* arg)
+{
+    struct fuse_chan_ops ops = {
+        .receive = plain_receive,
+        .send    = plain_send,
+        .destroy = plain_destroy,
+    };
+    struct fuse_chan* ch = fuse_chan_new(&ops, sv[1], 132 * 1024, NULL);
+
+    unixfs_session_loop(se, ch, NULL);
+    fuse_chan_destroy(ch);
+
+    return NULL;
+}
+
+/* Returns the payload length, or -errno. */
+static ssize_t
+readdirplus(uint64_t nodeid, uint64_t offset, uint32_t size)
+{
+    struct {
+        struct unixfs_in_header h;
+        struct unixfs_read_in   r;
+    } req;
+    struct unixfs_out_header* out = (struct unixfs_out_header*)reply;
+    ssize_t res;
+
+    memset(&req, 0, sizeof(req));
+    req.h.len = sizeof(req);
+    req.h.opcode = UNIXFS_FUSE_READDIRPLUS;
+    req.h.unique = unique++;
+    req.h.nodeid = nodeid;
+    req.r.offset = offset;
+    req.r.size = size;
+
+    if (write(sv[0], &req, sizeof(req)) != sizeof(req) ||
+        (res = read(sv[0], reply, sizeof(reply))) < (ssize_t)sizeof(*out)) {
+        fprintf(stderr, "FAIL: daemon went away\n");
+        exit(1);
+    }
+    CHECK(out->unique == req.h.unique && out->len == (uint32_t)res);
+
+    return out->error ? out->error : res - (ssize_t)sizeof(*out);
+}
+
+/*
+ * The kernel's side. The uio is a count of bytes left and an offset; an
+ * entry takes up what a struct dirent with a 32-bit d_fileno would.
+ */
+struct uio_model {
+    size_t   resid;
+    uint64_t offset;
+};
+
+#define DIRSIZ(namelen) (8 + (((namelen) + 1 + 3) & ~3))
+
+static int      listed[NENTRIES];
+static int      cached[NENTRIES];
+static int      forgotten[NENTRIES];
+static uint64_t cached_size[NENTRIES];
+static int      refused = -1; /* slot whose node the cache turns down */
+
+static int
+model_emit(void* arg, const struct fuse_dirent* fudge)
+{
+    struct uio_model* uio = arg;
+    char name[FUSE_MAXNAMLEN + 1];
+    int k = slot_of(fudge->ino);
+
+    memcpy(name, fudge->name, fudge->namelen);
+    name[fudge->namelen] = '\0';
+
+    CHECK(k >= 0 && k != DELETED);
+    if (k < 0)
+        return EIO;
+    CHECK(fudge->off > uio->offset);
+    CHECK(fudge->off ==
+          (uint64_t)((k + 1 < NENTRIES) ? slot_off(k + 1) :
+                                          slot_off(k) + 24));
+    CHECK(fudge->type ==
+          (uint32_t)(((k < 2 || k % 7 == 0) ? S_IFDIR : S_IFREG) >> 12));
+    if (k < 2)
+        CHECK(strcmp(name, (k == 0) ? "." : "..") == 0);
+
+    if (DIRSIZ(fudge->namelen) > uio->resid)
+        return -1;
+
+    listed[k]++;
+    uio->resid -= DIRSIZ(fudge->namelen);
+    uio->offset = fudge->off;
+
+    return 0;
+}
+
+static int
+model_cache(void* arg, const struct fuse_entry_out* feo, const char* name,
+            size_t namelen)
+{
+    char want[LONGEST + 1];
+    int k = slot_of(feo->nodeid);
+
+    CHECK(k >= 2 && k != DELETED);
+    if (k < 2)
+        return EIO;
+    CHECK(listed[k] == 1); /* it just went out */
+    CHECK(feo->attr.ino == feo->nodeid);
+    CHECK(feo->attr.mtime == (uint64_t)(1000 + k));
+    CHECK(feo->entry_valid == (uint64_t)UNIXFS_META_TIMEOUT);
+    CHECK(feo->attr_valid == (uint64_t)UNIXFS_META_TIMEOUT);
+    snprintf(want, sizeof(want), "entry%0*d", k % 11 + 1, k);
+    CHECK(namelen == strlen(want) && memcmp(name, want, namelen) == 0);
+
+    if (k == refused)
+        return EINVAL;
+    cached[k]++;
+    cached_size[k] = feo->attr.size;
+
+    return 0;
+}
+
+static void
+model_forget(void* arg, uint64_t nodeid)
+{
+    int k = slot_of(nodeid);
+
+    CHECK(k >= 2 && k != DELETED);
+    if (k >= 0)
+        forgotten[k]++;
+}
+
+static const struct fuse_readdir_ops model_ops = {
+    model_emit,
+    model_cache,
+    model_forget,
+};
+
+/*
+ * Takes one reply in with resid bytes of room. Returns the offset to resume
+ * from, which is that of the last entry that went out.
+ */
+static uint64_t
+take_reply(size_t len, size_t resid, uint64_t offset)
+{
+    struct uio_model uio = { resid, offset };
+
+    CHECK(fuse_readdir_take(&model_ops, &uio,
+                            reply + sizeof(struct unixfs_out_header), len,
+                            1 /* plus */, NULL) == -1);
+    CHECK(uio.offset > offset);
+
+    return uio.offset;
+}
+
+/*
+ * Lists the directory size bytes at a time into a buffer of resid bytes,
+ * with the first fails getattrs of FLAKY failing. Returns the number of
+ * calls.
+ */
+static int
+list(uint32_t size, size_t resid, int fails)
+{
+    uint64_t offset = 0;
+    ssize_t len;
+    int calls = 0;
+
+    memset(listed, 0, sizeof(listed));
+    memset(cached, 0, sizeof(cached));
+    memset(forgotten, 0, sizeof(forgotten));
+    memset(cached_size, 0, sizeof(cached_size));
+    memset(getattrs, 0, sizeof(getattrs));
+    flaky_fails = fails;
+
+    for (;;) {
+        len = readdirplus(DIR_INO, offset, size);
+        calls++;
+        CHECK(len >= 0 && len <= (ssize_t)size);
+        if (len <= 0 || failures)
+            break;
+        offset = take_reply((size_t)len, resid, offset);
+        if (failures)
+            break;
+    }
+    flaky_fails = 0;
+
+    return calls;
+}
+
+static int
+nforgotten(void)
+{
+    int k, n = 0;
+
+    for (k = 0; k < NENTRIES; k++)
+        n += forgotten[k];
+
+    return n;
+}
+
+/*
+ * Each entry listed once and cached unless refused, FLAKY only if its getattr
+ * went through, and every lookup the daemon made either cached or forgotten.
+ */
+static void
+check_listing(const char* what, int flaky_listed)
+{
+    int k, before = failures;
+
+    for (k = 0; k < NENTRIES; k++) {
+        int want = (k == DELETED) ? 0 : (k == FLAKY) ? flaky_listed : 1;
+        CHECK(listed[k] == want);
+        if (k < 2) {
+            CHECK(cached[k] == 0 && forgotten[k] == 0);
+            continue;
+        }
+        CHECK(cached[k] == ((k == refused) ? 0 : want));
+        if (cached[k])
+            CHECK(cached_size[k] == (uint64_t)k * 100);
+        CHECK(cached[k] + forgotten[k] == getattrs[k]);
+    }
+    if (failures != before)
+        fprintf(stderr, "FAIL: %s\n", what);
+}
+
+/*
+ * Entries that are never counted as lookups, and one with no file type,
+ * which is forgotten without being offered to the cache.
+ */
+static int skip_emits, skip_room, skip_caches, skip_forgets;
+
+static int
+skip_emit(void* arg, const struct fuse_dirent* fudge)
+{
+    if (skip_emits == skip_room)
+        return -1;
+    skip_emits++;
+    return 0;
+}
+
+static int
+skip_cache(void* arg, const struct fuse_entry_out* feo, const char* name,
+           size_t namelen)
+{
+    CHECK(feo->nodeid == 8);
+    skip_caches++;
+    return 0;
+}
+
+static void
+skip_forget(void* arg, uint64_t nodeid)
+{
+    CHECK(nodeid == 7 || (skip_room < 6 && nodeid == 8));
+    skip_forgets++;
+}
+
+static const struct fuse_readdir_ops skip_ops = {
+    skip_emit,
+    skip_cache,
+    skip_forget,
+};
+
+static void
+check_skips(void)
+{
+    static const struct {
+        const char* name;
+        uint64_t    nodeid;
+        uint32_t    mode;
+    } ents[] = {
+        { ".",      5,            S_IFDIR },
+        { "..",     6,            S_IFDIR },
+        { "root",   FUSE_ROOT_ID, S_IFDIR },
+        { "none",   0,            S_IFREG },
+        { "nomode", 7,            0 },
+        { "kept",   8,            S_IFREG },
+    };
+    uint64_t buf[1024 / sizeof(uint64_t)];
+    size_t i, len = 0, first = 0;
+    int n = -1;
+
+    memset(buf, 0, sizeof(buf));
+    for (i = 0; i < sizeof(ents) / sizeof(ents[0]); i++) {
+        struct fuse_direntplus* dep =
+            (struct fuse_direntplus*)((char*)buf + len);
+
+        dep->entry_out.nodeid = ents[i].nodeid;
+        dep->entry_out.attr.ino = ents[i].nodeid;
+        dep->entry_out.attr.mode = ents[i].mode;
+        dep->dirent.ino = 100 + i;
+        dep->dirent.off = i + 1;
+        dep->dirent.namelen = (uint32_t)strlen(ents[i].name);
+        memcpy(dep->dirent.name, ents[i].name, dep->dirent.namelen);
+        len += FUSE_DIRENTPLUS_SIZE(dep);
+        if (i == 0)
+            first = len;
+    }
+
+    /* Everything goes out; only "kept" is cached, "nomode" is forgotten. */
+    skip_emits = skip_caches = skip_forgets = 0;
+    skip_room = 6;
+    CHECK(fuse_readdir_take(&skip_ops, NULL, buf, len, 1, &n) == -1);
+    CHECK(skip_emits == 6 && skip_caches == 1 && skip_forgets == 1);
+
+    /* Room for two: the lookups past them are forgotten, the rest skipped. */
+    skip_emits = skip_caches = skip_forgets = 0;
+    skip_room = 2;
+    CHECK(fuse_readdir_take(&skip_ops, NULL, buf, len, 1, &n) == -1);
+    CHECK(skip_emits == 2 && skip_caches == 0 && skip_forgets == 2);
+
+    /* An answer cut short in its second entry. */
+    skip_emits = skip_caches = skip_forgets = 0;
+    skip_room = 6;
+    CHECK(fuse_readdir_take(&skip_ops, NULL, buf,
+                            first + FUSE_NAME_OFFSET_DIRENTPLUS, 1, &n) == 0);
+    CHECK(n == 1 && skip_emits == 1);
+}
+
+int
+main(int argc, char** argv)
+{
+    char* fargv[] = { "readdirplus_test", NULL };
+    struct fuse_args args = FUSE_ARGS_INIT(1, fargv);
+    uint32_t size;
+    size_t resid;
+    pthread_t t;
+    int calls;
+
+    unixfs = &stub_unixfs;
+
+    se = fuse_lowlevel_new(&args, &unixfs_ll_oper, sizeof(unixfs_ll_oper),
+                           NULL);
+    fuse_opt_free_args(&args);
+    if (!se || socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0) {
+        perror("readdirplus_test");
+        return 1;
+    }
+    pthread_create(&t, NULL, daemon_main, NULL);
+
+    struct {
+        struct unixfs_in_header h;
+        struct unixfs_init_in   i;
+    } init;
+    memset(&init, 0, sizeof(init));
+    init.h.len = sizeof(init);
+    init.h.opcode = UNIXFS_FUSE_INIT;
+    init.h.unique = unique++;
+    init.i.major = 7;
+    init.i.minor = 8;
+    init.i.max_readahead = 65536;
+    init.i.flags = UNIXFS_FUSE_DO_READDIRPLUS;
+    if (write(sv[0], &init, sizeof(init)) != sizeof(init) ||
+        read(sv[0], reply, sizeof(reply)) <= 0) {
+        fprintf(stderr, "FAIL: no answer to INIT\n");
+        return 1;
+    }
+    CHECK(((struct unixfs_init_out*)(reply + sizeof(struct unixfs_out_header)))
+          ->flags & UNIXFS_FUSE_DO_READDIRPLUS);
+
+    /* All at once, then down to one entry per call. */
+    calls = list(sizeof(reply) - sizeof(struct unixfs_out_header),
+                 ROOMY, 0);
+    CHECK(calls == 2);
+    check_listing("one call", 1);
+    CHECK(nforgotten() == 0);
+
+    for (size = 1024; size >= UNIXFS_DIRENTPLUS_SIZE(LONGEST); size /= 2) {
+        calls = list(size, ROOMY, 0);
+        CHECK(calls > 2);
+        check_listing("paged", 1);
+        CHECK(nforgotten() == 0);
+    }
+
+    /*
+     * A caller's buffer smaller than the replies: the entries past the last
+     * one that fits are forgotten, and sent again by the next call.
+     */
+    for (resid = DIRSIZ(LONGEST); resid <= 16 * DIRSIZ(LONGEST); resid *= 2) {
+        list(4096, resid, 0);
+        check_listing("small buffer", 1);
+        CHECK(nforgotten() > 0);
+    }
+
+    /* A node the cache won't keep is forgotten, and still listed. */
+    refused = 23;
+    list(512, ROOMY, 0);
+    check_listing("refused", 1);
+    CHECK(forgotten[23] == 1 && nforgotten() == 1);
+    refused = -1;
+
+    /*
+     * A getattr that fails once: the entry is left out of the call that hit
+     * it, and the entries after it keep their offsets, so the next call
+     * neither repeats nor skips any of them.
+     */
+    list(256, ROOMY, 1);
+    check_listing("getattr failing once", 0);
+    list(256, ROOMY, 1000);
+    check_listing("getattr failing throughout", 0);
+
+    check_skips();
+
+    /* A buffer too small for any entry gets an empty reply. */
+    memset(getattrs, 0, sizeof(getattrs));
+    CHECK(readdirplus(DIR_INO, 0, 16) == 0);
+    CHECK(getattrs[0] == 0);
+
+    CHECK(readdirplus(FILE_INO, 0, 4096) == -ENOTDIR);
+    CHECK(readdirplus(99, 0, 4096) == -ENOENT);
+    CHECK(igets == iputs);
+
+    shutdown(sv[0], SHUT_RDWR);
+    close(sv[0]);
+    pthread_join(t, NULL);
+    close(sv[1]);
+    fuse_session_destroy(se);
+
+    if (failures)
+        return 1;
+
+    printf("readdirplus_test: PASS\n");
+
+    return 0;
+}
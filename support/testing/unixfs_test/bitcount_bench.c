@@ -0,0 +1,145 @@
+/*
+ * bitcount_bench: check and time the minixfs free-bit counter.
+ *
+ * minixfs.c is compiled in here so that its static count_free() can be
+ * called directly. It is compared with the nibble-table counter it
+ * replaced and with a bit-at-a-time reference, first on random maps of
+ * random lengths, then timed on a large map.
+ *
+ * Usage: bitcount_bench [-n trials] [-s megabytes] [-r reps]
+ */
+
+#include "minixfs.c"
+
+#include <sys/time.h>
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* The counter count_free() replaced, flattened to one buffer. */
+
+static const int nibblemap[] = { 4,3,3,2,3,2,2,1,3,2,2,1,2,1,1,0 };
+
+static unsigned long
+nibble_count_free(const char* map, __u32 numbits)
+{
+    unsigned i, j, sum = 0;
+
+    i = (numbits / 16) * 2;
+    for (j = 0; j < i; j++)
+        sum += nibblemap[map[j] & 0xf] + nibblemap[(map[j] >> 4) & 0xf];
+
+    i = numbits % 16;
+    if (i != 0) {
+        i = *(__u16*)(&map[j]) | ~((1 << i) - 1);
+        sum += nibblemap[i & 0xf] + nibblemap[(i >> 4) & 0xf];
+        sum += nibblemap[(i >> 8) & 0xf] + nibblemap[(i >> 12) & 0xf];
+    }
+    return sum;
+}
+
+static unsigned long
+ref_count_free(const unsigned char* map, __u32 numbits)
+{
+    unsigned long sum = 0;
+    __u32 n;
+
+    for (n = 0; n < numbits; n++)
+        sum += !(map[n / 8] & (1 << (n % 8)));
+    return sum;
+}
+
+static void
+fill(unsigned char* map, size_t len, int density)
+{
+    size_t i;
+    int b;
+
+    for (i = 0; i < len; i++) {
+        map[i] = 0;
+        for (b = 0; b < 8; b++)
+            if (rand() % 100 < density)
+                map[i] |= 1 << b;
+    }
+}
+
+int
+main(int argc, char** argv)
+{
+    unsigned long trials = 2000, megs = 1, reps = 200, t;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:s:r:")) != -1) {
+        switch (c) {
+        case 'n': trials = strtoul(optarg, NULL, 0); break;
+        case 's': megs = strtoul(optarg, NULL, 0); break;
+        case 'r': reps = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr,
+                "usage: bitcount_bench [-n trials] [-s megabytes] [-r reps]\n");
+            return 1;
+        }
+    }
+
+    srand(1);
+
+    /*
+     * Maps are whole 1K blocks, as they are on disk. The bit count may be
+     * anywhere up to (and, for count_free, past) the end of the map.
+     */
+    for (t = 0; t < trials; t++) {
+        unsigned long nblocks = 1 + rand() % 8;
+        unsigned long numbytes = nblocks * 1024;
+        unsigned char* map = malloc(numbytes + 2);
+        __u32 numbits = 1 + rand() % (numbytes * 8);
+        unsigned long want;
+
+        fill(map, numbytes, rand() % 101);
+        want = ref_count_free(map, numbits);
+
+        if (count_free((char*)map, numbytes, numbits) != want ||
+            nibble_count_free((char*)map, numbits) != want) {
+            fprintf(stderr, "FAIL: %lu bytes, %u bits: reference %lu, "
+                    "count_free %lu, nibble table %lu\n", numbytes, numbits,
+                    want, count_free((char*)map, numbytes, numbits),
+                    nibble_count_free((char*)map, numbits));
+            return 1;
+        }
+        if (count_free((char*)map, numbytes, numbytes * 8 + numbits) !=
+            ref_count_free(map, numbytes * 8)) {
+            fprintf(stderr, "FAIL: %lu bytes, %lu bits: count_free read past "
+                    "the map\n", numbytes, numbytes * 8 + numbits);
+            return 1;
+        }
+        free(map);
+    }
+    printf("%lu random maps: count_free and nibble table match the "
+           "reference\n", trials);
+
+    unsigned long numbytes = megs << 20;
+    unsigned char* map = malloc(numbytes);
+    volatile unsigned long sink = 0;
+    double t0, t1, t2;
+    unsigned long r;
+
+    fill(map, numbytes, 50);
+
+    t0 = now();
+    for (r = 0; r < reps; r++)
+        sink += nibble_count_free((char*)map, numbytes * 8 - 5);
+    t1 = now();
+    for (r = 0; r < reps; r++)
+        sink += count_free((char*)map, numbytes, numbytes * 8 - 5);
+    t2 = now();
+
+    printf("%lu MiB map: nibble table %.3f ms, count_free %.3f ms\n", megs,
+           (t1 - t0) * 1e3 / reps, (t2 - t1) * 1e3 / reps);
+
+    free(map);
+    return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * Byte order helpers for building the UnixFS back ends on Linux, where
+ * <libkern/OSByteOrder.h> does not exist.
+ */
+
+#ifndef _COMPAT_LIBKERN_OSBYTEORDER_H_
+#define _COMPAT_LIBKERN_OSBYTEORDER_H_
+
+#include <byteswap.h>
+#include <endian.h>
+#define OSSwapInt16 bswap_16
+#define OSSwapInt32 bswap_32
+#define OSSwapInt64 bswap_64
+#define OSSwapLittleToHostInt16(x) le16toh(x)
+#define OSSwapLittleToHostInt32(x) le32toh(x)
+#define OSSwapLittleToHostInt64(x) le64toh(x)
+#define OSSwapBigToHostInt16(x) be16toh(x)
+#define OSSwapBigToHostInt32(x) be32toh(x)
+#define OSSwapBigToHostInt64(x) be64toh(x)
+#define OSSwapHostToLittleInt16(x) htole16(x)
+#define OSSwapHostToLittleInt32(x) htole32(x)
+#define OSSwapHostToLittleInt64(x) htole64(x)
+#define OSSwapHostToBigInt16(x) htobe16(x)
+#define OSSwapHostToBigInt32(x) htobe32(x)
+#define OSSwapHostToBigInt64(x) htobe64(x)
+
+#endif /* _COMPAT_LIBKERN_OSBYTEORDER_H_ */
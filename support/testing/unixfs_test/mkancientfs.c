@@ -0,0 +1,244 @@
+/*
+ * mkancientfs: build a synthetic UNIX V7 or UNIX/32V file system image.
+ *
+ * The image has a root directory holding a number of empty regular files,
+ * an inode list of the requested size, and every remaining block on the
+ * superblock free list. Inode and free-list counts are printed so that
+ * statvfs results can be checked against them.
+ *
+ * Usage: mkancientfs [-t v7|32v] [-s blocks] [-i iblocks] [-n files] image
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BSIZE   512
+#define NICFREE 50
+#define INOPB   8
+#define ROOTINO 2
+#define NADDR   10 /* direct addresses only */
+
+struct layout {
+    const char* name;
+    int  pdp;       /* PDP-11 middle-endian longs, else little-endian */
+    int  clsize;    /* blocks per cluster */
+    int  addrpad;   /* which byte of a 4-byte address is dropped on disk */
+    int  sb_fsize;  /* superblock field offsets */
+    int  sb_nfree;
+    int  sb_free;
+    int  sb_ninode;
+    int  sb_time;
+    int  sb_tfree;
+    int  sb_tinode;
+    int  fb_nfreesz;/* width of fblk.df_nfree */
+};
+
+static const struct layout layouts[] = {
+    { "v7",  1, 1, 1, 2, 6, 8,  208, 414, 418, 422, 2 },
+    { "32v", 0, 2, 3, 4, 8, 12, 212, 420, 424, 428, 4 },
+};
+
+static const struct layout* L;
+static int fd;
+
+static void
+put16(unsigned char* p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void
+put32(unsigned char* p, uint32_t v)
+{
+    if (L->pdp) {
+        put16(p, v >> 16);
+        put16(p + 2, v & 0xffff);
+    } else {
+        put16(p, v & 0xffff);
+        put16(p + 2, v >> 16);
+    }
+}
+
+static void
+put_addr(unsigned char* p, uint32_t v)
+{
+    unsigned char b[4];
+    int i, j;
+
+    put32(b, v);
+    for (i = 0, j = 0; i < 4; i++)
+        if (i != L->addrpad)
+            p[j++] = b[i];
+}
+
+static void
+wblock(uint32_t bno, const void* buf, size_t len)
+{
+    if (pwrite(fd, buf, len, (off_t)bno * BSIZE) != (ssize_t)len) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
+static void
+put_inode(uint32_t ino, uint32_t mode, uint32_t nlink, uint32_t size,
+          const uint32_t* addrs, int naddrs)
+{
+    unsigned char d[64];
+    int i;
+
+    memset(d, 0, sizeof(d));
+    put16(d + 0, mode);
+    put16(d + 2, nlink);
+    put32(d + 8, size);
+    for (i = 0; i < naddrs; i++)
+        put_addr(d + 12 + 3 * i, addrs[i]);
+    put32(d + 52, (uint32_t)time(NULL));
+    put32(d + 56, (uint32_t)time(NULL));
+    put32(d + 60, (uint32_t)time(NULL));
+
+    uint32_t bno = (ino + 15) / INOPB;
+    if (pwrite(fd, d, sizeof(d),
+               (off_t)bno * BSIZE + ((ino + 15) % INOPB) * 64) != 64) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "usage: mkancientfs [-t v7|32v] [-s blocks] [-i iblocks] "
+        "[-n files] image\n");
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    uint32_t fsize = 65536, isize = 1024, nfiles = 100;
+    const char* type = "v7";
+    int c, i;
+
+    while ((c = getopt(argc, argv, "t:s:i:n:")) != -1) {
+        switch (c) {
+        case 't': type = optarg; break;
+        case 's': fsize = strtoul(optarg, NULL, 0); break;
+        case 'i': isize = strtoul(optarg, NULL, 0); break;
+        case 'n': nfiles = strtoul(optarg, NULL, 0); break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    for (i = 0; i < (int)(sizeof(layouts) / sizeof(layouts[0])); i++)
+        if (strcmp(type, layouts[i].name) == 0)
+            L = &layouts[i];
+    if (!L)
+        usage();
+
+    uint32_t ninodes = (isize - 2) * INOPB;
+    uint32_t dirsize = (nfiles + 2) * 16;
+    uint32_t clbytes = BSIZE * L->clsize;
+    uint32_t ndirblks = (dirsize + clbytes - 1) / clbytes;
+
+    if (isize < 3 || fsize > 0xffffff || nfiles + 2 > ninodes ||
+        ndirblks > NADDR || isize + ndirblks * L->clsize + 1 >= fsize) {
+        fprintf(stderr, "mkancientfs: bad geometry\n");
+        return 1;
+    }
+
+    fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)fsize * BSIZE) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    /* Root directory, in whole clusters right after the inode list. */
+
+    uint32_t next = isize;
+    uint32_t diraddr[NADDR];
+    unsigned char* dir = calloc(ndirblks, clbytes);
+
+    for (i = 0; i < (int)(nfiles + 2); i++) {
+        unsigned char* de = dir + 16 * i;
+        if (i < 2) {
+            put16(de, ROOTINO);
+            strcpy((char*)de + 2, (i == 0) ? "." : "..");
+        } else {
+            put16(de, ROOTINO + i - 1);
+            snprintf((char*)de + 2, 14, "f%d", i - 2);
+        }
+    }
+    for (i = 0; i < (int)ndirblks; i++) {
+        diraddr[i] = next;
+        wblock(next, dir + i * clbytes, clbytes);
+        next += L->clsize;
+    }
+    free(dir);
+
+    put_inode(ROOTINO, 0040755, 2, dirsize, diraddr, ndirblks);
+    for (i = 0; i < (int)nfiles; i++)
+        put_inode(ROOTINO + 1 + i, 0100644, 1, 0, NULL, 0);
+
+    /*
+     * Free list. The superblock holds the first group; the first entry of
+     * every group is the block that holds the next group.
+     */
+
+    uint32_t nfree = fsize - next;
+    uint32_t group[NICFREE];
+    int ngroup = 0;
+    unsigned char sb[BSIZE];
+    unsigned char fb[BSIZE];
+    uint32_t b = next;
+
+    group[ngroup++] = 0;
+    memset(sb, 0, sizeof(sb));
+
+    for (;;) {
+        while (ngroup < NICFREE && b < fsize)
+            group[ngroup++] = b++;
+        if (b >= fsize)
+            break;
+        /* This group is full; the next free block becomes its holder. */
+        uint32_t holder = b++;
+        memset(fb, 0, sizeof(fb));
+        if (L->fb_nfreesz == 2)
+            put16(fb, ngroup);
+        else
+            put32(fb, ngroup);
+        for (i = 0; i < ngroup; i++)
+            put32(fb + L->fb_nfreesz + 4 * i, group[i]);
+        wblock(holder, fb, sizeof(fb));
+        ngroup = 0;
+        group[ngroup++] = holder;
+    }
+
+    put16(sb, isize);
+    put32(sb + L->sb_fsize, fsize);
+    put16(sb + L->sb_nfree, ngroup);
+    for (i = 0; i < ngroup; i++)
+        put32(sb + L->sb_free + 4 * i, group[i]);
+    put16(sb + L->sb_ninode, 0);
+    put32(sb + L->sb_time, (uint32_t)time(NULL));
+    put32(sb + L->sb_tfree, nfree);
+    put16(sb + L->sb_tinode, ninodes - nfiles - 1);
+    wblock(1, sb, sizeof(sb));
+
+    close(fd);
+
+    printf("%s: %u blocks, %u inodes (%u in use), %u free blocks\n",
+           argv[optind], fsize, ninodes, nfiles + 1, nfree);
+
+    return 0;
+}
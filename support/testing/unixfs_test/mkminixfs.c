@@ -0,0 +1,457 @@
+/*
+ * mkminixfs: build a synthetic Minix V1, V2 or V3 file system image.
+ *
+ * The image may hold:
+ *
+ *   /fNNNNN          -f empty regular files
+ *   /big/<name>      -b empty regular files with maildir-like names cut to
+ *                    the name length
+ *   /large/{direct,indirect,dindirect}
+ *                    -L: files reaching the single and double indirect zones
+ *   /large/big       -s: a file of the given number of MiB
+ *
+ * With -r, that percentage of the remaining free inodes and zones is then
+ * marked in use at random (without being referenced), so the bitmaps are
+ * not just a run of ones followed by zeroes. Two lines are printed for
+ * unixfs_bench:
+ *
+ *   mount <files>,<ffree>,<bfree>
+ *   find <entries>,<bytes>,<sum>
+ *
+ * where <sum> is the sum of all file data bytes.
+ *
+ * Usage: mkminixfs [-v 1|2|3] [-l 14|30] [-B blocksize] [-z zones]
+ *                  [-i inodes] [-f n] [-b n] [-L] [-s megabytes]
+ *                  [-r percent] image
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ROOTINO 1
+#define NDIRECT 7
+
+static int      version = 1;
+static uint32_t bsize = 1024;
+static uint32_t namelen = 14;
+static uint32_t dirsize, nindir;
+static uint32_t ninodes, nzones, firstdata;
+static uint32_t imap_blocks, zmap_blocks;
+static uint8_t* imap;
+static uint8_t* zmap;
+static uint32_t nextzone;
+static uint32_t nexti = ROOTINO + 1;
+static uint64_t nentries, nbytes, datasum;
+static int      fd;
+
+static void
+setbit(uint8_t* map, uint32_t n)
+{
+    map[n / 8] |= 1 << (n % 8);
+}
+
+static int
+testbit(const uint8_t* map, uint32_t n)
+{
+    return map[n / 8] & (1 << (n % 8));
+}
+
+static void
+wblock(uint32_t bno, const void* buf, size_t len)
+{
+    if (pwrite(fd, buf, len, (off_t)bno * bsize) != (ssize_t)len) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
+static uint32_t
+alloczone(void)
+{
+    if (nextzone >= nzones) {
+        fprintf(stderr, "mkminixfs: out of zones\n");
+        exit(1);
+    }
+    setbit(zmap, nextzone - firstdata + 1);
+    return nextzone++;
+}
+
+static uint32_t
+allocino(void)
+{
+    if (nexti > ninodes) {
+        fprintf(stderr, "mkminixfs: out of inodes\n");
+        exit(1);
+    }
+    setbit(imap, nexti);
+    return nexti++;
+}
+
+/*
+ * Builds an indirect block of the given depth over count data zones and
+ * returns its zone number.
+ */
+static uint32_t
+putindir(int depth, const uint32_t* zones, uint64_t count)
+{
+    uint64_t span = 1;
+    uint32_t i, bno = alloczone();
+    uint8_t* blk = calloc(1, bsize);
+    int d;
+
+    for (d = 1; d < depth; d++)
+        span *= nindir;
+
+    for (i = 0; i < nindir && (uint64_t)i * span < count; i++) {
+        uint64_t n = count - (uint64_t)i * span;
+        uint32_t z = (depth == 1) ? zones[i] :
+            putindir(depth - 1, zones + i * span, (n < span) ? n : span);
+        if (version == 1)
+            ((uint16_t*)blk)[i] = (uint16_t)z;
+        else
+            ((uint32_t*)blk)[i] = z;
+    }
+
+    wblock(bno, blk, bsize);
+    free(blk);
+    return bno;
+}
+
+/*
+ * Writes len bytes of data for a file and fills in its zone array. The
+ * data zones are allocated first, so a file's data is contiguous on disk,
+ * and the indirect blocks after them.
+ */
+static void
+putdata(const char* data, uint64_t len, uint32_t zone[10])
+{
+    uint64_t nblk = (len + bsize - 1) / bsize, lbn, span = 1;
+    uint32_t* zones = malloc((nblk + 1) * sizeof(uint32_t));
+    int depth, maxdepth = (version == 1) ? 2 : 3;
+
+    for (lbn = 0; lbn < nblk; lbn++) {
+        uint64_t rem = len - lbn * bsize;
+        zones[lbn] = alloczone();
+        wblock(zones[lbn], data + lbn * bsize, (rem > bsize) ? bsize : rem);
+    }
+
+    for (lbn = 0; lbn < nblk && lbn < NDIRECT; lbn++)
+        zone[lbn] = zones[lbn];
+
+    for (depth = 1; lbn < nblk; depth++) {
+        if (depth > maxdepth) {
+            fprintf(stderr, "mkminixfs: file too large\n");
+            exit(1);
+        }
+        span *= nindir;
+        uint64_t n = nblk - lbn;
+        if (n > span)
+            n = span;
+        zone[NDIRECT + depth - 1] = putindir(depth, zones + lbn, n);
+        lbn += n;
+    }
+
+    free(zones);
+}
+
+static void
+putinode(uint32_t ino, uint16_t mode, uint16_t nlink, const char* data,
+         uint64_t len)
+{
+    uint32_t zone[10];
+    uint8_t dinode[64];
+    uint32_t isize = (version == 1) ? 32 : 64;
+    int i;
+
+    memset(zone, 0, sizeof(zone));
+    memset(dinode, 0, sizeof(dinode));
+    putdata(data, len, zone);
+
+    if (version == 1) {
+        uint16_t* z = (uint16_t*)(dinode + 14);
+        *(uint16_t*)(dinode + 0) = mode;
+        *(uint16_t*)(dinode + 2) = 501;
+        *(uint32_t*)(dinode + 4) = (uint32_t)len;
+        *(uint32_t*)(dinode + 8) = 1200000000;
+        dinode[12] = 20;
+        dinode[13] = (uint8_t)nlink;
+        for (i = 0; i < 9; i++)
+            z[i] = (uint16_t)zone[i];
+    } else {
+        uint32_t* z = (uint32_t*)(dinode + 24);
+        *(uint16_t*)(dinode + 0) = mode;
+        *(uint16_t*)(dinode + 2) = nlink;
+        *(uint16_t*)(dinode + 4) = 501;
+        *(uint16_t*)(dinode + 6) = 20;
+        *(uint32_t*)(dinode + 8) = (uint32_t)len;
+        *(uint32_t*)(dinode + 12) = 1200000000;
+        *(uint32_t*)(dinode + 16) = 1200000000;
+        *(uint32_t*)(dinode + 20) = 1200000000;
+        for (i = 0; i < 10; i++)
+            z[i] = zone[i];
+    }
+
+    off_t off = (off_t)(2 + imap_blocks + zmap_blocks) * bsize +
+                (off_t)(ino - 1) * isize;
+    if (pwrite(fd, dinode, isize, off) != (ssize_t)isize) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
+/* Directories are built in memory as an array of fixed-size slots. */
+
+struct dirbuf {
+    char*    buf;
+    uint32_t len;
+    uint32_t cap;
+    uint32_t ino;
+    uint16_t nlink;
+};
+
+static void
+diradd(struct dirbuf* d, uint32_t ino, const char* name)
+{
+    if (d->len + dirsize > d->cap) {
+        d->cap = d->cap * 2 + 4096;
+        d->buf = realloc(d->buf, d->cap);
+    }
+
+    char* e = d->buf + d->len;
+    memset(e, 0, dirsize);
+    if (version == 3) {
+        *(uint32_t*)e = ino;
+        strncpy(e + 4, name, namelen);
+    } else {
+        *(uint16_t*)e = (uint16_t)ino;
+        strncpy(e + 2, name, namelen);
+    }
+    d->len += dirsize;
+}
+
+static void
+diropen(struct dirbuf* d, uint32_t ino, struct dirbuf* parent)
+{
+    memset(d, 0, sizeof(*d));
+    d->ino = ino;
+    d->nlink = 2;
+    diradd(d, ino, ".");
+    diradd(d, parent ? parent->ino : ino, "..");
+}
+
+static void
+dirfinish(struct dirbuf* d)
+{
+    putinode(d->ino, 040755, d->nlink, d->buf, d->len);
+    free(d->buf);
+}
+
+static void
+mksubdir(struct dirbuf* parent, struct dirbuf* d, const char* name)
+{
+    diropen(d, allocino(), parent);
+    diradd(parent, d->ino, name);
+    parent->nlink++;
+    nentries++;
+}
+
+static void
+mkfile(struct dirbuf* d, const char* name, uint64_t len)
+{
+    uint32_t ino = allocino();
+    char* data = malloc(len + 1);
+    uint64_t i;
+
+    for (i = 0; i < len; i++) {
+        data[i] = (char)((ino * 31 + i * 7 + (i >> 9)) & 0xff);
+        datasum += (uint8_t)data[i];
+    }
+    putinode(ino, 0100644, 1, data, len);
+    free(data);
+    diradd(d, ino, name);
+    nentries++;
+    nbytes += len;
+}
+
+/*
+ * Marks percent of the still clear bits among bits 1 through nbits - 1 of
+ * a bitmap as set, and returns how many are left clear.
+ */
+static uint32_t
+scatter(uint8_t* map, uint32_t nbits, int percent)
+{
+    uint32_t n, nfree = 0;
+
+    for (n = 1; n < nbits; n++) {
+        if (!testbit(map, n) && (rand() % 100) < percent)
+            setbit(map, n);
+        if (!testbit(map, n))
+            nfree++;
+    }
+    return nfree;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "usage: mkminixfs [-v 1|2|3] [-l 14|30] [-B blocksize] [-z zones] "
+        "[-i inodes] [-f n] [-b n] [-L] [-s megabytes] [-r percent] "
+        "image\n");
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    uint32_t nfiles = 0, nbig = 0, nmegs = 0, i;
+    int large = 0, percent = 0, c;
+    char name[64];
+
+    nzones = 65535;
+    ninodes = 8192;
+
+    while ((c = getopt(argc, argv, "v:l:B:z:i:f:b:Ls:r:")) != -1) {
+        switch (c) {
+        case 'v': version = atoi(optarg); break;
+        case 'l': namelen = strtoul(optarg, NULL, 0); break;
+        case 'B': bsize = strtoul(optarg, NULL, 0); break;
+        case 'z': nzones = strtoul(optarg, NULL, 0); break;
+        case 'i': ninodes = strtoul(optarg, NULL, 0); break;
+        case 'f': nfiles = strtoul(optarg, NULL, 0); break;
+        case 'b': nbig = strtoul(optarg, NULL, 0); break;
+        case 'L': large = 1; break;
+        case 's': nmegs = strtoul(optarg, NULL, 0); break;
+        case 'r': percent = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || version < 1 || version > 3)
+        usage();
+
+    if (version == 3) {
+        namelen = 60;
+        dirsize = 64;
+        if (bsize < 1024 || (bsize & (bsize - 1)) || bsize > 32768)
+            usage();
+    } else {
+        if (namelen != 14 && namelen != 30)
+            usage();
+        dirsize = namelen + 2;
+        bsize = 1024;
+        if (ninodes > 65535 || (version == 1 && nzones > 65535))
+            usage();
+    }
+    nindir = bsize / (version == 1 ? 2 : 4);
+
+    uint32_t ipb = bsize / (version == 1 ? 32 : 64);
+    imap_blocks = (ninodes + 1 + bsize * 8 - 1) / (bsize * 8);
+    /* The zone map covers the data zones, which depend on its own size. */
+    for (zmap_blocks = 1;; zmap_blocks++) {
+        firstdata = 2 + imap_blocks + zmap_blocks +
+                    (ninodes + ipb - 1) / ipb;
+        if (firstdata + 16 > nzones)
+            usage();
+        if ((uint64_t)zmap_blocks * bsize * 8 >= nzones - firstdata + 1)
+            break;
+    }
+
+    imap = calloc(imap_blocks, bsize);
+    zmap = calloc(zmap_blocks, bsize);
+    /* Bit 0 is reserved; bits past the end are set, as mkfs does. */
+    for (i = ninodes + 1; i < imap_blocks * bsize * 8; i++)
+        setbit(imap, i);
+    for (i = nzones - firstdata + 1; i < zmap_blocks * bsize * 8; i++)
+        setbit(zmap, i);
+    setbit(imap, 0);
+    setbit(zmap, 0);
+    setbit(imap, ROOTINO);
+    nextzone = firstdata;
+
+    fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)nzones * bsize) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    struct dirbuf root, sub;
+
+    diropen(&root, ROOTINO, NULL);
+    for (i = 0; i < nfiles; i++) {
+        snprintf(name, sizeof(name), "f%05u", i);
+        mkfile(&root, name, 0);
+    }
+
+    if (nbig) {
+        mksubdir(&root, &sub, "big");
+        for (i = 0; i < nbig; i++) {
+            snprintf(name, namelen + 1, "%06u.M%uP%u,S=%u:2,S", i, i * 7,
+                     i * 13, i);
+            mkfile(&sub, name, 0);
+        }
+        dirfinish(&sub);
+    }
+
+    if (large || nmegs) {
+        mksubdir(&root, &sub, "large");
+        if (large) {
+            mkfile(&sub, "direct", (uint64_t)NDIRECT * bsize - 100);
+            mkfile(&sub, "indirect", (uint64_t)(NDIRECT + 100) * bsize + 555);
+            mkfile(&sub, "dindirect",
+                   (uint64_t)(NDIRECT + nindir + 300) * bsize + 4321);
+        }
+        if (nmegs)
+            mkfile(&sub, "big", (uint64_t)nmegs << 20);
+        dirfinish(&sub);
+    }
+
+    dirfinish(&root);
+
+    srand(1);
+    uint32_t nifree = scatter(imap, ninodes + 1, percent);
+    uint32_t nzfree = scatter(zmap, nzones - firstdata + 1, percent);
+
+    wblock(2, imap, imap_blocks * bsize);
+    wblock(2 + imap_blocks, zmap, zmap_blocks * bsize);
+
+    uint8_t sb[1024];
+    memset(sb, 0, sizeof(sb));
+    if (version == 3) {
+        *(uint32_t*)(sb + 0) = ninodes;
+        *(uint16_t*)(sb + 6) = imap_blocks;
+        *(uint16_t*)(sb + 8) = zmap_blocks;
+        *(uint16_t*)(sb + 10) = firstdata;
+        *(uint32_t*)(sb + 16) = 0x7fffffff;
+        *(uint32_t*)(sb + 20) = nzones;
+        *(uint16_t*)(sb + 24) = 0x4d5a;
+        *(uint16_t*)(sb + 28) = bsize;
+    } else {
+        *(uint16_t*)(sb + 0) = ninodes;
+        *(uint16_t*)(sb + 2) = (version == 1) ? nzones : 0;
+        *(uint16_t*)(sb + 4) = imap_blocks;
+        *(uint16_t*)(sb + 6) = zmap_blocks;
+        *(uint16_t*)(sb + 8) = firstdata;
+        *(uint32_t*)(sb + 12) = (version == 1) ?
+            (NDIRECT + 512 + 512 * 512) * 1024 : 0x7fffffff;
+        *(uint16_t*)(sb + 16) = (version == 1) ?
+            ((namelen == 14) ? 0x137f : 0x138f) :
+            ((namelen == 14) ? 0x2468 : 0x2478);
+        *(uint16_t*)(sb + 18) = 1; /* valid */
+        *(uint32_t*)(sb + 20) = nzones;
+    }
+    if (pwrite(fd, sb, sizeof(sb), 1024) != sizeof(sb)) {
+        perror("pwrite");
+        return 1;
+    }
+    close(fd);
+
+    printf("mount %u,%u,%u\n", ninodes, nifree, nzfree);
+    printf("find %llu,%llu,%llu\n", (unsigned long long)nentries,
+           (unsigned long long)nbytes, (unsigned long long)datasum);
+
+    return 0;
+}
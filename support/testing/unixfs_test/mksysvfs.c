@@ -0,0 +1,331 @@
+/*
+ * mksysvfs: build a synthetic System V Release 4 file system image with
+ * 1K blocks, little-endian.
+ *
+ * The image may hold:
+ *
+ *   /fNNNNN          -f empty regular files
+ *   /big/<name>      -b empty regular files with maildir-like names cut to
+ *                    14 characters
+ *
+ * Every remaining block is on the superblock free list. Two lines are
+ * printed for unixfs_bench:
+ *
+ *   mount <files>,<ffree>,<bfree>
+ *   find <entries>,<bytes>,<sum>
+ *
+ * Usage: mksysvfs [-s blocks] [-i iblocks] [-f n] [-b n] image
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BSIZE    1024
+#define NICFREE  50
+#define INOPB    (BSIZE / 64)
+#define NINDIR   (BSIZE / 4)
+#define NDIRECT  10
+#define ROOTINO  2
+#define NAMELEN  14
+#define DIRSIZE  16
+
+static uint32_t fsize, isize, ninodes;
+static uint32_t nextblk;
+static uint32_t nexti = ROOTINO + 1;
+static uint64_t nentries;
+static int      fd;
+
+static void
+wblock(uint32_t bno, const void* buf, size_t len)
+{
+    if (pwrite(fd, buf, len, (off_t)bno * BSIZE) != (ssize_t)len) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
+static uint32_t
+allocblk(void)
+{
+    if (nextblk >= fsize) {
+        fprintf(stderr, "mksysvfs: out of blocks\n");
+        exit(1);
+    }
+    return nextblk++;
+}
+
+static uint32_t
+allocino(void)
+{
+    if (nexti > ninodes) {
+        fprintf(stderr, "mksysvfs: out of inodes\n");
+        exit(1);
+    }
+    return nexti++;
+}
+
+static void
+put_addr(uint8_t* p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+}
+
+/*
+ * Writes len bytes of data for a file and fills in its 13 block addresses.
+ * Directories here never need more than the single and double indirect
+ * blocks.
+ */
+static void
+putdata(const char* data, uint32_t len, uint32_t addr[13])
+{
+    uint32_t nblk = (len + BSIZE - 1) / BSIZE, lbn;
+    uint32_t ind[NINDIR], dind[NINDIR], ind2[NINDIR];
+    uint32_t ind2b = 0;
+
+    if (nblk > NDIRECT + NINDIR + NINDIR * NINDIR) {
+        fprintf(stderr, "mksysvfs: file too large\n");
+        exit(1);
+    }
+
+    memset(ind, 0, sizeof(ind));
+    memset(dind, 0, sizeof(dind));
+
+    for (lbn = 0; lbn < nblk; lbn++) {
+        uint32_t rem = len - lbn * BSIZE;
+        uint32_t b = allocblk();
+        wblock(b, data + lbn * BSIZE, (rem > BSIZE) ? BSIZE : rem);
+
+        if (lbn < NDIRECT) {
+            addr[lbn] = b;
+        } else if (lbn < NDIRECT + NINDIR) {
+            if (!addr[10])
+                addr[10] = allocblk();
+            ind[lbn - NDIRECT] = b;
+        } else {
+            uint32_t k = lbn - NDIRECT - NINDIR;
+            if (!addr[11])
+                addr[11] = allocblk();
+            if (k % NINDIR == 0) {
+                if (ind2b)
+                    wblock(ind2b, ind2, BSIZE);
+                memset(ind2, 0, sizeof(ind2));
+                ind2b = allocblk();
+                dind[k / NINDIR] = ind2b;
+            }
+            ind2[k % NINDIR] = b;
+        }
+    }
+
+    if (addr[10])
+        wblock(addr[10], ind, BSIZE);
+    if (ind2b)
+        wblock(ind2b, ind2, BSIZE);
+    if (addr[11])
+        wblock(addr[11], dind, BSIZE);
+}
+
+static void
+putinode(uint32_t ino, uint16_t mode, uint16_t nlink, const char* data,
+         uint32_t len)
+{
+    uint32_t addr[13];
+    uint8_t d[64];
+    int i;
+
+    memset(addr, 0, sizeof(addr));
+    memset(d, 0, sizeof(d));
+    putdata(data, len, addr);
+
+    *(uint16_t*)(d + 0) = mode;
+    *(uint16_t*)(d + 2) = nlink;
+    *(uint16_t*)(d + 4) = 501;
+    *(uint16_t*)(d + 6) = 20;
+    *(uint32_t*)(d + 8) = len;
+    for (i = 0; i < 13; i++)
+        put_addr(d + 12 + 3 * i, addr[i]);
+    *(uint32_t*)(d + 52) = 1200000000;
+    *(uint32_t*)(d + 56) = 1200000000;
+    *(uint32_t*)(d + 60) = 1200000000;
+
+    if (pwrite(fd, d, sizeof(d), (off_t)2 * BSIZE + (off_t)(ino - 1) * 64)
+        != sizeof(d)) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
+struct dirbuf {
+    char*    buf;
+    uint32_t len;
+    uint32_t cap;
+    uint32_t ino;
+    uint16_t nlink;
+};
+
+static void
+diradd(struct dirbuf* d, uint32_t ino, const char* name)
+{
+    if (d->len + DIRSIZE > d->cap) {
+        d->cap = d->cap * 2 + 4096;
+        d->buf = realloc(d->buf, d->cap);
+    }
+
+    char* e = d->buf + d->len;
+    memset(e, 0, DIRSIZE);
+    *(uint16_t*)e = (uint16_t)ino;
+    strncpy(e + 2, name, NAMELEN);
+    d->len += DIRSIZE;
+}
+
+static void
+diropen(struct dirbuf* d, uint32_t ino, struct dirbuf* parent)
+{
+    memset(d, 0, sizeof(*d));
+    d->ino = ino;
+    d->nlink = 2;
+    diradd(d, ino, ".");
+    diradd(d, parent ? parent->ino : ino, "..");
+}
+
+static void
+dirfinish(struct dirbuf* d)
+{
+    putinode(d->ino, 040755, d->nlink, d->buf, d->len);
+    free(d->buf);
+}
+
+static void
+mksubdir(struct dirbuf* parent, struct dirbuf* d, const char* name)
+{
+    diropen(d, allocino(), parent);
+    diradd(parent, d->ino, name);
+    parent->nlink++;
+    nentries++;
+}
+
+static void
+mkfile(struct dirbuf* d, const char* name)
+{
+    uint32_t ino = allocino();
+
+    putinode(ino, 0100644, 1, NULL, 0);
+    diradd(d, ino, name);
+    nentries++;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "usage: mksysvfs [-s blocks] [-i iblocks] [-f n] [-b n] image\n");
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    uint32_t nfiles = 0, nbig = 0, i;
+    int c;
+    char name[64];
+
+    fsize = 65536;
+    isize = 2048;
+
+    while ((c = getopt(argc, argv, "s:i:f:b:")) != -1) {
+        switch (c) {
+        case 's': fsize = strtoul(optarg, NULL, 0); break;
+        case 'i': isize = strtoul(optarg, NULL, 0); break;
+        case 'f': nfiles = strtoul(optarg, NULL, 0); break;
+        case 'b': nbig = strtoul(optarg, NULL, 0); break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || isize < 1 || fsize > 0xffffff)
+        usage();
+
+    /* Inodes are numbered from 1; inode numbers are 16 bits on disk. */
+    isize += 2;
+    ninodes = (isize - 2) * INOPB;
+    if (ninodes > 65535 || isize + 16 > fsize)
+        usage();
+    nextblk = isize;
+
+    fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)fsize * BSIZE) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    struct dirbuf root, sub;
+
+    diropen(&root, ROOTINO, NULL);
+    for (i = 0; i < nfiles; i++) {
+        snprintf(name, sizeof(name), "f%05u", i);
+        mkfile(&root, name);
+    }
+    if (nbig) {
+        mksubdir(&root, &sub, "big");
+        for (i = 0; i < nbig; i++) {
+            snprintf(name, NAMELEN + 1, "%06u.M%uP%u", i, i * 7, i * 13);
+            mkfile(&sub, name);
+        }
+        dirfinish(&sub);
+    }
+    dirfinish(&root);
+
+    /*
+     * Free list, as in V7: the superblock holds the first chunk, and the
+     * first entry of every chunk is the block holding the next one. The
+     * last chunk starts with a zero.
+     */
+    uint32_t nfree = fsize - nextblk;
+    uint32_t group[NICFREE];
+    int ngroup = 0;
+    uint8_t fb[BSIZE];
+    uint32_t b = nextblk;
+
+    group[ngroup++] = 0;
+    for (;;) {
+        while (ngroup < NICFREE && b < fsize)
+            group[ngroup++] = b++;
+        if (b >= fsize)
+            break;
+        uint32_t holder = b++;
+        memset(fb, 0, sizeof(fb));
+        *(uint16_t*)fb = ngroup;
+        memcpy(fb + 4, group, ngroup * sizeof(uint32_t));
+        wblock(holder, fb, sizeof(fb));
+        ngroup = 0;
+        group[ngroup++] = holder;
+    }
+
+    /* struct sysv4_super_block, 512 bytes into block 0 */
+    uint8_t sb[512];
+    memset(sb, 0, sizeof(sb));
+    *(uint16_t*)(sb + 0) = isize;
+    *(uint32_t*)(sb + 4) = fsize;
+    *(uint16_t*)(sb + 8) = ngroup;
+    memcpy(sb + 12, group, ngroup * sizeof(uint32_t));
+    *(uint32_t*)(sb + 420) = 1200000000;              /* s_time */
+    *(uint32_t*)(sb + 432) = nfree;                   /* s_tfree */
+    *(uint16_t*)(sb + 436) = ninodes - (nexti - 1);   /* s_tinode */
+    *(uint32_t*)(sb + 500) = 0x7c269d38 - 1200000000; /* s_state: clean */
+    *(uint32_t*)(sb + 504) = 0xfd187e20;              /* s_magic */
+    *(uint32_t*)(sb + 508) = 2;                       /* s_type: 1K */
+    if (pwrite(fd, sb, sizeof(sb), 512) != sizeof(sb)) {
+        perror("pwrite");
+        return 1;
+    }
+    close(fd);
+
+    printf("mount %u,%u,%u\n", ninodes, ninodes - (nexti - 1), nfree);
+    printf("find %llu,0,0\n", (unsigned long long)nentries);
+
+    return 0;
+}
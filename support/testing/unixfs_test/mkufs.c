@@ -0,0 +1,539 @@
+/*
+ * mkufs: build a synthetic UFS1 (4.4BSD) or UFS2 file system image.
+ *
+ * The image is laid out across a number of cylinder groups and may hold:
+ *
+ *   /big/<maildir-name>   -b entries, each an empty file with its own inode
+ *   /tree/dNNN/fNNNNN     -d directories of -f files, 0 to 12K of data each
+ *                         (empty with -z)
+ *   /large/{direct,indirect,dindirect}
+ *                         -L: files reaching the single and double indirect
+ *                         blocks
+ *
+ * Cylinder group headers are not written; read-only mounts never load them.
+ * The summary counts in the superblock are exact. Two lines are printed for
+ * unixfs_bench:
+ *
+ *   mount <files>,<ffree>,<bfree>
+ *   find <entries>,<bytes>,<sum>
+ *
+ * where <sum> is the sum of all file data bytes.
+ *
+ * Usage: mkufs [-2] [-g ncg] [-i ipg] [-F fpg] [-b n] [-d n] [-f n] [-z] [-L]
+ *              image
+ */
+
+#include "linux.h"
+#include <ufs/ufs_fs.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SBSIZE 2048
+
+static int      ufs2;
+static uint32_t fsize, bsize, fpb, isize, ipg, fpg, ncg;
+static uint32_t sblkno, cblkno, iblkno, dblkno;
+static uint64_t nfrags;
+static uint8_t* used;       /* one byte per fragment */
+static uint64_t cursor;     /* next fragment to try for a whole block */
+static uint64_t tailblk;    /* block handing out tail fragments, or 0 */
+static uint32_t tailused;
+static uint32_t nexti = UFS_ROOTINO + 1;
+static uint32_t ndirs = 1;
+static uint64_t nentries, nbytes, datasum;
+static int      fd;
+
+static void
+wfrags(uint64_t frag, const void* buf, size_t len)
+{
+    if (pwrite(fd, buf, len, (off_t)(frag * fsize)) != (ssize_t)len) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
+static uint64_t
+allocblk(void)
+{
+    for (;;) {
+        uint64_t off = cursor % fpg;
+        if (off < dblkno) {
+            cursor += (dblkno - off + fpb - 1) / fpb * fpb;
+            continue;
+        }
+        if (cursor + fpb > (cursor / fpg + 1) * (uint64_t)fpg) {
+            cursor = (cursor / fpg + 1) * (uint64_t)fpg;
+            continue;
+        }
+        if (cursor + fpb > nfrags) {
+            fprintf(stderr, "mkufs: out of space\n");
+            exit(1);
+        }
+        uint64_t b = cursor;
+        cursor += fpb;
+        memset(used + b, 1, fpb);
+        return b;
+    }
+}
+
+static uint64_t
+allocfrags(uint32_t n)
+{
+    if (tailblk == 0 || tailused + n > fpb) {
+        tailblk = allocblk();
+        memset(used + tailblk, 0, fpb);
+        tailused = 0;
+    }
+    uint64_t f = tailblk + tailused;
+    memset(used + f, 1, n);
+    tailused += n;
+    return f;
+}
+
+static uint32_t
+allocino(void)
+{
+    if (nexti >= ncg * ipg) {
+        fprintf(stderr, "mkufs: out of inodes\n");
+        exit(1);
+    }
+    return nexti++;
+}
+
+static void
+setptr(char* blk, uint32_t i, uint64_t v)
+{
+    if (ufs2)
+        ((uint64_t*)blk)[i] = v;
+    else
+        ((uint32_t*)blk)[i] = (uint32_t)v;
+}
+
+/*
+ * Writes len bytes of data for a file and fills in its block pointers and
+ * block count. The last block of a file without indirect blocks is stored
+ * in fragments, as the kernel would.
+ */
+static uint64_t
+putdata(const char* data, uint64_t len, uint64_t db[UFS_NDADDR],
+        uint64_t ib[UFS_NINDIR])
+{
+    uint32_t nindir = bsize / (ufs2 ? 8 : 4);
+    uint64_t nblk = (len + bsize - 1) / bsize;
+    uint64_t sectors = 0, lbn;
+    char* ind = NULL;
+    char* dind = NULL;
+    char* ind2 = NULL;
+    uint64_t ind2b = 0;
+
+    if (nblk > UFS_NDADDR + nindir + (uint64_t)nindir * nindir) {
+        fprintf(stderr, "mkufs: file too large\n");
+        exit(1);
+    }
+
+    for (lbn = 0; lbn < nblk; lbn++) {
+        uint64_t rem = len - lbn * bsize;
+        uint32_t sz = (rem > bsize) ? bsize : (uint32_t)rem;
+        uint64_t b;
+
+        if (lbn == nblk - 1 && nblk <= UFS_NDADDR && sz < bsize) {
+            uint32_t n = (sz + fsize - 1) / fsize;
+            b = allocfrags(n);
+            sectors += n * (fsize / 512);
+        } else {
+            b = allocblk();
+            sectors += bsize / 512;
+        }
+        wfrags(b, data + lbn * bsize, sz);
+
+        if (lbn < UFS_NDADDR) {
+            db[lbn] = b;
+        } else if (lbn < UFS_NDADDR + nindir) {
+            if (!ind) {
+                ind = calloc(1, bsize);
+                ib[0] = allocblk();
+                sectors += bsize / 512;
+            }
+            setptr(ind, lbn - UFS_NDADDR, b);
+        } else {
+            uint64_t k = lbn - UFS_NDADDR - nindir;
+            if (!dind) {
+                dind = calloc(1, bsize);
+                ib[1] = allocblk();
+                sectors += bsize / 512;
+            }
+            if (k % nindir == 0) {
+                if (ind2) {
+                    wfrags(ind2b, ind2, bsize);
+                    free(ind2);
+                }
+                ind2 = calloc(1, bsize);
+                ind2b = allocblk();
+                sectors += bsize / 512;
+                setptr(dind, k / nindir, ind2b);
+            }
+            setptr(ind2, k % nindir, b);
+        }
+    }
+
+    if (ind) {
+        wfrags(ib[0], ind, bsize);
+        free(ind);
+    }
+    if (ind2) {
+        wfrags(ind2b, ind2, bsize);
+        free(ind2);
+    }
+    if (dind) {
+        wfrags(ib[1], dind, bsize);
+        free(dind);
+    }
+
+    return sectors;
+}
+
+static void
+putinode(uint32_t ino, uint16_t mode, uint16_t nlink, const char* data,
+         uint64_t len)
+{
+    uint64_t db[UFS_NDADDR], ib[UFS_NINDIR];
+    char dinode[sizeof(struct ufs2_inode)];
+    int i;
+
+    memset(db, 0, sizeof(db));
+    memset(ib, 0, sizeof(ib));
+    memset(dinode, 0, sizeof(dinode));
+
+    uint64_t sectors = putdata(data, len, db, ib);
+
+    if (ufs2) {
+        struct ufs2_inode* ip = (struct ufs2_inode*)dinode;
+        ip->ui_mode = mode;
+        ip->ui_nlink = nlink;
+        ip->ui_uid = 501;
+        ip->ui_gid = 20;
+        ip->ui_blksize = bsize;
+        ip->ui_size = len;
+        ip->ui_blocks = sectors;
+        ip->ui_atime = ip->ui_mtime = ip->ui_ctime = 1200000000;
+        ip->ui_gen = ino;
+        for (i = 0; i < UFS_NDADDR; i++)
+            ip->ui_u2.ui_addr.ui_db[i] = db[i];
+        for (i = 0; i < UFS_NINDIR; i++)
+            ip->ui_u2.ui_addr.ui_ib[i] = ib[i];
+    } else {
+        struct ufs_inode* ip = (struct ufs_inode*)dinode;
+        ip->ui_mode = mode;
+        ip->ui_nlink = nlink;
+        ip->ui_u3.ui_44.ui_uid = 501;
+        ip->ui_u3.ui_44.ui_gid = 20;
+        ip->ui_size = len;
+        ip->ui_blocks = (uint32_t)sectors;
+        ip->ui_atime.tv_sec = ip->ui_mtime.tv_sec =
+            ip->ui_ctime.tv_sec = 1200000000;
+        ip->ui_gen = ino;
+        for (i = 0; i < UFS_NDADDR; i++)
+            ip->ui_u2.ui_addr.ui_db[i] = (uint32_t)db[i];
+        for (i = 0; i < UFS_NINDIR; i++)
+            ip->ui_u2.ui_addr.ui_ib[i] = (uint32_t)ib[i];
+    }
+
+    uint64_t frag = (uint64_t)(ino / ipg) * fpg + iblkno;
+    off_t off = (off_t)(frag * fsize) + (off_t)(ino % ipg) * isize;
+    if (pwrite(fd, dinode, isize, off) != (ssize_t)isize) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
+/* Directories are built in memory, in 512-byte chunks. */
+
+struct dirbuf {
+    char*    buf;
+    uint32_t len;
+    uint32_t cap;
+    uint32_t last;
+    uint32_t ino;
+    uint16_t nlink;
+};
+
+static void
+dirclose_chunk(struct dirbuf* d)
+{
+    struct ufs_dir_entry* l = (struct ufs_dir_entry*)(d->buf + d->last);
+    uint32_t end = (d->len + UFS_SECTOR_SIZE - 1) & ~(UFS_SECTOR_SIZE - 1);
+    l->d_reclen = end - d->last;
+    d->len = end;
+}
+
+static void
+diradd(struct dirbuf* d, uint32_t ino, const char* name, int type)
+{
+    uint32_t namlen = strlen(name);
+    uint32_t reclen = UFS_DIR_REC_LEN(namlen);
+
+    if (d->len % UFS_SECTOR_SIZE == 0 ||
+        (d->len % UFS_SECTOR_SIZE) + reclen > UFS_SECTOR_SIZE) {
+        if (d->len % UFS_SECTOR_SIZE)
+            dirclose_chunk(d);
+        if (d->len + UFS_SECTOR_SIZE > d->cap) {
+            d->cap = d->cap * 2 + 4096;
+            d->buf = realloc(d->buf, d->cap);
+        }
+        memset(d->buf + d->len, 0, UFS_SECTOR_SIZE);
+    }
+
+    struct ufs_dir_entry* e = (struct ufs_dir_entry*)(d->buf + d->len);
+    e->d_ino = ino;
+    e->d_reclen = reclen;
+    e->d_u.d_44.d_type = type;
+    e->d_u.d_44.d_namlen = namlen;
+    memcpy(e->d_name, name, namlen);
+    d->last = d->len;
+    d->len += reclen;
+}
+
+static void
+diropen(struct dirbuf* d, uint32_t ino, struct dirbuf* parent)
+{
+    memset(d, 0, sizeof(*d));
+    d->ino = ino;
+    d->nlink = 2;
+    diradd(d, ino, ".", DT_DIR);
+    diradd(d, parent ? parent->ino : ino, "..", DT_DIR);
+}
+
+static void
+dirfinish(struct dirbuf* d)
+{
+    dirclose_chunk(d);
+    putinode(d->ino, 040755, d->nlink, d->buf, d->len);
+    free(d->buf);
+}
+
+static void
+mksubdir(struct dirbuf* parent, struct dirbuf* d, const char* name)
+{
+    diropen(d, allocino(), parent);
+    diradd(parent, d->ino, name, DT_DIR);
+    parent->nlink++;
+    ndirs++;
+    nentries++;
+}
+
+static void
+mkfile(struct dirbuf* d, const char* name, uint64_t len)
+{
+    uint32_t ino = allocino();
+    char* data = malloc(len + 1);
+    uint64_t i;
+
+    for (i = 0; i < len; i++) {
+        data[i] = (char)((ino * 31 + i * 7 + (i >> 9)) & 0xff);
+        datasum += (uint8_t)data[i];
+    }
+    putinode(ino, 0100644, 1, data, len);
+    free(data);
+    diradd(d, ino, name, DT_REG);
+    nentries++;
+    nbytes += len;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "usage: mkufs [-2] [-g ncg] [-i ipg] [-F fpg] [-b n] [-d n] [-f n] "
+        "[-z] [-L] image\n");
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    uint32_t nbig = 0, ntree = 0, nperdir = 0;
+    int large = 0, empty = 0, c;
+    uint32_t i, j;
+
+    ncg = 4;
+    ipg = 16384;
+    fpg = 0;
+
+    while ((c = getopt(argc, argv, "2g:i:F:b:d:f:zL")) != -1) {
+        switch (c) {
+        case '2': ufs2 = 1; break;
+        case 'g': ncg = strtoul(optarg, NULL, 0); break;
+        case 'i': ipg = strtoul(optarg, NULL, 0); break;
+        case 'F': fpg = strtoul(optarg, NULL, 0); break;
+        case 'b': nbig = strtoul(optarg, NULL, 0); break;
+        case 'd': ntree = strtoul(optarg, NULL, 0); break;
+        case 'f': nperdir = strtoul(optarg, NULL, 0); break;
+        case 'z': empty = 1; break;
+        case 'L': large = 1; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || ncg == 0)
+        usage();
+
+    if (ufs2) {
+        fsize = 2048;
+        bsize = 16384;
+        isize = sizeof(struct ufs2_inode);
+        sblkno = SBLOCK_UFS2 / fsize;
+    } else {
+        fsize = 1024;
+        bsize = 8192;
+        isize = sizeof(struct ufs_inode);
+        sblkno = UFS_SBLOCK / fsize;
+    }
+    fpb = bsize / fsize;
+    ipg = (ipg + bsize / isize - 1) / (bsize / isize) * (bsize / isize);
+    cblkno = sblkno + (SBSIZE + fsize - 1) / fsize;
+    cblkno = (cblkno + fpb - 1) / fpb * fpb;
+    iblkno = cblkno + fpb;
+    dblkno = iblkno + ipg * isize / fsize;
+    if (fpg == 0)
+        fpg = dblkno + 65536;
+    fpg = (fpg + fpb - 1) / fpb * fpb;
+    if (fpg <= dblkno + fpb)
+        usage();
+    nfrags = (uint64_t)ncg * fpg;
+
+    used = calloc(nfrags, 1);
+    for (i = 0; i < ncg; i++)
+        memset(used + (uint64_t)i * fpg, 1, dblkno);
+
+    fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)(nfrags * fsize)) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    struct dirbuf root, sub, leaf;
+    char name[128];
+
+    diropen(&root, UFS_ROOTINO, NULL);
+
+    if (nbig) {
+        mksubdir(&root, &sub, "big");
+        for (i = 0; i < nbig; i++) {
+            snprintf(name, sizeof(name), "%u.M%uP%u.host,S=%u:2,S",
+                     1200000000 + i, i * 7, i * 13, i);
+            mkfile(&sub, name, 0);
+        }
+        dirfinish(&sub);
+    }
+
+    if (ntree) {
+        mksubdir(&root, &sub, "tree");
+        for (i = 0; i < ntree; i++) {
+            snprintf(name, sizeof(name), "d%03u", i);
+            mksubdir(&sub, &leaf, name);
+            for (j = 0; j < nperdir; j++) {
+                snprintf(name, sizeof(name), "f%05u", j);
+                mkfile(&leaf, name,
+                       empty ? 0 : ((i * 131 + j * 17) % 13) * 1000);
+            }
+            dirfinish(&leaf);
+        }
+        dirfinish(&sub);
+    }
+
+    if (large) {
+        uint32_t nindir = bsize / (ufs2 ? 8 : 4);
+        mksubdir(&root, &sub, "large");
+        mkfile(&sub, "direct", (uint64_t)UFS_NDADDR * bsize - 100);
+        mkfile(&sub, "indirect", (uint64_t)(UFS_NDADDR + 100) * bsize + 555);
+        mkfile(&sub, "dindirect",
+               (uint64_t)(UFS_NDADDR + nindir + 300) * bsize + 4321);
+        dirfinish(&sub);
+    }
+
+    dirfinish(&root);
+
+    /* Summary counts. Inodes 0 and 1 are reserved. */
+
+    uint64_t nbfree = 0, nffree = 0, f;
+    for (f = 0; f < nfrags; f += fpb) {
+        uint32_t k, n = 0;
+        for (k = 0; k < fpb; k++)
+            n += !used[f + k];
+        if (n == fpb)
+            nbfree++;
+        else
+            nffree += n;
+    }
+    uint64_t nifree = (uint64_t)ncg * ipg - nexti;
+    uint64_t dsize = (uint64_t)ncg * (fpg - dblkno);
+
+    char sbbuf[SBSIZE];
+    memset(sbbuf, 0, sizeof(sbbuf));
+    struct ufs_super_block_first* usb1 = (void*)sbbuf;
+    struct ufs_super_block_second* usb2 = (void*)(sbbuf + 512);
+    struct ufs_super_block_third* usb3 = (void*)(sbbuf + 1024);
+
+    usb1->fs_sblkno = sblkno;
+    usb1->fs_cblkno = cblkno;
+    usb1->fs_iblkno = iblkno;
+    usb1->fs_dblkno = dblkno;
+    usb1->fs_cgoffset = 0;
+    usb1->fs_cgmask = 0xffffffff;
+    usb1->fs_time = 1200000000;
+    usb1->fs_size = (uint32_t)nfrags;
+    usb1->fs_dsize = (uint32_t)dsize;
+    usb1->fs_ncg = ncg;
+    usb1->fs_bsize = bsize;
+    usb1->fs_fsize = fsize;
+    usb1->fs_frag = fpb;
+    usb1->fs_minfree = 8;
+    usb1->fs_bmask = ~(bsize - 1);
+    usb1->fs_fmask = ~(fsize - 1);
+    usb1->fs_bshift = __builtin_ctz(bsize);
+    usb1->fs_fshift = __builtin_ctz(fsize);
+    usb1->fs_fragshift = __builtin_ctz(fpb);
+    usb1->fs_fsbtodb = __builtin_ctz(fsize / 512);
+    usb1->fs_sbsize = SBSIZE;
+    usb1->fs_nindir = bsize / (ufs2 ? 8 : 4);
+    usb1->fs_inopb = bsize / isize;
+    usb1->fs_nspf = fsize / 512;
+    usb1->fs_csaddr = cblkno;
+    usb1->fs_cssize = fsize;
+    usb1->fs_cgsize = bsize;
+    usb1->fs_ipg = ipg;
+    usb1->fs_fpg = fpg;
+    usb1->fs_cstotal.cs_ndir = ndirs;
+    usb1->fs_cstotal.cs_nbfree = (uint32_t)nbfree;
+    usb1->fs_cstotal.cs_nifree = (uint32_t)nifree;
+    usb1->fs_cstotal.cs_nffree = (uint32_t)nffree;
+    usb1->fs_clean = UFS_FSCLEAN;
+    usb3->fs_un2.fs_44.fs_maxsymlinklen = ufs2 ? 120 : 60;
+    usb3->fs_magic = ufs2 ? UFS2_MAGIC : UFS_MAGIC;
+
+    if (ufs2) {
+        usb2->fs_un.fs_u2.cs_ndir = ndirs;
+        usb2->fs_un.fs_u2.cs_nbfree = nbfree;
+        usb2->fs_un.fs_u2.fs_sblockloc = SBLOCK_UFS2;
+        usb3->fs_un1.fs_u2.cs_nifree = nifree;
+        usb3->fs_un1.fs_u2.cs_nffree = nffree;
+        usb3->fs_un1.fs_u2.fs_size = nfrags;
+        usb3->fs_un1.fs_u2.fs_dsize = dsize;
+        usb3->fs_un1.fs_u2.fs_csaddr = cblkno;
+    }
+
+    wfrags(sblkno, sbbuf, sizeof(sbbuf));
+    close(fd);
+
+    printf("mount %llu,%llu,%llu\n", (unsigned long long)ncg * ipg,
+           (unsigned long long)nifree,
+           (unsigned long long)(nbfree * fpb + nffree));
+    printf("find %llu,%llu,%llu\n", (unsigned long long)nentries,
+           (unsigned long long)nbytes, (unsigned long long)datasum);
+
+    return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * msgloop_bench: small-request throughput of the unixfs message loop.
+ *
+ * unixfs.c is compiled in here so that its own unixfs_session_loop() and
+ * lowlevel operations serve the requests; the back end is a stub whose
+ * igetattr fills in a regular file. The device is one end of a
+ * SOCK_SEQPACKET socketpair, which keeps message boundaries the way
+ * /dev/fuseN does, and the main thread plays the kernel: it answers
+ * nothing, sends getattrs a window at a time and reads back the replies,
+ * checking that every request gets exactly one, in order.
+ *
+ * Three daemons are run in turn:
+ *
+ *   stock        libfuse's fuse_session_loop(), one message per syscall
+ *   batched      unixfs_session_loop() with FUSE_MULTI_MESSAGE offered,
+ *                so each window goes down in one write and its replies
+ *                come back in as few reads as the reply buffer allows
+ *   not offered  unixfs_session_loop() when the kernel does not offer the
+ *                flag; it must stay in one-message-per-syscall mode
+ *
+ * Each batched run ends with a FUSE_BATCH_FORGET sent in the same packet as
+ * a getattr; only the getattr may be answered.
+ *
+ * Needs libfuse 2.7 and AF_UNIX SOCK_SEQPACKET sockets (Linux).
+ *
+ * Usage: msgloop_bench [-n requests] [-w window]
+ */
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <fuse/fuse_lowlevel.h>
+
+/*
+ * unixfs.c builds its own loop only for MacFUSE, which defines this; the
+ * headers it includes have all been pulled in above without it.
+ */
+#ifndef __FreeBSD__
+#define __FreeBSD__ 10
+#endif
+
+#define main unixfs_main
+#include "unixfs.c"
+#undef main
+
+#define FUSE_GETATTR 3
+
+/* Back end and mount glue for unixfs.c; only igetattr does anything. */
+
+static void
+stub_fini(void* filsys)
+{
+}
+
+static int
+stub_igetattr(ino_t ino, struct stat* stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_ino = ino;
+    stbuf->st_mode = S_IFREG | 0644;
+    stbuf->st_nlink = 1;
+    return 0;
+}
+
+static struct unixfs_ops stub_ops = {
+    .fini     = stub_fini,
+    .igetattr = stub_igetattr,
+};
+static struct unixfs stub_unixfs = { .ops = &stub_ops };
+
+void
+unixfs_usage(void)
+{
+}
+
+struct unixfs*
+unixfs_preflight(char* dmg, char** type, struct unixfs** unixfsp)
+{
+    return NULL;
+}
+
+void
+unixfs_postflight(char* fsname, char* volname, char* extra_args)
+{
+}
+
+/* What fuse_kern_chan does, on a socket instead of the device. */
+
+static int
+plain_receive(struct fuse_chan** chp, char* buf, size_t size)
+{
+    ssize_t res = read(fuse_chan_fd(*chp), buf, size);
+    return (res == -1) ? -errno : (int)res;
+}
+
+static int
+plain_send(struct fuse_chan* ch, const struct iovec iov[], size_t count)
+{
+    return (writev(fuse_chan_fd(ch), iov, (int)count) == -1) ? -errno : 0;
+}
+
+static void
+plain_destroy(struct fuse_chan* ch)
+{
+}
+
+enum { STOCK, BATCHED, NOT_OFFERED };
+
+static const char* modename[] = { "stock", "batched", "not offered" };
+
+struct daemon {
+    int                  mode;
+    int                  fd;
+    struct fuse_session* se;
+};
+
+static void*
+daemon_main(void* arg)
+{
+    struct daemon* d = (struct daemon*)arg;
+    struct fuse_chan_ops ops = {
+        .receive = plain_receive,
+        .send    = plain_send,
+        .destroy = plain_destroy,
+    };
+    struct fuse_chan* ch = fuse_chan_new(&ops, d->fd, 132 * 1024, NULL);
+
+    if (d->mode == STOCK) {
+        fuse_session_add_chan(d->se, ch);
+        fuse_session_loop(d->se);
+        fuse_session_remove_chan(ch);
+    } else {
+        unixfs_session_loop(d->se, ch, NULL);
+    }
+    fuse_chan_destroy(ch);
+
+    return NULL;
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct getattr_msg {
+    struct unixfs_in_header h;
+    uint64_t fh;
+    uint32_t getattr_flags;
+    uint32_t padding;
+};
+
+static void
+put_getattr(struct getattr_msg* m, uint64_t unique, uint64_t nodeid)
+{
+    memset(m, 0, sizeof(*m));
+    m->h.len = sizeof(*m);
+    m->h.opcode = FUSE_GETATTR;
+    m->h.unique = unique;
+    m->h.nodeid = nodeid;
+}
+
+/*
+ * Reads replies until want of them have arrived; they must carry the
+ * uniques from *next on, in order, and no error.
+ */
+static int
+get_replies(int fd, char* buf, size_t bufsize, unsigned long want,
+            uint64_t* next, unsigned long* reads)
+{
+    while (want) {
+        ssize_t res = read(fd, buf, bufsize);
+        char* p = buf;
+
+        if (res <= 0) {
+            fprintf(stderr, "FAIL: daemon went away\n");
+            return -1;
+        }
+        (*reads)++;
+
+        while (res > 0) {
+            struct unixfs_out_header* out = (struct unixfs_out_header*)p;
+            if ((size_t)res < sizeof(*out) || out->len < sizeof(*out) ||
+                out->len > (size_t)res || !want) {
+                fprintf(stderr, "FAIL: malformed reply packet\n");
+                return -1;
+            }
+            if (out->unique != *next || out->error) {
+                fprintf(stderr, "FAIL: reply %llu (error %d), expected %llu\n",
+                        (unsigned long long)out->unique, out->error,
+                        (unsigned long long)*next);
+                return -1;
+            }
+            (*next)++;
+            want--;
+            p += out->len;
+            res -= out->len;
+        }
+    }
+
+    return 0;
+}
+
+static int
+run(int mode, unsigned long n, unsigned long window)
+{
+    char* fargv[] = { "msgloop_bench", NULL };
+    struct fuse_args args = FUSE_ARGS_INIT(1, fargv);
+    size_t bufsize = 256 * 1024;
+    char* out = malloc(bufsize);
+    char* in = malloc(bufsize);
+    uint64_t unique = 1, next;
+    unsigned long reads = 0, writes = 0, done;
+    struct daemon d;
+    pthread_t t;
+    int sv[2], multi, error = -1;
+
+    memset(&d, 0, sizeof(d));
+    d.mode = mode;
+    d.se = fuse_lowlevel_new(&args, &unixfs_ll_oper, sizeof(unixfs_ll_oper),
+                             NULL);
+    fuse_opt_free_args(&args);
+    if (!out || !in || !d.se ||
+        socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0) {
+        perror("msgloop_bench");
+        exit(1);
+    }
+    d.fd = sv[1];
+    pthread_create(&t, NULL, daemon_main, &d);
+
+    struct {
+        struct unixfs_in_header h;
+        struct unixfs_init_in   i;
+    } init;
+    memset(&init, 0, sizeof(init));
+    init.h.len = sizeof(init);
+    init.h.opcode = UNIXFS_FUSE_INIT;
+    init.h.unique = next = unique++;
+    init.i.major = 7;
+    init.i.minor = 8;
+    init.i.max_readahead = 65536;
+    if (mode != NOT_OFFERED)
+        init.i.flags = UNIXFS_FUSE_MULTI_MESSAGE | UNIXFS_FUSE_BATCH_FORGETS;
+    if (write(sv[0], &init, sizeof(init)) != sizeof(init) ||
+        get_replies(sv[0], in, bufsize, 1, &next, &reads) != 0)
+        goto out;
+
+    struct unixfs_init_out* io =
+        (struct unixfs_init_out*)(in + sizeof(struct unixfs_out_header));
+    multi = (io->flags & UNIXFS_FUSE_MULTI_MESSAGE) != 0;
+    if (multi != (mode == BATCHED)) {
+        fprintf(stderr, "FAIL: %s: multi-message mode %snegotiated\n",
+                modename[mode], multi ? "" : "not ");
+        goto out;
+    }
+    reads = 0;
+
+    double t0 = now();
+
+    for (done = 0; done < n; done += window) {
+        unsigned long k, count = (n - done < window) ? n - done : window;
+        size_t off = 0;
+
+        for (k = 0; k < count; k++) {
+            struct getattr_msg m;
+            put_getattr(&m, unique++, 2 + k);
+            if (multi) {
+                memcpy(out + off, &m, sizeof(m));
+                off += sizeof(m);
+            } else {
+                if (write(sv[0], &m, sizeof(m)) != sizeof(m))
+                    goto out;
+                writes++;
+            }
+        }
+        if (multi) {
+            if (write(sv[0], out, off) != (ssize_t)off)
+                goto out;
+            writes++;
+        }
+        if (get_replies(sv[0], in, bufsize, count, &next, &reads) != 0)
+            goto out;
+    }
+
+    double t1 = now();
+
+    printf("%-12s %lu getattrs: %8.0f req/s, %lu writes, %lu reads, "
+           "%.1f messages per syscall\n", modename[mode], n, n / (t1 - t0),
+           writes, reads, 2.0 * n / (writes + reads));
+
+    if (mode != STOCK) {
+        struct {
+            struct unixfs_in_header       h;
+            struct unixfs_batch_forget_in b;
+            struct unixfs_forget_one      f[3];
+        } forget;
+        struct getattr_msg m;
+        size_t off = 0;
+
+        memset(&forget, 0, sizeof(forget));
+        forget.h.len = sizeof(forget);
+        forget.h.opcode = UNIXFS_FUSE_BATCH_FORGET;
+        forget.h.unique = unique++;
+        forget.b.count = 3;
+        next = unique;
+        put_getattr(&m, unique++, 2);
+
+        memcpy(out, &forget, sizeof(forget));
+        off = sizeof(forget);
+        if (multi) {
+            memcpy(out + off, &m, sizeof(m));
+            off += sizeof(m);
+        }
+        if (write(sv[0], out, off) != (ssize_t)off ||
+            (!multi && write(sv[0], &m, sizeof(m)) != sizeof(m)) ||
+            get_replies(sv[0], in, bufsize, 1, &next, &reads) != 0) {
+            fprintf(stderr, "FAIL: %s: batch forget was answered\n",
+                    modename[mode]);
+            goto out;
+        }
+    }
+
+    error = 0;
+
+out:
+    shutdown(sv[0], SHUT_RDWR);
+    close(sv[0]);
+    pthread_join(t, NULL);
+    close(sv[1]);
+    fuse_session_destroy(d.se);
+    free(out);
+    free(in);
+
+    return error;
+}
+
+int
+main(int argc, char** argv)
+{
+    unsigned long n = 1000000, window = 64;
+    int c, mode;
+
+    while ((c = getopt(argc, argv, "n:w:")) != -1) {
+        switch (c) {
+        case 'n': n = strtoul(optarg, NULL, 0); break;
+        case 'w': window = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: msgloop_bench [-n requests] [-w window]\n");
+            return 1;
+        }
+    }
+    if (!window || window > 1024) {
+        fprintf(stderr, "msgloop_bench: window must be 1 to 1024\n");
+        return 1;
+    }
+
+    unixfs = &stub_unixfs;
+
+    for (mode = STOCK; mode <= NOT_OFFERED; mode++)
+        if (run(mode, n, window) != 0)
+            return 1;
+
+    return 0;
+}
@@ -0,0 +1,576 @@
+/*
+ * unixfs_bench: drive a UnixFS back end directly, without FUSE.
+ *
+ * The back end is picked at build time (-DUNIXFS_IMPL=unixfs_v7 and so on)
+ * and its operations are called the way unixfs.c calls them.
+ *
+ * Usage: unixfs_bench [-t type] <command> [options] image
+ *
+ * The type is passed to the back end's init as the file system name; UFS
+ * uses it to pick the flavor (44bsd, ufs2, ...).
+ *
+ *   mount [-e files,ffree,bfree]
+ *       Time init, the first statvfs and a second statvfs. With -e, fail
+ *       unless statvfs reports the given inode and free block counts.
+ *
+ *   lookup [-r reps] path
+ *       Read the directory at path, then look up every name in it in a
+ *       scrambled order, reps times, checking each inode number. The first
+ *       pass is reported separately since it may pay for building an index.
+ *
+ *   find [-j threads] [-e entries,bytes,sum]
+ *       Walk the whole tree the way find(1) with a read of every file
+ *       would, in each of the given number of threads at once. Every walk
+ *       must see the same entries, byte count and sum of file data as a
+ *       single-threaded walk, and as -e if given.
+ *
+ *   ls [-r reps]
+ *       Walk the whole tree the way find -ls would: read every directory
+ *       and stat every entry, without reading file data. The first walk
+ *       after mount is reported separately from the later ones.
+ *
+ *   read [-r reps] path
+ *       Read the file at path from start to end, reps times, in 64K
+ *       requests. Every pass must return the whole file with the same sum
+ *       of data bytes. The first pass is reported separately.
+ */
+
+#include "unixfs_internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+extern struct unixfs UNIXFS_IMPL;
+
+static struct unixfs* u = &UNIXFS_IMPL;
+static char* fstype = NULL;
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void*
+bench_mount(const char* image)
+{
+    char* fsname = fstype;
+    char* volname = NULL;
+    void* fs = u->ops->init(image, 0, UNIXFS_FS_INVALID, &fsname, &volname);
+    if (!fs) {
+        fprintf(stderr, "%s: failed to mount\n", image);
+        exit(1);
+    }
+    return fs;
+}
+
+static int
+cmd_mount(int argc, char** argv)
+{
+    unsigned long efiles = 0, effree = 0, ebfree = 0;
+    int check = 0, c;
+
+    while ((c = getopt(argc, argv, "e:")) != -1) {
+        switch (c) {
+        case 'e':
+            if (sscanf(optarg, "%lu,%lu,%lu", &efiles, &effree, &ebfree) != 3)
+                return -1;
+            check = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (optind != argc - 1)
+        return -1;
+
+    struct statvfs svb1, svb2;
+    double t0 = now();
+    void* fs = bench_mount(argv[optind]);
+    double t1 = now();
+    u->ops->statvfs(&svb1);
+    double t2 = now();
+    u->ops->statvfs(&svb2);
+    double t3 = now();
+
+    printf("init %.3f ms, first statvfs %.3f ms, second statvfs %.3f ms\n",
+           (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t3 - t2) * 1e3);
+    printf("files %lu ffree %lu bfree %lu bavail %lu\n",
+           (unsigned long)svb1.f_files, (unsigned long)svb1.f_ffree,
+           (unsigned long)svb1.f_bfree, (unsigned long)svb1.f_bavail);
+
+    u->ops->fini(fs);
+
+    if (memcmp(&svb1, &svb2, sizeof(svb1)) != 0) {
+        fprintf(stderr, "FAIL: statvfs changed between calls\n");
+        return 1;
+    }
+    if (check && (svb1.f_files != efiles || svb1.f_ffree != effree ||
+                  svb1.f_bfree != ebfree)) {
+        fprintf(stderr, "FAIL: expected files %lu ffree %lu bfree %lu\n",
+                efiles, effree, ebfree);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Resolves a slash-separated path from the root to an inode number. */
+static ino_t
+bench_resolve(const char* path)
+{
+    char buf[UNIXFS_MAXPATHLEN];
+    char* last = NULL;
+    char* comp;
+    ino_t ino = MACFUSE_ROOTINO;
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (comp = strtok_r(buf, "/", &last); comp;
+         comp = strtok_r(NULL, "/", &last)) {
+        struct stat stbuf;
+        if (u->ops->namei(ino, comp, &stbuf) != 0) {
+            fprintf(stderr, "%s: not found\n", path);
+            exit(1);
+        }
+        ino = stbuf.st_ino;
+    }
+
+    return ino;
+}
+
+struct bench_dirent {
+    ino_t ino;
+    char  name[UNIXFS_MAXNAMLEN + 1];
+};
+
+/* Reads a whole directory, leaving out "." and "..". */
+static struct bench_dirent*
+bench_readdir(ino_t dino, size_t* countp)
+{
+    struct inode* dp = u->ops->iget(dino);
+    struct unixfs_dirbuf dirbuf;
+    struct unixfs_direntry dent;
+    struct bench_dirent* ents = NULL;
+    size_t count = 0, cap = 0;
+    off_t offset = 0;
+
+    if (!dp) {
+        fprintf(stderr, "iget %lu failed\n", (unsigned long)dino);
+        exit(1);
+    }
+
+    dirbuf.flags.initialized = 0;
+    while (u->ops->nextdirentry(dp, &dirbuf, &offset, &dent) == 0) {
+        if (dent.ino == 0 || strcmp(dent.name, ".") == 0 ||
+            strcmp(dent.name, "..") == 0)
+            continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 256;
+            ents = realloc(ents, cap * sizeof(*ents));
+        }
+        ents[count].ino = dent.ino;
+        memcpy(ents[count].name, dent.name, sizeof(ents[count].name));
+        count++;
+    }
+    u->ops->iput(dp);
+
+    *countp = count;
+    return ents;
+}
+
+static int
+cmd_lookup(int argc, char** argv)
+{
+    int reps = 10, c;
+
+    while ((c = getopt(argc, argv, "r:")) != -1) {
+        switch (c) {
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (optind != argc - 2 || reps < 1)
+        return -1;
+
+    void* fs = bench_mount(argv[optind + 1]);
+    ino_t dino = bench_resolve(argv[optind]);
+    size_t n, i;
+    struct bench_dirent* ents = bench_readdir(dino, &n);
+
+    if (n == 0) {
+        fprintf(stderr, "%s: empty directory\n", argv[optind]);
+        return 1;
+    }
+
+    /* Fixed-seed shuffle so that lookups don't follow directory order. */
+    srandom(1);
+    for (i = n - 1; i > 0; i--) {
+        size_t j = (size_t)random() % (i + 1);
+        struct bench_dirent tmp = ents[i];
+        ents[i] = ents[j];
+        ents[j] = tmp;
+    }
+
+    double first = 0, rest = 0;
+    size_t bad = 0;
+    int r;
+
+    for (r = 0; r < reps; r++) {
+        double t0 = now();
+        for (i = 0; i < n; i++) {
+            struct stat stbuf;
+            if (u->ops->namei(dino, ents[i].name, &stbuf) != 0 ||
+                stbuf.st_ino != ents[i].ino)
+                bad++;
+        }
+        double t = now() - t0;
+        if (r == 0)
+            first = t;
+        else
+            rest += t;
+    }
+
+    struct stat stbuf;
+    if (u->ops->namei(dino, "no such name", &stbuf) == 0)
+        bad++;
+
+    printf("%zu entries: first pass %.2f us/lookup", n, first * 1e6 / n);
+    if (reps > 1)
+        printf(", later passes %.2f us/lookup", rest * 1e6 / (n * (reps - 1)));
+    printf("\n");
+
+    free(ents);
+    u->ops->fini(fs);
+
+    if (bad) {
+        fprintf(stderr, "FAIL: %zu lookups went wrong\n", bad);
+        return 1;
+    }
+
+    return 0;
+}
+
+struct walk_result {
+    unsigned long long entries;
+    unsigned long long bytes;
+    unsigned long long sum;
+    unsigned long long errors;
+};
+
+/* Reads a whole file; like unixfs.c, stop at the size, not at pbread. */
+static void
+walk_file(ino_t ino, off_t size, struct walk_result* res)
+{
+    struct inode* ip = u->ops->iget(ino);
+    char buf[65536];
+    off_t offset = 0;
+    int error = 0;
+
+    if (!ip) {
+        res->errors++;
+        return;
+    }
+
+    while (offset < size) {
+        size_t count = min((off_t)sizeof(buf), size - offset);
+        ssize_t n = u->ops->pbread(ip, buf, count, offset, &error);
+        if (n <= 0 || error) {
+            res->errors++;
+            break;
+        }
+        ssize_t i;
+        for (i = 0; i < n; i++)
+            res->sum += (unsigned char)buf[i];
+        res->bytes += n;
+        offset += n;
+    }
+
+    u->ops->iput(ip);
+}
+
+/*
+ * Looks up each entry while the directory is still being read, as find
+ * does, so that readdir and lookups in one directory interleave.
+ */
+static void
+walk_dir(ino_t dino, struct walk_result* res, int readfiles, int depth)
+{
+    struct inode* dp = u->ops->iget(dino);
+    struct unixfs_dirbuf dirbuf;
+    struct unixfs_direntry dent;
+    off_t offset = 0;
+
+    if (!dp) {
+        res->errors++;
+        return;
+    }
+
+    dirbuf.flags.initialized = 0;
+    while (u->ops->nextdirentry(dp, &dirbuf, &offset, &dent) == 0) {
+        struct stat stbuf;
+        if (dent.ino == 0 || strcmp(dent.name, ".") == 0 ||
+            strcmp(dent.name, "..") == 0)
+            continue;
+        res->entries++;
+        if (u->ops->namei(dino, dent.name, &stbuf) != 0 ||
+            stbuf.st_ino != dent.ino) {
+            res->errors++;
+            continue;
+        }
+        if (S_ISDIR(stbuf.st_mode) && depth < 64)
+            walk_dir(stbuf.st_ino, res, readfiles, depth + 1);
+        else if (S_ISREG(stbuf.st_mode) && readfiles)
+            walk_file(stbuf.st_ino, stbuf.st_size, res);
+    }
+
+    u->ops->iput(dp);
+}
+
+static void*
+walk_thread(void* arg)
+{
+    struct walk_result* res = (struct walk_result*)arg;
+    walk_dir(MACFUSE_ROOTINO, res, 1, 0);
+    return NULL;
+}
+
+static int
+cmd_find(int argc, char** argv)
+{
+    struct walk_result expect = { 0, 0, 0, 0 };
+    int nthreads = 8, check = 0, c, i;
+
+    while ((c = getopt(argc, argv, "j:e:")) != -1) {
+        switch (c) {
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 'e':
+            if (sscanf(optarg, "%llu,%llu,%llu", &expect.entries,
+                       &expect.bytes, &expect.sum) != 3)
+                return -1;
+            check = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (optind != argc - 1 || nthreads < 1)
+        return -1;
+
+    void* fs = bench_mount(argv[optind]);
+    struct walk_result single;
+    struct walk_result* results = calloc(nthreads, sizeof(*results));
+    pthread_t* threads = calloc(nthreads, sizeof(*threads));
+    int failed = 0;
+
+    memset(&single, 0, sizeof(single));
+    double t0 = now();
+    walk_thread(&single);
+    double t1 = now();
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, walk_thread, &results[i]);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    double t2 = now();
+
+    printf("%llu entries, %llu bytes: 1 walk %.1f ms, %d parallel walks "
+           "%.1f ms\n", single.entries, single.bytes, (t1 - t0) * 1e3,
+           nthreads, (t2 - t1) * 1e3);
+
+    if (single.errors) {
+        fprintf(stderr, "FAIL: %llu errors in the single walk\n",
+                single.errors);
+        failed = 1;
+    }
+    if (check && (single.entries != expect.entries ||
+                  single.bytes != expect.bytes || single.sum != expect.sum)) {
+        fprintf(stderr, "FAIL: walk saw %llu,%llu,%llu\n", single.entries,
+                single.bytes, single.sum);
+        failed = 1;
+    }
+    for (i = 0; i < nthreads; i++) {
+        if (results[i].errors || results[i].entries != single.entries ||
+            results[i].bytes != single.bytes || results[i].sum != single.sum) {
+            fprintf(stderr, "FAIL: walk %d saw %llu,%llu,%llu with %llu "
+                    "errors\n", i, results[i].entries, results[i].bytes,
+                    results[i].sum, results[i].errors);
+            failed = 1;
+        }
+    }
+
+    free(threads);
+    free(results);
+    u->ops->fini(fs);
+
+    return failed;
+}
+
+static int
+cmd_ls(int argc, char** argv)
+{
+    int reps = 5, c, r;
+
+    while ((c = getopt(argc, argv, "r:")) != -1) {
+        switch (c) {
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (optind != argc - 1 || reps < 1)
+        return -1;
+
+    void* fs = bench_mount(argv[optind]);
+    struct walk_result res;
+    double first = 0, best = 0;
+
+    for (r = 0; r < reps; r++) {
+        memset(&res, 0, sizeof(res));
+        double t0 = now();
+        walk_dir(MACFUSE_ROOTINO, &res, 0, 0);
+        double t = now() - t0;
+        if (r == 0)
+            first = t;
+        else if (r == 1 || t < best)
+            best = t;
+        if (res.errors) {
+            fprintf(stderr, "FAIL: %llu errors\n", res.errors);
+            return 1;
+        }
+    }
+
+    printf("%llu entries: first walk %.1f ms (%.2f us/entry)",
+           res.entries, first * 1e3, first * 1e6 / res.entries);
+    if (reps > 1)
+        printf(", best later walk %.1f ms (%.2f us/entry)", best * 1e3,
+               best * 1e6 / res.entries);
+    printf("\n");
+
+    u->ops->fini(fs);
+
+    return 0;
+}
+
+static int
+cmd_read(int argc, char** argv)
+{
+    int reps = 5, c, r;
+
+    while ((c = getopt(argc, argv, "r:")) != -1) {
+        switch (c) {
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (optind != argc - 2 || reps < 1)
+        return -1;
+
+    void* fs = bench_mount(argv[optind + 1]);
+    ino_t ino = bench_resolve(argv[optind]);
+    struct stat stbuf;
+    struct walk_result res, first;
+    double tfirst = 0, best = 0;
+
+    if (u->ops->igetattr(ino, &stbuf) != 0 || !S_ISREG(stbuf.st_mode)) {
+        fprintf(stderr, "%s: not a regular file\n", argv[optind]);
+        return 1;
+    }
+
+    for (r = 0; r < reps; r++) {
+        memset(&res, 0, sizeof(res));
+        double t0 = now();
+        walk_file(ino, stbuf.st_size, &res);
+        double t = now() - t0;
+        if (r == 0) {
+            tfirst = t;
+            first = res;
+        } else if (r == 1 || t < best)
+            best = t;
+        if (res.errors || res.bytes != (unsigned long long)stbuf.st_size ||
+            res.sum != first.sum) {
+            fprintf(stderr, "FAIL: pass %d read %llu of %llu bytes, sum %llu "
+                    "(first pass %llu), %llu errors\n", r, res.bytes,
+                    (unsigned long long)stbuf.st_size, res.sum, first.sum,
+                    res.errors);
+            return 1;
+        }
+    }
+
+    double mb = stbuf.st_size / 1048576.0;
+    printf("%.1f MiB, sum %llu: first pass %.1f ms (%.0f MiB/s)", mb,
+           first.sum, tfirst * 1e3, mb / tfirst);
+    if (reps > 1)
+        printf(", best later pass %.1f ms (%.0f MiB/s)", best * 1e3,
+               mb / best);
+    printf("\n");
+
+    u->ops->fini(fs);
+
+    return 0;
+}
+
+static struct {
+    const char* name;
+    int       (*func)(int argc, char** argv);
+} commands[] = {
+    { "mount",  cmd_mount },
+    { "lookup", cmd_lookup },
+    { "find",   cmd_find },
+    { "ls",     cmd_ls },
+    { "read",   cmd_read },
+};
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "usage: unixfs_bench [-t type] mount [-e files,ffree,bfree] image\n"
+        "       unixfs_bench [-t type] lookup [-r reps] path image\n"
+        "       unixfs_bench [-t type] find [-j threads] "
+        "[-e entries,bytes,sum] image\n"
+        "       unixfs_bench [-t type] ls [-r reps] image\n"
+        "       unixfs_bench [-t type] read [-r reps] path image\n");
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t i;
+
+    if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+        fstype = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2)
+        usage();
+
+    for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(argv[1], commands[i].name) == 0) {
+            int ret = commands[i].func(argc - 1, argv + 1);
+            if (ret < 0)
+                usage();
+            return ret;
+        }
+    }
+
+    usage();
+    return 1;
+}
@@ -0,0 +1,783 @@
+/*
+ * fusetrace: record FUSE request/reply streams and replay them.
+ *
+ * See fusetrace.h for the trace format.
+ */
+
+#include "fusetrace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The few wire structures we look into. They mirror fuse_kernel.h, which
+ * libfuse does not install.
+ */
+
+#define FUSETRACE_OP_FORGET        2
+#define FUSETRACE_OP_READ          15
+#define FUSETRACE_OP_WRITE         16
+#define FUSETRACE_OP_INIT          26
+#define FUSETRACE_OP_READDIR       28
+#define FUSETRACE_OP_INTERRUPT     36
+#define FUSETRACE_OP_BATCH_FORGET  42
+#define FUSETRACE_NOPS             64
+
+#define FUSETRACE_MAXWRITE         (4096 * 1024) /* largest WRITE replayed */
+
+struct fusetrace_in_header {
+    uint32_t len;
+    uint32_t opcode;
+    uint64_t unique;
+    uint64_t nodeid;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t pid;
+    uint32_t padding;
+};
+
+struct fusetrace_out_header {
+    uint32_t len;
+    int32_t  error;
+    uint64_t unique;
+};
+
+struct fusetrace_io_in { /* fuse_read_in and fuse_write_in */
+    uint64_t fh;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t flags;
+};
+
+struct fusetrace_init_in {
+    uint32_t major;
+    uint32_t minor;
+    uint32_t max_readahead;
+    uint32_t flags;
+};
+
+static const char* fusetrace_opnames[FUSETRACE_NOPS] = {
+    [1]  = "LOOKUP",      [2]  = "FORGET",      [3]  = "GETATTR",
+    [4]  = "SETATTR",     [5]  = "READLINK",    [6]  = "SYMLINK",
+    [8]  = "MKNOD",       [9]  = "MKDIR",       [10] = "UNLINK",
+    [11] = "RMDIR",       [12] = "RENAME",      [13] = "LINK",
+    [14] = "OPEN",        [15] = "READ",        [16] = "WRITE",
+    [17] = "STATFS",      [18] = "RELEASE",     [20] = "FSYNC",
+    [21] = "SETXATTR",    [22] = "GETXATTR",    [23] = "LISTXATTR",
+    [24] = "REMOVEXATTR", [25] = "FLUSH",       [26] = "INIT",
+    [27] = "OPENDIR",     [28] = "READDIR",     [29] = "RELEASEDIR",
+    [30] = "FSYNCDIR",    [31] = "GETLK",       [32] = "SETLK",
+    [33] = "SETLKW",      [34] = "ACCESS",      [35] = "CREATE",
+    [36] = "INTERRUPT",   [37] = "BMAP",        [38] = "DESTROY",
+    [42] = "BATCH_FORGET",
+    [61] = "SETVOLNAME",  [62] = "GETXTIMES",   [63] = "EXCHANGE",
+};
+
+static uint64_t
+fusetrace_now(void)
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+static int
+fusetrace_noreply(uint32_t opcode)
+{
+    return (opcode == FUSETRACE_OP_FORGET) ||
+           (opcode == FUSETRACE_OP_BATCH_FORGET) ||
+           (opcode == FUSETRACE_OP_INTERRUPT);
+}
+
+/* Recording */
+
+struct fusetrace {
+    FILE*           fp;
+    pthread_mutex_t lock;
+    uint64_t        start;
+};
+
+struct fusetrace*
+fusetrace_open(const char* path)
+{
+    struct fusetrace* t = calloc(1, sizeof(struct fusetrace));
+    if (!t)
+        return NULL;
+
+    if (!(t->fp = fopen(path, "w"))) {
+        free(t);
+        return NULL;
+    }
+
+    pthread_mutex_init(&t->lock, NULL);
+    t->start = fusetrace_now();
+
+    struct fusetrace_header h;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FUSETRACE_MAGIC, sizeof(h.magic));
+    h.version = FUSETRACE_VERSION;
+    h.recordsize = sizeof(struct fusetrace_record);
+    h.starttime = (uint64_t)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+
+    if (fwrite(&h, sizeof(h), 1, t->fp) != 1) {
+        fusetrace_close(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void
+fusetrace_close(struct fusetrace* t)
+{
+    if (!t)
+        return;
+
+    fclose(t->fp);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
+
+void
+fusetrace_log_requests(struct fusetrace* t, const char* buf, size_t len)
+{
+    uint64_t now = fusetrace_now() - t->start;
+
+    pthread_mutex_lock(&t->lock);
+
+    /* A read may carry several requests back to back. */
+    while (len >= sizeof(struct fusetrace_in_header)) {
+
+        const struct fusetrace_in_header* in =
+            (const struct fusetrace_in_header*)buf;
+
+        if (in->len < sizeof(*in) || in->len > len)
+            break;
+
+        const char* arg = buf + sizeof(*in);
+        size_t argsize = in->len - sizeof(*in);
+
+        struct fusetrace_record r;
+        memset(&r, 0, sizeof(r));
+        r.time = now;
+        r.unique = in->unique;
+        r.nodeid = in->nodeid;
+        r.opcode = in->opcode;
+        r.type = FUSETRACE_REQUEST;
+
+        if ((in->opcode == FUSETRACE_OP_READ ||
+             in->opcode == FUSETRACE_OP_WRITE ||
+             in->opcode == FUSETRACE_OP_READDIR) &&
+            argsize >= sizeof(struct fusetrace_io_in)) {
+            const struct fusetrace_io_in* io =
+                (const struct fusetrace_io_in*)arg;
+            r.offset = io->offset;
+            r.size = io->size;
+            if (in->opcode == FUSETRACE_OP_WRITE)
+                argsize = sizeof(*io); /* keep the size, not the data */
+        }
+
+        if (argsize > FUSETRACE_MAXARGS) {
+            argsize = FUSETRACE_MAXARGS;
+            r.type |= FUSETRACE_TRUNCATED;
+        }
+        r.argsize = (uint16_t)argsize;
+
+        fwrite(&r, sizeof(r), 1, t->fp);
+        fwrite(arg, argsize, 1, t->fp);
+
+        buf += in->len;
+        len -= in->len;
+    }
+
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void
+fusetrace_log_reply(struct fusetrace* t, uint64_t now,
+                    const struct fusetrace_out_header* out)
+{
+    struct fusetrace_record r;
+    memset(&r, 0, sizeof(r));
+    r.time = now;
+    r.unique = out->unique;
+    r.size = out->len - (uint32_t)sizeof(*out);
+    r.error = out->error;
+    r.type = FUSETRACE_REPLY;
+
+    fwrite(&r, sizeof(r), 1, t->fp);
+}
+
+void
+fusetrace_log_replies(struct fusetrace* t, const struct iovec* iov,
+                      size_t count)
+{
+    uint64_t now = fusetrace_now() - t->start;
+
+    pthread_mutex_lock(&t->lock);
+
+    if (count > 1) {
+        /* One reply: a header, then its body in the remaining vectors. */
+        if (iov[0].iov_len >= sizeof(struct fusetrace_out_header))
+            fusetrace_log_reply(t, now, iov[0].iov_base);
+    } else if (count == 1) {
+        /* Possibly several replies back to back. */
+        const char* p = iov[0].iov_base;
+        size_t len = iov[0].iov_len;
+        while (len >= sizeof(struct fusetrace_out_header)) {
+            const struct fusetrace_out_header* out =
+                (const struct fusetrace_out_header*)p;
+            if (out->len < sizeof(*out) || out->len > len)
+                break;
+            fusetrace_log_reply(t, now, out);
+            p += out->len;
+            len -= out->len;
+        }
+    }
+
+    pthread_mutex_unlock(&t->lock);
+}
+
+/* A channel that does its own device I/O and records it. */
+
+struct fusetrace_chan {
+    int               fd;
+    struct fusetrace* trace;
+};
+
+static int
+fusetrace_chan_receive(struct fuse_chan** chp, char* buf, size_t size)
+{
+    struct fuse_chan* ch = *chp;
+    struct fusetrace_chan* tc = fuse_chan_data(ch);
+    struct fuse_session* se = fuse_chan_session(ch);
+    ssize_t res;
+    int err;
+
+restart:
+    res = read(tc->fd, buf, size);
+    err = errno;
+
+    if (fuse_session_exited(se))
+        return 0;
+
+    if (res == -1) {
+        /* ENOENT means the operation was interrupted; it's safe to restart */
+        if (err == ENOENT)
+            goto restart;
+        if (err == ENODEV) {
+            fuse_session_exit(se);
+            return 0;
+        }
+        if (err != EINTR && err != EAGAIN)
+            perror("fuse: reading device");
+        return -err;
+    }
+
+    fusetrace_log_requests(tc->trace, buf, (size_t)res);
+
+    return (int)res;
+}
+
+static int
+fusetrace_chan_send(struct fuse_chan* ch, const struct iovec iov[],
+                    size_t count)
+{
+    struct fusetrace_chan* tc = fuse_chan_data(ch);
+
+    if (!iov)
+        return 0;
+
+    fusetrace_log_replies(tc->trace, iov, count);
+
+    if (writev(tc->fd, iov, (int)count) == -1) {
+        int err = errno;
+        if (!fuse_session_exited(fuse_chan_session(ch)) && err != ENOENT)
+            perror("fuse: writing device");
+        return -err;
+    }
+
+    return 0;
+}
+
+static void
+fusetrace_chan_destroy(struct fuse_chan* ch)
+{
+    free(fuse_chan_data(ch));
+}
+
+struct fuse_chan*
+fusetrace_chan_new(struct fuse_chan* ch, struct fusetrace* t)
+{
+    struct fuse_chan_ops ops = {
+        .receive = fusetrace_chan_receive,
+        .send    = fusetrace_chan_send,
+        .destroy = fusetrace_chan_destroy,
+    };
+
+    struct fusetrace_chan* tc = calloc(1, sizeof(struct fusetrace_chan));
+    if (!tc)
+        return NULL;
+
+    tc->fd = fuse_chan_fd(ch);
+    tc->trace = t;
+
+    struct fuse_chan* tch = fuse_chan_new(&ops, tc->fd, fuse_chan_bufsize(ch),
+                                          tc);
+    if (!tch)
+        free(tc);
+
+    return tch;
+}
+
+/* Statistics */
+
+struct fusetrace_opstats {
+    uint64_t  count;
+    uint64_t  errors;
+    uint64_t  bytes;
+    uint64_t  total;     /* ns */
+    uint64_t* lat;       /* ns, one per timed request */
+    size_t    nlat;
+    size_t    maxlat;
+};
+
+struct fusetrace_stats {
+    struct fusetrace_opstats op[FUSETRACE_NOPS];
+    uint64_t                 requests;
+    uint64_t                 skipped;
+    uint64_t                 elapsed;  /* ns */
+};
+
+static void
+fusetrace_stats_add(struct fusetrace_stats* s, uint32_t opcode, int timed,
+                    uint64_t lat, uint64_t bytes, int error)
+{
+    struct fusetrace_opstats* o = &s->op[opcode % FUSETRACE_NOPS];
+
+    o->count++;
+    o->bytes += bytes;
+    if (error)
+        o->errors++;
+
+    if (!timed)
+        return;
+
+    if (o->nlat == o->maxlat) {
+        size_t n = o->maxlat ? 2 * o->maxlat : 1024;
+        uint64_t* p = realloc(o->lat, n * sizeof(uint64_t));
+        if (!p)
+            return;
+        o->lat = p;
+        o->maxlat = n;
+    }
+
+    o->lat[o->nlat++] = lat;
+    o->total += lat;
+}
+
+static int
+fusetrace_cmp64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void
+fusetrace_stats_print(struct fusetrace_stats* s, FILE* report)
+{
+    uint64_t bytes = 0;
+    int i;
+
+    fprintf(report, "%-14s %10s %8s %10s %10s %10s %10s %10s\n", "opcode",
+            "count", "errors", "mean_us", "p50_us", "p99_us", "max_us", "MB");
+
+    for (i = 0; i < FUSETRACE_NOPS; i++) {
+        struct fusetrace_opstats* o = &s->op[i];
+        if (!o->count)
+            continue;
+
+        bytes += o->bytes;
+
+        char unknown[16];
+        const char* name = fusetrace_opnames[i];
+        if (!name) {
+            snprintf(unknown, sizeof(unknown), "OP%d", i);
+            name = unknown;
+        }
+
+        fprintf(report, "%-14s %10llu %8llu", name,
+                (unsigned long long)o->count, (unsigned long long)o->errors);
+
+        if (o->nlat) {
+            qsort(o->lat, o->nlat, sizeof(uint64_t), fusetrace_cmp64);
+            fprintf(report, " %10.1f %10.1f %10.1f %10.1f",
+                    o->total / 1e3 / o->nlat, o->lat[o->nlat / 2] / 1e3,
+                    o->lat[(o->nlat * 99) / 100] / 1e3,
+                    o->lat[o->nlat - 1] / 1e3);
+        } else {
+            fprintf(report, " %10s %10s %10s %10s", "-", "-", "-", "-");
+        }
+
+        fprintf(report, " %10.1f\n", o->bytes / 1048576.0);
+
+        free(o->lat);
+        o->lat = NULL;
+    }
+
+    double secs = s->elapsed / 1e9;
+    fprintf(report, "%llu requests", (unsigned long long)s->requests);
+    if (s->skipped)
+        fprintf(report, " (%llu skipped)", (unsigned long long)s->skipped);
+    if (secs > 0)
+        fprintf(report, " in %.3f s: %.0f requests/s, %.1f MB/s", secs,
+                s->requests / secs, bytes / 1048576.0 / secs);
+    fprintf(report, "\n");
+}
+
+/*
+ * Requests in flight, by unique ID. IDs are handed out sequentially, so
+ * (unique & mask) is a good enough slot; an entry that gets overwritten
+ * just goes untimed.
+ */
+
+#define FUSETRACE_PENDING 65536
+
+struct fusetrace_pending {
+    uint64_t unique;
+    uint64_t start;
+    uint64_t bytes;
+    uint32_t opcode;
+    uint32_t inuse;
+};
+
+/* Reading traces */
+
+struct fusetrace_reader {
+    FILE*                   fp;
+    struct fusetrace_header h;
+    struct fusetrace_record r;
+    char                    arg[FUSETRACE_MAXARGS];
+};
+
+static int
+fusetrace_reader_open(struct fusetrace_reader* tr, const char* path)
+{
+    if (!(tr->fp = fopen(path, "r"))) {
+        perror(path);
+        return -1;
+    }
+
+    if (fread(&tr->h, sizeof(tr->h), 1, tr->fp) != 1 ||
+        memcmp(tr->h.magic, FUSETRACE_MAGIC, sizeof(tr->h.magic)) ||
+        tr->h.version != FUSETRACE_VERSION ||
+        tr->h.recordsize != sizeof(struct fusetrace_record)) {
+        fprintf(stderr, "%s: not a version %d fusetrace file\n", path,
+                FUSETRACE_VERSION);
+        fclose(tr->fp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Returns 1 if a record was read, 0 at the end of the trace, -1 on error. */
+static int
+fusetrace_reader_next(struct fusetrace_reader* tr)
+{
+    if (fread(&tr->r, sizeof(tr->r), 1, tr->fp) != 1)
+        return ferror(tr->fp) ? -1 : 0;
+
+    if (tr->r.argsize > FUSETRACE_MAXARGS ||
+        (tr->r.argsize &&
+         fread(tr->arg, tr->r.argsize, 1, tr->fp) != 1)) {
+        fprintf(stderr, "fusetrace: truncated trace\n");
+        return -1;
+    }
+
+    return 1;
+}
+
+int
+fusetrace_stat(const char* path, FILE* report)
+{
+    struct fusetrace_reader tr;
+    if (fusetrace_reader_open(&tr, path) != 0)
+        return -1;
+
+    struct fusetrace_stats* s = calloc(1, sizeof(struct fusetrace_stats));
+    struct fusetrace_pending* pending =
+        calloc(FUSETRACE_PENDING, sizeof(struct fusetrace_pending));
+    if (!s || !pending) {
+        free(s);
+        free(pending);
+        fclose(tr.fp);
+        return -1;
+    }
+
+    int ret, seen = 0;
+    uint64_t first = 0, last = 0;
+
+    while ((ret = fusetrace_reader_next(&tr)) > 0) {
+
+        struct fusetrace_record* r = &tr.r;
+        struct fusetrace_pending* p =
+            &pending[r->unique & (FUSETRACE_PENDING - 1)];
+
+        if (!seen) {
+            first = r->time;
+            seen = 1;
+        }
+        last = r->time;
+
+        if (r->type & FUSETRACE_REQUEST) {
+            s->requests++;
+            if (fusetrace_noreply(r->opcode)) {
+                fusetrace_stats_add(s, r->opcode, 0, 0, 0, 0);
+                continue;
+            }
+            if (p->inuse) /* never answered */
+                fusetrace_stats_add(s, p->opcode, 0, 0, 0, 0);
+            p->unique = r->unique;
+            p->start = r->time;
+            p->opcode = r->opcode;
+            p->bytes = (r->opcode == FUSETRACE_OP_WRITE) ? r->size : 0;
+            p->inuse = 1;
+        } else if (r->type & FUSETRACE_REPLY) {
+            if (!p->inuse || p->unique != r->unique)
+                continue;
+            if (p->opcode != FUSETRACE_OP_WRITE && !r->error)
+                p->bytes = r->size;
+            fusetrace_stats_add(s, p->opcode, 1, r->time - p->start,
+                                p->bytes, r->error != 0);
+            p->inuse = 0;
+        }
+    }
+
+    s->elapsed = last - first;
+
+    if (ret == 0)
+        fusetrace_stats_print(s, report);
+
+    free(pending);
+    free(s);
+    fclose(tr.fp);
+
+    return ret;
+}
+
+int
+fusetrace_dump(const char* path, FILE* report)
+{
+    struct fusetrace_reader tr;
+    if (fusetrace_reader_open(&tr, path) != 0)
+        return -1;
+
+    int ret;
+
+    while ((ret = fusetrace_reader_next(&tr)) > 0) {
+
+        struct fusetrace_record* r = &tr.r;
+
+        if (r->type & FUSETRACE_REQUEST) {
+            const char* name = fusetrace_opnames[r->opcode % FUSETRACE_NOPS];
+            fprintf(report, "%14.6f > %-6llu %-12s node=%llu",
+                    r->time / 1e9, (unsigned long long)r->unique,
+                    name ? name : "?", (unsigned long long)r->nodeid);
+            if (r->size)
+                fprintf(report, " off=%llu size=%u",
+                        (unsigned long long)r->offset, r->size);
+            if (r->type & FUSETRACE_TRUNCATED)
+                fprintf(report, " (truncated)");
+            fprintf(report, "\n");
+        } else {
+            fprintf(report, "%14.6f < %-6llu error=%d len=%u\n",
+                    r->time / 1e9, (unsigned long long)r->unique,
+                    r->error, r->size);
+        }
+    }
+
+    fclose(tr.fp);
+
+    return ret;
+}
+
+/* Replay */
+
+struct fusetrace_replay {
+    struct fusetrace_stats*   s;
+    struct fusetrace_pending* pending;
+};
+
+static void
+fusetrace_replay_done(struct fusetrace_replay* rp, uint64_t unique,
+                      uint64_t bytes, int error)
+{
+    struct fusetrace_pending* p =
+        &rp->pending[unique & (FUSETRACE_PENDING - 1)];
+
+    if (!p->inuse || p->unique != unique)
+        return;
+
+    if (p->opcode == FUSETRACE_OP_WRITE || error)
+        bytes = p->bytes;
+
+    fusetrace_stats_add(rp->s, p->opcode, 1, fusetrace_now() - p->start,
+                        bytes, error);
+    p->inuse = 0;
+}
+
+static int
+fusetrace_replay_send(struct fuse_chan* ch, const struct iovec iov[],
+                      size_t count)
+{
+    struct fusetrace_replay* rp = fuse_chan_data(ch);
+
+    if (!iov || !count || iov[0].iov_len < sizeof(struct fusetrace_out_header))
+        return 0;
+
+    const struct fusetrace_out_header* out = iov[0].iov_base;
+
+    fusetrace_replay_done(rp, out->unique, out->len - sizeof(*out),
+                          out->error != 0);
+
+    return 0;
+}
+
+static void
+fusetrace_replay_process(struct fuse_session* se, struct fuse_chan* ch,
+                         struct fusetrace_replay* rp, char* buf,
+                         const struct fusetrace_record* r, const char* arg)
+{
+    struct fusetrace_in_header* in = (struct fusetrace_in_header*)buf;
+    size_t len = sizeof(*in) + r->argsize;
+
+    memcpy(buf + sizeof(*in), arg, r->argsize);
+
+    if (r->opcode == FUSETRACE_OP_WRITE) { /* the data wasn't kept */
+        memset(buf + len, 0, r->size);
+        len += r->size;
+    }
+
+    memset(in, 0, sizeof(*in));
+    in->len = (uint32_t)len;
+    in->opcode = r->opcode;
+    in->unique = r->unique;
+    in->nodeid = r->nodeid;
+    in->uid = getuid();
+    in->gid = getgid();
+    in->pid = getpid();
+
+    struct fusetrace_pending* p =
+        &rp->pending[r->unique & (FUSETRACE_PENDING - 1)];
+    p->unique = r->unique;
+    p->opcode = r->opcode;
+    p->bytes = (r->opcode == FUSETRACE_OP_WRITE) ? r->size : 0;
+    p->inuse = 1;
+    p->start = fusetrace_now();
+
+    rp->s->requests++;
+
+    fuse_session_process(se, buf, len, ch);
+
+    if (fusetrace_noreply(r->opcode))
+        fusetrace_replay_done(rp, r->unique, 0, 0);
+}
+
+int
+fusetrace_replay(struct fuse_session* se, const char* path, FILE* report)
+{
+    struct fusetrace_reader tr;
+    if (fusetrace_reader_open(&tr, path) != 0)
+        return -1;
+
+    struct fuse_chan_ops ops = {
+        .receive = NULL,
+        .send    = fusetrace_replay_send,
+        .destroy = NULL,
+    };
+
+    struct fusetrace_replay rp;
+    rp.s = calloc(1, sizeof(struct fusetrace_stats));
+    rp.pending = calloc(FUSETRACE_PENDING, sizeof(struct fusetrace_pending));
+
+    /* Room for the largest request we rebuild: a WRITE with its data. */
+    size_t bufsize = sizeof(struct fusetrace_in_header) + FUSETRACE_MAXARGS +
+                     FUSETRACE_MAXWRITE;
+    char* buf = malloc(bufsize);
+
+    struct fuse_chan* ch = fuse_chan_new(&ops, -1, bufsize, &rp);
+
+    if (!rp.s || !rp.pending || !buf || !ch) {
+        fprintf(stderr, "fusetrace: out of memory\n");
+        free(rp.s);
+        free(rp.pending);
+        free(buf);
+        fclose(tr.fp);
+        return -1;
+    }
+
+    fuse_session_add_chan(se, ch);
+
+    int ret, inited = 0;
+    uint64_t start = fusetrace_now();
+
+    while ((ret = fusetrace_reader_next(&tr)) > 0) {
+
+        struct fusetrace_record* r = &tr.r;
+
+        if (!(r->type & FUSETRACE_REQUEST))
+            continue;
+
+        if ((r->type & FUSETRACE_TRUNCATED) ||
+            (r->opcode == FUSETRACE_OP_WRITE && r->size > FUSETRACE_MAXWRITE)) {
+            rp.s->skipped++;
+            continue;
+        }
+
+        if (r->opcode == FUSETRACE_OP_INIT) {
+            inited = 1;
+        } else if (!inited) {
+            /* The trace started after INIT; the session still needs one. */
+            struct fusetrace_record ir;
+            struct fusetrace_init_in ii = { 7, 8, 0, 0 };
+            memset(&ir, 0, sizeof(ir));
+            ir.opcode = FUSETRACE_OP_INIT;
+            ir.argsize = sizeof(ii);
+            fusetrace_replay_process(se, ch, &rp, buf, &ir, (char*)&ii);
+            inited = 1;
+        }
+
+        fusetrace_replay_process(se, ch, &rp, buf, r, tr.arg);
+
+        if (fuse_session_exited(se))
+            break;
+    }
+
+    rp.s->elapsed = fusetrace_now() - start;
+
+    if (ret >= 0)
+        fusetrace_stats_print(rp.s, report);
+
+    fuse_session_remove_chan(ch);
+    fuse_chan_destroy(ch);
+    free(buf);
+    free(rp.pending);
+    free(rp.s);
+    fclose(tr.fp);
+
+    return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * fusetrace: record FUSE request/reply streams and replay them.
+ *
+ * A trace file is a struct fusetrace_header followed by records. Each record
+ * is a struct fusetrace_record, followed (for requests) by argsize bytes of
+ * the request's arguments as they appeared on the wire. Bulk WRITE data is
+ * not kept; only its size is. All fields are in the byte order of the
+ * recording host.
+ *
+ * A daemon records a trace either by swapping its device channel for one
+ * made by fusetrace_chan_new(), or, if it does its own device I/O, by
+ * handing what it reads and writes to fusetrace_log_requests() and
+ * fusetrace_log_replies(). fusetrace_replay() feeds a trace straight into a
+ * session's lowlevel operations, with no mount and no kernel involved, and
+ * reports per-opcode latency and throughput.
+ */
+
+#ifndef _FUSETRACE_H_
+#define _FUSETRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <fuse/fuse_lowlevel.h>
+
+#define FUSETRACE_MAGIC       "FUSETRC1"
+#define FUSETRACE_VERSION     1
+#define FUSETRACE_MAXARGS     4096   /* larger arguments are truncated   */
+
+struct fusetrace_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t recordsize;             /* sizeof(struct fusetrace_record)  */
+    uint64_t starttime;              /* wall clock, ns since the epoch   */
+};
+
+#define FUSETRACE_REQUEST     0x0001
+#define FUSETRACE_REPLY       0x0002
+#define FUSETRACE_TRUNCATED   0x8000 /* arguments were cut short         */
+
+struct fusetrace_record {
+    uint64_t time;                   /* ns since the trace began         */
+    uint64_t unique;
+    uint64_t nodeid;                 /* requests                         */
+    uint64_t offset;                 /* READ, WRITE, READDIR             */
+    uint32_t size;                   /* READ, WRITE, READDIR; reply body */
+    uint32_t opcode;                 /* requests                         */
+    int32_t  error;                  /* replies                          */
+    uint16_t type;
+    uint16_t argsize;                /* argument bytes that follow       */
+};
+
+struct fusetrace;
+
+/* recording */
+
+struct fusetrace* fusetrace_open(const char* path);
+void fusetrace_close(struct fusetrace* t);
+
+void fusetrace_log_requests(struct fusetrace* t, const char* buf, size_t len);
+void fusetrace_log_replies(struct fusetrace* t, const struct iovec* iov,
+                           size_t count);
+
+/*
+ * Returns a channel that does the device I/O of ch itself and records all
+ * of it in t. ch keeps ownership of the device descriptor.
+ */
+struct fuse_chan* fusetrace_chan_new(struct fuse_chan* ch, struct fusetrace* t);
+
+/* analysis */
+
+int fusetrace_stat(const char* path, FILE* report);
+int fusetrace_dump(const char* path, FILE* report);
+int fusetrace_replay(struct fuse_session* se, const char* path, FILE* report);
+
+#endif /* _FUSETRACE_H_ */
@@ -0,0 +1,43 @@
+/*
+ * fusetrace: inspect FUSE protocol traces.
+ *
+ * fusetrace stat <trace>   per-opcode counts, latencies and throughput, as
+ *                          recorded
+ * fusetrace dump <trace>   one line per request and reply
+ *
+ * Traces are replayed by the file system itself (for example, unixfs file
+ * systems take --replay), since replay needs its lowlevel operations.
+ */
+
+#include "fusetrace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static void
+fusetrace_usage(void)
+{
+    fprintf(stderr, "usage: fusetrace stat|dump <trace>\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        fusetrace_usage();
+        return 1;
+    }
+
+    int ret;
+
+    if (strcmp(argv[1], "stat") == 0)
+        ret = fusetrace_stat(argv[2], stdout);
+    else if (strcmp(argv[1], "dump") == 0)
+        ret = fusetrace_dump(argv[2], stdout);
+    else {
+        fusetrace_usage();
+        return 1;
+    }
+
+    return ret ? 1 : 0;
+}